@@ -1,6 +1,9 @@
 // Retrieved from https://github.com/bluesillybeard/BeardArena/blob/main/beard_arena.c on August 15 2026
 
 // Modifications are here
+// - beard_arena_reallocate grows the top allocation in place by adding to last_block_used instead of subtracting from it
+// - beard_arena_guarantee_capacity resets last_block_used when it puts a different block on top of the stack
+// - beard_arena_allocate_aligned guarantees room for the alignment padding as well as the allocation
 #include "grug_options.h"
 #define BEARD_MALLOC GRUG_MALLOC
 #define BEARD_FREE GRUG_FREE
@@ -51,6 +54,7 @@ static void beard_arena_guarantee_capacity(struct beard_arena* me, size_t cap) {
             }
             block->next = me->blocks;
             me->blocks = block;
+            me->last_block_used = 0;
             return;
         }
         prev_block = block;
@@ -65,6 +69,7 @@ static void beard_arena_guarantee_capacity(struct beard_arena* me, size_t cap) {
     new_block->total_size = cap_with_overhead;
     new_block->next = me->blocks;
     me->blocks = new_block;
+    me->last_block_used = 0;
 }
 
 void beard_arena_init(struct beard_arena* me, size_t initial_capacity, size_t block_size) {
@@ -85,7 +90,8 @@ void* beard_arena_allocate(struct beard_arena* me, size_t size) {
 }
 
 void* beard_arena_allocate_aligned(struct beard_arena* me, size_t size, size_t alignment) {
-    beard_arena_guarantee_capacity(me, size);
+    // worst case the aligned spot is alignment-1 bytes past the first free byte
+    beard_arena_guarantee_capacity(me, size + alignment - 1);
     // guaranteeCapacity puts the space on the top of the stack so we can just yoink some out willy nilly
     char* block_start = (char*)me->blocks;
     uintptr_t first_free_spot = (uintptr_t) (block_start + sizeof(struct beard_arena_block) + me->last_block_used);
@@ -104,7 +110,7 @@ void* beard_arena_reallocate(struct beard_arena* me, void* ptr, size_t size, siz
     if(((char*)ptr) + size == ((char*)me->blocks + sizeof(struct beard_arena_block) + me->last_block_used)) {
         // Check that there is enough additional space
         if(me->blocks->total_size - sizeof(struct beard_arena_block) - me->last_block_used >= extra_space_needed) {
-            me->last_block_used -= extra_space_needed;
+            me->last_block_used += extra_space_needed;
             return ptr;
         }
     }
@@ -0,0 +1,1553 @@
+#include "grug_bytecode.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "grug_options.h"
+
+// The built-in backend.
+// Every file is lowered to register based bytecode in one contiguous buffer, and run by a threaded dispatch loop.
+// Instructions are typed, so ADD_NUM never has to look at what its operands are.
+
+#if defined(__GNUC__) && !defined(GRUG_NO_COMPUTED_GOTO)
+	#define BYTECODE_COMPUTED_GOTO 1
+#else
+	#define BYTECODE_COMPUTED_GOTO 0
+#endif
+
+struct bytecode_backend {
+	/// Indexed by file id - 1
+	struct bytecode_file** files;
+	size_t files_len;
+	size_t files_capacity;
+	struct bytecode_vm vm;
+	/// The backend a worker from bytecode_new_worker looks up files in, or NULL if this is that backend
+	struct bytecode_backend const* parent;
+};
+
+// MARK: compiler
+
+// Files are lowered from the SSA form of grug_ir.h, after the shared passes have run.
+// Every value gets a register by coloring the graph of which values are live at the same time.
+// A phi shares its register with its operands wherever they don't interfere, so most phis cost nothing and the rest become moves at the end of their predecessors.
+// The registers after the ones values live in hold the arguments of calls, and the scratch register that breaks cycles of moves.
+
+/// A growable array of uint32_t
+struct bytecode_u32s {
+	uint32_t* data;
+	uint32_t len;
+	uint32_t capacity;
+};
+
+struct bytecode_compiler {
+	struct grug_ir* ir;
+	struct grug_arena* arena;
+
+	struct bytecode_instruction* code;
+	uint32_t code_len;
+	uint32_t code_capacity;
+	union grug_value* constants;
+	uint32_t constants_len;
+	uint32_t constants_capacity;
+	struct bytecode_game_fn* game_fns;
+	uint32_t game_fns_len;
+	uint32_t game_fns_capacity;
+	/// Jumps of the function being compiled that still need their target, as pairs of instruction and block
+	struct bytecode_u32s jumps;
+
+	/// Everything below is about the function being compiled, and lives in `scratch`, which is cleared after every function
+	struct grug_arena* scratch;
+	struct grug_ir_function* function;
+	/// The reachable blocks, in the order their code is laid out
+	grug_ir_block_id* order;
+	uint32_t order_len;
+	/// The position of every block in `order`, or GRUG_IR_NONE if it can't be reached
+	uint32_t* positions;
+	/// Bitsets of values, `live_words` words per position in `order`
+	uint64_t* live_in;
+	uint64_t* live_out;
+	uint32_t live_words;
+	/// Pairs of values that are live at the same time
+	grug_ir_value* interferences;
+	uint32_t interferences_len;
+	uint32_t interferences_capacity;
+	/// The values that interfere with `value` are adjacency[adjacency_starts[value]] up to adjacency[adjacency_starts[value + 1]]
+	uint32_t* adjacency_starts;
+	grug_ir_value* adjacency;
+	/// Values in the same class share a register. The classes are a union-find forest, and every class is also a circular list through class_next.
+	grug_ir_value* class_parents;
+	grug_ir_value* class_next;
+	/// Indexed by the root of a class: the argument index of the param in it, and its register, each GRUG_IR_NONE if there is none
+	uint32_t* class_params;
+	uint32_t* class_registers;
+	/// The first register after the ones values live in
+	uint32_t outgoing;
+	/// The number of registers needed from `outgoing` on
+	uint32_t outgoing_len;
+	/// Where the code of every emitted block starts
+	uint32_t* block_addresses;
+	/// The block that jumps to a block end up at, skipping blocks without code
+	grug_ir_block_id* forwards;
+	/// Room for the moves of the phis on one edge
+	uint32_t* move_dsts;
+	uint32_t* move_srcs;
+	bool failed;
+};
+
+/// Grows `*array` to hold at least `len + 1` items of `item_size` bytes
+static bool bytecode_reserve(struct bytecode_compiler* compiler, void** array, uint32_t len, uint32_t* capacity, size_t item_size) {
+	if(len < *capacity) {
+		return true;
+	}
+	if(*capacity >= UINT32_MAX / 2) {
+		compiler->failed = true;
+		return false;
+	}
+	uint32_t new_capacity = *capacity ? *capacity * 2 : 64;
+	void* grown = grug_realloc(*array, *capacity * item_size, new_capacity * item_size);
+	if(!grown) {
+		compiler->failed = true;
+		return false;
+	}
+	*array = grown;
+	*capacity = new_capacity;
+	return true;
+}
+
+static void bytecode_u32s_push(struct bytecode_compiler* compiler, struct bytecode_u32s* array, uint32_t value) {
+	if(bytecode_reserve(compiler, (void**)&array->data, array->len, &array->capacity, sizeof(uint32_t))) {
+		array->data[array->len++] = value;
+	}
+}
+
+static void bytecode_u32s_deinit(struct bytecode_u32s* array) {
+	if(array->data) {
+		GRUG_FREE(array->data, array->capacity * sizeof(uint32_t));
+	}
+}
+
+static void* scratch_alloc(struct bytecode_compiler* compiler, size_t size) {
+	void* memory = grug_arena_alloc(compiler->scratch, size + 1);
+	if(!memory) {
+		compiler->failed = true;
+	}
+	return memory;
+}
+
+static void* scratch_alloc_zeroed(struct bytecode_compiler* compiler, size_t size) {
+	void* memory = scratch_alloc(compiler, size);
+	if(memory) {
+		memset(memory, 0, size);
+	}
+	return memory;
+}
+
+/// Returns the index of the instruction
+static uint32_t emit(struct bytecode_compiler* compiler, enum bytecode_op_enum op, uint32_t a, uint32_t b, uint32_t c) {
+	if(!bytecode_reserve(compiler, (void**)&compiler->code, compiler->code_len, &compiler->code_capacity, sizeof(struct bytecode_instruction))) {
+		return 0;
+	}
+	compiler->code[compiler->code_len] = (struct bytecode_instruction) {.op = (uint16_t)op, .a = (uint16_t)a, .b = (uint16_t)b, .c = (uint16_t)c};
+	return compiler->code_len++;
+}
+
+static uint32_t emit_wide(struct bytecode_compiler* compiler, enum bytecode_op_enum op, uint32_t a, uint32_t wide) {
+	return emit(compiler, op, a, wide & 0xFFFFU, wide >> 16);
+}
+
+/// The target is filled in by patch_jumps once every block of the function has been emitted
+static void emit_jump(struct bytecode_compiler* compiler, enum bytecode_op_enum op, uint32_t a, grug_ir_block_id target) {
+	uint32_t jump = emit_wide(compiler, op, a, 0);
+	bytecode_u32s_push(compiler, &compiler->jumps, jump);
+	bytecode_u32s_push(compiler, &compiler->jumps, target);
+}
+
+static void patch_jumps(struct bytecode_compiler* compiler) {
+	for(uint32_t index = 0; index + 1 < compiler->jumps.len && !compiler->failed; index += 2) {
+		uint32_t jump = compiler->jumps.data[index];
+		uint32_t address = compiler->block_addresses[compiler->jumps.data[index + 1]];
+		compiler->code[jump].b = (uint16_t)(address & 0xFFFFU);
+		compiler->code[jump].c = (uint16_t)(address >> 16);
+	}
+	compiler->jumps.len = 0;
+}
+
+static uint32_t add_constant(struct bytecode_compiler* compiler, union grug_value value) {
+	if(!bytecode_reserve(compiler, (void**)&compiler->constants, compiler->constants_len, &compiler->constants_capacity, sizeof(union grug_value))) {
+		return 0;
+	}
+	compiler->constants[compiler->constants_len] = value;
+	return compiler->constants_len++;
+}
+
+/// The AST's strings are freed once compile_script returns, so string constants are copied into the file's arena
+static uint32_t add_string_constant(struct bytecode_compiler* compiler, char const* string) {
+	union grug_value value;
+	value._string = grug_arena_copy_string(compiler->arena, string);
+	if(!value._string) {
+		compiler->failed = true;
+		return 0;
+	}
+	return add_constant(compiler, value);
+}
+
+static uint32_t add_game_fn(struct bytecode_compiler* compiler, game_fn fn, void* data) {
+	for(uint32_t index = 0; index < compiler->game_fns_len; index += 1) {
+		if(compiler->game_fns[index].fn == fn && compiler->game_fns[index].data == data) {
+			return index;
+		}
+	}
+	if(compiler->game_fns_len >= UINT16_MAX || !bytecode_reserve(compiler, (void**)&compiler->game_fns, compiler->game_fns_len, &compiler->game_fns_capacity, sizeof(struct bytecode_game_fn))) {
+		compiler->failed = true;
+		return 0;
+	}
+	compiler->game_fns[compiler->game_fns_len] = (struct bytecode_game_fn) {.fn = fn, .data = data};
+	return compiler->game_fns_len++;
+}
+
+static uint32_t phis_len(struct grug_ir_function const* function, struct grug_ir_block const* block) {
+	uint32_t len = 0;
+	while(len < block->instrs_len && function->instrs[block->instrs[len]].op == GRUG_IR_PHI) {
+		len += 1;
+	}
+	return len;
+}
+
+static uint32_t pred_index(struct grug_ir_block const* block, grug_ir_block_id pred) {
+	uint32_t index = 0;
+	while(block->preds[index] != pred) {
+		index += 1;
+	}
+	return index;
+}
+
+/// Stores only have side effects, while every other instruction gets a register, even a call whose value isn't used
+static bool defines_register(grug_ir_op op) {
+	return op != GRUG_IR_STORE_MEMBER;
+}
+
+// MARK: liveness
+
+static void bitset_add(uint64_t* set, uint32_t bit) {
+	set[bit / 64] |= 1ULL << (bit % 64);
+}
+
+static void bitset_remove(uint64_t* set, uint32_t bit) {
+	set[bit / 64] &= ~(1ULL << (bit % 64));
+}
+
+/// Adds the values that the phis of `successor` get from `block` to `live`
+static void add_phi_uses(struct bytecode_compiler* compiler, grug_ir_block_id block, grug_ir_block_id successor, uint64_t* live) {
+	struct grug_ir_function const* function = compiler->function;
+	struct grug_ir_block const* successor_block = &function->blocks[successor];
+	uint32_t phis = phis_len(function, successor_block);
+	if(!phis) {
+		return;
+	}
+	uint32_t index = pred_index(successor_block, block);
+	for(uint32_t phi_index = 0; phi_index < phis; phi_index += 1) {
+		bitset_add(live, grug_ir_operand(function, &function->instrs[successor_block->instrs[phi_index]], index));
+	}
+}
+
+/// Turns the values live at the end of a block into the values live at its start
+static void live_through_block(struct bytecode_compiler* compiler, struct grug_ir_block const* block, uint64_t* live) {
+	struct grug_ir_function const* function = compiler->function;
+	if(block->value != GRUG_IR_NONE) {
+		bitset_add(live, block->value);
+	}
+	for(uint32_t index = block->instrs_len; index > 0; index -= 1) {
+		grug_ir_value value = block->instrs[index - 1];
+		struct grug_ir_instr const* instr = &function->instrs[value];
+		bitset_remove(live, value);
+		// The operands of a phi are used at the end of the predecessors
+		if(instr->op == GRUG_IR_PHI) {
+			continue;
+		}
+		for(uint32_t operand_index = 0; operand_index < instr->operands_len; operand_index += 1) {
+			bitset_add(live, grug_ir_operand(function, instr, operand_index));
+		}
+	}
+}
+
+/// Writes the values live at the end of the block at `position` to `live`
+static void compute_live_out(struct bytecode_compiler* compiler, uint32_t position, uint64_t* live) {
+	grug_ir_block_id block_id = compiler->order[position];
+	struct grug_ir_block const* block = &compiler->function->blocks[block_id];
+	uint32_t words = compiler->live_words;
+	memset(live, 0, words * sizeof(uint64_t));
+	grug_ir_block_id targets[2] = {block->targets[0], block->targets[1]};
+	uint32_t targets_len = block->terminator == GRUG_IR_JUMP ? 1 : block->terminator == GRUG_IR_BRANCH ? 2 : 0;
+	for(uint32_t target_index = 0; target_index < targets_len; target_index += 1) {
+		uint64_t const* target_in = &compiler->live_in[compiler->positions[targets[target_index]] * words];
+		for(uint32_t word = 0; word < words; word += 1) {
+			live[word] |= target_in[word];
+		}
+		add_phi_uses(compiler, block_id, targets[target_index], live);
+	}
+}
+
+static void compute_liveness(struct bytecode_compiler* compiler) {
+	uint32_t words = (compiler->function->instrs_len + 63) / 64;
+	compiler->live_words = words;
+	compiler->live_in = scratch_alloc_zeroed(compiler, (size_t)compiler->order_len * words * sizeof(uint64_t));
+	compiler->live_out = scratch_alloc_zeroed(compiler, (size_t)compiler->order_len * words * sizeof(uint64_t));
+	uint64_t* live = scratch_alloc(compiler, words * sizeof(uint64_t));
+	if(compiler->failed) {
+		return;
+	}
+	// Going backwards over reverse postorder, only loops need another round
+	for(bool changed = true; changed;) {
+		changed = false;
+		for(uint32_t position = compiler->order_len; position > 0; position -= 1) {
+			uint64_t* out = &compiler->live_out[(position - 1) * words];
+			uint64_t* in = &compiler->live_in[(position - 1) * words];
+			compute_live_out(compiler, position - 1, out);
+			memcpy(live, out, words * sizeof(uint64_t));
+			live_through_block(compiler, &compiler->function->blocks[compiler->order[position - 1]], live);
+			if(memcmp(live, in, words * sizeof(uint64_t)) != 0) {
+				memcpy(in, live, words * sizeof(uint64_t));
+				changed = true;
+			}
+		}
+	}
+}
+
+// MARK: register allocation
+
+static void add_interference(struct bytecode_compiler* compiler, grug_ir_value left, grug_ir_value right) {
+	if(left == right || compiler->failed) {
+		return;
+	}
+	if(compiler->interferences_len == compiler->interferences_capacity) {
+		uint32_t new_capacity = compiler->interferences_capacity ? compiler->interferences_capacity * 2 : 256;
+		size_t new_size = new_capacity * 2 * sizeof(grug_ir_value);
+		grug_ir_value* grown = compiler->interferences ? grug_arena_realloc(compiler->scratch, compiler->interferences, compiler->interferences_capacity * 2 * sizeof(grug_ir_value), new_size) : grug_arena_alloc(compiler->scratch, new_size);
+		if(!grown) {
+			compiler->failed = true;
+			return;
+		}
+		compiler->interferences = grown;
+		compiler->interferences_capacity = new_capacity;
+	}
+	compiler->interferences[compiler->interferences_len * 2] = left;
+	compiler->interferences[compiler->interferences_len * 2 + 1] = right;
+	compiler->interferences_len += 1;
+}
+
+/// A value interferes with everything that is live where it is defined
+static void interfere_with_live(struct bytecode_compiler* compiler, grug_ir_value value, uint64_t const* live) {
+	for(uint32_t word = 0; word < compiler->live_words; word += 1) {
+		if(!live[word]) {
+			continue;
+		}
+		for(uint32_t bit = 0; bit < 64; bit += 1) {
+			if(live[word] >> bit & 1) {
+				add_interference(compiler, value, word * 64 + bit);
+			}
+		}
+	}
+}
+
+static void build_interference(struct bytecode_compiler* compiler) {
+	struct grug_ir_function const* function = compiler->function;
+	uint32_t words = compiler->live_words;
+	uint64_t* live = scratch_alloc(compiler, words * sizeof(uint64_t));
+	for(uint32_t position = 0; position < compiler->order_len && !compiler->failed; position += 1) {
+		struct grug_ir_block const* block = &function->blocks[compiler->order[position]];
+		memcpy(live, &compiler->live_out[position * words], words * sizeof(uint64_t));
+		if(block->value != GRUG_IR_NONE) {
+			bitset_add(live, block->value);
+		}
+		uint32_t phis = phis_len(function, block);
+		for(uint32_t index = block->instrs_len; index > phis; index -= 1) {
+			grug_ir_value value = block->instrs[index - 1];
+			struct grug_ir_instr const* instr = &function->instrs[value];
+			if(defines_register(instr->op)) {
+				bitset_remove(live, value);
+				interfere_with_live(compiler, value, live);
+			}
+			for(uint32_t operand_index = 0; operand_index < instr->operands_len; operand_index += 1) {
+				bitset_add(live, grug_ir_operand(function, instr, operand_index));
+			}
+		}
+		// The phis of a block are all written at the end of every predecessor, so they interfere with each other even when unused
+		for(uint32_t index = 0; index < phis; index += 1) {
+			bitset_remove(live, block->instrs[index]);
+		}
+		for(uint32_t index = 0; index < phis; index += 1) {
+			interfere_with_live(compiler, block->instrs[index], live);
+			for(uint32_t other = index + 1; other < phis; other += 1) {
+				add_interference(compiler, block->instrs[index], block->instrs[other]);
+			}
+		}
+	}
+	if(compiler->failed) {
+		return;
+	}
+
+	uint32_t values_len = function->instrs_len;
+	compiler->adjacency_starts = scratch_alloc_zeroed(compiler, (values_len + 1) * sizeof(uint32_t));
+	compiler->adjacency = scratch_alloc(compiler, compiler->interferences_len * 2 * sizeof(grug_ir_value));
+	uint32_t* filled = scratch_alloc_zeroed(compiler, values_len * sizeof(uint32_t));
+	if(compiler->failed) {
+		return;
+	}
+	for(uint32_t index = 0; index < compiler->interferences_len * 2; index += 1) {
+		compiler->adjacency_starts[compiler->interferences[index] + 1] += 1;
+	}
+	for(grug_ir_value value = 0; value < values_len; value += 1) {
+		compiler->adjacency_starts[value + 1] += compiler->adjacency_starts[value];
+	}
+	for(uint32_t index = 0; index < compiler->interferences_len; index += 1) {
+		grug_ir_value left = compiler->interferences[index * 2];
+		grug_ir_value right = compiler->interferences[index * 2 + 1];
+		compiler->adjacency[compiler->adjacency_starts[left] + filled[left]++] = right;
+		compiler->adjacency[compiler->adjacency_starts[right] + filled[right]++] = left;
+	}
+}
+
+static grug_ir_value find_class(struct bytecode_compiler* compiler, grug_ir_value value) {
+	while(compiler->class_parents[value] != value) {
+		compiler->class_parents[value] = compiler->class_parents[compiler->class_parents[value]];
+		value = compiler->class_parents[value];
+	}
+	return value;
+}
+
+static bool classes_interfere(struct bytecode_compiler* compiler, grug_ir_value left, grug_ir_value right) {
+	grug_ir_value member = left;
+	do {
+		for(uint32_t index = compiler->adjacency_starts[member]; index < compiler->adjacency_starts[member + 1]; index += 1) {
+			if(find_class(compiler, compiler->adjacency[index]) == right) {
+				return true;
+			}
+		}
+		member = compiler->class_next[member];
+	} while(member != left);
+	return false;
+}
+
+/// Gives the two values the same register if that is possible
+static void try_coalesce(struct bytecode_compiler* compiler, grug_ir_value left, grug_ir_value right) {
+	grug_ir_value left_class = find_class(compiler, left);
+	grug_ir_value right_class = find_class(compiler, right);
+	if(left_class == right_class) {
+		return;
+	}
+	// Arguments arrive in fixed registers
+	if(compiler->class_params[left_class] != GRUG_IR_NONE && compiler->class_params[right_class] != GRUG_IR_NONE) {
+		return;
+	}
+	if(classes_interfere(compiler, left_class, right_class)) {
+		return;
+	}
+	compiler->class_parents[right_class] = left_class;
+	if(compiler->class_params[left_class] == GRUG_IR_NONE) {
+		compiler->class_params[left_class] = compiler->class_params[right_class];
+	}
+	// Swapping the successors of one member of each circular list joins them into one
+	grug_ir_value next = compiler->class_next[left];
+	compiler->class_next[left] = compiler->class_next[right];
+	compiler->class_next[right] = next;
+}
+
+static void coalesce(struct bytecode_compiler* compiler) {
+	struct grug_ir_function const* function = compiler->function;
+	uint32_t values_len = function->instrs_len;
+	compiler->class_parents = scratch_alloc(compiler, values_len * sizeof(grug_ir_value));
+	compiler->class_next = scratch_alloc(compiler, values_len * sizeof(grug_ir_value));
+	compiler->class_params = scratch_alloc(compiler, values_len * sizeof(uint32_t));
+	compiler->class_registers = scratch_alloc(compiler, values_len * sizeof(uint32_t));
+	if(compiler->failed) {
+		return;
+	}
+	for(grug_ir_value value = 0; value < values_len; value += 1) {
+		struct grug_ir_instr const* instr = &function->instrs[value];
+		compiler->class_parents[value] = value;
+		compiler->class_next[value] = value;
+		compiler->class_params[value] = instr->op == GRUG_IR_PARAM && instr->block != GRUG_IR_NONE ? instr->data.index : GRUG_IR_NONE;
+		compiler->class_registers[value] = GRUG_IR_NONE;
+	}
+	for(uint32_t position = 0; position < compiler->order_len; position += 1) {
+		struct grug_ir_block const* block = &function->blocks[compiler->order[position]];
+		for(uint32_t index = 0; index < block->instrs_len; index += 1) {
+			grug_ir_value value = block->instrs[index];
+			struct grug_ir_instr const* instr = &function->instrs[value];
+			if(instr->op == GRUG_IR_COPY) {
+				try_coalesce(compiler, value, grug_ir_operand(function, instr, 0));
+			} else if(instr->op == GRUG_IR_PHI) {
+				for(uint32_t operand_index = 0; operand_index < instr->operands_len; operand_index += 1) {
+					if(compiler->positions[block->preds[operand_index]] != GRUG_IR_NONE) {
+						try_coalesce(compiler, value, grug_ir_operand(function, instr, operand_index));
+					}
+				}
+			}
+		}
+	}
+}
+
+/// Colors the classes greedily in the order their values are defined, after the arguments got their registers
+static void assign_registers(struct bytecode_compiler* compiler) {
+	struct grug_ir_function const* function = compiler->function;
+	uint32_t colors_len = function->instrs_len + function->params_len;
+	/// used[register] == stamp if a neighbor of the class being colored has the register
+	uint32_t* used = scratch_alloc_zeroed(compiler, colors_len * sizeof(uint32_t));
+	if(compiler->failed) {
+		return;
+	}
+	uint32_t registers_len = function->params_len;
+	for(grug_ir_value value = 0; value < function->instrs_len; value += 1) {
+		grug_ir_value class = find_class(compiler, value);
+		if(value == class && compiler->class_params[class] != GRUG_IR_NONE) {
+			compiler->class_registers[class] = compiler->class_params[class];
+		}
+	}
+	uint32_t stamp = 0;
+	for(uint32_t position = 0; position < compiler->order_len; position += 1) {
+		struct grug_ir_block const* block = &function->blocks[compiler->order[position]];
+		for(uint32_t index = 0; index < block->instrs_len; index += 1) {
+			grug_ir_value value = block->instrs[index];
+			grug_ir_value class = find_class(compiler, value);
+			if(!defines_register(function->instrs[value].op) || compiler->class_registers[class] != GRUG_IR_NONE) {
+				continue;
+			}
+			stamp += 1;
+			grug_ir_value member = class;
+			do {
+				for(uint32_t adjacent = compiler->adjacency_starts[member]; adjacent < compiler->adjacency_starts[member + 1]; adjacent += 1) {
+					uint32_t reg = compiler->class_registers[find_class(compiler, compiler->adjacency[adjacent])];
+					if(reg != GRUG_IR_NONE) {
+						used[reg] = stamp;
+					}
+				}
+				member = compiler->class_next[member];
+			} while(member != class);
+			uint32_t reg = 0;
+			while(used[reg] == stamp) {
+				reg += 1;
+			}
+			compiler->class_registers[class] = reg;
+			if(reg + 1 > registers_len) {
+				registers_len = reg + 1;
+			}
+		}
+	}
+	compiler->outgoing = registers_len;
+	compiler->outgoing_len = 0;
+}
+
+static uint32_t register_of(struct bytecode_compiler* compiler, grug_ir_value value) {
+	return compiler->class_registers[find_class(compiler, value)];
+}
+
+// MARK: emitting
+
+static void use_outgoing(struct bytecode_compiler* compiler, uint32_t len) {
+	if(len > compiler->outgoing_len) {
+		compiler->outgoing_len = len;
+	}
+}
+
+/// Emits moves that happen all at once, so no move may overwrite a register another move still reads
+static void emit_parallel_moves(struct bytecode_compiler* compiler, uint32_t* dsts, uint32_t* srcs, uint32_t len) {
+	while(len) {
+		uint32_t ready = 0;
+		for(; ready < len; ready += 1) {
+			bool read = false;
+			for(uint32_t index = 0; index < len && !read; index += 1) {
+				read = srcs[index] == dsts[ready];
+			}
+			if(!read) {
+				break;
+			}
+		}
+		if(ready == len) {
+			// Every destination is still read, so the moves form cycles. Saving one source in the scratch register breaks its cycle.
+			uint32_t saved = srcs[0];
+			uint32_t scratch = compiler->outgoing;
+			use_outgoing(compiler, 1);
+			emit(compiler, BYTECODE_OP_MOVE, scratch, saved, 0);
+			for(uint32_t index = 0; index < len; index += 1) {
+				if(srcs[index] == saved) {
+					srcs[index] = scratch;
+				}
+			}
+			continue;
+		}
+		emit(compiler, BYTECODE_OP_MOVE, dsts[ready], srcs[ready], 0);
+		len -= 1;
+		dsts[ready] = dsts[len];
+		srcs[ready] = srcs[len];
+	}
+}
+
+/// Collects the moves into the phis of `successor` at the end of `block`, and returns how many there are
+static uint32_t collect_phi_moves(struct bytecode_compiler* compiler, grug_ir_block_id block, grug_ir_block_id successor) {
+	struct grug_ir_function const* function = compiler->function;
+	struct grug_ir_block const* successor_block = &function->blocks[successor];
+	uint32_t phis = phis_len(function, successor_block);
+	if(!phis) {
+		return 0;
+	}
+	uint32_t index = pred_index(successor_block, block);
+	uint32_t moves_len = 0;
+	for(uint32_t phi_index = 0; phi_index < phis; phi_index += 1) {
+		grug_ir_value phi = successor_block->instrs[phi_index];
+		uint32_t dst = register_of(compiler, phi);
+		uint32_t src = register_of(compiler, grug_ir_operand(function, &function->instrs[phi], index));
+		if(dst != src) {
+			compiler->move_dsts[moves_len] = dst;
+			compiler->move_srcs[moves_len] = src;
+			moves_len += 1;
+		}
+	}
+	return moves_len;
+}
+
+/// A block that only has phis and a jump, and whose phis need no moves into the block it jumps to, has no code
+static void compute_forwards(struct bytecode_compiler* compiler) {
+	struct grug_ir_function const* function = compiler->function;
+	grug_ir_block_id* next = scratch_alloc(compiler, function->blocks_len * sizeof(grug_ir_block_id));
+	compiler->forwards = scratch_alloc(compiler, function->blocks_len * sizeof(grug_ir_block_id));
+	if(compiler->failed) {
+		return;
+	}
+	for(uint32_t position = 0; position < compiler->order_len; position += 1) {
+		grug_ir_block_id block_id = compiler->order[position];
+		struct grug_ir_block const* block = &function->blocks[block_id];
+		bool empty = position != 0 && block->terminator == GRUG_IR_JUMP && phis_len(function, block) == block->instrs_len;
+		next[block_id] = empty && collect_phi_moves(compiler, block_id, block->targets[0]) == 0 ? block->targets[0] : block_id;
+	}
+	for(uint32_t position = 0; position < compiler->order_len; position += 1) {
+		grug_ir_block_id block_id = compiler->order[position];
+		grug_ir_block_id target = block_id;
+		for(uint32_t steps = 0; next[target] != target && steps < compiler->order_len; steps += 1) {
+			target = next[target];
+		}
+		// An empty `while true {}` jumps to itself forever, so one block of the cycle keeps its jump
+		if(next[target] != target) {
+			next[block_id] = block_id;
+			target = block_id;
+		}
+		compiler->forwards[block_id] = target;
+	}
+}
+
+static enum bytecode_op_enum comparison_op(grug_ir_op op, uint8_t type) {
+	bool equals = op == GRUG_IR_EQ;
+	switch(type) {
+		case GRUG_TYPE_NUMBER:
+			return (enum bytecode_op_enum)(BYTECODE_OP_CMP_EQ_NUM + (op - GRUG_IR_EQ));
+		case GRUG_TYPE_BOOL:
+			return equals ? BYTECODE_OP_CMP_EQ_BOOL : BYTECODE_OP_CMP_NE_BOOL;
+		case GRUG_TYPE_ID:
+			return equals ? BYTECODE_OP_CMP_EQ_ID : BYTECODE_OP_CMP_NE_ID;
+		default:
+			// Strings, resources and entities all compare their text
+			return equals ? BYTECODE_OP_CMP_EQ_STR : BYTECODE_OP_CMP_NE_STR;
+	}
+}
+
+static void emit_call(struct bytecode_compiler* compiler, grug_ir_value value) {
+	struct grug_ir_function const* function = compiler->function;
+	struct grug_ir_instr const* instr = &function->instrs[value];
+	use_outgoing(compiler, instr->operands_len);
+	for(uint32_t index = 0; index < instr->operands_len; index += 1) {
+		emit(compiler, BYTECODE_OP_MOVE, compiler->outgoing + index, register_of(compiler, grug_ir_operand(function, instr, index)), 0);
+	}
+	if(instr->op == GRUG_IR_CALL_GAME) {
+		uint32_t game_fn_index = add_game_fn(compiler, instr->data.game_fn.fn, instr->data.game_fn.data);
+		emit(compiler, BYTECODE_OP_CALL_GAME, register_of(compiler, value), game_fn_index, compiler->outgoing);
+	} else {
+		emit(compiler, BYTECODE_OP_CALL_HELPER, register_of(compiler, value), instr->data.index, compiler->outgoing);
+	}
+}
+
+static void emit_instr(struct bytecode_compiler* compiler, grug_ir_value value) {
+	struct grug_ir_function const* function = compiler->function;
+	struct grug_ir_instr const* instr = &function->instrs[value];
+	uint32_t reg = instr->op == GRUG_IR_STORE_MEMBER ? 0 : register_of(compiler, value);
+	switch(instr->op) {
+		case GRUG_IR_CONST:
+			switch(instr->type) {
+				case GRUG_TYPE_BOOL:
+					emit(compiler, BYTECODE_OP_LOAD_BOOL, reg, instr->data.constant._bool, 0);
+					break;
+				case GRUG_TYPE_STRING:
+				case GRUG_TYPE_RESOURCE:
+				case GRUG_TYPE_ENTITY:
+					emit_wide(compiler, BYTECODE_OP_LOAD_CONST, reg, add_string_constant(compiler, instr->data.constant._string));
+					break;
+				default:
+					emit_wide(compiler, BYTECODE_OP_LOAD_CONST, reg, add_constant(compiler, instr->data.constant));
+					break;
+			}
+			break;
+		case GRUG_IR_PARAM:
+		case GRUG_IR_PHI:
+			break;
+		case GRUG_IR_ME:
+			emit(compiler, BYTECODE_OP_LOAD_ME, reg, 0, 0);
+			break;
+		case GRUG_IR_LOAD_MEMBER:
+			emit(compiler, BYTECODE_OP_LOAD_MEMBER, reg, instr->data.index, 0);
+			break;
+		case GRUG_IR_STORE_MEMBER:
+			emit(compiler, BYTECODE_OP_STORE_MEMBER, instr->data.index, register_of(compiler, grug_ir_operand(function, instr, 0)), 0);
+			break;
+		case GRUG_IR_NOT:
+			emit(compiler, BYTECODE_OP_NOT, reg, register_of(compiler, grug_ir_operand(function, instr, 0)), 0);
+			break;
+		case GRUG_IR_NEG:
+			emit(compiler, BYTECODE_OP_NEG_NUM, reg, register_of(compiler, grug_ir_operand(function, instr, 0)), 0);
+			break;
+		case GRUG_IR_ADD:
+		case GRUG_IR_SUB:
+		case GRUG_IR_MUL:
+		case GRUG_IR_DIV: {
+			enum bytecode_op_enum op = (enum bytecode_op_enum)(BYTECODE_OP_ADD_NUM + (instr->op - GRUG_IR_ADD));
+			emit(compiler, op, reg, register_of(compiler, grug_ir_operand(function, instr, 0)), register_of(compiler, grug_ir_operand(function, instr, 1)));
+			break;
+		}
+		case GRUG_IR_EQ:
+		case GRUG_IR_NE:
+		case GRUG_IR_LT:
+		case GRUG_IR_LE:
+		case GRUG_IR_GT:
+		case GRUG_IR_GE: {
+			grug_ir_value left = grug_ir_operand(function, instr, 0);
+			enum bytecode_op_enum op = comparison_op(instr->op, function->instrs[left].type);
+			emit(compiler, op, reg, register_of(compiler, left), register_of(compiler, grug_ir_operand(function, instr, 1)));
+			break;
+		}
+		case GRUG_IR_CALL_HELPER:
+		case GRUG_IR_CALL_GAME:
+			emit_call(compiler, value);
+			break;
+		case GRUG_IR_COPY: {
+			uint32_t src = register_of(compiler, grug_ir_operand(function, instr, 0));
+			if(src != reg) {
+				emit(compiler, BYTECODE_OP_MOVE, reg, src, 0);
+			}
+			break;
+		}
+		default:
+			compiler->failed = true;
+			break;
+	}
+}
+
+/// Emits the blocks that have code in reverse postorder, so a jump to the next block can be left out
+static void emit_blocks(struct bytecode_compiler* compiler) {
+	struct grug_ir_function const* function = compiler->function;
+	compiler->block_addresses = scratch_alloc(compiler, function->blocks_len * sizeof(uint32_t));
+	grug_ir_block_id* emitted = scratch_alloc(compiler, compiler->order_len * sizeof(grug_ir_block_id));
+	if(compiler->failed) {
+		return;
+	}
+	uint32_t emitted_len = 0;
+	for(uint32_t position = 0; position < compiler->order_len; position += 1) {
+		grug_ir_block_id block_id = compiler->order[position];
+		if(compiler->forwards[block_id] == block_id) {
+			emitted[emitted_len++] = block_id;
+		}
+	}
+	for(uint32_t index = 0; index < emitted_len && !compiler->failed; index += 1) {
+		grug_ir_block_id block_id = emitted[index];
+		struct grug_ir_block const* block = &function->blocks[block_id];
+		grug_ir_block_id next = index + 1 < emitted_len ? emitted[index + 1] : GRUG_IR_NONE;
+		compiler->block_addresses[block_id] = compiler->code_len;
+		for(uint32_t instr_index = 0; instr_index < block->instrs_len; instr_index += 1) {
+			emit_instr(compiler, block->instrs[instr_index]);
+		}
+		switch(block->terminator) {
+			case GRUG_IR_RETURN:
+				if(block->value == GRUG_IR_NONE) {
+					emit(compiler, BYTECODE_OP_RETURN_VOID, 0, 0, 0);
+				} else {
+					emit(compiler, BYTECODE_OP_RETURN, register_of(compiler, block->value), 0, 0);
+				}
+				break;
+			case GRUG_IR_JUMP: {
+				uint32_t moves_len = collect_phi_moves(compiler, block_id, block->targets[0]);
+				emit_parallel_moves(compiler, compiler->move_dsts, compiler->move_srcs, moves_len);
+				grug_ir_block_id target = compiler->forwards[block->targets[0]];
+				if(target != next) {
+					emit_jump(compiler, BYTECODE_OP_JUMP, 0, target);
+				}
+				break;
+			}
+			case GRUG_IR_BRANCH: {
+				// Critical edges were split, so a branch never has to move anything into phis
+				uint32_t cond = register_of(compiler, block->value);
+				grug_ir_block_id if_true = compiler->forwards[block->targets[0]];
+				grug_ir_block_id if_false = compiler->forwards[block->targets[1]];
+				if(if_false == next) {
+					emit_jump(compiler, BYTECODE_OP_JUMP_IF_TRUE, cond, if_true);
+				} else {
+					emit_jump(compiler, BYTECODE_OP_JUMP_IF_FALSE, cond, if_false);
+					if(if_true != next) {
+						emit_jump(compiler, BYTECODE_OP_JUMP, 0, if_true);
+					}
+				}
+				break;
+			}
+		}
+	}
+	patch_jumps(compiler);
+}
+
+static struct bytecode_function compile_function(struct bytecode_compiler* compiler, struct grug_ir_function* function) {
+	struct bytecode_function compiled = {.code_start = compiler->code_len, .params_len = (uint16_t)function->params_len};
+	if(function->params_len > BYTECODE_MAX_REGISTERS) {
+		compiler->failed = true;
+		return compiled;
+	}
+	compiler->function = function;
+	compiler->interferences = NULL;
+	compiler->interferences_len = 0;
+	compiler->interferences_capacity = 0;
+	compiler->jumps.len = 0;
+
+	grug_ir_split_critical_edges(compiler->ir, function);
+	compiler->order = scratch_alloc(compiler, function->blocks_len * sizeof(grug_ir_block_id));
+	compiler->positions = scratch_alloc(compiler, function->blocks_len * sizeof(uint32_t));
+	compiler->move_dsts = scratch_alloc(compiler, function->instrs_len * sizeof(uint32_t));
+	compiler->move_srcs = scratch_alloc(compiler, function->instrs_len * sizeof(uint32_t));
+	if(!compiler->failed) {
+		compiler->order_len = grug_ir_reverse_postorder(compiler->ir, function, compiler->order);
+		for(grug_ir_block_id block_id = 0; block_id < function->blocks_len; block_id += 1) {
+			compiler->positions[block_id] = GRUG_IR_NONE;
+		}
+		for(uint32_t position = 0; position < compiler->order_len; position += 1) {
+			compiler->positions[compiler->order[position]] = position;
+		}
+	}
+	if(compiler->ir->failed) {
+		compiler->failed = true;
+	}
+
+	if(!compiler->failed) {
+		compute_liveness(compiler);
+	}
+	if(!compiler->failed) {
+		build_interference(compiler);
+	}
+	if(!compiler->failed) {
+		coalesce(compiler);
+	}
+	if(!compiler->failed) {
+		assign_registers(compiler);
+	}
+	if(!compiler->failed) {
+		compute_forwards(compiler);
+	}
+	if(!compiler->failed) {
+		emit_blocks(compiler);
+	}
+	uint32_t registers_len = compiler->outgoing + compiler->outgoing_len;
+	if(registers_len > BYTECODE_MAX_REGISTERS) {
+		compiler->failed = true;
+	}
+	compiled.registers_len = (uint16_t)registers_len;
+	grug_arena_clear(compiler->scratch, 1 << 16);
+	return compiled;
+}
+
+/// Copies a compiler array into the file's arena
+static void* copy_to_file(struct bytecode_compiler* compiler, void const* data, size_t size) {
+	if(!size) {
+		return NULL;
+	}
+	void* copy = grug_arena_alloc(compiler->arena, size);
+	if(!copy) {
+		compiler->failed = true;
+		return NULL;
+	}
+	memcpy(copy, data, size);
+	return copy;
+}
+
+static void lower_file(struct bytecode_compiler* compiler, struct bytecode_file* file) {
+	struct grug_ir* ir = compiler->ir;
+	if(ir->failed || ir->members_len > UINT16_MAX || !compiler->scratch) {
+		compiler->failed = true;
+		return;
+	}
+	file->members_len = (uint16_t)ir->members_len;
+	file->init = compile_function(compiler, &ir->init);
+
+	file->helpers_len = ir->helpers_len;
+	file->helpers = grug_arena_alloc(compiler->arena, file->helpers_len * sizeof(struct bytecode_function) + 1);
+	for(uint32_t helper_index = 0; file->helpers && helper_index < file->helpers_len && !compiler->failed; helper_index += 1) {
+		file->helpers[helper_index] = compile_function(compiler, &ir->helpers[helper_index]);
+	}
+
+	file->on_fns_len = ir->on_fns_len;
+	file->on_fns = grug_arena_alloc(compiler->arena, file->on_fns_len * sizeof(struct bytecode_function) + 1);
+	for(uint32_t on_fn_index = 0; file->on_fns && on_fn_index < file->on_fns_len && !compiler->failed; on_fn_index += 1) {
+		if(ir->on_fns[on_fn_index].defined) {
+			file->on_fns[on_fn_index] = compile_function(compiler, &ir->on_fns[on_fn_index]);
+		} else {
+			file->on_fns[on_fn_index] = (struct bytecode_function) {.code_start = BYTECODE_NO_FUNCTION};
+		}
+	}
+	if(!file->helpers || !file->on_fns) {
+		compiler->failed = true;
+	}
+
+	file->code_len = compiler->code_len;
+	file->code = copy_to_file(compiler, compiler->code, compiler->code_len * sizeof(struct bytecode_instruction));
+	file->constants = copy_to_file(compiler, compiler->constants, compiler->constants_len * sizeof(union grug_value));
+	file->game_fns = copy_to_file(compiler, compiler->game_fns, compiler->game_fns_len * sizeof(struct bytecode_game_fn));
+}
+
+struct bytecode_file* grug_bytecode_compile_file(struct grug_ir* ir) {
+	struct grug_arena* arena = grug_arena_new();
+	struct bytecode_file* file = grug_arena_alloc(arena, sizeof(struct bytecode_file));
+	if(!file) {
+		grug_arena_deinit(arena);
+		return NULL;
+	}
+	*file = (struct bytecode_file) {.arena = arena};
+	struct bytecode_compiler compiler = {.ir = ir, .arena = arena, .scratch = grug_arena_new()};
+	lower_file(&compiler, file);
+	file->failed = compiler.failed;
+	if(!file->failed) {
+		file->members = GRUG_MALLOC(sizeof(struct bytecode_members));
+		if(file->members) {
+			*file->members = (struct bytecode_members) {.members_len = file->members_len};
+		} else {
+			file->failed = true;
+		}
+	}
+
+	if(compiler.code) {
+		GRUG_FREE(compiler.code, compiler.code_capacity * sizeof(struct bytecode_instruction));
+	}
+	if(compiler.constants) {
+		GRUG_FREE(compiler.constants, compiler.constants_capacity * sizeof(union grug_value));
+	}
+	if(compiler.game_fns) {
+		GRUG_FREE(compiler.game_fns, compiler.game_fns_capacity * sizeof(struct bytecode_game_fn));
+	}
+	bytecode_u32s_deinit(&compiler.jumps);
+	if(compiler.scratch) {
+		grug_arena_deinit(compiler.scratch);
+	}
+	return file;
+}
+
+// MARK: superinstructions
+
+void grug_bytecode_fuse(struct bytecode_file* file) {
+	if(!file || file->failed) {
+		return;
+	}
+	// Only the first instruction of a pair is overwritten, so the second one can still start a pair of its own
+	for(uint32_t index = 0; index + 1 < file->code_len; index += 1) {
+		struct bytecode_instruction* instruction = &file->code[index];
+		uint16_t second = file->code[index + 1].op;
+	#define BYTECODE_FUSE(_first, _second) \
+		if(instruction->op == BYTECODE_OP_##_first && second == BYTECODE_OP_##_second) { \
+			instruction->op = BYTECODE_OP_##_first##_THEN_##_second; \
+			continue; \
+		}
+		BYTECODE_SUPERINSTRUCTIONS(BYTECODE_FUSE)
+	#undef BYTECODE_FUSE
+	}
+}
+
+// MARK: interpreter
+
+bool grug_bytecode_stack_overflow(struct grug_state* gst) {
+	grug_raise_runtime_error(gst, GRUG_ERROR_CODE_RUNTIME_STACK_OVERFLOW, "Stack overflow, so check for accidental infinite recursion");
+	return false;
+}
+
+#define BYTECODE_WIDE(_instruction) ((uint32_t)(_instruction)->b | (uint32_t)(_instruction)->c << 16)
+
+// What the instructions that can start a superinstruction do, shared by their own handlers and the superinstruction handlers
+#define BYTECODE_RUN_LOAD_CONST regs[instruction->a] = constants[BYTECODE_WIDE(instruction)]
+#define BYTECODE_RUN_LOAD_MEMBER regs[instruction->a] = members[(size_t)instruction->b * BYTECODE_MEMBERS_CHUNK]
+#define BYTECODE_RUN_MOVE regs[instruction->a] = regs[instruction->b]
+#define BYTECODE_RUN_CMP_NUM(_operator) regs[instruction->a]._bool = regs[instruction->b]._number _operator regs[instruction->c]._number
+#define BYTECODE_RUN_CMP_EQ_NUM BYTECODE_RUN_CMP_NUM(==)
+#define BYTECODE_RUN_CMP_NE_NUM BYTECODE_RUN_CMP_NUM(!=)
+#define BYTECODE_RUN_CMP_LT_NUM BYTECODE_RUN_CMP_NUM(<)
+#define BYTECODE_RUN_CMP_LE_NUM BYTECODE_RUN_CMP_NUM(<=)
+#define BYTECODE_RUN_CMP_GT_NUM BYTECODE_RUN_CMP_NUM(>)
+#define BYTECODE_RUN_CMP_GE_NUM BYTECODE_RUN_CMP_NUM(>=)
+
+// Taking the address of a label is a GNU extension.
+// Superinstructions jump to the label of every handler, but only some of those labels are used without computed goto.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#pragma GCC diagnostic ignored "-Wunused-label"
+
+bool grug_bytecode_run(struct bytecode_vm* vm, struct grug_state* gst, struct bytecode_file const* file, struct grug_entity* entity, struct bytecode_function const* function, union grug_value const* args) {
+	union grug_value* stack_end = vm->stack + BYTECODE_STACK_SIZE;
+	union grug_value* saved_stack_top = vm->stack_top;
+	size_t base_frame = vm->frames_len;
+	union grug_value* regs = saved_stack_top;
+	if(regs + function->registers_len > stack_end) {
+		return grug_bytecode_stack_overflow(gst);
+	}
+	if(function->params_len) {
+		memcpy(regs, args, function->params_len * sizeof(union grug_value));
+	}
+	vm->stack_top = regs + function->registers_len;
+
+	union grug_value* members = ((struct bytecode_entity_data*)entity->data)->members;
+	union grug_value const* constants = file->constants;
+	struct bytecode_instruction const* code = file->code;
+	struct bytecode_instruction const* pc = code + function->code_start;
+	struct bytecode_instruction const* instruction;
+	union grug_value result;
+	bool success = true;
+
+#ifdef GRUG_BYTECODE_PROFILE
+	// The first instruction of a call counts as following RETURN_VOID, which nothing else can follow
+	uint32_t previous_op = BYTECODE_OP_RETURN_VOID;
+	#define PROFILE() vm->pair_counts[previous_op * BYTECODE_OP_COUNT + instruction->op] += 1; previous_op = instruction->op
+#else
+	#define PROFILE() (void)0
+#endif
+
+#if BYTECODE_COMPUTED_GOTO
+	static void* const dispatch_table[BYTECODE_OP_COUNT] = {
+	#define BYTECODE_OP_LABEL(_name) [BYTECODE_OP_##_name] = &&op_##_name,
+		BYTECODE_OPS(BYTECODE_OP_LABEL)
+	#undef BYTECODE_OP_LABEL
+	#define BYTECODE_SUPERINSTRUCTION_LABEL(_first, _second) [BYTECODE_OP_##_first##_THEN_##_second] = &&op_##_first##_THEN_##_second,
+		BYTECODE_SUPERINSTRUCTIONS(BYTECODE_SUPERINSTRUCTION_LABEL)
+	#undef BYTECODE_SUPERINSTRUCTION_LABEL
+	};
+	#define CASE(_name) op_##_name:
+	#define DISPATCH() instruction = pc++; PROFILE(); goto *dispatch_table[instruction->op]
+	DISPATCH();
+#else
+	#define CASE(_name) case BYTECODE_OP_##_name: op_##_name:
+	#define DISPATCH() continue
+	for(;;) {
+		instruction = pc++;
+		PROFILE();
+		switch(instruction->op) {
+#endif
+
+	CASE(LOAD_CONST) {
+		BYTECODE_RUN_LOAD_CONST;
+		DISPATCH();
+	}
+	CASE(LOAD_BOOL) {
+		regs[instruction->a]._bool = instruction->b != 0;
+		DISPATCH();
+	}
+	CASE(MOVE) {
+		BYTECODE_RUN_MOVE;
+		DISPATCH();
+	}
+	CASE(LOAD_MEMBER) {
+		BYTECODE_RUN_LOAD_MEMBER;
+		DISPATCH();
+	}
+	CASE(STORE_MEMBER) {
+		members[(size_t)instruction->a * BYTECODE_MEMBERS_CHUNK] = regs[instruction->b];
+		DISPATCH();
+	}
+	CASE(LOAD_ME) {
+		regs[instruction->a]._id = entity->me;
+		DISPATCH();
+	}
+	CASE(NOT) {
+		regs[instruction->a]._bool = !regs[instruction->b]._bool;
+		DISPATCH();
+	}
+	CASE(NEG_NUM) {
+		regs[instruction->a]._number = -regs[instruction->b]._number;
+		DISPATCH();
+	}
+	CASE(ADD_NUM) {
+		regs[instruction->a]._number = regs[instruction->b]._number + regs[instruction->c]._number;
+		DISPATCH();
+	}
+	CASE(SUB_NUM) {
+		regs[instruction->a]._number = regs[instruction->b]._number - regs[instruction->c]._number;
+		DISPATCH();
+	}
+	CASE(MUL_NUM) {
+		regs[instruction->a]._number = regs[instruction->b]._number * regs[instruction->c]._number;
+		DISPATCH();
+	}
+	CASE(DIV_NUM) {
+		regs[instruction->a]._number = regs[instruction->b]._number / regs[instruction->c]._number;
+		DISPATCH();
+	}
+	CASE(CMP_EQ_NUM) {
+		BYTECODE_RUN_CMP_EQ_NUM;
+		DISPATCH();
+	}
+	CASE(CMP_NE_NUM) {
+		BYTECODE_RUN_CMP_NE_NUM;
+		DISPATCH();
+	}
+	CASE(CMP_LT_NUM) {
+		BYTECODE_RUN_CMP_LT_NUM;
+		DISPATCH();
+	}
+	CASE(CMP_LE_NUM) {
+		BYTECODE_RUN_CMP_LE_NUM;
+		DISPATCH();
+	}
+	CASE(CMP_GT_NUM) {
+		BYTECODE_RUN_CMP_GT_NUM;
+		DISPATCH();
+	}
+	CASE(CMP_GE_NUM) {
+		BYTECODE_RUN_CMP_GE_NUM;
+		DISPATCH();
+	}
+	CASE(CMP_EQ_BOOL) {
+		regs[instruction->a]._bool = regs[instruction->b]._bool == regs[instruction->c]._bool;
+		DISPATCH();
+	}
+	CASE(CMP_NE_BOOL) {
+		regs[instruction->a]._bool = regs[instruction->b]._bool != regs[instruction->c]._bool;
+		DISPATCH();
+	}
+	CASE(CMP_EQ_STR) {
+		regs[instruction->a]._bool = strcmp(regs[instruction->b]._string, regs[instruction->c]._string) == 0;
+		DISPATCH();
+	}
+	CASE(CMP_NE_STR) {
+		regs[instruction->a]._bool = strcmp(regs[instruction->b]._string, regs[instruction->c]._string) != 0;
+		DISPATCH();
+	}
+	CASE(CMP_EQ_ID) {
+		regs[instruction->a]._bool = regs[instruction->b]._id == regs[instruction->c]._id;
+		DISPATCH();
+	}
+	CASE(CMP_NE_ID) {
+		regs[instruction->a]._bool = regs[instruction->b]._id != regs[instruction->c]._id;
+		DISPATCH();
+	}
+	CASE(JUMP) {
+		pc = code + BYTECODE_WIDE(instruction);
+		DISPATCH();
+	}
+	CASE(JUMP_IF_FALSE) {
+		if(!regs[instruction->a]._bool) {
+			pc = code + BYTECODE_WIDE(instruction);
+		}
+		DISPATCH();
+	}
+	CASE(JUMP_IF_TRUE) {
+		if(regs[instruction->a]._bool) {
+			pc = code + BYTECODE_WIDE(instruction);
+		}
+		DISPATCH();
+	}
+	CASE(CALL_HELPER) {
+		struct bytecode_function const* callee = &file->helpers[instruction->b];
+		// The callee's arguments are already in place, as the first registers of its frame
+		union grug_value* callee_regs = regs + instruction->c;
+		if(vm->frames_len == BYTECODE_MAX_FRAMES || callee_regs + callee->registers_len > stack_end) {
+			success = grug_bytecode_stack_overflow(gst);
+			goto done;
+		}
+		vm->frames[vm->frames_len++] = (struct bytecode_frame) {
+			.return_pc = pc,
+			.regs = regs,
+			.stack_top = vm->stack_top,
+			.dst = instruction->a,
+		};
+		regs = callee_regs;
+		vm->stack_top = regs + callee->registers_len;
+		pc = code + callee->code_start;
+		DISPATCH();
+	}
+	CASE(CALL_GAME) {
+		struct bytecode_game_fn const* game_fn = &file->game_fns[instruction->b];
+		regs[instruction->a] = game_fn->fn(gst, game_fn->data, regs + instruction->c);
+		if(grug_runtime_error_raised(gst)) {
+			success = false;
+			goto done;
+		}
+		DISPATCH();
+	}
+	CASE(RETURN) {
+		result = regs[instruction->a];
+		if(vm->frames_len == base_frame) {
+			goto done;
+		}
+		struct bytecode_frame const* frame = &vm->frames[--vm->frames_len];
+		regs = frame->regs;
+		regs[frame->dst] = result;
+		vm->stack_top = frame->stack_top;
+		pc = frame->return_pc;
+		DISPATCH();
+	}
+	CASE(RETURN_VOID) {
+		if(vm->frames_len == base_frame) {
+			goto done;
+		}
+		struct bytecode_frame const* frame = &vm->frames[--vm->frames_len];
+		regs = frame->regs;
+		vm->stack_top = frame->stack_top;
+		pc = frame->return_pc;
+		DISPATCH();
+	}
+
+	#define SUPERINSTRUCTION(_first, _second) \
+	CASE(_first##_THEN_##_second) { \
+		BYTECODE_RUN_##_first; \
+		instruction = pc++; \
+		goto op_##_second; \
+	}
+	BYTECODE_SUPERINSTRUCTIONS(SUPERINSTRUCTION)
+	#undef SUPERINSTRUCTION
+
+#if !BYTECODE_COMPUTED_GOTO
+			default:
+				assert(false && "Unknown bytecode instruction");
+				success = false;
+				goto done;
+		}
+	}
+#endif
+	#undef CASE
+	#undef DISPATCH
+	#undef PROFILE
+
+done:
+	vm->stack_top = saved_stack_top;
+	vm->frames_len = base_frame;
+	return success;
+}
+
+#pragma GCC diagnostic pop
+
+// MARK: shared
+
+#ifdef GRUG_BYTECODE_PROFILE
+static char const* const op_names[BYTECODE_OP_COUNT] = {
+#define BYTECODE_OP_NAME(_name) [BYTECODE_OP_##_name] = #_name,
+	BYTECODE_OPS(BYTECODE_OP_NAME)
+#undef BYTECODE_OP_NAME
+#define BYTECODE_SUPERINSTRUCTION_NAME(_first, _second) [BYTECODE_OP_##_first##_THEN_##_second] = #_first "_THEN_" #_second,
+	BYTECODE_SUPERINSTRUCTIONS(BYTECODE_SUPERINSTRUCTION_NAME)
+#undef BYTECODE_SUPERINSTRUCTION_NAME
+};
+
+/// Prints the 20 most frequent pairs of instructions to stderr, hottest first
+static void print_profile(uint64_t* pair_counts) {
+	uint64_t total = 0;
+	for(uint32_t pair = 0; pair < BYTECODE_OP_COUNT * BYTECODE_OP_COUNT; pair += 1) {
+		total += pair_counts[pair];
+	}
+	(void)fprintf(stderr, "grug bytecode profile: %llu instructions\n", (unsigned long long)total);
+	for(uint32_t rank = 0; rank < 20; rank += 1) {
+		uint32_t hottest = 0;
+		for(uint32_t pair = 1; pair < BYTECODE_OP_COUNT * BYTECODE_OP_COUNT; pair += 1) {
+			if(pair_counts[pair] > pair_counts[hottest]) {
+				hottest = pair;
+			}
+		}
+		if(!pair_counts[hottest]) {
+			break;
+		}
+		(void)fprintf(stderr, "%12llu %s -> %s\n", (unsigned long long)pair_counts[hottest], op_names[hottest / BYTECODE_OP_COUNT], op_names[hottest % BYTECODE_OP_COUNT]);
+		// Counts are only printed once, when the vm goes away
+		pair_counts[hottest] = 0;
+	}
+}
+#endif
+
+static void free_members(struct bytecode_members* pool) {
+	size_t chunk_size = sizeof(struct bytecode_members_chunk) + (size_t)pool->members_len * BYTECODE_MEMBERS_CHUNK * sizeof(union grug_value);
+	for(uint32_t chunk_index = 0; chunk_index < pool->chunks_len; chunk_index += 1) {
+		GRUG_FREE(pool->chunks[chunk_index], chunk_size);
+	}
+	if(pool->chunks) {
+		GRUG_FREE(pool->chunks, pool->chunks_capacity * sizeof(struct bytecode_members_chunk*));
+	}
+	GRUG_FREE(pool, sizeof(struct bytecode_members));
+}
+
+void grug_bytecode_free_file(struct bytecode_file* file) {
+	if(!file) {
+		return;
+	}
+	// Entities keep using the members of a hot reloaded file until they are reinitialized
+	if(file->members) {
+		if(file->members->live_rows) {
+			file->members->retired = true;
+		} else {
+			free_members(file->members);
+		}
+	}
+	grug_arena_deinit(file->arena);
+}
+
+bool grug_bytecode_vm_init(struct bytecode_vm* vm) {
+	*vm = (struct bytecode_vm) {0};
+	vm->stack = GRUG_MALLOC(BYTECODE_STACK_SIZE * sizeof(union grug_value));
+	vm->frames = GRUG_MALLOC(BYTECODE_MAX_FRAMES * sizeof(struct bytecode_frame));
+	if(!vm->stack || !vm->frames) {
+		grug_bytecode_vm_deinit(vm);
+		return false;
+	}
+	vm->stack_top = vm->stack;
+#ifdef GRUG_BYTECODE_PROFILE
+	vm->pair_counts = GRUG_MALLOC(BYTECODE_OP_COUNT * BYTECODE_OP_COUNT * sizeof(uint64_t));
+	if(!vm->pair_counts) {
+		grug_bytecode_vm_deinit(vm);
+		return false;
+	}
+	memset(vm->pair_counts, 0, BYTECODE_OP_COUNT * BYTECODE_OP_COUNT * sizeof(uint64_t));
+#endif
+	return true;
+}
+
+void grug_bytecode_vm_deinit(struct bytecode_vm* vm) {
+	if(vm->stack) {
+		GRUG_FREE(vm->stack, BYTECODE_STACK_SIZE * sizeof(union grug_value));
+	}
+	if(vm->frames) {
+		GRUG_FREE(vm->frames, BYTECODE_MAX_FRAMES * sizeof(struct bytecode_frame));
+	}
+#ifdef GRUG_BYTECODE_PROFILE
+	if(vm->pair_counts) {
+		print_profile(vm->pair_counts);
+		GRUG_FREE(vm->pair_counts, BYTECODE_OP_COUNT * BYTECODE_OP_COUNT * sizeof(uint64_t));
+	}
+#endif
+	*vm = (struct bytecode_vm) {0};
+}
+
+bool grug_bytecode_alloc_entity_data(struct grug_state* gst, struct bytecode_file const* file, struct grug_entity* entity) {
+	if(!file || file->failed) {
+		grug_raise_runtime_error(gst, GRUG_ERROR_CODE_RUNTIME, "Failed to create an entity: its file could not be lowered to bytecode");
+		return false;
+	}
+	struct bytecode_members* pool = file->members;
+	struct bytecode_entity_data* data = pool->free_rows;
+	if(data) {
+		pool->free_rows = data->next_free;
+	} else {
+		if(pool->chunks_len == 0 || pool->last_chunk_len == BYTECODE_MEMBERS_CHUNK) {
+			if(pool->chunks_len == pool->chunks_capacity) {
+				uint32_t new_capacity = pool->chunks_capacity ? pool->chunks_capacity * 2 : 8;
+				struct bytecode_members_chunk** new_chunks = grug_realloc(pool->chunks, pool->chunks_capacity * sizeof(struct bytecode_members_chunk*), new_capacity * sizeof(struct bytecode_members_chunk*));
+				if(!new_chunks) {
+					grug_raise_runtime_error(gst, GRUG_ERROR_CODE_RUNTIME, "Failed to create an entity: malloc() returned null");
+					return false;
+				}
+				pool->chunks = new_chunks;
+				pool->chunks_capacity = new_capacity;
+			}
+			struct bytecode_members_chunk* chunk = GRUG_MALLOC(sizeof(struct bytecode_members_chunk) + (size_t)pool->members_len * BYTECODE_MEMBERS_CHUNK * sizeof(union grug_value));
+			if(!chunk) {
+				grug_raise_runtime_error(gst, GRUG_ERROR_CODE_RUNTIME, "Failed to create an entity: malloc() returned null");
+				return false;
+			}
+			pool->chunks[pool->chunks_len++] = chunk;
+			pool->last_chunk_len = 0;
+		}
+		struct bytecode_members_chunk* chunk = pool->chunks[pool->chunks_len - 1];
+		data = &chunk->rows[pool->last_chunk_len];
+		*data = (struct bytecode_entity_data) {.members = &chunk->values[pool->last_chunk_len], .pool = pool};
+		pool->last_chunk_len += 1;
+	}
+	for(uint32_t member_index = 0; member_index < pool->members_len; member_index += 1) {
+		data->members[member_index * BYTECODE_MEMBERS_CHUNK] = (union grug_value) {0};
+	}
+	pool->live_rows += 1;
+	entity->data = data;
+	return true;
+}
+
+void grug_bytecode_free_entity_data(struct grug_entity* entity) {
+	struct bytecode_entity_data* data = entity->data;
+	if(!data) {
+		return;
+	}
+	entity->data = NULL;
+	struct bytecode_members* pool = data->pool;
+	pool->live_rows -= 1;
+	if(pool->retired && !pool->live_rows) {
+		free_members(pool);
+		return;
+	}
+	// Freed rows are reused first, which keeps a file's entities packed into as few chunks as possible
+	data->next_free = pool->free_rows;
+	pool->free_rows = data;
+}
+
+// MARK: backend
+
+static struct bytecode_file* file_of(struct bytecode_backend const* backend, grug_file_id file_id) {
+	if(backend->parent) {
+		backend = backend->parent;
+	}
+	if(file_id == 0 || file_id > backend->files_len) {
+		return NULL;
+	}
+	return backend->files[file_id - 1];
+}
+
+static void bytecode_compile_script(void* backend_data, grug_file_id file_id, struct grug_ast ast) {
+	struct bytecode_backend* backend = backend_data;
+	struct grug_ir ir;
+	grug_ir_from_ast(&ir, &ast);
+	grug_ir_optimize(&ir, GRUG_IR_PASSES_ALL);
+	struct bytecode_file* file = grug_bytecode_compile_file(&ir);
+	grug_ir_free(&ir);
+	grug_bytecode_fuse(file);
+	if(file_id <= backend->files_len) {
+		grug_bytecode_free_file(backend->files[file_id - 1]);
+		backend->files[file_id - 1] = file;
+		return;
+	}
+	// File ids are handed out in contiguous ascending order
+	assert(file_id == backend->files_len + 1);
+	if(backend->files_len == backend->files_capacity) {
+		size_t new_capacity = backend->files_capacity ? backend->files_capacity * 2 : 64;
+		struct bytecode_file** new_files = grug_realloc(backend->files, backend->files_capacity * sizeof(struct bytecode_file*), new_capacity * sizeof(struct bytecode_file*));
+		if(!new_files) {
+			grug_bytecode_free_file(file);
+			return;
+		}
+		backend->files = new_files;
+		backend->files_capacity = new_capacity;
+	}
+	backend->files[backend->files_len++] = file;
+}
+
+static bool bytecode_init_entity(void* backend_data, struct grug_state* gst, struct grug_entity* entity) {
+	struct bytecode_backend* backend = backend_data;
+	struct bytecode_file const* file = file_of(backend, entity->file_id);
+	if(!grug_bytecode_alloc_entity_data(gst, file, entity)) {
+		return false;
+	}
+	return grug_bytecode_run(&backend->vm, gst, file, entity, &file->init, NULL);
+}
+
+static void bytecode_destroy_entity_data(void* backend_data, struct grug_entity* entity) {
+	(void)backend_data;
+	grug_bytecode_free_entity_data(entity);
+}
+
+static bool bytecode_call_on_function_raw(void* backend_data, struct grug_state* gst, struct grug_entity* entity, uint64_t on_fn_index, union grug_value* args) {
+	struct bytecode_backend* backend = backend_data;
+	struct bytecode_file const* file = file_of(backend, entity->file_id);
+	// Files don't have to define every on function of their entity type
+	if(!file || on_fn_index >= file->on_fns_len || file->on_fns[on_fn_index].code_start == BYTECODE_NO_FUNCTION) {
+		return true;
+	}
+	return grug_bytecode_run(&backend->vm, gst, file, entity, &file->on_fns[on_fn_index], args);
+}
+
+static bool bytecode_call_on_function(void* backend_data, struct grug_state* gst, struct grug_entity* entity, uint64_t on_fn_index, union grug_value* args, size_t args_len) {
+	struct bytecode_backend* backend = backend_data;
+	struct bytecode_file const* file = file_of(backend, entity->file_id);
+	if(!file || on_fn_index >= file->on_fns_len || file->on_fns[on_fn_index].code_start == BYTECODE_NO_FUNCTION) {
+		return true;
+	}
+	struct bytecode_function const* function = &file->on_fns[on_fn_index];
+	if(args_len != function->params_len) {
+		grug_raise_runtime_error(gst, GRUG_ERROR_CODE_RUNTIME, "An on function was called with the wrong number of arguments");
+		return false;
+	}
+	return grug_bytecode_run(&backend->vm, gst, file, entity, function, args);
+}
+
+static size_t bytecode_call_on_function_batch(void* backend_data, struct grug_state* gst, struct grug_entity* const* entities, size_t count, uint64_t on_fn_index, union grug_value const* args, size_t stride) {
+	struct bytecode_backend* backend = backend_data;
+	// Every entity of a batch comes from the same file, so the function is only looked up once
+	struct bytecode_file const* file = file_of(backend, entities[0]->file_id);
+	if(!file || on_fn_index >= file->on_fns_len || file->on_fns[on_fn_index].code_start == BYTECODE_NO_FUNCTION) {
+		return count;
+	}
+	struct bytecode_function const* function = &file->on_fns[on_fn_index];
+	for(size_t index = 0; index < count; index += 1) {
+		if(!grug_bytecode_run(&backend->vm, gst, file, entities[index], function, args ? args + index * stride : NULL)) {
+			return index;
+		}
+	}
+	return count;
+}
+
+static void bytecode_drop(void* backend_data) {
+	struct bytecode_backend* backend = backend_data;
+	for(size_t file_index = 0; file_index < backend->files_len; file_index += 1) {
+		grug_bytecode_free_file(backend->files[file_index]);
+	}
+	if(backend->files) {
+		GRUG_FREE(backend->files, backend->files_capacity * sizeof(struct bytecode_file*));
+	}
+	grug_bytecode_vm_deinit(&backend->vm);
+	GRUG_FREE(backend, sizeof(struct bytecode_backend));
+}
+
+static void* bytecode_new_worker(void* backend_data) {
+	struct bytecode_backend* worker = GRUG_MALLOC(sizeof(struct bytecode_backend));
+	if(!worker) {
+		return NULL;
+	}
+	*worker = (struct bytecode_backend) {.parent = backend_data};
+	if(!grug_bytecode_vm_init(&worker->vm)) {
+		GRUG_FREE(worker, sizeof(struct bytecode_backend));
+		return NULL;
+	}
+	return worker;
+}
+
+static void bytecode_drop_worker(void* worker_data) {
+	struct bytecode_backend* worker = worker_data;
+	grug_bytecode_vm_deinit(&worker->vm);
+	GRUG_FREE(worker, sizeof(struct bytecode_backend));
+}
+
+static union grug_value* bytecode_entity_members(void* backend_data, struct grug_entity* entity) {
+	(void)backend_data;
+	return entity->data ? ((struct bytecode_entity_data*)entity->data)->members : NULL;
+}
+
+static size_t bytecode_member_stride(void* backend_data) {
+	(void)backend_data;
+	return BYTECODE_MEMBERS_CHUNK * sizeof(union grug_value);
+}
+
+static struct grug_backend_vtable bytecode_vtable = {
+	.compile_script = bytecode_compile_script,
+	.init_entity = bytecode_init_entity,
+	// grug_deinit destroys the entities one by one
+	.clear_entities = NULL,
+	.entity_data = bytecode_destroy_entity_data,
+	.call_on_function_raw = bytecode_call_on_function_raw,
+	.call_on_function = bytecode_call_on_function,
+	.call_on_function_batch = bytecode_call_on_function_batch,
+	.new_worker = bytecode_new_worker,
+	.drop_worker = bytecode_drop_worker,
+	.entity_members = bytecode_entity_members,
+	.member_stride = bytecode_member_stride,
+	.drop = bytecode_drop,
+};
+
+struct grug_backend grug_bytecode_backend_new(void) {
+	struct bytecode_backend* backend = GRUG_MALLOC(sizeof(struct bytecode_backend));
+	if(!backend) {
+		return (struct grug_backend) {0};
+	}
+	*backend = (struct bytecode_backend) {0};
+	if(!grug_bytecode_vm_init(&backend->vm)) {
+		GRUG_FREE(backend, sizeof(struct bytecode_backend));
+		return (struct grug_backend) {0};
+	}
+	return (struct grug_backend) {.obj = backend, .vtable = &bytecode_vtable};
+}
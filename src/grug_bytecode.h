@@ -0,0 +1,235 @@
+#pragma once
+
+// Internal to the library: the view the built-in backends have of grug_main.c beyond the public API, and the bytecode they share.
+// The backends themselves are created with the functions declared in grug_main.h.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "grug_ir.h"
+#include "grug_main.h"
+
+/// Defined in grug_main.c.
+/// Records a runtime error of the on function being run, which the backend then aborts by returning false.
+/// Only the first error of a call is kept.
+void grug_raise_runtime_error(struct grug_state* gst, struct grug_error_code error_code, char const* message);
+
+/// Defined in grug_main.c.
+/// Whether a runtime error was raised since the outermost on function call started, for instance by a game function calling grug_game_fn_runtime_error.
+bool grug_runtime_error_raised(struct grug_state const* gst);
+
+/// Defined in grug_main.c.
+/// Whether the game asked for speed over safety with grug_set_fast_mode.
+bool grug_fast_mode(struct grug_state const* gst);
+
+// MARK: bytecode
+
+/// The number of values shared by the frames of all running functions
+#define BYTECODE_STACK_SIZE (1 << 16)
+#define BYTECODE_MAX_FRAMES 4096
+/// Registers are addressed with 16 bits
+#define BYTECODE_MAX_REGISTERS UINT16_MAX
+#define BYTECODE_NO_FUNCTION UINT32_MAX
+
+// MARK: instructions
+
+/// `a` is the destination register unless noted otherwise.
+/// A 32 bit operand, like a constant index or a jump target, is stored as `b | c << 16`.
+#define BYTECODE_OPS(X) \
+	X(LOAD_CONST)    /* a = constants[bc] */ \
+	X(LOAD_BOOL)     /* a = b */ \
+	X(MOVE)          /* a = b */ \
+	X(LOAD_MEMBER)   /* a = members[b] */ \
+	X(STORE_MEMBER)  /* members[a] = b */ \
+	X(LOAD_ME)       /* a = me */ \
+	X(NOT)           /* a = not b */ \
+	X(NEG_NUM)       /* a = -b */ \
+	X(ADD_NUM)       /* a = b + c */ \
+	X(SUB_NUM) \
+	X(MUL_NUM) \
+	X(DIV_NUM) \
+	X(CMP_EQ_NUM)    /* a = b == c */ \
+	X(CMP_NE_NUM) \
+	X(CMP_LT_NUM) \
+	X(CMP_LE_NUM) \
+	X(CMP_GT_NUM) \
+	X(CMP_GE_NUM) \
+	X(CMP_EQ_BOOL) \
+	X(CMP_NE_BOOL) \
+	X(CMP_EQ_STR) \
+	X(CMP_NE_STR) \
+	X(CMP_EQ_ID) \
+	X(CMP_NE_ID) \
+	X(JUMP)          /* pc = bc */ \
+	X(JUMP_IF_FALSE) /* if not a: pc = bc */ \
+	X(JUMP_IF_TRUE)  /* if a: pc = bc */ \
+	X(CALL_HELPER)   /* a = helpers[b](registers from c) */ \
+	X(CALL_GAME)     /* a = game_fns[b](registers from c) */ \
+	X(RETURN)        /* return a */ \
+	X(RETURN_VOID)
+
+/// Superinstructions, which are the pairs that GRUG_BYTECODE_PROFILE found to run most often.
+/// grug_bytecode_fuse writes FIRST_THEN_SECOND over the first instruction of a pair and leaves the second one in place.
+/// The interpreter then runs the first one and jumps straight to the handler of the second one, saving a dispatch.
+/// Since the second instruction is untouched, jumping to it still works.
+#define BYTECODE_SUPERINSTRUCTIONS(X) \
+	X(CMP_EQ_NUM, JUMP_IF_FALSE) \
+	X(CMP_NE_NUM, JUMP_IF_FALSE) \
+	X(CMP_LT_NUM, JUMP_IF_FALSE) \
+	X(CMP_LE_NUM, JUMP_IF_FALSE) \
+	X(CMP_GT_NUM, JUMP_IF_FALSE) \
+	X(CMP_GE_NUM, JUMP_IF_FALSE) \
+	X(CMP_EQ_NUM, JUMP_IF_TRUE) \
+	X(CMP_NE_NUM, JUMP_IF_TRUE) \
+	X(CMP_LT_NUM, JUMP_IF_TRUE) \
+	X(CMP_LE_NUM, JUMP_IF_TRUE) \
+	X(CMP_GT_NUM, JUMP_IF_TRUE) \
+	X(CMP_GE_NUM, JUMP_IF_TRUE) \
+	X(LOAD_CONST, ADD_NUM)       /* i = i + 1 */ \
+	X(LOAD_CONST, SUB_NUM) \
+	X(LOAD_CONST, CMP_LT_NUM) \
+	X(LOAD_CONST, MOVE)          /* a constant argument */ \
+	X(LOAD_MEMBER, LOAD_CONST)   /* a member compared with a constant */ \
+	X(MOVE, MOVE) \
+	X(MOVE, CALL_HELPER) \
+	X(MOVE, CALL_GAME)
+
+enum bytecode_op_enum {
+#define BYTECODE_OP_ENUM(_name) BYTECODE_OP_##_name,
+	BYTECODE_OPS(BYTECODE_OP_ENUM)
+#undef BYTECODE_OP_ENUM
+#define BYTECODE_SUPERINSTRUCTION_ENUM(_first, _second) BYTECODE_OP_##_first##_THEN_##_second,
+	BYTECODE_SUPERINSTRUCTIONS(BYTECODE_SUPERINSTRUCTION_ENUM)
+#undef BYTECODE_SUPERINSTRUCTION_ENUM
+	BYTECODE_OP_COUNT,
+};
+
+struct bytecode_instruction {
+	uint16_t op;
+	uint16_t a;
+	uint16_t b;
+	uint16_t c;
+};
+
+struct bytecode_function {
+	/// Index of the first instruction in the file's code, or BYTECODE_NO_FUNCTION for an on function the file doesn't define
+	uint32_t code_start;
+	/// The arguments are the first registers
+	uint16_t params_len;
+	uint16_t registers_len;
+};
+
+struct bytecode_game_fn {
+	game_fn fn;
+	void* data;
+};
+
+struct bytecode_file {
+	/// Owns the file and everything it points to
+	struct grug_arena* arena;
+	struct bytecode_instruction* code;
+	uint32_t code_len;
+	union grug_value* constants;
+	struct bytecode_game_fn* game_fns;
+	/// Initializes the members of a new entity
+	struct bytecode_function init;
+	struct bytecode_function* helpers;
+	uint32_t helpers_len;
+	/// Indexed by on_fn_index
+	struct bytecode_function* on_fns;
+	uint32_t on_fns_len;
+	uint16_t members_len;
+	/// Set if lowering failed, in which case entities of this file can't be created
+	bool failed;
+	/// Where the members of the file's entities are stored
+	struct bytecode_members* members;
+};
+
+/// The number of entities in a chunk of bytecode_members, which is also how far apart the members of one entity are
+#define BYTECODE_MEMBERS_CHUNK 256
+
+/// What the bytecode and JIT backends store in grug_entity.data.
+/// Member i of the entity is members[i * BYTECODE_MEMBERS_CHUNK].
+struct bytecode_entity_data {
+	union grug_value* members;
+	struct bytecode_members* pool;
+	/// The next free row of the pool, while this row is free
+	struct bytecode_entity_data* next_free;
+};
+
+/// BYTECODE_MEMBERS_CHUNK entities of a file, whose members are stored column by column,
+/// so a batch over the file's entities reads every member from consecutive addresses
+struct bytecode_members_chunk {
+	struct bytecode_entity_data rows[BYTECODE_MEMBERS_CHUNK];
+	/// members_len columns of BYTECODE_MEMBERS_CHUNK values
+	union grug_value values[];
+};
+
+/// The members of every entity of a file. Chunks never move, so grug_entity.data stays valid until the entity is freed.
+/// A hot reloaded file's pool outlives it until the last of its entities has been given members from the new file.
+struct bytecode_members {
+	struct bytecode_members_chunk** chunks;
+	uint32_t chunks_len;
+	uint32_t chunks_capacity;
+	/// The rows used so far in the last chunk
+	uint32_t last_chunk_len;
+	uint16_t members_len;
+	struct bytecode_entity_data* free_rows;
+	size_t live_rows;
+	/// Set once the file is freed, after which the pool frees itself along with its last row
+	bool retired;
+};
+
+struct bytecode_frame {
+	/// The instruction after the call
+	struct bytecode_instruction const* return_pc;
+	union grug_value* regs;
+	union grug_value* stack_top;
+	uint16_t dst;
+};
+
+/// The value stack and call frames that bytecode runs on.
+/// Every backend that runs bytecode owns one, and calls that game functions make back into grug continue on the same stack.
+struct bytecode_vm {
+	union grug_value* stack;
+	/// The first value not used by a running function, where a game function calling back into grug starts its frame
+	union grug_value* stack_top;
+	struct bytecode_frame* frames;
+	size_t frames_len;
+#ifdef GRUG_BYTECODE_PROFILE
+	/// How often every instruction ran right after every other one, indexed by [previous op * BYTECODE_OP_COUNT + op].
+	/// grug_bytecode_vm_deinit prints the most frequent pairs, which are the candidates for superinstructions.
+	uint64_t* pair_counts;
+#endif
+};
+
+/// Lowers the IR of a file to bytecode. Critical edges of the IR's functions get split along the way.
+/// Returns NULL if not even a failed file could be allocated, and a file with `failed` set if the IR or lowering failed.
+struct bytecode_file* grug_bytecode_compile_file(struct grug_ir* ir);
+
+/// Writes superinstructions over the pairs of instructions in BYTECODE_SUPERINSTRUCTIONS.
+/// Only grug_bytecode_run understands them, so the JIT translates a file before fusing it for its safe mode.
+void grug_bytecode_fuse(struct bytecode_file* file);
+
+/// Frees a file from grug_bytecode_compile_file, which may be NULL
+void grug_bytecode_free_file(struct bytecode_file* file);
+
+/// Returns false if the stack could not be allocated
+bool grug_bytecode_vm_init(struct bytecode_vm* vm);
+
+void grug_bytecode_vm_deinit(struct bytecode_vm* vm);
+
+/// Runs `function` of `file` for `entity`, starting its frame at the top of the stack so game functions can call back into grug.
+/// Returns false if there was a runtime error.
+bool grug_bytecode_run(struct bytecode_vm* vm, struct grug_state* gst, struct bytecode_file const* file, struct grug_entity* entity, struct bytecode_function const* function, union grug_value const* args);
+
+/// Allocates the zeroed members of an entity of `file` into entity->data, without running the member initializers.
+/// Returns false and raises a runtime error upon an error.
+bool grug_bytecode_alloc_entity_data(struct grug_state* gst, struct bytecode_file const* file, struct grug_entity* entity);
+
+/// Raises GRUG_ERROR_CODE_RUNTIME_STACK_OVERFLOW, and returns false so it can be returned right away
+bool grug_bytecode_stack_overflow(struct grug_state* gst);
+
+/// Frees entity->data, if it was allocated
+void grug_bytecode_free_entity_data(struct grug_entity* entity);
@@ -0,0 +1,199 @@
+#include "grug_cache.h"
+
+#include "grug_options.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// Entries smaller than this are read into an allocation, as mapping and unmapping a file costs more than reading a few pages of it
+#define CACHE_MAP_MIN (64 * 1024)
+
+/// Room for the name of an entry or a temporary file after the directory, like "/0123456789abcdef.4294967295.4294967295.tmp"
+#define CACHE_NAME_CAPACITY 64
+
+struct grug_cache {
+	char* dir_path;
+	size_t dir_path_len;
+	/// Tells the temporary files of the threads of this process apart, where the process id tells processes apart
+	uint32_t next_temporary;
+};
+
+/// Like mkdir -p
+static bool make_dirs(char* path) {
+	for(char* character = path + 1; *character; character += 1) {
+		if(*character != '/') {
+			continue;
+		}
+		*character = '\0';
+		bool made = mkdir(path, 0777) == 0 || errno == EEXIST;
+		*character = '/';
+		if(!made) {
+			return false;
+		}
+	}
+	struct stat dir_stat;
+	return (mkdir(path, 0777) == 0 || errno == EEXIST) && stat(path, &dir_stat) == 0 && S_ISDIR(dir_stat.st_mode);
+}
+
+/// Writes the path of the entry of `key` to `out_path`, which holds PATH_MAX characters, followed by `suffix`
+static void entry_path(struct grug_cache const* cache, uint64_t key, char const* suffix, char* out_path) {
+	(void)snprintf(out_path, PATH_MAX, "%s%s%016" PRIx64 "%s", cache->dir_path, cache->dir_path_len ? "/" : "", key, suffix);
+}
+
+struct grug_cache* grug_cache_new(char const* dir_path) {
+	size_t dir_path_len = strlen(dir_path);
+	if(dir_path_len + CACHE_NAME_CAPACITY > PATH_MAX) {
+		return NULL;
+	}
+	struct grug_cache* cache = GRUG_MALLOC(sizeof(struct grug_cache));
+	char* dir_path_copy = GRUG_MALLOC(dir_path_len + 1);
+	if(!cache || !dir_path_copy) {
+		if(cache) {
+			GRUG_FREE(cache, sizeof(struct grug_cache));
+		}
+		if(dir_path_copy) {
+			GRUG_FREE(dir_path_copy, dir_path_len + 1);
+		}
+		return NULL;
+	}
+	memcpy(dir_path_copy, dir_path, dir_path_len + 1);
+	*cache = (struct grug_cache) {.dir_path = dir_path_copy, .dir_path_len = dir_path_len};
+	if(dir_path_len && !make_dirs(dir_path_copy)) {
+		grug_cache_free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
+void grug_cache_free(struct grug_cache* cache) {
+	if(!cache) {
+		return;
+	}
+	GRUG_FREE(cache->dir_path, cache->dir_path_len + 1);
+	GRUG_FREE(cache, sizeof(struct grug_cache));
+}
+
+bool grug_cache_load(struct grug_cache const* cache, uint64_t key, struct grug_cache_entry* out_entry) {
+	*out_entry = (struct grug_cache_entry) {0};
+	char path[PATH_MAX];
+	entry_path(cache, key, ".grugc", path);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		return false;
+	}
+	struct stat file_stat;
+	// An empty entry is no entry
+	if(fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode) || file_stat.st_size <= 0) {
+		(void)close(fd);
+		return false;
+	}
+	size_t len = (size_t)file_stat.st_size;
+	void* data = NULL;
+	if(len >= CACHE_MAP_MIN) {
+		data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		data = data == MAP_FAILED ? NULL : data;
+	} else {
+		data = GRUG_MALLOC(len);
+		size_t read_len = 0;
+		while(data && read_len < len) {
+			ssize_t result = read(fd, (char*)data + read_len, len - read_len);
+			if(result < 0 && errno == EINTR) {
+				continue;
+			}
+			if(result <= 0) {
+				// It got cut short since the fstat
+				GRUG_FREE(data, len);
+				data = NULL;
+				break;
+			}
+			read_len += (size_t)result;
+		}
+	}
+	// A mapping keeps the file around by itself
+	(void)close(fd);
+	if(!data) {
+		return false;
+	}
+	*out_entry = (struct grug_cache_entry) {.data = data, .len = len};
+	return true;
+}
+
+void grug_cache_release(struct grug_cache_entry* entry) {
+	if(entry->data && entry->len >= CACHE_MAP_MIN) {
+		(void)munmap((void*)entry->data, entry->len);
+	} else if(entry->data) {
+		GRUG_FREE((void*)entry->data, entry->len);
+	}
+	*entry = (struct grug_cache_entry) {0};
+}
+
+bool grug_cache_store(struct grug_cache* cache, uint64_t key, void const* data, size_t len) {
+	char path[PATH_MAX];
+	char temporary_path[PATH_MAX];
+	entry_path(cache, key, ".grugc", path);
+	char suffix[CACHE_NAME_CAPACITY];
+	uint32_t temporary = __atomic_fetch_add(&cache->next_temporary, 1, __ATOMIC_RELAXED);
+	(void)snprintf(suffix, sizeof(suffix), ".%ld.%" PRIu32 ".tmp", (long)getpid(), temporary);
+	entry_path(cache, key, suffix, temporary_path);
+	int fd = open(temporary_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if(fd < 0) {
+		return false;
+	}
+	bool success = true;
+	for(size_t written = 0; success && written < len;) {
+		ssize_t result = write(fd, (char const*)data + written, len - written);
+		if(result < 0 && errno == EINTR) {
+			continue;
+		}
+		success = result > 0;
+		written += success ? (size_t)result : 0;
+	}
+	// There is no fsync, as an entry that a crash cut short is caught by whoever reads it
+	success = close(fd) == 0 && success;
+	success = success && rename(temporary_path, path) == 0;
+	if(!success) {
+		(void)unlink(temporary_path);
+	}
+	return success;
+}
+
+#else
+
+struct grug_cache* grug_cache_new(char const* dir_path) {
+	(void)dir_path;
+	return NULL;
+}
+
+void grug_cache_free(struct grug_cache* cache) {
+	(void)cache;
+}
+
+bool grug_cache_load(struct grug_cache const* cache, uint64_t key, struct grug_cache_entry* out_entry) {
+	(void)cache;
+	(void)key;
+	*out_entry = (struct grug_cache_entry) {0};
+	return false;
+}
+
+void grug_cache_release(struct grug_cache_entry* entry) {
+	*entry = (struct grug_cache_entry) {0};
+}
+
+bool grug_cache_store(struct grug_cache* cache, uint64_t key, void const* data, size_t len) {
+	(void)cache;
+	(void)key;
+	(void)data;
+	(void)len;
+	return false;
+}
+
+#endif
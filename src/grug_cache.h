@@ -0,0 +1,32 @@
+#pragma once
+
+// A directory of files that each hold an entry of bytes under a 64 bit key, which outlives the process.
+// Big entries are mapped into memory when read and small ones read into an allocation. Entries are written to a temporary file that is then renamed over the entry,
+// so a reader, even in another process, never sees half an entry. What the bytes mean is up to the caller.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct grug_cache;
+
+struct grug_cache_entry {
+	void const* data;
+	size_t len;
+};
+
+/// Uses the directory at `dir_path`, creating it and its parents if they don't exist yet.
+/// Returns NULL if that fails, or if the platform can't map files.
+struct grug_cache* grug_cache_new(char const* dir_path);
+
+/// `cache` may be NULL
+void grug_cache_free(struct grug_cache* cache);
+
+/// Maps the entry of `key`, which has to be given back with grug_cache_release. Returns false if there is no such entry.
+/// Several threads may load and store at once.
+bool grug_cache_load(struct grug_cache const* cache, uint64_t key, struct grug_cache_entry* out_entry);
+
+void grug_cache_release(struct grug_cache_entry* entry);
+
+/// Writes the `len` bytes at `data` as the entry of `key`, replacing the entry that was there. Returns false if that fails.
+bool grug_cache_store(struct grug_cache* cache, uint64_t key, void const* data, size_t len);
@@ -0,0 +1,87 @@
+#include "grug_file.h"
+
+#include "grug_options.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+char* grug_read_file(char const* path, size_t* out_len, size_t* out_capacity) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		return NULL;
+	}
+	struct stat file_stat;
+	if(fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+		(void)close(fd);
+		return NULL;
+	}
+	size_t capacity = (size_t)file_stat.st_size + 1;
+	char* text = GRUG_MALLOC(capacity);
+	size_t len = 0;
+	// A file that grows while it is read is cut off at the size it had, and one that shrinks ends early
+	while(text && len + 1 < capacity) {
+		ssize_t result = read(fd, text + len, capacity - 1 - len);
+		if(result < 0 && errno == EINTR) {
+			continue;
+		}
+		if(result < 0) {
+			GRUG_FREE(text, capacity);
+			text = NULL;
+		} else if(result == 0) {
+			break;
+		} else {
+			len += (size_t)result;
+		}
+	}
+	(void)close(fd);
+	if(!text) {
+		return NULL;
+	}
+	text[len] = '\0';
+	*out_len = len;
+	*out_capacity = capacity;
+	return text;
+}
+
+#else
+
+#include <stdio.h>
+
+char* grug_read_file(char const* path, size_t* out_len, size_t* out_capacity) {
+	FILE* file = fopen(path, "rb");
+	if(!file) {
+		return NULL;
+	}
+	long size = -1;
+	if(fseek(file, 0, SEEK_END) == 0) {
+		size = ftell(file);
+	}
+	char* text = NULL;
+	size_t capacity = 0;
+	size_t len = 0;
+	if(size >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+		capacity = (size_t)size + 1;
+		text = GRUG_MALLOC(capacity);
+	}
+	if(text) {
+		len = fread(text, 1, capacity - 1, file);
+		if(ferror(file)) {
+			GRUG_FREE(text, capacity);
+			text = NULL;
+		}
+	}
+	(void)fclose(file);
+	if(!text) {
+		return NULL;
+	}
+	text[len] = '\0';
+	*out_len = len;
+	*out_capacity = capacity;
+	return text;
+}
+
+#endif
@@ -0,0 +1,9 @@
+#pragma once
+
+// Reads whole files with a single allocation of the right size, as the size comes from the file system before any of the file is read.
+
+#include <stddef.h>
+
+/// Returns the contents of the file at `path` followed by a null terminator, or NULL if it couldn't be read.
+/// The contents are allocated with GRUG_MALLOC(*out_capacity), which is *out_len + 1 unless the file shrank while it was read.
+char* grug_read_file(char const* path, size_t* out_len, size_t* out_capacity);
@@ -0,0 +1,141 @@
+#include "grug_intern.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "grug_main.h"
+#include "grug_options.h"
+
+void grug_interner_init(struct grug_interner* interner, struct grug_arena* arena) {
+	*interner = (struct grug_interner) {.arena = arena};
+}
+
+void grug_interner_init_child(struct grug_interner* interner, struct grug_interner const* parent, struct grug_arena* arena) {
+	*interner = (struct grug_interner) {.arena = arena, .parent = parent, .first_symbol = parent->first_symbol + parent->count};
+}
+
+void grug_interner_deinit(struct grug_interner* interner) {
+	if(interner->strings) {
+		GRUG_FREE(interner->strings, interner->strings_capacity * sizeof(struct grug_interned_string));
+	}
+	if(interner->slots) {
+		GRUG_FREE(interner->slots, interner->slots_capacity * sizeof(grug_symbol));
+	}
+	*interner = (struct grug_interner) {0};
+}
+
+uint32_t grug_hash_string(char const* string, size_t len) {
+	uint32_t hash = 2166136261U;
+	for(size_t index = 0; index < len; index += 1) {
+		hash ^= (uint8_t)string[index];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/// Returns the slot holding `string`, or the empty slot it would go in. The slots hold indices into `strings`, not symbols.
+static uint32_t find_slot(struct grug_interner const* interner, char const* string, size_t len, uint32_t hash) {
+	uint32_t mask = interner->slots_capacity - 1;
+	uint32_t slot = hash & mask;
+	while(true) {
+		grug_symbol symbol = interner->slots[slot];
+		if(symbol == GRUG_SYMBOL_NONE) {
+			return slot;
+		}
+		struct grug_interned_string const* interned = &interner->strings[symbol];
+		if(interned->hash == hash && interned->len == len && memcmp(interned->string, string, len) == 0) {
+			return slot;
+		}
+		slot = (slot + 1) & mask;
+	}
+}
+
+/// Keeps the table at most half full
+static bool grow_slots(struct grug_interner* interner) {
+	uint32_t new_capacity = interner->slots_capacity ? interner->slots_capacity * 2 : 256;
+	grug_symbol* new_slots = GRUG_MALLOC(new_capacity * sizeof(grug_symbol));
+	if(!new_slots) {
+		return false;
+	}
+	memset(new_slots, 0xFF, new_capacity * sizeof(grug_symbol));
+	if(interner->slots) {
+		GRUG_FREE(interner->slots, interner->slots_capacity * sizeof(grug_symbol));
+	}
+	interner->slots = new_slots;
+	interner->slots_capacity = new_capacity;
+	// The hashes are kept, so rehashing never touches the strings themselves
+	uint32_t mask = new_capacity - 1;
+	for(grug_symbol symbol = 0; symbol < interner->count; symbol += 1) {
+		uint32_t slot = interner->strings[symbol].hash & mask;
+		while(new_slots[slot] != GRUG_SYMBOL_NONE) {
+			slot = (slot + 1) & mask;
+		}
+		new_slots[slot] = symbol;
+	}
+	return true;
+}
+
+/// grug_interner_find, with the hash already computed
+static grug_symbol find_symbol(struct grug_interner const* interner, char const* string, size_t len, uint32_t hash) {
+	if(interner->parent) {
+		grug_symbol symbol = find_symbol(interner->parent, string, len, hash);
+		if(symbol != GRUG_SYMBOL_NONE) {
+			return symbol;
+		}
+	}
+	if(!interner->count) {
+		return GRUG_SYMBOL_NONE;
+	}
+	grug_symbol index = interner->slots[find_slot(interner, string, len, hash)];
+	return index == GRUG_SYMBOL_NONE ? GRUG_SYMBOL_NONE : interner->first_symbol + index;
+}
+
+grug_symbol grug_intern(struct grug_interner* interner, char const* string, size_t len) {
+	if(len > UINT32_MAX) {
+		return GRUG_SYMBOL_NONE;
+	}
+	uint32_t hash = grug_hash_string(string, len);
+	if(interner->parent) {
+		grug_symbol symbol = find_symbol(interner->parent, string, len, hash);
+		if(symbol != GRUG_SYMBOL_NONE) {
+			return symbol;
+		}
+	}
+	if(interner->first_symbol + interner->count >= GRUG_SYMBOL_NONE - 1) {
+		return GRUG_SYMBOL_NONE;
+	}
+	if((interner->count + 1) * 2 > interner->slots_capacity && !grow_slots(interner)) {
+		return GRUG_SYMBOL_NONE;
+	}
+	uint32_t slot = find_slot(interner, string, len, hash);
+	if(interner->slots[slot] != GRUG_SYMBOL_NONE) {
+		return interner->first_symbol + interner->slots[slot];
+	}
+	if(interner->count == interner->strings_capacity) {
+		uint32_t new_capacity = interner->strings_capacity ? interner->strings_capacity * 2 : 128;
+		struct grug_interned_string* new_strings = grug_realloc(interner->strings, interner->strings_capacity * sizeof(struct grug_interned_string), new_capacity * sizeof(struct grug_interned_string));
+		if(!new_strings) {
+			return GRUG_SYMBOL_NONE;
+		}
+		interner->strings = new_strings;
+		interner->strings_capacity = new_capacity;
+	}
+	char* copy = grug_arena_alloc_aligned(interner->arena, len + 1, 1);
+	if(!copy) {
+		return GRUG_SYMBOL_NONE;
+	}
+	memcpy(copy, string, len);
+	copy[len] = '\0';
+	uint32_t index = interner->count;
+	interner->strings[index] = (struct grug_interned_string) {.string = copy, .len = (uint32_t)len, .hash = hash};
+	interner->slots[slot] = index;
+	interner->count += 1;
+	return interner->first_symbol + index;
+}
+
+grug_symbol grug_interner_find(struct grug_interner const* interner, char const* string, size_t len) {
+	if(len > UINT32_MAX) {
+		return GRUG_SYMBOL_NONE;
+	}
+	return find_symbol(interner, string, len, grug_hash_string(string, len));
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+// String interner that turns names into dense 32 bit symbols, so the compiler and runtime compare and hash names as integers.
+// Every distinct string gets the next symbol, starting from 0, and keeps it for the lifetime of the interner.
+// A child interner looks strings up in its parent first, and numbers the ones its parent doesn't have after the parent's symbols,
+// so several threads can each intern into their own child while the parent is left alone.
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct grug_arena;
+
+typedef uint32_t grug_symbol;
+
+#define GRUG_SYMBOL_NONE UINT32_MAX
+
+struct grug_interned_string {
+	/// Null terminated
+	char const* string;
+	uint32_t len;
+	uint32_t hash;
+};
+
+struct grug_interner {
+	/// The strings are copied into this arena, which the interner doesn't own
+	struct grug_arena* arena;
+	/// Indexed by symbol
+	struct grug_interned_string* strings;
+	uint32_t count;
+	uint32_t strings_capacity;
+	/// Open addressing with linear probing, GRUG_SYMBOL_NONE marks an empty slot. The capacity is a power of two.
+	grug_symbol* slots;
+	uint32_t slots_capacity;
+	/// NULL unless this is a child interner
+	struct grug_interner const* parent;
+	/// The symbol of strings[0], which is the number of symbols the parent had when the child was made
+	grug_symbol first_symbol;
+};
+
+void grug_interner_init(struct grug_interner* interner, struct grug_arena* arena);
+
+/// The parent must not be a child itself, must not get new strings while the child is in use, and must outlive it
+void grug_interner_init_child(struct grug_interner* interner, struct grug_interner const* parent, struct grug_arena* arena);
+
+/// Frees the table, but not the strings, since those live in the arena
+void grug_interner_deinit(struct grug_interner* interner);
+
+/// 32 bit FNV-1a
+uint32_t grug_hash_string(char const* string, size_t len);
+
+/// Returns the symbol of `string`, adding it if it's new. Returns GRUG_SYMBOL_NONE if an allocation failed.
+grug_symbol grug_intern(struct grug_interner* interner, char const* string, size_t len);
+
+/// Returns the symbol of `string`, or GRUG_SYMBOL_NONE if it was never interned
+grug_symbol grug_interner_find(struct grug_interner const* interner, char const* string, size_t len);
+
+static inline struct grug_interned_string const* grug_interned_string_of(struct grug_interner const* interner, grug_symbol symbol) {
+	if(symbol < interner->first_symbol) {
+		return &interner->parent->strings[symbol];
+	}
+	return &interner->strings[symbol - interner->first_symbol];
+}
+
+static inline char const* grug_symbol_string(struct grug_interner const* interner, grug_symbol symbol) {
+	return grug_interned_string_of(interner, symbol)->string;
+}
+
+static inline size_t grug_symbol_len(struct grug_interner const* interner, grug_symbol symbol) {
+	return grug_interned_string_of(interner, symbol)->len;
+}
@@ -0,0 +1,1610 @@
+#include "grug_ir.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "grug_options.h"
+
+// SSA is built straight from the AST with the algorithm of Braun et al., "Simple and Efficient Construction of Static Single Assignment Form".
+// A variable read looks for the value the variable has at the end of the current block, and otherwise asks the predecessors for it,
+// which puts a phi in the block if there is more than one. Blocks whose predecessors aren't all known yet, like a loop header before its body is built,
+// get placeholder phis that are filled in once the block is sealed.
+//
+// Every primitive below checks ir->failed before indexing anything, since ids handed out after an allocation failed are GRUG_IR_NONE.
+
+// MARK: functions
+
+static bool ir_reserve(struct grug_ir* ir, void** array, uint32_t len, uint32_t needed, uint32_t* capacity, size_t item_size) {
+	if(needed <= *capacity - len) {
+		return true;
+	}
+	uint32_t new_capacity = *capacity ? *capacity : 16;
+	while(new_capacity - len < needed) {
+		if(new_capacity >= UINT32_MAX / 2) {
+			ir->failed = true;
+			return false;
+		}
+		new_capacity *= 2;
+	}
+	void* grown = grug_realloc(*array, (size_t)*capacity * item_size, (size_t)new_capacity * item_size);
+	if(!grown) {
+		ir->failed = true;
+		return false;
+	}
+	*array = grown;
+	*capacity = new_capacity;
+	return true;
+}
+
+/// Allocates `len` items for a pass, which has to free them with ir_free_scratch and the same length
+static void* ir_alloc_scratch(struct grug_ir* ir, size_t len, size_t item_size) {
+	void* scratch = GRUG_MALLOC((len + 1) * item_size);
+	if(!scratch) {
+		ir->failed = true;
+	}
+	return scratch;
+}
+
+static void ir_free_scratch(void* scratch, size_t len, size_t item_size) {
+	if(scratch) {
+		GRUG_FREE(scratch, (len + 1) * item_size);
+	}
+}
+
+static grug_ir_block_id add_block(struct grug_ir* ir, struct grug_ir_function* function, uint32_t loop) {
+	if(ir->failed || !ir_reserve(ir, (void**)&function->blocks, function->blocks_len, 1, &function->blocks_capacity, sizeof(struct grug_ir_block))) {
+		return GRUG_IR_NONE;
+	}
+	function->blocks[function->blocks_len] = (struct grug_ir_block) {
+		.terminator = GRUG_IR_RETURN,
+		.value = GRUG_IR_NONE,
+		.targets = {GRUG_IR_NONE, GRUG_IR_NONE},
+		.loop = loop,
+	};
+	return function->blocks_len++;
+}
+
+static void add_pred(struct grug_ir* ir, struct grug_ir_function* function, grug_ir_block_id block_id, grug_ir_block_id pred) {
+	if(ir->failed) {
+		return;
+	}
+	struct grug_ir_block* block = &function->blocks[block_id];
+	if(ir_reserve(ir, (void**)&block->preds, block->preds_len, 1, &block->preds_capacity, sizeof(grug_ir_block_id))) {
+		block->preds[block->preds_len++] = pred;
+	}
+}
+
+static uint32_t phis_len(struct grug_ir_function const* function, grug_ir_block_id block_id) {
+	struct grug_ir_block const* block = &function->blocks[block_id];
+	uint32_t len = 0;
+	while(len < block->instrs_len && function->instrs[block->instrs[len]].op == GRUG_IR_PHI) {
+		len += 1;
+	}
+	return len;
+}
+
+static void block_insert(struct grug_ir* ir, struct grug_ir_function* function, grug_ir_block_id block_id, uint32_t position, grug_ir_value value) {
+	if(ir->failed) {
+		return;
+	}
+	struct grug_ir_block* block = &function->blocks[block_id];
+	if(!ir_reserve(ir, (void**)&block->instrs, block->instrs_len, 1, &block->instrs_capacity, sizeof(grug_ir_value))) {
+		return;
+	}
+	memmove(&block->instrs[position + 1], &block->instrs[position], (block->instrs_len - position) * sizeof(grug_ir_value));
+	block->instrs[position] = value;
+	block->instrs_len += 1;
+	function->instrs[value].block = block_id;
+}
+
+static void block_append(struct grug_ir* ir, struct grug_ir_function* function, grug_ir_block_id block_id, grug_ir_value value) {
+	if(!ir->failed) {
+		block_insert(ir, function, block_id, function->blocks[block_id].instrs_len, value);
+	}
+}
+
+/// Returns the index of the first of `len` new operands
+static uint32_t reserve_operands(struct grug_ir* ir, struct grug_ir_function* function, uint32_t len) {
+	if(ir->failed || !ir_reserve(ir, (void**)&function->operands, function->operands_len, len, &function->operands_capacity, sizeof(grug_ir_value))) {
+		return GRUG_IR_NONE;
+	}
+	uint32_t start = function->operands_len;
+	function->operands_len += len;
+	return start;
+}
+
+/// Adds an instruction to the end of a block, or after the other phis for a phi
+static grug_ir_value add_instr(struct grug_ir* ir, struct grug_ir_function* function, grug_ir_block_id block, grug_ir_op op, uint8_t type, grug_ir_value const* operands, uint32_t operands_len) {
+	uint32_t operands_start = reserve_operands(ir, function, operands_len);
+	if(ir->failed || !ir_reserve(ir, (void**)&function->instrs, function->instrs_len, 1, &function->instrs_capacity, sizeof(struct grug_ir_instr))) {
+		return GRUG_IR_NONE;
+	}
+	if(operands_len) {
+		memcpy(&function->operands[operands_start], operands, operands_len * sizeof(grug_ir_value));
+	}
+	grug_ir_value value = function->instrs_len++;
+	function->instrs[value] = (struct grug_ir_instr) {
+		.op = op,
+		.type = type,
+		.block = GRUG_IR_NONE,
+		.operands_start = operands_start,
+		.operands_len = operands_len,
+	};
+	block_insert(ir, function, block, op == GRUG_IR_PHI ? phis_len(function, block) : function->blocks[block].instrs_len, value);
+	return value;
+}
+
+static bool has_phis(struct grug_ir_function const* function, grug_ir_block_id block_id) {
+	return phis_len(function, block_id) != 0;
+}
+
+static uint32_t successors(struct grug_ir_block const* block, grug_ir_block_id out[2]) {
+	switch(block->terminator) {
+		case GRUG_IR_JUMP:
+			out[0] = block->targets[0];
+			return 1;
+		case GRUG_IR_BRANCH:
+			out[0] = block->targets[0];
+			out[1] = block->targets[1];
+			return 2;
+		default:
+			return 0;
+	}
+}
+
+/// Removes the edge from `pred` along with the operands its phis got from it
+static void remove_pred(struct grug_ir_function* function, grug_ir_block_id block_id, grug_ir_block_id pred) {
+	struct grug_ir_block* block = &function->blocks[block_id];
+	uint32_t index = 0;
+	while(index < block->preds_len && block->preds[index] != pred) {
+		index += 1;
+	}
+	if(index == block->preds_len) {
+		return;
+	}
+	memmove(&block->preds[index], &block->preds[index + 1], (block->preds_len - index - 1) * sizeof(grug_ir_block_id));
+	block->preds_len -= 1;
+	for(uint32_t phi_index = 0; phi_index < block->instrs_len; phi_index += 1) {
+		struct grug_ir_instr* phi = &function->instrs[block->instrs[phi_index]];
+		if(phi->op != GRUG_IR_PHI) {
+			break;
+		}
+		if(index < phi->operands_len) {
+			grug_ir_value* operands = &function->operands[phi->operands_start];
+			memmove(&operands[index], &operands[index + 1], (phi->operands_len - index - 1) * sizeof(grug_ir_value));
+			phi->operands_len -= 1;
+		}
+	}
+}
+
+static bool block_in_loop(struct grug_ir_function const* function, grug_ir_block_id block, uint32_t loop) {
+	for(uint32_t outer = function->blocks[block].loop; outer != GRUG_IR_NONE; outer = function->loops[outer].parent) {
+		if(outer == loop) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/// Drops the instructions that were removed or moved from the instruction list of every block
+static void compact_blocks(struct grug_ir_function* function) {
+	for(grug_ir_block_id block_id = 0; block_id < function->blocks_len; block_id += 1) {
+		struct grug_ir_block* block = &function->blocks[block_id];
+		uint32_t kept = 0;
+		for(uint32_t index = 0; index < block->instrs_len; index += 1) {
+			if(function->instrs[block->instrs[index]].block == block_id) {
+				block->instrs[kept++] = block->instrs[index];
+			}
+		}
+		block->instrs_len = kept;
+	}
+}
+
+// MARK: building
+
+struct ir_local {
+	char const* name;
+	uint32_t variable;
+};
+
+/// The value a variable has at the end of a block
+struct ir_definition {
+	/// The block in the upper 32 bits and the variable in the lower ones, or UINT64_MAX for an empty slot
+	uint64_t key;
+	grug_ir_value value;
+};
+
+/// A phi for a variable read in a block whose predecessors weren't all known yet
+struct ir_incomplete_phi {
+	grug_ir_block_id block;
+	uint32_t variable;
+	grug_ir_value phi;
+};
+
+struct ir_builder {
+	struct grug_ir* ir;
+	struct grug_ast const* ast;
+	struct grug_ir_function* function;
+	/// The block that instructions are added to
+	grug_ir_block_id block;
+
+	/// The arguments and local variables in scope, innermost last
+	struct ir_local* locals;
+	uint32_t locals_len;
+	uint32_t locals_capacity;
+	/// The grug_type_type of every variable of the function
+	uint8_t* variable_types;
+	uint32_t variables_len;
+	uint32_t variables_capacity;
+	/// Open addressing with linear probing, with a power of two capacity
+	struct ir_definition* definitions;
+	uint32_t definitions_len;
+	uint32_t definitions_capacity;
+	struct ir_incomplete_phi* incomplete_phis;
+	uint32_t incomplete_phis_len;
+	uint32_t incomplete_phis_capacity;
+	/// Whether all predecessors of a block are known, indexed by block
+	bool* sealed;
+	uint32_t sealed_capacity;
+	/// The value a phi that turned out to be trivial was replaced with, indexed by value
+	grug_ir_value* replacements;
+	uint32_t replacements_len;
+	uint32_t replacements_capacity;
+	/// Call arguments that have been built, innermost call last
+	grug_ir_value* args;
+	uint32_t args_len;
+	uint32_t args_capacity;
+
+	/// The members a member initializer can see are the ones above it
+	uint32_t members_len;
+	/// The innermost while loop being built, and where its `continue` and `break` go
+	uint32_t loop;
+	grug_ir_block_id loop_header;
+	grug_ir_block_id loop_exit;
+};
+
+static grug_ir_block_id build_block_in_loop(struct ir_builder* builder, uint32_t loop) {
+	grug_ir_block_id block = add_block(builder->ir, builder->function, loop);
+	if(block != GRUG_IR_NONE && ir_reserve(builder->ir, (void**)&builder->sealed, block, 1, &builder->sealed_capacity, sizeof(bool))) {
+		builder->sealed[block] = false;
+	}
+	return block;
+}
+
+static grug_ir_block_id build_block(struct ir_builder* builder) {
+	return build_block_in_loop(builder, builder->loop);
+}
+
+static grug_ir_value build_instr(struct ir_builder* builder, grug_ir_op op, uint8_t type, grug_ir_value const* operands, uint32_t operands_len) {
+	return add_instr(builder->ir, builder->function, builder->block, op, type, operands, operands_len);
+}
+
+static grug_ir_value build_const(struct ir_builder* builder, uint8_t type, union grug_value constant) {
+	grug_ir_value value = build_instr(builder, GRUG_IR_CONST, type, NULL, 0);
+	if(value != GRUG_IR_NONE) {
+		builder->function->instrs[value].data.constant = constant;
+	}
+	return value;
+}
+
+static grug_ir_value build_indexed(struct ir_builder* builder, grug_ir_op op, uint8_t type, uint32_t index, grug_ir_value const* operands, uint32_t operands_len) {
+	grug_ir_value value = build_instr(builder, op, type, operands, operands_len);
+	if(value != GRUG_IR_NONE) {
+		builder->function->instrs[value].data.index = index;
+	}
+	return value;
+}
+
+/// Ends the current block
+static void terminate(struct ir_builder* builder, grug_ir_terminator terminator, grug_ir_value value, grug_ir_block_id target, grug_ir_block_id other_target) {
+	if(builder->ir->failed) {
+		return;
+	}
+	struct grug_ir_block* block = &builder->function->blocks[builder->block];
+	block->terminator = terminator;
+	block->value = value;
+	block->targets[0] = target;
+	block->targets[1] = other_target;
+	if(terminator != GRUG_IR_RETURN) {
+		add_pred(builder->ir, builder->function, target, builder->block);
+	}
+	if(terminator == GRUG_IR_BRANCH) {
+		add_pred(builder->ir, builder->function, other_target, builder->block);
+	}
+}
+
+static grug_ir_value resolve_trivial_phi(struct ir_builder const* builder, grug_ir_value value) {
+	while(value != GRUG_IR_NONE && value < builder->replacements_len && builder->replacements[value] != GRUG_IR_NONE) {
+		value = builder->replacements[value];
+	}
+	return value;
+}
+
+static void grow_replacements(struct ir_builder* builder) {
+	uint32_t instrs_len = builder->function->instrs_len;
+	if(builder->replacements_len >= instrs_len || !ir_reserve(builder->ir, (void**)&builder->replacements, builder->replacements_len, instrs_len - builder->replacements_len, &builder->replacements_capacity, sizeof(grug_ir_value))) {
+		return;
+	}
+	for(uint32_t value = builder->replacements_len; value < instrs_len; value += 1) {
+		builder->replacements[value] = GRUG_IR_NONE;
+	}
+	builder->replacements_len = instrs_len;
+}
+
+static uint32_t hash_definition_key(uint64_t key) {
+	key ^= key >> 33;
+	key *= 0xFF51AFD7ED558CCDULL;
+	key ^= key >> 33;
+	return (uint32_t)key;
+}
+
+static bool grow_definitions(struct ir_builder* builder) {
+	uint32_t old_capacity = builder->definitions_capacity;
+	uint32_t new_capacity = old_capacity ? old_capacity * 2 : 64;
+	struct ir_definition* definitions = GRUG_MALLOC(new_capacity * sizeof(struct ir_definition));
+	if(!definitions) {
+		builder->ir->failed = true;
+		return false;
+	}
+	for(uint32_t index = 0; index < new_capacity; index += 1) {
+		definitions[index].key = UINT64_MAX;
+	}
+	for(uint32_t index = 0; index < old_capacity; index += 1) {
+		struct ir_definition definition = builder->definitions[index];
+		if(definition.key == UINT64_MAX) {
+			continue;
+		}
+		uint32_t slot = hash_definition_key(definition.key) & (new_capacity - 1);
+		while(definitions[slot].key != UINT64_MAX) {
+			slot = (slot + 1) & (new_capacity - 1);
+		}
+		definitions[slot] = definition;
+	}
+	if(builder->definitions) {
+		GRUG_FREE(builder->definitions, old_capacity * sizeof(struct ir_definition));
+	}
+	builder->definitions = definitions;
+	builder->definitions_capacity = new_capacity;
+	return true;
+}
+
+static void write_variable(struct ir_builder* builder, uint32_t variable, grug_ir_block_id block, grug_ir_value value) {
+	if(builder->ir->failed) {
+		return;
+	}
+	if((builder->definitions_len + 1) * 2 > builder->definitions_capacity && !grow_definitions(builder)) {
+		return;
+	}
+	uint64_t key = (uint64_t)block << 32 | variable;
+	uint32_t mask = builder->definitions_capacity - 1;
+	for(uint32_t slot = hash_definition_key(key) & mask;; slot = (slot + 1) & mask) {
+		if(builder->definitions[slot].key == key) {
+			builder->definitions[slot].value = value;
+			return;
+		}
+		if(builder->definitions[slot].key == UINT64_MAX) {
+			builder->definitions[slot] = (struct ir_definition) {.key = key, .value = value};
+			builder->definitions_len += 1;
+			return;
+		}
+	}
+}
+
+static grug_ir_value find_definition(struct ir_builder const* builder, uint32_t variable, grug_ir_block_id block) {
+	if(!builder->definitions_capacity) {
+		return GRUG_IR_NONE;
+	}
+	uint64_t key = (uint64_t)block << 32 | variable;
+	uint32_t mask = builder->definitions_capacity - 1;
+	for(uint32_t slot = hash_definition_key(key) & mask;; slot = (slot + 1) & mask) {
+		if(builder->definitions[slot].key == key) {
+			return builder->definitions[slot].value;
+		}
+		if(builder->definitions[slot].key == UINT64_MAX) {
+			return GRUG_IR_NONE;
+		}
+	}
+}
+
+static grug_ir_value read_variable(struct ir_builder* builder, uint32_t variable, grug_ir_block_id block);
+
+/// Returns the one value other than itself that flows into the phi, or the phi if there are several
+static grug_ir_value try_remove_trivial_phi(struct ir_builder* builder, grug_ir_value phi) {
+	struct grug_ir_function const* function = builder->function;
+	struct grug_ir_instr const* instr = &function->instrs[phi];
+	grug_ir_value same = GRUG_IR_NONE;
+	for(uint32_t index = 0; index < instr->operands_len; index += 1) {
+		grug_ir_value operand = resolve_trivial_phi(builder, grug_ir_operand(function, instr, index));
+		if(operand == same || operand == phi) {
+			continue;
+		}
+		if(same != GRUG_IR_NONE) {
+			return phi;
+		}
+		same = operand;
+	}
+	// A phi without operands is in a block that can't be reached, which dead branch elimination removes
+	if(same == GRUG_IR_NONE) {
+		return phi;
+	}
+	grow_replacements(builder);
+	if(builder->ir->failed) {
+		return phi;
+	}
+	builder->replacements[phi] = same;
+	return same;
+}
+
+static grug_ir_value add_phi_operands(struct ir_builder* builder, uint32_t variable, grug_ir_value phi) {
+	if(builder->ir->failed) {
+		return phi;
+	}
+	struct grug_ir_function* function = builder->function;
+	grug_ir_block_id block = function->instrs[phi].block;
+	uint32_t preds_len = function->blocks[block].preds_len;
+	// Reading the predecessors can add more phis, so the operands are reserved up front to keep them contiguous
+	uint32_t start = reserve_operands(builder->ir, function, preds_len);
+	if(builder->ir->failed) {
+		return phi;
+	}
+	function->instrs[phi].operands_start = start;
+	function->instrs[phi].operands_len = preds_len;
+	for(uint32_t index = 0; index < preds_len; index += 1) {
+		function->operands[start + index] = GRUG_IR_NONE;
+	}
+	for(uint32_t index = 0; index < preds_len; index += 1) {
+		grug_ir_value value = read_variable(builder, variable, function->blocks[block].preds[index]);
+		if(builder->ir->failed) {
+			return phi;
+		}
+		function->operands[start + index] = value;
+	}
+	return try_remove_trivial_phi(builder, phi);
+}
+
+static grug_ir_value read_variable_recursive(struct ir_builder* builder, uint32_t variable, grug_ir_block_id block) {
+	struct grug_ir* ir = builder->ir;
+	struct grug_ir_function* function = builder->function;
+	uint8_t type = builder->variable_types[variable];
+	grug_ir_value value;
+	if(!builder->sealed[block]) {
+		value = add_instr(ir, function, block, GRUG_IR_PHI, type, NULL, 0);
+		if(ir_reserve(ir, (void**)&builder->incomplete_phis, builder->incomplete_phis_len, 1, &builder->incomplete_phis_capacity, sizeof(struct ir_incomplete_phi))) {
+			builder->incomplete_phis[builder->incomplete_phis_len++] = (struct ir_incomplete_phi) {.block = block, .variable = variable, .phi = value};
+		}
+	} else if(function->blocks[block].preds_len == 1) {
+		value = read_variable(builder, variable, function->blocks[block].preds[0]);
+	} else if(function->blocks[block].preds_len == 0) {
+		// Only code that can't be reached, like the code after a return, has no predecessors, so any value will do
+		value = add_instr(ir, function, block, GRUG_IR_CONST, type, NULL, 0);
+		if(value != GRUG_IR_NONE) {
+			function->instrs[value].data.constant = (union grug_value) {0};
+		}
+	} else {
+		// Writing the phi first ends the search when it loops back to this block
+		value = add_instr(ir, function, block, GRUG_IR_PHI, type, NULL, 0);
+		write_variable(builder, variable, block, value);
+		value = add_phi_operands(builder, variable, value);
+	}
+	write_variable(builder, variable, block, value);
+	return value;
+}
+
+static grug_ir_value read_variable(struct ir_builder* builder, uint32_t variable, grug_ir_block_id block) {
+	if(builder->ir->failed) {
+		return GRUG_IR_NONE;
+	}
+	grug_ir_value value = find_definition(builder, variable, block);
+	if(value != GRUG_IR_NONE) {
+		return resolve_trivial_phi(builder, value);
+	}
+	return read_variable_recursive(builder, variable, block);
+}
+
+/// Called once all predecessors of a block are known
+static void seal_block(struct ir_builder* builder, grug_ir_block_id block) {
+	if(builder->ir->failed) {
+		return;
+	}
+	// Filling in a phi can add incomplete phis for other blocks, but never for this one
+	for(uint32_t index = 0; index < builder->incomplete_phis_len; index += 1) {
+		struct ir_incomplete_phi incomplete = builder->incomplete_phis[index];
+		if(incomplete.block == block) {
+			add_phi_operands(builder, incomplete.variable, incomplete.phi);
+		}
+	}
+	uint32_t kept = 0;
+	for(uint32_t index = 0; index < builder->incomplete_phis_len; index += 1) {
+		if(builder->incomplete_phis[index].block != block) {
+			builder->incomplete_phis[kept++] = builder->incomplete_phis[index];
+		}
+	}
+	builder->incomplete_phis_len = kept;
+	builder->sealed[block] = true;
+}
+
+/// Continues in a new block without predecessors, for the code after a return, break or continue
+static void build_unreachable_block(struct ir_builder* builder) {
+	builder->block = build_block(builder);
+	seal_block(builder, builder->block);
+}
+
+static uint32_t new_variable(struct ir_builder* builder, char const* name, uint8_t type) {
+	if(!ir_reserve(builder->ir, (void**)&builder->variable_types, builder->variables_len, 1, &builder->variables_capacity, sizeof(uint8_t))
+	|| !ir_reserve(builder->ir, (void**)&builder->locals, builder->locals_len, 1, &builder->locals_capacity, sizeof(struct ir_local))) {
+		return GRUG_IR_NONE;
+	}
+	builder->variable_types[builder->variables_len] = type;
+	builder->locals[builder->locals_len++] = (struct ir_local) {.name = name, .variable = builder->variables_len};
+	return builder->variables_len++;
+}
+
+/// Returns the variable of the local variable or argument `name`, or GRUG_IR_NONE if there is none
+static uint32_t find_local(struct ir_builder const* builder, char const* name) {
+	for(uint32_t index = builder->locals_len; index > 0; index -= 1) {
+		if(strcmp(builder->locals[index - 1].name, name) == 0) {
+			return builder->locals[index - 1].variable;
+		}
+	}
+	return GRUG_IR_NONE;
+}
+
+/// Returns the index of the member variable `name`, or GRUG_IR_NONE if there is none
+static uint32_t find_member(struct ir_builder const* builder, char const* name) {
+	for(uint32_t index = 0; index < builder->members_len; index += 1) {
+		if(strcmp(builder->ast->members[index].name, name) == 0) {
+			return index;
+		}
+	}
+	return GRUG_IR_NONE;
+}
+
+static grug_ir_value build_expr(struct ir_builder* builder, struct grug_expr const* expr);
+
+static grug_ir_value build_call(struct ir_builder* builder, struct grug_expr const* call) {
+	uint32_t args_start = builder->args_len;
+	for(size_t arg_index = 0; arg_index < call->expr_data.call.args_count; arg_index += 1) {
+		grug_ir_value arg = build_expr(builder, &call->expr_data.call.args[arg_index]);
+		if(!ir_reserve(builder->ir, (void**)&builder->args, builder->args_len, 1, &builder->args_capacity, sizeof(grug_ir_value))) {
+			return GRUG_IR_NONE;
+		}
+		builder->args[builder->args_len++] = arg;
+	}
+	uint32_t args_len = builder->args_len - args_start;
+	uint8_t type = (uint8_t)call->result_type.type;
+	grug_ir_value value;
+	if(call->expr_data.call.game_fn_ptr) {
+		value = build_instr(builder, GRUG_IR_CALL_GAME, type, builder->args + args_start, args_len);
+		if(value != GRUG_IR_NONE) {
+			builder->function->instrs[value].data.game_fn.fn = call->expr_data.call.game_fn_ptr;
+			builder->function->instrs[value].data.game_fn.data = call->expr_data.call.game_fn_data;
+		}
+	} else {
+		value = build_indexed(builder, GRUG_IR_CALL_HELPER, type, (uint32_t)call->expr_data.call.helper_fn_index, builder->args + args_start, args_len);
+	}
+	builder->args_len = args_start;
+	return value;
+}
+
+/// `and` and `or` only evaluate their right operand if the left one didn't decide the result
+static grug_ir_value build_short_circuit(struct ir_builder* builder, struct grug_expr const* expr) {
+	bool is_and = expr->expr_data.binary.op == GRUG_BINARY_AND;
+	grug_ir_value left = build_expr(builder, expr->expr_data.binary.left);
+	grug_ir_block_id right_block = build_block(builder);
+	grug_ir_block_id merge = build_block(builder);
+	terminate(builder, GRUG_IR_BRANCH, left, is_and ? right_block : merge, is_and ? merge : right_block);
+	seal_block(builder, right_block);
+	builder->block = right_block;
+	grug_ir_value right = build_expr(builder, expr->expr_data.binary.right);
+	terminate(builder, GRUG_IR_JUMP, GRUG_IR_NONE, merge, GRUG_IR_NONE);
+	seal_block(builder, merge);
+	builder->block = merge;
+	// The block with the left operand branched to the merge before the right operand jumped to it
+	grug_ir_value operands[2] = {left, right};
+	return build_instr(builder, GRUG_IR_PHI, GRUG_TYPE_BOOL, operands, 2);
+}
+
+static grug_ir_value build_binary(struct ir_builder* builder, struct grug_expr const* expr) {
+	grug_binary_operator op = expr->expr_data.binary.op;
+	if(op == GRUG_BINARY_AND || op == GRUG_BINARY_OR) {
+		return build_short_circuit(builder, expr);
+	}
+	grug_ir_value operands[2];
+	operands[0] = build_expr(builder, expr->expr_data.binary.left);
+	operands[1] = build_expr(builder, expr->expr_data.binary.right);
+	grug_ir_op ir_op;
+	switch(op) {
+		case GRUG_BINARY_DOUBLEEQUALS: ir_op = GRUG_IR_EQ; break;
+		case GRUG_BINARY_NOTEQUALS: ir_op = GRUG_IR_NE; break;
+		case GRUG_BINARY_GREATER: ir_op = GRUG_IR_GT; break;
+		case GRUG_BINARY_GREATEREQUALS: ir_op = GRUG_IR_GE; break;
+		case GRUG_BINARY_LESS: ir_op = GRUG_IR_LT; break;
+		case GRUG_BINARY_LESSEQUALS: ir_op = GRUG_IR_LE; break;
+		case GRUG_BINARY_PLUS: ir_op = GRUG_IR_ADD; break;
+		case GRUG_BINARY_MINUS: ir_op = GRUG_IR_SUB; break;
+		case GRUG_BINARY_MULTIPLY: ir_op = GRUG_IR_MUL; break;
+		case GRUG_BINARY_DIVISION: ir_op = GRUG_IR_DIV; break;
+		default:
+			// The parser never produces a remainder, since grug has no '%' token
+			builder->ir->failed = true;
+			return GRUG_IR_NONE;
+	}
+	uint8_t type = ir_op >= GRUG_IR_EQ ? GRUG_TYPE_BOOL : GRUG_TYPE_NUMBER;
+	return build_instr(builder, ir_op, type, operands, 2);
+}
+
+static grug_ir_value build_identifier(struct ir_builder* builder, struct grug_expr const* expr) {
+	char const* name = expr->expr_data.identifier_name;
+	uint32_t variable = find_local(builder, name);
+	if(variable != GRUG_IR_NONE) {
+		return read_variable(builder, variable, builder->block);
+	}
+	uint32_t member = find_member(builder, name);
+	if(member != GRUG_IR_NONE) {
+		return build_indexed(builder, GRUG_IR_LOAD_MEMBER, (uint8_t)builder->ast->members[member].type.type, member, NULL, 0);
+	}
+	if(strcmp(name, "me") == 0) {
+		return build_instr(builder, GRUG_IR_ME, GRUG_TYPE_ID, NULL, 0);
+	}
+	// The type checker rules this out
+	builder->ir->failed = true;
+	return GRUG_IR_NONE;
+}
+
+static grug_ir_value build_expr(struct ir_builder* builder, struct grug_expr const* expr) {
+	if(builder->ir->failed) {
+		return GRUG_IR_NONE;
+	}
+	union grug_value constant = {0};
+	switch(expr->type) {
+		case GRUG_EXPR_TYPE_TRUE:
+		case GRUG_EXPR_TYPE_FALSE:
+			constant._bool = expr->type == GRUG_EXPR_TYPE_TRUE;
+			return build_const(builder, GRUG_TYPE_BOOL, constant);
+		case GRUG_EXPR_TYPE_STRING:
+		case GRUG_EXPR_TYPE_RESOURCE:
+		case GRUG_EXPR_TYPE_ENTITY: {
+			// The three share the same union member
+			constant._string = expr->expr_data.string;
+			grug_type_type type = expr->result_type.type;
+			if(type == GRUG_TYPE_VOID) {
+				type = expr->type == GRUG_EXPR_TYPE_STRING ? GRUG_TYPE_STRING : expr->type == GRUG_EXPR_TYPE_RESOURCE ? GRUG_TYPE_RESOURCE : GRUG_TYPE_ENTITY;
+			}
+			return build_const(builder, (uint8_t)type, constant);
+		}
+		case GRUG_EXPR_TYPE_NUMBER:
+			constant._number = expr->expr_data.number.value;
+			return build_const(builder, GRUG_TYPE_NUMBER, constant);
+		case GRUG_EXPR_TYPE_IDENTIFIER:
+			return build_identifier(builder, expr);
+		case GRUG_EXPR_TYPE_UNARY: {
+			grug_ir_value inner = build_expr(builder, expr->expr_data.unary.inner);
+			if(expr->expr_data.unary.op == GRUG_UNARY_NOT) {
+				return build_instr(builder, GRUG_IR_NOT, GRUG_TYPE_BOOL, &inner, 1);
+			}
+			return build_instr(builder, GRUG_IR_NEG, GRUG_TYPE_NUMBER, &inner, 1);
+		}
+		case GRUG_EXPR_TYPE_BINARY:
+			return build_binary(builder, expr);
+		case GRUG_EXPR_TYPE_CALL:
+			return build_call(builder, expr);
+		case GRUG_EXPR_TYPE_PARENTHESIZED:
+			return build_expr(builder, expr->expr_data.parenthesized);
+		default:
+			builder->ir->failed = true;
+			return GRUG_IR_NONE;
+	}
+}
+
+static void build_statements(struct ir_builder* builder, struct grug_block const* block);
+
+static void build_if(struct ir_builder* builder, struct grug_statement const* statement) {
+	grug_ir_block_id merge = build_block(builder);
+	size_t branches_len = 1 + statement->statement_data.if_stmt.additional_branches_len;
+	for(size_t branch_index = 0; branch_index < branches_len; branch_index += 1) {
+		struct grug_if_branch const* branch = branch_index == 0 ? &statement->statement_data.if_stmt.branch : &statement->statement_data.if_stmt.additional_branches[branch_index - 1];
+		grug_ir_value cond = build_expr(builder, &branch->cond);
+		grug_ir_block_id then_block = build_block(builder);
+		grug_ir_block_id next_block = build_block(builder);
+		terminate(builder, GRUG_IR_BRANCH, cond, then_block, next_block);
+		seal_block(builder, then_block);
+		builder->block = then_block;
+		build_statements(builder, &branch->block);
+		terminate(builder, GRUG_IR_JUMP, GRUG_IR_NONE, merge, GRUG_IR_NONE);
+		seal_block(builder, next_block);
+		builder->block = next_block;
+	}
+	build_statements(builder, &statement->statement_data.if_stmt.else_block);
+	terminate(builder, GRUG_IR_JUMP, GRUG_IR_NONE, merge, GRUG_IR_NONE);
+	seal_block(builder, merge);
+	builder->block = merge;
+}
+
+static void build_while(struct ir_builder* builder, struct grug_statement const* statement) {
+	struct grug_ir* ir = builder->ir;
+	struct grug_ir_function* function = builder->function;
+	uint32_t outer_loop = builder->loop;
+	grug_ir_block_id outer_header = builder->loop_header;
+	grug_ir_block_id outer_exit = builder->loop_exit;
+
+	grug_ir_block_id preheader = build_block(builder);
+	terminate(builder, GRUG_IR_JUMP, GRUG_IR_NONE, preheader, GRUG_IR_NONE);
+	seal_block(builder, preheader);
+	builder->block = preheader;
+	if(!ir_reserve(ir, (void**)&function->loops, function->loops_len, 1, &function->loops_capacity, sizeof(struct grug_ir_loop))) {
+		return;
+	}
+	uint32_t loop = function->loops_len++;
+	builder->loop = loop;
+	grug_ir_block_id header = build_block(builder);
+	grug_ir_block_id exit = build_block_in_loop(builder, outer_loop);
+	function->loops[loop] = (struct grug_ir_loop) {.header = header, .preheader = preheader, .parent = outer_loop};
+	terminate(builder, GRUG_IR_JUMP, GRUG_IR_NONE, header, GRUG_IR_NONE);
+	builder->loop_header = header;
+	builder->loop_exit = exit;
+
+	// The header stays unsealed until the end of the body and every continue have jumped back to it
+	builder->block = header;
+	grug_ir_value cond = build_expr(builder, &statement->statement_data.while_stmt.condition);
+	grug_ir_block_id body = build_block(builder);
+	terminate(builder, GRUG_IR_BRANCH, cond, body, exit);
+	seal_block(builder, body);
+	builder->block = body;
+	build_statements(builder, &statement->statement_data.while_stmt.block);
+	terminate(builder, GRUG_IR_JUMP, GRUG_IR_NONE, header, GRUG_IR_NONE);
+	seal_block(builder, header);
+
+	builder->loop = outer_loop;
+	builder->loop_header = outer_header;
+	builder->loop_exit = outer_exit;
+	seal_block(builder, exit);
+	builder->block = exit;
+}
+
+static void build_statement(struct ir_builder* builder, struct grug_statement const* statement) {
+	switch(statement->type) {
+		case GRUG_STATEMENT_VARIABLE: {
+			char const* name = statement->statement_data.variable.name;
+			// The value is built first, so it can't see the variable it declares
+			grug_ir_value value = build_expr(builder, &statement->statement_data.variable.assignment_expr);
+			grug_type_type declared_type = statement->statement_data.variable.type.type;
+			uint32_t variable = declared_type != GRUG_TYPE_VOID ? new_variable(builder, name, (uint8_t)declared_type) : find_local(builder, name);
+			if(variable != GRUG_IR_NONE) {
+				write_variable(builder, variable, builder->block, value);
+				break;
+			}
+			uint32_t member = find_member(builder, name);
+			if(member == GRUG_IR_NONE) {
+				builder->ir->failed = true;
+				break;
+			}
+			build_indexed(builder, GRUG_IR_STORE_MEMBER, GRUG_TYPE_VOID, member, &value, 1);
+			break;
+		}
+		case GRUG_STATEMENT_CALL:
+			build_call(builder, &statement->statement_data.call);
+			break;
+		case GRUG_STATEMENT_IF:
+			build_if(builder, statement);
+			break;
+		case GRUG_STATEMENT_WHILE:
+			build_while(builder, statement);
+			break;
+		case GRUG_STATEMENT_RETURN: {
+			grug_ir_value value = GRUG_IR_NONE;
+			if(statement->statement_data.return_stmt.expr.type != GRUG_EXPR_TYPE_NOTHING) {
+				value = build_expr(builder, &statement->statement_data.return_stmt.expr);
+			}
+			terminate(builder, GRUG_IR_RETURN, value, GRUG_IR_NONE, GRUG_IR_NONE);
+			build_unreachable_block(builder);
+			break;
+		}
+		case GRUG_STATEMENT_BREAK:
+			terminate(builder, GRUG_IR_JUMP, GRUG_IR_NONE, builder->loop_exit, GRUG_IR_NONE);
+			build_unreachable_block(builder);
+			break;
+		case GRUG_STATEMENT_CONTINUE:
+			terminate(builder, GRUG_IR_JUMP, GRUG_IR_NONE, builder->loop_header, GRUG_IR_NONE);
+			build_unreachable_block(builder);
+			break;
+		default:
+			break;
+	}
+}
+
+static void build_statements(struct ir_builder* builder, struct grug_block const* block) {
+	uint32_t locals_len = builder->locals_len;
+	for(size_t statement_index = 0; statement_index < block->statements_len && !builder->ir->failed; statement_index += 1) {
+		build_statement(builder, &block->statements[statement_index]);
+	}
+	builder->locals_len = locals_len;
+}
+
+static void apply_replacements(struct grug_ir_function* function, grug_ir_value const* replacements, uint32_t replacements_len);
+
+static void begin_function(struct ir_builder* builder, struct grug_ir_function* function, struct grug_argument const* arguments, size_t arguments_len) {
+	builder->function = function;
+	function->defined = true;
+	function->params_len = (uint32_t)arguments_len;
+	builder->locals_len = 0;
+	builder->variables_len = 0;
+	builder->incomplete_phis_len = 0;
+	builder->replacements_len = 0;
+	builder->args_len = 0;
+	for(uint32_t index = 0; index < builder->definitions_capacity; index += 1) {
+		builder->definitions[index].key = UINT64_MAX;
+	}
+	builder->definitions_len = 0;
+	builder->loop = GRUG_IR_NONE;
+	builder->loop_header = GRUG_IR_NONE;
+	builder->loop_exit = GRUG_IR_NONE;
+
+	builder->block = build_block(builder);
+	seal_block(builder, builder->block);
+	for(size_t argument_index = 0; argument_index < arguments_len; argument_index += 1) {
+		uint8_t type = (uint8_t)arguments[argument_index].type.type;
+		grug_ir_value param = build_indexed(builder, GRUG_IR_PARAM, type, (uint32_t)argument_index, NULL, 0);
+		write_variable(builder, new_variable(builder, arguments[argument_index].name, type), builder->block, param);
+	}
+}
+
+static void end_function(struct ir_builder* builder) {
+	terminate(builder, GRUG_IR_RETURN, GRUG_IR_NONE, GRUG_IR_NONE, GRUG_IR_NONE);
+	grow_replacements(builder);
+	if(!builder->ir->failed) {
+		apply_replacements(builder->function, builder->replacements, builder->replacements_len);
+	}
+}
+
+static void build_member_initializers(struct ir_builder* builder) {
+	begin_function(builder, &builder->ir->init, NULL, 0);
+	for(size_t member_index = 0; member_index < builder->ast->members_count && !builder->ir->failed; member_index += 1) {
+		builder->members_len = (uint32_t)member_index;
+		grug_ir_value value = build_expr(builder, &builder->ast->members[member_index].assignment_expr);
+		build_indexed(builder, GRUG_IR_STORE_MEMBER, GRUG_TYPE_VOID, (uint32_t)member_index, &value, 1);
+	}
+	builder->members_len = (uint32_t)builder->ast->members_count;
+	end_function(builder);
+}
+
+static void free_builder(struct ir_builder* builder) {
+	if(builder->locals) {
+		GRUG_FREE(builder->locals, builder->locals_capacity * sizeof(struct ir_local));
+	}
+	if(builder->variable_types) {
+		GRUG_FREE(builder->variable_types, builder->variables_capacity * sizeof(uint8_t));
+	}
+	if(builder->definitions) {
+		GRUG_FREE(builder->definitions, builder->definitions_capacity * sizeof(struct ir_definition));
+	}
+	if(builder->incomplete_phis) {
+		GRUG_FREE(builder->incomplete_phis, builder->incomplete_phis_capacity * sizeof(struct ir_incomplete_phi));
+	}
+	if(builder->sealed) {
+		GRUG_FREE(builder->sealed, builder->sealed_capacity * sizeof(bool));
+	}
+	if(builder->replacements) {
+		GRUG_FREE(builder->replacements, builder->replacements_capacity * sizeof(grug_ir_value));
+	}
+	if(builder->args) {
+		GRUG_FREE(builder->args, builder->args_capacity * sizeof(grug_ir_value));
+	}
+}
+
+void grug_ir_from_ast(struct grug_ir* ir, struct grug_ast const* ast) {
+	*ir = (struct grug_ir) {.members_len = (uint32_t)ast->members_count};
+	if(ast->helper_functions_count) {
+		ir->helpers = GRUG_MALLOC(ast->helper_functions_count * sizeof(struct grug_ir_function));
+		if(!ir->helpers) {
+			ir->failed = true;
+			return;
+		}
+		memset(ir->helpers, 0, ast->helper_functions_count * sizeof(struct grug_ir_function));
+		ir->helpers_len = (uint32_t)ast->helper_functions_count;
+	}
+	uint32_t on_fns_len = 0;
+	for(size_t on_fn_index = 0; on_fn_index < ast->on_functions_count; on_fn_index += 1) {
+		if(ast->on_functions[on_fn_index].on_fn_index >= on_fns_len) {
+			on_fns_len = (uint32_t)ast->on_functions[on_fn_index].on_fn_index + 1;
+		}
+	}
+	if(on_fns_len) {
+		ir->on_fns = GRUG_MALLOC(on_fns_len * sizeof(struct grug_ir_function));
+		if(!ir->on_fns) {
+			ir->failed = true;
+			return;
+		}
+		memset(ir->on_fns, 0, on_fns_len * sizeof(struct grug_ir_function));
+		ir->on_fns_len = on_fns_len;
+	}
+
+	struct ir_builder builder = {.ir = ir, .ast = ast};
+	build_member_initializers(&builder);
+	for(uint32_t helper_index = 0; helper_index < ir->helpers_len && !ir->failed; helper_index += 1) {
+		struct grug_helper_function const* helper = &ast->helper_function[helper_index];
+		begin_function(&builder, &ir->helpers[helper_index], helper->arguments, helper->arguments_len);
+		build_statements(&builder, &helper->block);
+		end_function(&builder);
+	}
+	for(size_t on_fn_index = 0; on_fn_index < ast->on_functions_count && !ir->failed; on_fn_index += 1) {
+		struct grug_on_function const* on_fn = &ast->on_functions[on_fn_index];
+		begin_function(&builder, &ir->on_fns[on_fn->on_fn_index], on_fn->arguments, on_fn->arguments_len);
+		build_statements(&builder, &on_fn->block);
+		end_function(&builder);
+	}
+	free_builder(&builder);
+}
+
+// MARK: passes
+
+static bool has_side_effects(grug_ir_op op) {
+	return op == GRUG_IR_STORE_MEMBER || op == GRUG_IR_CALL_HELPER || op == GRUG_IR_CALL_GAME;
+}
+
+/// Whether evaluating the instruction twice, or earlier than written, gives the same value.
+/// Loads are too, as long as nothing writes members in between.
+static bool is_pure_expression(grug_ir_op op) {
+	switch(op) {
+		case GRUG_IR_CONST:
+		case GRUG_IR_ME:
+		case GRUG_IR_LOAD_MEMBER:
+		case GRUG_IR_NOT:
+		case GRUG_IR_NEG:
+		case GRUG_IR_ADD:
+		case GRUG_IR_SUB:
+		case GRUG_IR_MUL:
+		case GRUG_IR_DIV:
+		case GRUG_IR_EQ:
+		case GRUG_IR_NE:
+		case GRUG_IR_LT:
+		case GRUG_IR_LE:
+		case GRUG_IR_GT:
+		case GRUG_IR_GE:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static grug_ir_value resolve_replacement(grug_ir_value const* replacements, grug_ir_value value) {
+	while(value != GRUG_IR_NONE && replacements[value] != GRUG_IR_NONE) {
+		value = replacements[value];
+	}
+	return value;
+}
+
+/// Rewrites every use of a replaced value to its replacement, and removes the replaced instructions
+static void apply_replacements(struct grug_ir_function* function, grug_ir_value const* replacements, uint32_t replacements_len) {
+	(void)replacements_len;
+	for(grug_ir_block_id block_id = 0; block_id < function->blocks_len; block_id += 1) {
+		struct grug_ir_block* block = &function->blocks[block_id];
+		for(uint32_t index = 0; index < block->instrs_len; index += 1) {
+			struct grug_ir_instr const* instr = &function->instrs[block->instrs[index]];
+			for(uint32_t operand_index = 0; operand_index < instr->operands_len; operand_index += 1) {
+				grug_ir_value* operand = &function->operands[instr->operands_start + operand_index];
+				*operand = resolve_replacement(replacements, *operand);
+			}
+		}
+		block->value = resolve_replacement(replacements, block->value);
+	}
+	for(grug_ir_value value = 0; value < function->instrs_len; value += 1) {
+		if(replacements[value] != GRUG_IR_NONE) {
+			function->instrs[value].block = GRUG_IR_NONE;
+		}
+	}
+	compact_blocks(function);
+}
+
+static grug_ir_value* new_replacements(struct grug_ir* ir, struct grug_ir_function const* function) {
+	grug_ir_value* replacements = ir_alloc_scratch(ir, function->instrs_len, sizeof(grug_ir_value));
+	if(replacements) {
+		for(grug_ir_value value = 0; value <= function->instrs_len; value += 1) {
+			replacements[value] = GRUG_IR_NONE;
+		}
+	}
+	return replacements;
+}
+
+static bool is_const(struct grug_ir_function const* function, grug_ir_value value) {
+	return function->instrs[value].op == GRUG_IR_CONST;
+}
+
+static union grug_value const_of(struct grug_ir_function const* function, grug_ir_value value) {
+	return function->instrs[value].data.constant;
+}
+
+/// Compares two constants of `type` like the backends do at runtime. Returns false if they can't be compared at compile time.
+static bool fold_comparison(grug_ir_op op, uint8_t type, union grug_value left, union grug_value right, bool* out_result) {
+	int order;
+	switch(type) {
+		case GRUG_TYPE_NUMBER:
+			switch(op) {
+				case GRUG_IR_EQ: *out_result = left._number == right._number; return true;
+				case GRUG_IR_NE: *out_result = left._number != right._number; return true;
+				case GRUG_IR_LT: *out_result = left._number < right._number; return true;
+				case GRUG_IR_LE: *out_result = left._number <= right._number; return true;
+				case GRUG_IR_GT: *out_result = left._number > right._number; return true;
+				default: *out_result = left._number >= right._number; return true;
+			}
+		case GRUG_TYPE_BOOL:
+			order = (int)left._bool - (int)right._bool;
+			break;
+		case GRUG_TYPE_STRING:
+		case GRUG_TYPE_RESOURCE:
+		case GRUG_TYPE_ENTITY:
+			order = strcmp(left._string, right._string);
+			break;
+		default:
+			return false;
+	}
+	if(op == GRUG_IR_EQ) {
+		*out_result = order == 0;
+		return true;
+	}
+	if(op == GRUG_IR_NE) {
+		*out_result = order != 0;
+		return true;
+	}
+	return false;
+}
+
+static bool same_constant(union grug_value left, union grug_value right) {
+	return memcmp(&left, &right, sizeof(union grug_value)) == 0;
+}
+
+/// Turns the instruction into a constant if its operands are constants
+static bool fold_instr(struct grug_ir_function* function, grug_ir_value value) {
+	struct grug_ir_instr* instr = &function->instrs[value];
+	union grug_value result = {0};
+	if(instr->op == GRUG_IR_PHI) {
+		// A phi that gets the same constant from every side, like a variable set to 1 in both branches of an if
+		if(!instr->operands_len) {
+			return false;
+		}
+		grug_ir_value first = grug_ir_operand(function, instr, 0);
+		for(uint32_t index = 0; index < instr->operands_len; index += 1) {
+			grug_ir_value operand = grug_ir_operand(function, instr, index);
+			if(!is_const(function, operand) || !same_constant(const_of(function, operand), const_of(function, first))) {
+				return false;
+			}
+		}
+		result = const_of(function, first);
+	} else if(instr->op == GRUG_IR_NOT || instr->op == GRUG_IR_NEG) {
+		grug_ir_value operand = grug_ir_operand(function, instr, 0);
+		if(!is_const(function, operand)) {
+			return false;
+		}
+		if(instr->op == GRUG_IR_NOT) {
+			result._bool = !const_of(function, operand)._bool;
+		} else {
+			result._number = -const_of(function, operand)._number;
+		}
+	} else if(instr->op >= GRUG_IR_ADD && instr->op <= GRUG_IR_GE) {
+		grug_ir_value left = grug_ir_operand(function, instr, 0);
+		grug_ir_value right = grug_ir_operand(function, instr, 1);
+		if(!is_const(function, left) || !is_const(function, right)) {
+			return false;
+		}
+		double left_number = const_of(function, left)._number;
+		double right_number = const_of(function, right)._number;
+		switch(instr->op) {
+			case GRUG_IR_ADD: result._number = left_number + right_number; break;
+			case GRUG_IR_SUB: result._number = left_number - right_number; break;
+			case GRUG_IR_MUL: result._number = left_number * right_number; break;
+			case GRUG_IR_DIV: result._number = left_number / right_number; break;
+			default: {
+				bool compared;
+				if(!fold_comparison(instr->op, function->instrs[left].type, const_of(function, left), const_of(function, right), &compared)) {
+					return false;
+				}
+				result._bool = compared;
+				break;
+			}
+		}
+	} else {
+		return false;
+	}
+	instr->op = GRUG_IR_CONST;
+	instr->operands_len = 0;
+	instr->data.constant = result;
+	return true;
+}
+
+static bool fold_constants(struct grug_ir* ir, struct grug_ir_function* function) {
+	grug_ir_block_id* order = ir_alloc_scratch(ir, function->blocks_len, sizeof(grug_ir_block_id));
+	if(!order) {
+		return false;
+	}
+	// Dominators first, so the operands of an instruction are folded before it
+	uint32_t order_len = grug_ir_reverse_postorder(ir, function, order);
+	bool changed = false;
+	for(uint32_t order_index = 0; order_index < order_len; order_index += 1) {
+		struct grug_ir_block const* block = &function->blocks[order[order_index]];
+		for(uint32_t index = 0; index < block->instrs_len; index += 1) {
+			changed |= fold_instr(function, block->instrs[index]);
+		}
+	}
+	ir_free_scratch(order, function->blocks_len, sizeof(grug_ir_block_id));
+	return changed;
+}
+
+static bool eliminate_dead_branches(struct grug_ir* ir, struct grug_ir_function* function) {
+	bool changed = false;
+	for(grug_ir_block_id block_id = 0; block_id < function->blocks_len; block_id += 1) {
+		struct grug_ir_block* block = &function->blocks[block_id];
+		if(block->dead || block->terminator != GRUG_IR_BRANCH) {
+			continue;
+		}
+		grug_ir_block_id kept;
+		grug_ir_block_id dropped;
+		if(block->targets[0] == block->targets[1]) {
+			kept = dropped = block->targets[0];
+		} else if(is_const(function, block->value)) {
+			bool taken = const_of(function, block->value)._bool;
+			kept = block->targets[taken ? 0 : 1];
+			dropped = block->targets[taken ? 1 : 0];
+		} else {
+			continue;
+		}
+		block->terminator = GRUG_IR_JUMP;
+		block->value = GRUG_IR_NONE;
+		block->targets[0] = kept;
+		block->targets[1] = GRUG_IR_NONE;
+		remove_pred(function, dropped, block_id);
+		changed = true;
+	}
+
+	bool* reachable = ir_alloc_scratch(ir, function->blocks_len, sizeof(bool));
+	grug_ir_block_id* order = ir_alloc_scratch(ir, function->blocks_len, sizeof(grug_ir_block_id));
+	if(reachable && order) {
+		memset(reachable, 0, function->blocks_len * sizeof(bool));
+		uint32_t order_len = grug_ir_reverse_postorder(ir, function, order);
+		for(uint32_t index = 0; index < order_len; index += 1) {
+			reachable[order[index]] = true;
+		}
+		for(grug_ir_block_id block_id = 0; block_id < function->blocks_len && !ir->failed; block_id += 1) {
+			struct grug_ir_block* block = &function->blocks[block_id];
+			if(reachable[block_id] || block->dead) {
+				continue;
+			}
+			grug_ir_block_id targets[2];
+			uint32_t targets_len = successors(block, targets);
+			for(uint32_t target_index = 0; target_index < targets_len; target_index += 1) {
+				remove_pred(function, targets[target_index], block_id);
+			}
+			for(uint32_t index = 0; index < block->instrs_len; index += 1) {
+				function->instrs[block->instrs[index]].block = GRUG_IR_NONE;
+			}
+			block->instrs_len = 0;
+			block->preds_len = 0;
+			block->terminator = GRUG_IR_RETURN;
+			block->value = GRUG_IR_NONE;
+			block->dead = true;
+			changed = true;
+		}
+	}
+	ir_free_scratch(reachable, function->blocks_len, sizeof(bool));
+	ir_free_scratch(order, function->blocks_len, sizeof(grug_ir_block_id));
+	return changed;
+}
+
+static bool propagate_copies(struct grug_ir* ir, struct grug_ir_function* function) {
+	grug_ir_value* replacements = new_replacements(ir, function);
+	if(!replacements) {
+		return false;
+	}
+	bool changed = false;
+	// Replacing one phi can make another one trivial, like the phis of a loop nested in another loop
+	for(bool replaced = true; replaced;) {
+		replaced = false;
+		for(grug_ir_value value = 0; value < function->instrs_len; value += 1) {
+			struct grug_ir_instr const* instr = &function->instrs[value];
+			if(instr->block == GRUG_IR_NONE || replacements[value] != GRUG_IR_NONE) {
+				continue;
+			}
+			grug_ir_value same = GRUG_IR_NONE;
+			if(instr->op == GRUG_IR_COPY) {
+				same = resolve_replacement(replacements, grug_ir_operand(function, instr, 0));
+			} else if(instr->op == GRUG_IR_PHI) {
+				for(uint32_t index = 0; index < instr->operands_len; index += 1) {
+					grug_ir_value operand = resolve_replacement(replacements, grug_ir_operand(function, instr, index));
+					if(operand == value || operand == same) {
+						continue;
+					}
+					if(same != GRUG_IR_NONE) {
+						same = GRUG_IR_NONE;
+						break;
+					}
+					same = operand;
+				}
+			}
+			if(same != GRUG_IR_NONE && same != value) {
+				replacements[value] = same;
+				replaced = true;
+				changed = true;
+			}
+		}
+	}
+	if(changed) {
+		apply_replacements(function, replacements, function->instrs_len);
+	}
+	ir_free_scratch(replacements, function->instrs_len, sizeof(grug_ir_value));
+	return changed;
+}
+
+static uint32_t hash_instr(struct grug_ir_function const* function, grug_ir_value const* replacements, struct grug_ir_instr const* instr, uint32_t epoch) {
+	uint32_t hash = 2166136261U;
+	uint32_t words[4] = {instr->op, instr->type, 0, 0};
+	if(instr->op == GRUG_IR_CONST) {
+		uint64_t bits;
+		memcpy(&bits, &instr->data.constant, sizeof(bits));
+		words[2] = (uint32_t)bits;
+		words[3] = (uint32_t)(bits >> 32);
+	} else if(instr->op == GRUG_IR_LOAD_MEMBER) {
+		words[2] = instr->data.index;
+		words[3] = epoch;
+	}
+	for(uint32_t index = 0; index < 4; index += 1) {
+		hash = (hash ^ words[index]) * 16777619U;
+	}
+	for(uint32_t index = 0; index < instr->operands_len; index += 1) {
+		hash = (hash ^ resolve_replacement(replacements, grug_ir_operand(function, instr, index))) * 16777619U;
+	}
+	return hash;
+}
+
+static bool same_instr(struct grug_ir_function const* function, grug_ir_value const* replacements, grug_ir_value const* load_epochs, grug_ir_value left_value, grug_ir_value right_value) {
+	struct grug_ir_instr const* left = &function->instrs[left_value];
+	struct grug_ir_instr const* right = &function->instrs[right_value];
+	if(left->op != right->op || left->type != right->type || left->operands_len != right->operands_len) {
+		return false;
+	}
+	if(left->op == GRUG_IR_CONST && !same_constant(left->data.constant, right->data.constant)) {
+		return false;
+	}
+	if(left->op == GRUG_IR_LOAD_MEMBER && (left->data.index != right->data.index || load_epochs[left_value] != load_epochs[right_value])) {
+		return false;
+	}
+	for(uint32_t index = 0; index < left->operands_len; index += 1) {
+		if(resolve_replacement(replacements, grug_ir_operand(function, left, index)) != resolve_replacement(replacements, grug_ir_operand(function, right, index))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/// Common subexpression elimination within every block
+static bool eliminate_local_common_subexpressions(struct grug_ir* ir, struct grug_ir_function* function) {
+	grug_ir_value* replacements = new_replacements(ir, function);
+	/// The number of member stores and calls before every load in its block, since those can change what a load reads
+	grug_ir_value* load_epochs = ir_alloc_scratch(ir, function->instrs_len, sizeof(grug_ir_value));
+	grug_ir_value* table = NULL;
+	uint32_t table_capacity = 0;
+	bool changed = false;
+	for(grug_ir_block_id block_id = 0; block_id < function->blocks_len && replacements && load_epochs; block_id += 1) {
+		struct grug_ir_block const* block = &function->blocks[block_id];
+		uint32_t needed_capacity = 16;
+		while(needed_capacity < block->instrs_len * 2) {
+			needed_capacity *= 2;
+		}
+		if(needed_capacity > table_capacity) {
+			ir_free_scratch(table, table_capacity, sizeof(grug_ir_value));
+			table = ir_alloc_scratch(ir, needed_capacity, sizeof(grug_ir_value));
+			table_capacity = table ? needed_capacity : 0;
+			if(!table) {
+				break;
+			}
+		}
+		for(uint32_t slot = 0; slot < table_capacity; slot += 1) {
+			table[slot] = GRUG_IR_NONE;
+		}
+		uint32_t epoch = 0;
+		for(uint32_t index = 0; index < block->instrs_len; index += 1) {
+			grug_ir_value value = block->instrs[index];
+			struct grug_ir_instr const* instr = &function->instrs[value];
+			if(has_side_effects(instr->op)) {
+				epoch += 1;
+				continue;
+			}
+			if(!is_pure_expression(instr->op)) {
+				continue;
+			}
+			load_epochs[value] = epoch;
+			uint32_t mask = table_capacity - 1;
+			for(uint32_t slot = hash_instr(function, replacements, instr, epoch) & mask;; slot = (slot + 1) & mask) {
+				if(table[slot] == GRUG_IR_NONE) {
+					table[slot] = value;
+					break;
+				}
+				if(same_instr(function, replacements, load_epochs, table[slot], value)) {
+					replacements[value] = table[slot];
+					changed = true;
+					break;
+				}
+			}
+		}
+	}
+	if(changed) {
+		apply_replacements(function, replacements, function->instrs_len);
+	}
+	ir_free_scratch(table, table_capacity, sizeof(grug_ir_value));
+	ir_free_scratch(load_epochs, function->instrs_len, sizeof(grug_ir_value));
+	ir_free_scratch(replacements, function->instrs_len, sizeof(grug_ir_value));
+	return changed;
+}
+
+/// Loop invariant code motion into the preheaders of while loops, innermost loops first
+static bool hoist_invariants(struct grug_ir* ir, struct grug_ir_function* function) {
+	/// Whether the loop being looked at stores to a member
+	bool* stored = ir_alloc_scratch(ir, ir->members_len, sizeof(bool));
+	if(!stored) {
+		return false;
+	}
+	bool changed = false;
+	for(uint32_t loop = function->loops_len; loop > 0; loop -= 1) {
+		struct grug_ir_loop const* info = &function->loops[loop - 1];
+		if(function->blocks[info->header].dead || function->blocks[info->preheader].dead) {
+			continue;
+		}
+		// A call can run an on function of this same entity, which may write any member
+		memset(stored, 0, (ir->members_len + 1) * sizeof(bool));
+		bool calls = false;
+		for(grug_ir_block_id block_id = 0; block_id < function->blocks_len; block_id += 1) {
+			struct grug_ir_block const* block = &function->blocks[block_id];
+			if(block->dead || !block_in_loop(function, block_id, loop - 1)) {
+				continue;
+			}
+			for(uint32_t index = 0; index < block->instrs_len; index += 1) {
+				struct grug_ir_instr const* instr = &function->instrs[block->instrs[index]];
+				if(instr->op == GRUG_IR_STORE_MEMBER) {
+					stored[instr->data.index] = true;
+				} else if(instr->op == GRUG_IR_CALL_HELPER || instr->op == GRUG_IR_CALL_GAME) {
+					calls = true;
+				}
+			}
+		}
+
+		// An instruction whose operands were just hoisted can be hoisted in the next sweep
+		for(bool moved = true; moved && !ir->failed;) {
+			moved = false;
+			for(grug_ir_block_id block_id = 0; block_id < function->blocks_len; block_id += 1) {
+				struct grug_ir_block const* block = &function->blocks[block_id];
+				if(block->dead || !block_in_loop(function, block_id, loop - 1)) {
+					continue;
+				}
+				for(uint32_t index = 0; index < block->instrs_len; index += 1) {
+					grug_ir_value value = block->instrs[index];
+					struct grug_ir_instr const* instr = &function->instrs[value];
+					if(instr->block != block_id || !is_pure_expression(instr->op)) {
+						continue;
+					}
+					if(instr->op == GRUG_IR_LOAD_MEMBER && (calls || stored[instr->data.index])) {
+						continue;
+					}
+					bool invariant = true;
+					for(uint32_t operand_index = 0; operand_index < instr->operands_len && invariant; operand_index += 1) {
+						grug_ir_block_id operand_block = function->instrs[grug_ir_operand(function, instr, operand_index)].block;
+						invariant = !block_in_loop(function, operand_block, loop - 1);
+					}
+					if(invariant) {
+						block_append(ir, function, info->preheader, value);
+						moved = true;
+						changed = true;
+					}
+				}
+			}
+		}
+		compact_blocks(function);
+	}
+	ir_free_scratch(stored, ir->members_len, sizeof(bool));
+	return changed;
+}
+
+/// Removes the instructions without side effects whose value is never used, including phis that only use each other
+static void remove_unused_instrs(struct grug_ir* ir, struct grug_ir_function* function) {
+	bool* used = ir_alloc_scratch(ir, function->instrs_len, sizeof(bool));
+	grug_ir_value* worklist = ir_alloc_scratch(ir, function->instrs_len, sizeof(grug_ir_value));
+	if(used && worklist) {
+		memset(used, 0, function->instrs_len * sizeof(bool));
+		uint32_t worklist_len = 0;
+		for(grug_ir_block_id block_id = 0; block_id < function->blocks_len; block_id += 1) {
+			struct grug_ir_block const* block = &function->blocks[block_id];
+			for(uint32_t index = 0; index < block->instrs_len; index += 1) {
+				grug_ir_value value = block->instrs[index];
+				if(has_side_effects(function->instrs[value].op) && !used[value]) {
+					used[value] = true;
+					worklist[worklist_len++] = value;
+				}
+			}
+			if(block->value != GRUG_IR_NONE && !used[block->value]) {
+				used[block->value] = true;
+				worklist[worklist_len++] = block->value;
+			}
+		}
+		while(worklist_len) {
+			struct grug_ir_instr const* instr = &function->instrs[worklist[--worklist_len]];
+			for(uint32_t index = 0; index < instr->operands_len; index += 1) {
+				grug_ir_value operand = grug_ir_operand(function, instr, index);
+				if(!used[operand]) {
+					used[operand] = true;
+					worklist[worklist_len++] = operand;
+				}
+			}
+		}
+		for(grug_ir_value value = 0; value < function->instrs_len; value += 1) {
+			if(!used[value]) {
+				function->instrs[value].block = GRUG_IR_NONE;
+			}
+		}
+		compact_blocks(function);
+	}
+	ir_free_scratch(used, function->instrs_len, sizeof(bool));
+	ir_free_scratch(worklist, function->instrs_len, sizeof(grug_ir_value));
+}
+
+static void optimize_function(struct grug_ir* ir, struct grug_ir_function* function, uint32_t passes) {
+	// Folding a condition kills a branch, which can make a phi trivial, whose value can then be folded into the next condition
+	for(uint32_t iteration = 0; iteration < 8 && !ir->failed; iteration += 1) {
+		bool changed = false;
+		if(passes & GRUG_IR_PASS_FOLD_CONSTANTS) {
+			changed |= fold_constants(ir, function);
+		}
+		if(passes & GRUG_IR_PASS_DEAD_BRANCHES) {
+			changed |= eliminate_dead_branches(ir, function);
+		}
+		if(passes & GRUG_IR_PASS_COPY_PROPAGATION) {
+			changed |= propagate_copies(ir, function);
+		}
+		if(!changed) {
+			break;
+		}
+	}
+	if((passes & GRUG_IR_PASS_LOCAL_CSE) && !ir->failed) {
+		eliminate_local_common_subexpressions(ir, function);
+	}
+	if((passes & GRUG_IR_PASS_HOIST_INVARIANTS) && !ir->failed && hoist_invariants(ir, function) && (passes & GRUG_IR_PASS_LOCAL_CSE)) {
+		// The same constant hoisted out of two places ends up twice in the preheader
+		eliminate_local_common_subexpressions(ir, function);
+	}
+	if(!ir->failed) {
+		remove_unused_instrs(ir, function);
+	}
+}
+
+void grug_ir_optimize(struct grug_ir* ir, uint32_t passes) {
+	if(ir->failed) {
+		return;
+	}
+	optimize_function(ir, &ir->init, passes);
+	for(uint32_t helper_index = 0; helper_index < ir->helpers_len; helper_index += 1) {
+		optimize_function(ir, &ir->helpers[helper_index], passes);
+	}
+	for(uint32_t on_fn_index = 0; on_fn_index < ir->on_fns_len; on_fn_index += 1) {
+		if(ir->on_fns[on_fn_index].defined) {
+			optimize_function(ir, &ir->on_fns[on_fn_index], passes);
+		}
+	}
+}
+
+// MARK: utilities
+
+void grug_ir_split_critical_edges(struct grug_ir* ir, struct grug_ir_function* function) {
+	uint32_t blocks_len = function->blocks_len;
+	for(grug_ir_block_id block_id = 0; block_id < blocks_len && !ir->failed; block_id += 1) {
+		if(function->blocks[block_id].dead || function->blocks[block_id].terminator != GRUG_IR_BRANCH) {
+			continue;
+		}
+		for(uint32_t target_index = 0; target_index < 2; target_index += 1) {
+			grug_ir_block_id target = function->blocks[block_id].targets[target_index];
+			if(!has_phis(function, target)) {
+				continue;
+			}
+			// The new block is in the innermost loop that has both ends of the edge
+			uint32_t target_loop = function->blocks[target].loop;
+			uint32_t loop = target_loop == GRUG_IR_NONE || block_in_loop(function, block_id, target_loop) ? target_loop : function->blocks[block_id].loop;
+			grug_ir_block_id split = add_block(ir, function, loop);
+			if(split == GRUG_IR_NONE) {
+				return;
+			}
+			function->blocks[split].terminator = GRUG_IR_JUMP;
+			function->blocks[split].targets[0] = target;
+			add_pred(ir, function, split, block_id);
+			function->blocks[block_id].targets[target_index] = split;
+			// The phis keep their operands, since the split block takes the place of this block among the target's predecessors
+			struct grug_ir_block* target_block = &function->blocks[target];
+			for(uint32_t pred_index = 0; pred_index < target_block->preds_len; pred_index += 1) {
+				if(target_block->preds[pred_index] == block_id) {
+					target_block->preds[pred_index] = split;
+					break;
+				}
+			}
+		}
+	}
+}
+
+uint32_t grug_ir_reverse_postorder(struct grug_ir* ir, struct grug_ir_function const* function, grug_ir_block_id* out_order) {
+	if(!function->blocks_len) {
+		return 0;
+	}
+	bool* visited = ir_alloc_scratch(ir, function->blocks_len, sizeof(bool));
+	/// The blocks being visited, and how many of their successors have been looked at
+	grug_ir_block_id* stack = ir_alloc_scratch(ir, function->blocks_len, sizeof(grug_ir_block_id));
+	uint32_t* next_successor = ir_alloc_scratch(ir, function->blocks_len, sizeof(uint32_t));
+	uint32_t order_len = 0;
+	if(visited && stack && next_successor) {
+		memset(visited, 0, function->blocks_len * sizeof(bool));
+		uint32_t stack_len = 1;
+		stack[0] = 0;
+		next_successor[0] = 0;
+		visited[0] = true;
+		while(stack_len) {
+			grug_ir_block_id block_id = stack[stack_len - 1];
+			grug_ir_block_id targets[2];
+			uint32_t targets_len = successors(&function->blocks[block_id], targets);
+			if(next_successor[stack_len - 1] == targets_len) {
+				out_order[order_len++] = block_id;
+				stack_len -= 1;
+				continue;
+			}
+			// The false side is visited first, so it ends up after the true side
+			grug_ir_block_id target = targets[targets_len - 1 - next_successor[stack_len - 1]++];
+			if(!visited[target]) {
+				visited[target] = true;
+				stack[stack_len] = target;
+				next_successor[stack_len] = 0;
+				stack_len += 1;
+			}
+		}
+		for(uint32_t index = 0; index < order_len / 2; index += 1) {
+			grug_ir_block_id swapped = out_order[index];
+			out_order[index] = out_order[order_len - 1 - index];
+			out_order[order_len - 1 - index] = swapped;
+		}
+	}
+	ir_free_scratch(visited, function->blocks_len, sizeof(bool));
+	ir_free_scratch(stack, function->blocks_len, sizeof(grug_ir_block_id));
+	ir_free_scratch(next_successor, function->blocks_len, sizeof(uint32_t));
+	return order_len;
+}
+
+static void free_function(struct grug_ir_function* function) {
+	for(grug_ir_block_id block_id = 0; block_id < function->blocks_len; block_id += 1) {
+		struct grug_ir_block* block = &function->blocks[block_id];
+		if(block->instrs) {
+			GRUG_FREE(block->instrs, block->instrs_capacity * sizeof(grug_ir_value));
+		}
+		if(block->preds) {
+			GRUG_FREE(block->preds, block->preds_capacity * sizeof(grug_ir_block_id));
+		}
+	}
+	if(function->blocks) {
+		GRUG_FREE(function->blocks, function->blocks_capacity * sizeof(struct grug_ir_block));
+	}
+	if(function->instrs) {
+		GRUG_FREE(function->instrs, function->instrs_capacity * sizeof(struct grug_ir_instr));
+	}
+	if(function->operands) {
+		GRUG_FREE(function->operands, function->operands_capacity * sizeof(grug_ir_value));
+	}
+	if(function->loops) {
+		GRUG_FREE(function->loops, function->loops_capacity * sizeof(struct grug_ir_loop));
+	}
+}
+
+void grug_ir_free(struct grug_ir* ir) {
+	free_function(&ir->init);
+	for(uint32_t helper_index = 0; helper_index < ir->helpers_len; helper_index += 1) {
+		free_function(&ir->helpers[helper_index]);
+	}
+	if(ir->helpers) {
+		GRUG_FREE(ir->helpers, ir->helpers_len * sizeof(struct grug_ir_function));
+	}
+	for(uint32_t on_fn_index = 0; on_fn_index < ir->on_fns_len; on_fn_index += 1) {
+		free_function(&ir->on_fns[on_fn_index]);
+	}
+	if(ir->on_fns) {
+		GRUG_FREE(ir->on_fns, ir->on_fns_len * sizeof(struct grug_ir_function));
+	}
+	*ir = (struct grug_ir) {0};
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+// Typed SSA intermediate representation that sits between the type checked AST and the backends.
+// grug_ir_from_ast lowers every function of a file to basic blocks, and grug_ir_optimize runs the shared passes over them.
+// A backend that lowers the IR instead of the AST gets every optimization for free.
+//
+// Every instruction defines at most one value, which is referred to by the index of the instruction.
+// Local variables only exist as values, so the only memory is the entity's member variables.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "grug_main.h"
+
+/// The index of an instruction in grug_ir_function.instrs, which also names the value it defines
+typedef uint32_t grug_ir_value;
+/// The index of a block in grug_ir_function.blocks
+typedef uint32_t grug_ir_block_id;
+
+#define GRUG_IR_NONE UINT32_MAX
+
+enum grug_ir_op_enum {
+	/// data.constant
+	GRUG_IR_CONST = 0,
+	/// The argument at data.index, which must come before anything else in the entry block
+	GRUG_IR_PARAM,
+	/// The id of the entity the function runs on
+	GRUG_IR_ME,
+	/// Reads the member variable at data.index
+	GRUG_IR_LOAD_MEMBER,
+	/// Writes operands[0] to the member variable at data.index
+	GRUG_IR_STORE_MEMBER,
+	GRUG_IR_NOT,
+	GRUG_IR_NEG,
+	/// The arithmetic operators only take numbers
+	GRUG_IR_ADD,
+	GRUG_IR_SUB,
+	GRUG_IR_MUL,
+	GRUG_IR_DIV,
+	/// The comparisons define a bool, and compare their operands as the type of operands[0]
+	GRUG_IR_EQ,
+	GRUG_IR_NE,
+	GRUG_IR_LT,
+	GRUG_IR_LE,
+	GRUG_IR_GT,
+	GRUG_IR_GE,
+	/// Calls the helper function at data.index with the operands as its arguments
+	GRUG_IR_CALL_HELPER,
+	/// Calls data.game_fn with the operands as its arguments
+	GRUG_IR_CALL_GAME,
+	/// operands[i] is the value that flows in from preds[i] of the block
+	GRUG_IR_PHI,
+	/// operands[0], which copy propagation removes
+	GRUG_IR_COPY,
+	GRUG_IR_OP_COUNT,
+};
+typedef uint8_t grug_ir_op;
+
+struct grug_ir_instr {
+	grug_ir_op op;
+	/// The grug_type_type of the value. GRUG_TYPE_VOID for a store, and for a call of a function that returns nothing.
+	uint8_t type;
+	/// The block the instruction is in, or GRUG_IR_NONE once a pass has removed it
+	grug_ir_block_id block;
+	/// The operands are operands[operands_start] up to operands[operands_start + operands_len] of the function
+	uint32_t operands_start;
+	uint32_t operands_len;
+	union {
+		/// Strings point into the AST, so they have to be copied before the AST is freed
+		union grug_value constant;
+		uint32_t index;
+		struct {
+			game_fn fn;
+			void* data;
+		} game_fn;
+	} data;
+};
+
+enum grug_ir_terminator_enum {
+	/// Continues at targets[0]
+	GRUG_IR_JUMP = 0,
+	/// Continues at targets[0] if `value` is true, and at targets[1] if it is false
+	GRUG_IR_BRANCH,
+	/// Returns `value`, or nothing if it is GRUG_IR_NONE
+	GRUG_IR_RETURN,
+};
+typedef uint8_t grug_ir_terminator;
+
+struct grug_ir_block {
+	/// Phis come first
+	grug_ir_value* instrs;
+	uint32_t instrs_len;
+	uint32_t instrs_capacity;
+	grug_ir_block_id* preds;
+	uint32_t preds_len;
+	uint32_t preds_capacity;
+	grug_ir_terminator terminator;
+	grug_ir_value value;
+	grug_ir_block_id targets[2];
+	/// The innermost while loop the block is in, as an index in grug_ir_function.loops, or GRUG_IR_NONE
+	uint32_t loop;
+	/// Set once a pass found the block unreachable, after which it has no instructions and no predecessors
+	bool dead;
+};
+
+struct grug_ir_loop {
+	/// Evaluates the condition, and is where `continue` and the end of the body go
+	grug_ir_block_id header;
+	/// The only predecessor of the header outside of the loop, which loop invariant code is hoisted into
+	grug_ir_block_id preheader;
+	/// The loop this one is nested in, or GRUG_IR_NONE
+	uint32_t parent;
+};
+
+struct grug_ir_function {
+	/// Block 0 is the entry, which has no predecessors
+	struct grug_ir_block* blocks;
+	uint32_t blocks_len;
+	uint32_t blocks_capacity;
+	struct grug_ir_instr* instrs;
+	uint32_t instrs_len;
+	uint32_t instrs_capacity;
+	grug_ir_value* operands;
+	uint32_t operands_len;
+	uint32_t operands_capacity;
+	/// Outer loops come before the loops nested in them
+	struct grug_ir_loop* loops;
+	uint32_t loops_len;
+	uint32_t loops_capacity;
+	uint32_t params_len;
+	/// False for an on function that the file doesn't define
+	bool defined;
+};
+
+struct grug_ir {
+	/// Initializes the members of a new entity
+	struct grug_ir_function init;
+	struct grug_ir_function* helpers;
+	uint32_t helpers_len;
+	/// Indexed by on_fn_index
+	struct grug_ir_function* on_fns;
+	uint32_t on_fns_len;
+	uint32_t members_len;
+	/// Set if an allocation failed, or the AST had something the IR can't express
+	bool failed;
+};
+
+enum grug_ir_pass_enum {
+	/// Evaluates operators whose operands are constants
+	GRUG_IR_PASS_FOLD_CONSTANTS = 1 << 0,
+	/// Turns branches on constants into jumps, and removes the blocks that can no longer be reached
+	GRUG_IR_PASS_DEAD_BRANCHES = 1 << 1,
+	/// Replaces copies and phis that only ever see one value by that value
+	GRUG_IR_PASS_COPY_PROPAGATION = 1 << 2,
+	/// Reuses the value of an identical earlier instruction in the same block
+	GRUG_IR_PASS_LOCAL_CSE = 1 << 3,
+	/// Moves instructions whose operands don't change in a while loop to before the loop
+	GRUG_IR_PASS_HOIST_INVARIANTS = 1 << 4,
+};
+
+#define GRUG_IR_PASSES_ALL 0x1FU
+
+/// Lowers a type checked AST. Check `failed` afterwards, and always free the IR with grug_ir_free.
+void grug_ir_from_ast(struct grug_ir* ir, struct grug_ast const* ast);
+
+/// Runs the passes in `passes`, a mask of grug_ir_pass_enum, until they stop finding anything to do.
+/// Instructions without side effects whose value is never used are removed as well.
+void grug_ir_optimize(struct grug_ir* ir, uint32_t passes);
+
+/// Puts an empty block on every edge from a block with two successors to a block with phis.
+/// Lowering out of SSA then has a block that only that edge runs through, to put the copies of the phis in.
+void grug_ir_split_critical_edges(struct grug_ir* ir, struct grug_ir_function* function);
+
+/// Returns the reachable blocks in reverse postorder, where every block comes after the blocks that dominate it.
+/// The false side of a branch comes after the true side. Returns the number of blocks written to `out_order`, which has room for blocks_len.
+uint32_t grug_ir_reverse_postorder(struct grug_ir* ir, struct grug_ir_function const* function, grug_ir_block_id* out_order);
+
+void grug_ir_free(struct grug_ir* ir);
+
+static inline grug_ir_value grug_ir_operand(struct grug_ir_function const* function, struct grug_ir_instr const* instr, uint32_t index) {
+	return function->operands[instr->operands_start + index];
+}
@@ -0,0 +1,887 @@
+#include "grug_bytecode.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "grug_options.h"
+
+// A baseline JIT for x86-64 Linux.
+// Files are lowered to bytecode like in the bytecode backend, after which every instruction is translated to a fixed sequence of machine code.
+// The registers of a frame stay in the bytecode VM's value stack, so game functions get their arguments the same way and can call back into grug.
+// In safe mode, which is the default until the game calls grug_set_fast_mode(true), the bytecode interpreter runs the file instead.
+// Define GRUG_NO_JIT to make grug_jit_backend_new return the bytecode backend.
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(GRUG_NO_JIT)
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef bool (*jit_fn)(void* backend, union grug_value* regs);
+
+struct jit_file {
+	struct bytecode_file* bytecode;
+	/// Executable, or NULL if the file couldn't be translated and always runs on the interpreter
+	uint8_t* code;
+	size_t code_size;
+	/// Offset in `code` of the first byte of every bytecode function
+	uint32_t init_entry;
+	uint32_t* on_fn_entries;
+};
+
+struct jit_backend {
+	/// Indexed by file id - 1
+	struct jit_file** files;
+	size_t files_len;
+	size_t files_capacity;
+	struct bytecode_vm vm;
+	/// The backend a worker from jit_new_worker looks up files in, or NULL if this is that backend
+	struct jit_backend const* parent;
+
+	// The native code reaches the fields below through r12
+	struct grug_state* gst;
+	union grug_value* members;
+	grug_object_id me;
+	union grug_value* stack_end;
+	/// The number of helper functions being run natively
+	uint32_t depth;
+};
+
+// MARK: emitter
+
+// Register numbers as they are encoded in instructions
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RSI 6
+#define RDI 7
+
+struct jit_fixup {
+	/// Where the rel32 is in the code
+	uint32_t at;
+	/// The bytecode instruction it jumps to
+	uint32_t target;
+	/// Whether it jumps to the prologue of the function starting at `target`, instead of the instruction itself
+	bool entry;
+};
+
+struct jit_emitter {
+	uint8_t* code;
+	uint32_t len;
+	uint32_t capacity;
+	struct jit_fixup* fixups;
+	uint32_t fixups_len;
+	uint32_t fixups_capacity;
+	bool failed;
+};
+
+static bool jit_reserve(struct jit_emitter* emitter, void** array, uint32_t len, uint32_t needed, uint32_t* capacity, size_t item_size) {
+	if(len + needed <= *capacity) {
+		return true;
+	}
+	uint32_t new_capacity = *capacity ? *capacity : 4096;
+	while(new_capacity < len + needed) {
+		if(new_capacity >= UINT32_MAX / 2) {
+			emitter->failed = true;
+			return false;
+		}
+		new_capacity *= 2;
+	}
+	void* grown = grug_realloc(*array, *capacity * item_size, new_capacity * item_size);
+	if(!grown) {
+		emitter->failed = true;
+		return false;
+	}
+	*array = grown;
+	*capacity = new_capacity;
+	return true;
+}
+
+static void emit_bytes(struct jit_emitter* emitter, void const* bytes, uint32_t len) {
+	if(jit_reserve(emitter, (void**)&emitter->code, emitter->len, len, &emitter->capacity, 1)) {
+		memcpy(emitter->code + emitter->len, bytes, len);
+		emitter->len += len;
+	}
+}
+
+static void emit_u8(struct jit_emitter* emitter, uint8_t byte) {
+	emit_bytes(emitter, &byte, 1);
+}
+
+static void emit_u32(struct jit_emitter* emitter, uint32_t value) {
+	uint8_t bytes[4] = {(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+	emit_bytes(emitter, bytes, 4);
+}
+
+static void emit_u64(struct jit_emitter* emitter, uint64_t value) {
+	emit_u32(emitter, (uint32_t)value);
+	emit_u32(emitter, (uint32_t)(value >> 32));
+}
+
+/// ModRM for [rbx + disp32]
+static void emit_rbx_operand(struct jit_emitter* emitter, uint8_t reg, uint32_t disp) {
+	emit_u8(emitter, (uint8_t)(0x80 | reg << 3 | 3));
+	emit_u32(emitter, disp);
+}
+
+/// ModRM and SIB for [r12 + disp32], which needs a REX.B prefix
+static void emit_r12_operand(struct jit_emitter* emitter, uint8_t reg, uint32_t disp) {
+	emit_u8(emitter, (uint8_t)(0x80 | reg << 3 | 4));
+	emit_u8(emitter, 0x24);
+	emit_u32(emitter, disp);
+}
+
+/// ModRM for [r13 + disp32], which needs a REX.B prefix
+static void emit_r13_operand(struct jit_emitter* emitter, uint8_t reg, uint32_t disp) {
+	emit_u8(emitter, (uint8_t)(0x80 | reg << 3 | 5));
+	emit_u32(emitter, disp);
+}
+
+static uint32_t reg_disp(uint32_t reg) {
+	return reg * (uint32_t)sizeof(union grug_value);
+}
+
+static uint32_t member_disp(uint32_t member) {
+	return member * BYTECODE_MEMBERS_CHUNK * (uint32_t)sizeof(union grug_value);
+}
+
+/// mov r64, [rbx + reg * 8]
+static void emit_load(struct jit_emitter* emitter, uint8_t dst, uint32_t reg) {
+	emit_u8(emitter, 0x48);
+	emit_u8(emitter, 0x8B);
+	emit_rbx_operand(emitter, dst, reg_disp(reg));
+}
+
+/// mov [rbx + reg * 8], rax
+static void emit_store_rax(struct jit_emitter* emitter, uint32_t reg) {
+	emit_u8(emitter, 0x48);
+	emit_u8(emitter, 0x89);
+	emit_rbx_operand(emitter, RAX, reg_disp(reg));
+}
+
+/// mov r64, imm64
+static void emit_mov_imm64(struct jit_emitter* emitter, uint8_t dst, uint64_t value) {
+	emit_u8(emitter, 0x48);
+	emit_u8(emitter, (uint8_t)(0xB8 + dst));
+	emit_u64(emitter, value);
+}
+
+/// mov r64, [r12 + offset]
+static void emit_load_backend_field(struct jit_emitter* emitter, uint8_t dst, size_t offset) {
+	emit_u8(emitter, 0x49);
+	emit_u8(emitter, 0x8B);
+	emit_r12_operand(emitter, dst, (uint32_t)offset);
+}
+
+/// call an absolute address through rax
+static void emit_call_absolute(struct jit_emitter* emitter, uint64_t address) {
+	emit_mov_imm64(emitter, RAX, address);
+	emit_u8(emitter, 0xFF);
+	emit_u8(emitter, 0xD0);
+}
+
+/// A rel32 jump or call to a bytecode instruction, filled in once all code is emitted
+static void emit_fixup(struct jit_emitter* emitter, uint32_t target, bool entry) {
+	if(jit_reserve(emitter, (void**)&emitter->fixups, emitter->fixups_len, 1, &emitter->fixups_capacity, sizeof(struct jit_fixup))) {
+		emitter->fixups[emitter->fixups_len++] = (struct jit_fixup) {.at = emitter->len, .target = target, .entry = entry};
+	}
+	emit_u32(emitter, 0);
+}
+
+/// A rel32 to an offset that was already emitted
+static void emit_rel32_to(struct jit_emitter* emitter, uint32_t offset) {
+	emit_u32(emitter, offset - (emitter->len + 4));
+}
+
+/// jcc rel32 to an offset that was already emitted
+static void emit_jcc_to(struct jit_emitter* emitter, uint8_t condition, uint32_t offset) {
+	emit_u8(emitter, 0x0F);
+	emit_u8(emitter, (uint8_t)(0x80 | condition));
+	emit_rel32_to(emitter, offset);
+}
+
+// Condition codes
+#define CC_B 0x2
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_A 0x7
+#define CC_P 0xA
+#define CC_NP 0xB
+
+/// setcc r8
+static void emit_setcc(struct jit_emitter* emitter, uint8_t condition, uint8_t dst) {
+	emit_u8(emitter, 0x0F);
+	emit_u8(emitter, (uint8_t)(0x90 | condition));
+	emit_u8(emitter, (uint8_t)(0xC0 | dst));
+}
+
+/// Stores al as a bool in a register
+static void emit_store_al_as_bool(struct jit_emitter* emitter, uint32_t reg) {
+	// movzx eax, al
+	emit_u8(emitter, 0x0F);
+	emit_u8(emitter, 0xB6);
+	emit_u8(emitter, 0xC0);
+	emit_store_rax(emitter, reg);
+}
+
+/// SSE2 op like `movsd xmm, [rbx + reg * 8]`, with `prefix` 0xF2 for the scalar double ops and 0x66 for ucomisd
+static void emit_sse(struct jit_emitter* emitter, uint8_t prefix, uint8_t op, uint8_t xmm, uint32_t reg) {
+	emit_u8(emitter, prefix);
+	emit_u8(emitter, 0x0F);
+	emit_u8(emitter, op);
+	emit_rbx_operand(emitter, xmm, reg_disp(reg));
+}
+
+#define SSE_MOVSD_LOAD 0x10
+#define SSE_MOVSD_STORE 0x11
+#define SSE_UCOMISD 0x2E
+#define SSE_MULSD 0x59
+#define SSE_ADDSD 0x58
+#define SSE_SUBSD 0x5C
+#define SSE_DIVSD 0x5E
+
+static uint64_t address_of_fn(void (*fn)(void)) {
+	uint64_t address;
+	memcpy(&address, &fn, sizeof(address));
+	return address;
+}
+
+// MARK: translation
+
+// Every function pushes the same three registers, so the shared stubs at the start of the code can return from any of them
+static void emit_prologue(struct jit_emitter* emitter) {
+	static uint8_t const prologue[] = {
+		0x53,             // push rbx
+		0x41, 0x54,       // push r12
+		0x41, 0x55,       // push r13
+		0x49, 0x89, 0xFC, // mov r12, rdi
+		0x48, 0x89, 0xF3, // mov rbx, rsi
+	};
+	emit_bytes(emitter, prologue, sizeof(prologue));
+	// mov r13, [r12 + members]
+	emit_u8(emitter, 0x4D);
+	emit_u8(emitter, 0x8B);
+	emit_r12_operand(emitter, 5, offsetof(struct jit_backend, members));
+}
+
+static void emit_return(struct jit_emitter* emitter, bool success) {
+	static uint8_t const epilogue[] = {
+		0x41, 0x5D, // pop r13
+		0x41, 0x5C, // pop r12
+		0x5B,       // pop rbx
+		0xC3,       // ret
+	};
+	if(success) {
+		// mov eax, 1
+		emit_u8(emitter, 0xB8);
+		emit_u32(emitter, 1);
+	} else {
+		// xor eax, eax
+		emit_u8(emitter, 0x31);
+		emit_u8(emitter, 0xC0);
+	}
+	emit_bytes(emitter, epilogue, sizeof(epilogue));
+}
+
+/// Offsets of the stubs that every function jumps to
+struct jit_stubs {
+	uint32_t fail;
+	uint32_t stack_overflow;
+};
+
+static struct jit_stubs emit_stubs(struct jit_emitter* emitter) {
+	struct jit_stubs stubs;
+	stubs.fail = emitter->len;
+	emit_return(emitter, false);
+	stubs.stack_overflow = emitter->len;
+	emit_load_backend_field(emitter, RDI, offsetof(struct jit_backend, gst));
+	emit_call_absolute(emitter, address_of_fn((void (*)(void))grug_bytecode_stack_overflow));
+	// jmp fail
+	emit_u8(emitter, 0xE9);
+	emit_rel32_to(emitter, stubs.fail);
+	return stubs;
+}
+
+static void emit_number_compare(struct jit_emitter* emitter, struct bytecode_instruction const* instruction, enum bytecode_op_enum op) {
+	// ucomisd sets CF and ZF like an unsigned compare, and PF if either side is NaN.
+	// Putting the larger side on the left means `a` and `ae` give false for NaN, like C does.
+	bool swap = op == BYTECODE_OP_CMP_LT_NUM || op == BYTECODE_OP_CMP_LE_NUM;
+	emit_sse(emitter, 0xF2, SSE_MOVSD_LOAD, 0, swap ? instruction->c : instruction->b);
+	emit_sse(emitter, 0x66, SSE_UCOMISD, 0, swap ? instruction->b : instruction->c);
+	switch(op) {
+		case BYTECODE_OP_CMP_GT_NUM:
+		case BYTECODE_OP_CMP_LT_NUM:
+			emit_setcc(emitter, CC_A, RAX);
+			break;
+		case BYTECODE_OP_CMP_GE_NUM:
+		case BYTECODE_OP_CMP_LE_NUM:
+			emit_setcc(emitter, CC_AE, RAX);
+			break;
+		case BYTECODE_OP_CMP_EQ_NUM:
+			emit_setcc(emitter, CC_E, RAX);
+			emit_setcc(emitter, CC_NP, RCX);
+			// and al, cl
+			emit_u8(emitter, 0x20);
+			emit_u8(emitter, 0xC8);
+			break;
+		default:
+			emit_setcc(emitter, CC_NE, RAX);
+			emit_setcc(emitter, CC_P, RCX);
+			// or al, cl
+			emit_u8(emitter, 0x08);
+			emit_u8(emitter, 0xC8);
+			break;
+	}
+	emit_store_al_as_bool(emitter, instruction->a);
+}
+
+/// Translates a single instruction of a function with `registers_len` registers
+static void translate_instruction(struct jit_emitter* emitter, struct jit_stubs stubs, struct bytecode_file const* file, struct bytecode_instruction const* instruction, uint16_t registers_len) {
+	uint32_t wide = (uint32_t)instruction->b | (uint32_t)instruction->c << 16;
+	enum bytecode_op_enum op = instruction->op;
+	switch(op) {
+		case BYTECODE_OP_LOAD_CONST: {
+			uint64_t bits;
+			memcpy(&bits, &file->constants[wide], sizeof(bits));
+			emit_mov_imm64(emitter, RAX, bits);
+			emit_store_rax(emitter, instruction->a);
+			return;
+		}
+		case BYTECODE_OP_LOAD_BOOL:
+			// mov eax, imm32
+			emit_u8(emitter, 0xB8);
+			emit_u32(emitter, instruction->b != 0);
+			emit_store_rax(emitter, instruction->a);
+			return;
+		case BYTECODE_OP_MOVE:
+			emit_load(emitter, RAX, instruction->b);
+			emit_store_rax(emitter, instruction->a);
+			return;
+		case BYTECODE_OP_LOAD_MEMBER:
+			// mov rax, [r13 + b * BYTECODE_MEMBERS_CHUNK * 8]
+			emit_u8(emitter, 0x49);
+			emit_u8(emitter, 0x8B);
+			emit_r13_operand(emitter, RAX, member_disp(instruction->b));
+			emit_store_rax(emitter, instruction->a);
+			return;
+		case BYTECODE_OP_STORE_MEMBER:
+			emit_load(emitter, RAX, instruction->b);
+			// mov [r13 + a * BYTECODE_MEMBERS_CHUNK * 8], rax
+			emit_u8(emitter, 0x49);
+			emit_u8(emitter, 0x89);
+			emit_r13_operand(emitter, RAX, member_disp(instruction->a));
+			return;
+		case BYTECODE_OP_LOAD_ME:
+			emit_load_backend_field(emitter, RAX, offsetof(struct jit_backend, me));
+			emit_store_rax(emitter, instruction->a);
+			return;
+		case BYTECODE_OP_NOT:
+			// movzx eax, byte [rbx + b * 8]
+			emit_u8(emitter, 0x0F);
+			emit_u8(emitter, 0xB6);
+			emit_rbx_operand(emitter, RAX, reg_disp(instruction->b));
+			// xor eax, 1
+			emit_u8(emitter, 0x83);
+			emit_u8(emitter, 0xF0);
+			emit_u8(emitter, 0x01);
+			emit_store_rax(emitter, instruction->a);
+			return;
+		case BYTECODE_OP_NEG_NUM:
+			emit_load(emitter, RAX, instruction->b);
+			// btc rax, 63 flips the sign bit, which is what negating a double does
+			emit_u8(emitter, 0x48);
+			emit_u8(emitter, 0x0F);
+			emit_u8(emitter, 0xBA);
+			emit_u8(emitter, 0xF8);
+			emit_u8(emitter, 63);
+			emit_store_rax(emitter, instruction->a);
+			return;
+		case BYTECODE_OP_ADD_NUM:
+		case BYTECODE_OP_SUB_NUM:
+		case BYTECODE_OP_MUL_NUM:
+		case BYTECODE_OP_DIV_NUM: {
+			uint8_t sse_op = op == BYTECODE_OP_ADD_NUM ? SSE_ADDSD : op == BYTECODE_OP_SUB_NUM ? SSE_SUBSD : op == BYTECODE_OP_MUL_NUM ? SSE_MULSD : SSE_DIVSD;
+			emit_sse(emitter, 0xF2, SSE_MOVSD_LOAD, 0, instruction->b);
+			emit_sse(emitter, 0xF2, sse_op, 0, instruction->c);
+			emit_sse(emitter, 0xF2, SSE_MOVSD_STORE, 0, instruction->a);
+			return;
+		}
+		case BYTECODE_OP_CMP_EQ_NUM:
+		case BYTECODE_OP_CMP_NE_NUM:
+		case BYTECODE_OP_CMP_LT_NUM:
+		case BYTECODE_OP_CMP_LE_NUM:
+		case BYTECODE_OP_CMP_GT_NUM:
+		case BYTECODE_OP_CMP_GE_NUM:
+			emit_number_compare(emitter, instruction, op);
+			return;
+		case BYTECODE_OP_CMP_EQ_BOOL:
+		case BYTECODE_OP_CMP_NE_BOOL:
+			// movzx eax, byte [rbx + b * 8]
+			emit_u8(emitter, 0x0F);
+			emit_u8(emitter, 0xB6);
+			emit_rbx_operand(emitter, RAX, reg_disp(instruction->b));
+			// cmp al, byte [rbx + c * 8]
+			emit_u8(emitter, 0x3A);
+			emit_rbx_operand(emitter, RAX, reg_disp(instruction->c));
+			emit_setcc(emitter, op == BYTECODE_OP_CMP_EQ_BOOL ? CC_E : CC_NE, RAX);
+			emit_store_al_as_bool(emitter, instruction->a);
+			return;
+		case BYTECODE_OP_CMP_EQ_ID:
+		case BYTECODE_OP_CMP_NE_ID:
+			emit_load(emitter, RAX, instruction->b);
+			// cmp rax, [rbx + c * 8]
+			emit_u8(emitter, 0x48);
+			emit_u8(emitter, 0x3B);
+			emit_rbx_operand(emitter, RAX, reg_disp(instruction->c));
+			emit_setcc(emitter, op == BYTECODE_OP_CMP_EQ_ID ? CC_E : CC_NE, RAX);
+			emit_store_al_as_bool(emitter, instruction->a);
+			return;
+		case BYTECODE_OP_CMP_EQ_STR:
+		case BYTECODE_OP_CMP_NE_STR:
+			emit_load(emitter, RDI, instruction->b);
+			emit_load(emitter, RSI, instruction->c);
+			emit_call_absolute(emitter, address_of_fn((void (*)(void))strcmp));
+			// test eax, eax
+			emit_u8(emitter, 0x85);
+			emit_u8(emitter, 0xC0);
+			emit_setcc(emitter, op == BYTECODE_OP_CMP_EQ_STR ? CC_E : CC_NE, RAX);
+			emit_store_al_as_bool(emitter, instruction->a);
+			return;
+		case BYTECODE_OP_JUMP:
+			emit_u8(emitter, 0xE9);
+			emit_fixup(emitter, wide, false);
+			return;
+		case BYTECODE_OP_JUMP_IF_FALSE:
+		case BYTECODE_OP_JUMP_IF_TRUE:
+			// cmp byte [rbx + a * 8], 0
+			emit_u8(emitter, 0x80);
+			emit_rbx_operand(emitter, 7, reg_disp(instruction->a));
+			emit_u8(emitter, 0);
+			emit_u8(emitter, 0x0F);
+			emit_u8(emitter, op == BYTECODE_OP_JUMP_IF_FALSE ? 0x84 : 0x85);
+			emit_fixup(emitter, wide, false);
+			return;
+		case BYTECODE_OP_CALL_HELPER: {
+			struct bytecode_function const* callee = &file->helpers[instruction->b];
+			// lea rax, [rbx + (c + callee registers) * 8], then make sure the callee's frame fits on the stack
+			emit_u8(emitter, 0x48);
+			emit_u8(emitter, 0x8D);
+			emit_rbx_operand(emitter, RAX, reg_disp((uint32_t)instruction->c + callee->registers_len));
+			// cmp rax, [r12 + stack_end]
+			emit_u8(emitter, 0x49);
+			emit_u8(emitter, 0x3B);
+			emit_r12_operand(emitter, RAX, offsetof(struct jit_backend, stack_end));
+			emit_jcc_to(emitter, CC_A, stubs.stack_overflow);
+			// cmp dword [r12 + depth], BYTECODE_MAX_FRAMES
+			emit_u8(emitter, 0x41);
+			emit_u8(emitter, 0x81);
+			emit_r12_operand(emitter, 7, offsetof(struct jit_backend, depth));
+			emit_u32(emitter, BYTECODE_MAX_FRAMES);
+			emit_jcc_to(emitter, CC_AE, stubs.stack_overflow);
+			// inc dword [r12 + depth]
+			emit_u8(emitter, 0x41);
+			emit_u8(emitter, 0xFF);
+			emit_r12_operand(emitter, 0, offsetof(struct jit_backend, depth));
+			// mov rdi, r12
+			emit_u8(emitter, 0x4C);
+			emit_u8(emitter, 0x89);
+			emit_u8(emitter, 0xE7);
+			// lea rsi, [rbx + c * 8]
+			emit_u8(emitter, 0x48);
+			emit_u8(emitter, 0x8D);
+			emit_rbx_operand(emitter, RSI, reg_disp(instruction->c));
+			emit_u8(emitter, 0xE8);
+			emit_fixup(emitter, callee->code_start, true);
+			// dec dword [r12 + depth]
+			emit_u8(emitter, 0x41);
+			emit_u8(emitter, 0xFF);
+			emit_r12_operand(emitter, 1, offsetof(struct jit_backend, depth));
+			// test al, al
+			emit_u8(emitter, 0x84);
+			emit_u8(emitter, 0xC0);
+			emit_jcc_to(emitter, CC_E, stubs.fail);
+			// The callee returns its value in its first register
+			emit_load(emitter, RAX, instruction->c);
+			emit_store_rax(emitter, instruction->a);
+			return;
+		}
+		case BYTECODE_OP_CALL_GAME: {
+			struct bytecode_game_fn const* game_fn = &file->game_fns[instruction->b];
+			// A game function that calls back into grug starts its frame past this one
+			emit_u8(emitter, 0x48);
+			emit_u8(emitter, 0x8D);
+			emit_rbx_operand(emitter, RAX, reg_disp(registers_len));
+			emit_u8(emitter, 0x49);
+			emit_u8(emitter, 0x89);
+			emit_r12_operand(emitter, RAX, offsetof(struct jit_backend, vm) + offsetof(struct bytecode_vm, stack_top));
+			emit_load_backend_field(emitter, RDI, offsetof(struct jit_backend, gst));
+			emit_mov_imm64(emitter, RSI, (uint64_t)(uintptr_t)game_fn->data);
+			// lea rdx, [rbx + c * 8]
+			emit_u8(emitter, 0x48);
+			emit_u8(emitter, 0x8D);
+			emit_rbx_operand(emitter, RDX, reg_disp(instruction->c));
+			emit_call_absolute(emitter, address_of_fn((void (*)(void))game_fn->fn));
+			// union grug_value is returned in rax
+			emit_store_rax(emitter, instruction->a);
+			emit_load_backend_field(emitter, RDI, offsetof(struct jit_backend, gst));
+			emit_call_absolute(emitter, address_of_fn((void (*)(void))grug_runtime_error_raised));
+			emit_u8(emitter, 0x84);
+			emit_u8(emitter, 0xC0);
+			emit_jcc_to(emitter, CC_NE, stubs.fail);
+			return;
+		}
+		case BYTECODE_OP_RETURN:
+			emit_load(emitter, RAX, instruction->a);
+			emit_store_rax(emitter, 0);
+			emit_return(emitter, true);
+			return;
+		case BYTECODE_OP_RETURN_VOID:
+			emit_return(emitter, true);
+			return;
+		default:
+			emitter->failed = true;
+			return;
+	}
+}
+
+/// Maps executable memory holding the emitted code. Returns NULL upon an error.
+static uint8_t* map_code(struct jit_emitter const* emitter, size_t* out_size) {
+	size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	size_t size = (emitter->len + page_size - 1) / page_size * page_size;
+	void* code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(code == MAP_FAILED) {
+		return NULL;
+	}
+	memcpy(code, emitter->code, emitter->len);
+	// The pages are never writable and executable at the same time
+	if(mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(code, size);
+		return NULL;
+	}
+	*out_size = size;
+	return code;
+}
+
+/// Translates the bytecode of `file`. Leaves file->code NULL if that fails, so the file runs on the interpreter.
+static void translate_file(struct jit_file* file) {
+	struct bytecode_file const* bytecode = file->bytecode;
+	uint32_t code_len = bytecode->code_len;
+	// The native offset of every instruction, and of every function's prologue
+	uint32_t* offsets = GRUG_MALLOC((code_len + 1) * sizeof(uint32_t));
+	uint32_t* entries = GRUG_MALLOC((code_len + 1) * sizeof(uint32_t));
+	/// The number of registers of the function every instruction is in
+	uint16_t* registers_lens = GRUG_MALLOC((code_len + 1) * sizeof(uint16_t));
+	bool* starts = GRUG_MALLOC(code_len + 1);
+	struct jit_emitter emitter = {0};
+	if(!offsets || !entries || !registers_lens || !starts) {
+		emitter.failed = true;
+	}
+
+	if(!emitter.failed) {
+		memset(starts, 0, code_len + 1);
+		memset(registers_lens, 0, (code_len + 1) * sizeof(uint16_t));
+		starts[bytecode->init.code_start] = true;
+		registers_lens[bytecode->init.code_start] = bytecode->init.registers_len;
+		for(uint32_t helper_index = 0; helper_index < bytecode->helpers_len; helper_index += 1) {
+			starts[bytecode->helpers[helper_index].code_start] = true;
+			registers_lens[bytecode->helpers[helper_index].code_start] = bytecode->helpers[helper_index].registers_len;
+		}
+		for(uint32_t on_fn_index = 0; on_fn_index < bytecode->on_fns_len; on_fn_index += 1) {
+			if(bytecode->on_fns[on_fn_index].code_start != BYTECODE_NO_FUNCTION) {
+				starts[bytecode->on_fns[on_fn_index].code_start] = true;
+				registers_lens[bytecode->on_fns[on_fn_index].code_start] = bytecode->on_fns[on_fn_index].registers_len;
+			}
+		}
+
+		struct jit_stubs stubs = emit_stubs(&emitter);
+		uint16_t registers_len = 0;
+		for(uint32_t index = 0; index < code_len && !emitter.failed; index += 1) {
+			if(starts[index]) {
+				registers_len = registers_lens[index];
+				entries[index] = emitter.len;
+				emit_prologue(&emitter);
+			}
+			offsets[index] = emitter.len;
+			translate_instruction(&emitter, stubs, bytecode, &bytecode->code[index], registers_len);
+		}
+	}
+
+	for(uint32_t fixup_index = 0; fixup_index < emitter.fixups_len && !emitter.failed; fixup_index += 1) {
+		struct jit_fixup const* fixup = &emitter.fixups[fixup_index];
+		uint32_t target = fixup->entry ? entries[fixup->target] : offsets[fixup->target];
+		uint32_t rel = target - (fixup->at + 4);
+		memcpy(emitter.code + fixup->at, &rel, sizeof(rel));
+	}
+
+	if(!emitter.failed) {
+		file->on_fn_entries = GRUG_MALLOC((bytecode->on_fns_len + 1) * sizeof(uint32_t));
+		if(file->on_fn_entries) {
+			file->init_entry = entries[bytecode->init.code_start];
+			for(uint32_t on_fn_index = 0; on_fn_index < bytecode->on_fns_len; on_fn_index += 1) {
+				uint32_t code_start = bytecode->on_fns[on_fn_index].code_start;
+				file->on_fn_entries[on_fn_index] = code_start == BYTECODE_NO_FUNCTION ? 0 : entries[code_start];
+			}
+			file->code = map_code(&emitter, &file->code_size);
+		}
+	}
+
+	if(offsets) {
+		GRUG_FREE(offsets, (code_len + 1) * sizeof(uint32_t));
+	}
+	if(entries) {
+		GRUG_FREE(entries, (code_len + 1) * sizeof(uint32_t));
+	}
+	if(registers_lens) {
+		GRUG_FREE(registers_lens, (code_len + 1) * sizeof(uint16_t));
+	}
+	if(starts) {
+		GRUG_FREE(starts, code_len + 1);
+	}
+	if(emitter.code) {
+		GRUG_FREE(emitter.code, emitter.capacity);
+	}
+	if(emitter.fixups) {
+		GRUG_FREE(emitter.fixups, emitter.fixups_capacity * sizeof(struct jit_fixup));
+	}
+}
+
+// MARK: backend
+
+static void free_jit_file(struct jit_file* file) {
+	if(!file) {
+		return;
+	}
+	if(file->code) {
+		munmap(file->code, file->code_size);
+	}
+	if(file->on_fn_entries) {
+		GRUG_FREE(file->on_fn_entries, (file->bytecode->on_fns_len + 1) * sizeof(uint32_t));
+	}
+	grug_bytecode_free_file(file->bytecode);
+	GRUG_FREE(file, sizeof(struct jit_file));
+}
+
+static struct jit_file* jit_file_of(struct jit_backend const* backend, grug_file_id file_id) {
+	if(backend->parent) {
+		backend = backend->parent;
+	}
+	if(file_id == 0 || file_id > backend->files_len) {
+		return NULL;
+	}
+	return backend->files[file_id - 1];
+}
+
+/// Runs a function natively in fast mode, and on the interpreter in safe mode or if the file couldn't be translated
+static bool jit_run(struct jit_backend* backend, struct grug_state* gst, struct jit_file const* file, struct grug_entity* entity, struct bytecode_function const* function, uint32_t entry, union grug_value const* args) {
+	if(!file->code || !grug_fast_mode(gst)) {
+		return grug_bytecode_run(&backend->vm, gst, file->bytecode, entity, function, args);
+	}
+	union grug_value* regs = backend->vm.stack_top;
+	if(regs + function->registers_len > backend->stack_end) {
+		return grug_bytecode_stack_overflow(gst);
+	}
+	if(function->params_len) {
+		memcpy(regs, args, function->params_len * sizeof(union grug_value));
+	}
+
+	// A game function may be calling back into grug, so the outer call's fields are put back afterwards
+	struct grug_state* outer_gst = backend->gst;
+	union grug_value* outer_members = backend->members;
+	grug_object_id outer_me = backend->me;
+	union grug_value* outer_stack_top = backend->vm.stack_top;
+	backend->gst = gst;
+	backend->members = ((struct bytecode_entity_data*)entity->data)->members;
+	backend->me = entity->me;
+	backend->vm.stack_top = regs + function->registers_len;
+
+	jit_fn fn;
+	void* code = file->code + entry;
+	memcpy(&fn, &code, sizeof(fn));
+	bool success = fn(backend, regs);
+
+	backend->gst = outer_gst;
+	backend->members = outer_members;
+	backend->me = outer_me;
+	backend->vm.stack_top = outer_stack_top;
+	return success;
+}
+
+static void jit_compile_script(void* backend_data, grug_file_id file_id, struct grug_ast ast) {
+	struct jit_backend* backend = backend_data;
+	struct grug_ir ir;
+	grug_ir_from_ast(&ir, &ast);
+	grug_ir_optimize(&ir, GRUG_IR_PASSES_ALL);
+	struct jit_file* file = GRUG_MALLOC(sizeof(struct jit_file));
+	if(file) {
+		*file = (struct jit_file) {.bytecode = grug_bytecode_compile_file(&ir)};
+		if(!file->bytecode) {
+			GRUG_FREE(file, sizeof(struct jit_file));
+			file = NULL;
+		} else if(!file->bytecode->failed) {
+			translate_file(file);
+		}
+		if(file) {
+			// Safe mode and files that failed to translate run in the interpreter, so the bytecode is fused once the translator is done with it
+			grug_bytecode_fuse(file->bytecode);
+		}
+	}
+	grug_ir_free(&ir);
+	// Hot reloading a file replaces its code, and grug_main.c then reinitializes its entities
+	if(file_id <= backend->files_len) {
+		free_jit_file(backend->files[file_id - 1]);
+		backend->files[file_id - 1] = file;
+		return;
+	}
+	// File ids are handed out in contiguous ascending order
+	assert(file_id == backend->files_len + 1);
+	if(backend->files_len == backend->files_capacity) {
+		size_t new_capacity = backend->files_capacity ? backend->files_capacity * 2 : 64;
+		struct jit_file** new_files = grug_realloc(backend->files, backend->files_capacity * sizeof(struct jit_file*), new_capacity * sizeof(struct jit_file*));
+		if(!new_files) {
+			free_jit_file(file);
+			return;
+		}
+		backend->files = new_files;
+		backend->files_capacity = new_capacity;
+	}
+	backend->files[backend->files_len++] = file;
+}
+
+static bool jit_init_entity(void* backend_data, struct grug_state* gst, struct grug_entity* entity) {
+	struct jit_backend* backend = backend_data;
+	struct jit_file const* file = jit_file_of(backend, entity->file_id);
+	if(!grug_bytecode_alloc_entity_data(gst, file ? file->bytecode : NULL, entity)) {
+		return false;
+	}
+	return jit_run(backend, gst, file, entity, &file->bytecode->init, file->init_entry, NULL);
+}
+
+static void jit_destroy_entity_data(void* backend_data, struct grug_entity* entity) {
+	(void)backend_data;
+	grug_bytecode_free_entity_data(entity);
+}
+
+static bool jit_call_on_function_raw(void* backend_data, struct grug_state* gst, struct grug_entity* entity, uint64_t on_fn_index, union grug_value* args) {
+	struct jit_backend* backend = backend_data;
+	struct jit_file const* file = jit_file_of(backend, entity->file_id);
+	// Files don't have to define every on function of their entity type
+	if(!file || on_fn_index >= file->bytecode->on_fns_len || file->bytecode->on_fns[on_fn_index].code_start == BYTECODE_NO_FUNCTION) {
+		return true;
+	}
+	uint32_t entry = file->code ? file->on_fn_entries[on_fn_index] : 0;
+	return jit_run(backend, gst, file, entity, &file->bytecode->on_fns[on_fn_index], entry, args);
+}
+
+static bool jit_call_on_function(void* backend_data, struct grug_state* gst, struct grug_entity* entity, uint64_t on_fn_index, union grug_value* args, size_t args_len) {
+	struct jit_backend* backend = backend_data;
+	struct jit_file const* file = jit_file_of(backend, entity->file_id);
+	if(!file || on_fn_index >= file->bytecode->on_fns_len || file->bytecode->on_fns[on_fn_index].code_start == BYTECODE_NO_FUNCTION) {
+		return true;
+	}
+	if(args_len != file->bytecode->on_fns[on_fn_index].params_len) {
+		grug_raise_runtime_error(gst, GRUG_ERROR_CODE_RUNTIME, "An on function was called with the wrong number of arguments");
+		return false;
+	}
+	return jit_call_on_function_raw(backend_data, gst, entity, on_fn_index, args);
+}
+
+static size_t jit_call_on_function_batch(void* backend_data, struct grug_state* gst, struct grug_entity* const* entities, size_t count, uint64_t on_fn_index, union grug_value const* args, size_t stride) {
+	struct jit_backend* backend = backend_data;
+	// Every entity of a batch comes from the same file, so the function is only looked up once
+	struct jit_file const* file = jit_file_of(backend, entities[0]->file_id);
+	if(!file || on_fn_index >= file->bytecode->on_fns_len || file->bytecode->on_fns[on_fn_index].code_start == BYTECODE_NO_FUNCTION) {
+		return count;
+	}
+	struct bytecode_function const* function = &file->bytecode->on_fns[on_fn_index];
+	uint32_t entry = file->code ? file->on_fn_entries[on_fn_index] : 0;
+	for(size_t index = 0; index < count; index += 1) {
+		if(!jit_run(backend, gst, file, entities[index], function, entry, args ? args + index * stride : NULL)) {
+			return index;
+		}
+	}
+	return count;
+}
+
+static void jit_drop(void* backend_data) {
+	struct jit_backend* backend = backend_data;
+	for(size_t file_index = 0; file_index < backend->files_len; file_index += 1) {
+		free_jit_file(backend->files[file_index]);
+	}
+	if(backend->files) {
+		GRUG_FREE(backend->files, backend->files_capacity * sizeof(struct jit_file*));
+	}
+	grug_bytecode_vm_deinit(&backend->vm);
+	GRUG_FREE(backend, sizeof(struct jit_backend));
+}
+
+/// The native code gets the worker instead of the backend, so it uses the worker's stack and fields
+static void* jit_new_worker(void* backend_data) {
+	struct jit_backend* worker = GRUG_MALLOC(sizeof(struct jit_backend));
+	if(!worker) {
+		return NULL;
+	}
+	*worker = (struct jit_backend) {.parent = backend_data};
+	if(!grug_bytecode_vm_init(&worker->vm)) {
+		GRUG_FREE(worker, sizeof(struct jit_backend));
+		return NULL;
+	}
+	worker->stack_end = worker->vm.stack + BYTECODE_STACK_SIZE;
+	return worker;
+}
+
+static void jit_drop_worker(void* worker_data) {
+	struct jit_backend* worker = worker_data;
+	grug_bytecode_vm_deinit(&worker->vm);
+	GRUG_FREE(worker, sizeof(struct jit_backend));
+}
+
+static union grug_value* jit_entity_members(void* backend_data, struct grug_entity* entity) {
+	(void)backend_data;
+	return entity->data ? ((struct bytecode_entity_data*)entity->data)->members : NULL;
+}
+
+static size_t jit_member_stride(void* backend_data) {
+	(void)backend_data;
+	return BYTECODE_MEMBERS_CHUNK * sizeof(union grug_value);
+}
+
+static struct grug_backend_vtable jit_vtable = {
+	.compile_script = jit_compile_script,
+	.init_entity = jit_init_entity,
+	// grug_deinit destroys the entities one by one
+	.clear_entities = NULL,
+	.entity_data = jit_destroy_entity_data,
+	.call_on_function_raw = jit_call_on_function_raw,
+	.call_on_function = jit_call_on_function,
+	.call_on_function_batch = jit_call_on_function_batch,
+	.new_worker = jit_new_worker,
+	.drop_worker = jit_drop_worker,
+	.entity_members = jit_entity_members,
+	.member_stride = jit_member_stride,
+	.drop = jit_drop,
+};
+
+struct grug_backend grug_jit_backend_new(void) {
+	struct jit_backend* backend = GRUG_MALLOC(sizeof(struct jit_backend));
+	if(!backend) {
+		return (struct grug_backend) {0};
+	}
+	*backend = (struct jit_backend) {0};
+	if(!grug_bytecode_vm_init(&backend->vm)) {
+		GRUG_FREE(backend, sizeof(struct jit_backend));
+		return (struct grug_backend) {0};
+	}
+	backend->stack_end = backend->vm.stack + BYTECODE_STACK_SIZE;
+	return (struct grug_backend) {.obj = backend, .vtable = &jit_vtable};
+}
+
+#else
+
+struct grug_backend grug_jit_backend_new(void) {
+	return grug_bytecode_backend_new();
+}
+
+#endif
@@ -0,0 +1,410 @@
+#include "grug_json.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "grug_main.h"
+#include "grug_options.h"
+
+/// Nesting deeper than this is an error instead of a stack overflow
+#define GRUG_JSON_MAX_DEPTH 512
+
+/// A growable array that the items of an array or object are collected in before being copied into the arena at their final size.
+/// Nested containers are finished before their parent gets its next item, so one stack per item type is enough.
+struct json_stack {
+	char* data;
+	size_t len;
+	size_t capacity;
+};
+
+struct json_parser {
+	char const* json;
+	size_t len;
+	size_t index;
+	size_t depth;
+	struct grug_arena* arena;
+	struct json_stack values;
+	struct json_stack members;
+	char const* error_message;
+	size_t error_offset;
+};
+
+static bool fail(struct json_parser* parser, char const* message) {
+	if(!parser->error_message) {
+		parser->error_message = message;
+		parser->error_offset = parser->index;
+	}
+	return false;
+}
+
+static void skip_whitespace(struct json_parser* parser) {
+	while(parser->index < parser->len) {
+		char character = parser->json[parser->index];
+		if(character != ' ' && character != '\t' && character != '\n' && character != '\r') {
+			return;
+		}
+		parser->index += 1;
+	}
+}
+
+static bool json_stack_push(struct json_parser* parser, struct json_stack* stack, void const* item, size_t item_size) {
+	if(stack->len + item_size > stack->capacity) {
+		size_t new_capacity = stack->capacity ? stack->capacity * 2 : item_size * 16;
+		char* new_data = grug_realloc(stack->data, stack->capacity, new_capacity);
+		if(!new_data) {
+			return fail(parser, "Out of memory");
+		}
+		stack->data = new_data;
+		stack->capacity = new_capacity;
+	}
+	memcpy(stack->data + stack->len, item, item_size);
+	stack->len += item_size;
+	return true;
+}
+
+/// Moves everything pushed since `base` into the arena
+static bool json_stack_pop_into_arena(struct json_parser* parser, struct json_stack* stack, size_t base, void** out_items) {
+	size_t size = stack->len - base;
+	stack->len = base;
+	*out_items = NULL;
+	if(!size) {
+		return true;
+	}
+	*out_items = grug_arena_alloc(parser->arena, size);
+	if(!*out_items) {
+		return fail(parser, "Out of memory");
+	}
+	memcpy(*out_items, stack->data + base, size);
+	return true;
+}
+
+static bool append_utf8(char* out, size_t* out_len, uint32_t code_point) {
+	if(code_point < 0x80) {
+		out[(*out_len)++] = (char)code_point;
+	} else if(code_point < 0x800) {
+		out[(*out_len)++] = (char)(0xC0 | (code_point >> 6));
+		out[(*out_len)++] = (char)(0x80 | (code_point & 0x3F));
+	} else if(code_point < 0x10000) {
+		out[(*out_len)++] = (char)(0xE0 | (code_point >> 12));
+		out[(*out_len)++] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+		out[(*out_len)++] = (char)(0x80 | (code_point & 0x3F));
+	} else if(code_point < 0x110000) {
+		out[(*out_len)++] = (char)(0xF0 | (code_point >> 18));
+		out[(*out_len)++] = (char)(0x80 | ((code_point >> 12) & 0x3F));
+		out[(*out_len)++] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+		out[(*out_len)++] = (char)(0x80 | (code_point & 0x3F));
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static bool parse_hex4(struct json_parser* parser, uint32_t* out_value) {
+	if(parser->len - parser->index < 4) {
+		return fail(parser, "Expected 4 hex digits after \\u");
+	}
+	uint32_t value = 0;
+	for(size_t digit_index = 0; digit_index < 4; digit_index += 1) {
+		char character = parser->json[parser->index];
+		uint32_t digit = 0;
+		if(character >= '0' && character <= '9') {
+			digit = (uint32_t)(character - '0');
+		} else if(character >= 'a' && character <= 'f') {
+			digit = (uint32_t)(character - 'a' + 10);
+		} else if(character >= 'A' && character <= 'F') {
+			digit = (uint32_t)(character - 'A' + 10);
+		} else {
+			return fail(parser, "Expected 4 hex digits after \\u");
+		}
+		value = value * 16 + digit;
+		parser->index += 1;
+	}
+	*out_value = value;
+	return true;
+}
+
+/// Parses a string starting at its opening quote
+static bool parse_string(struct json_parser* parser, char const** out_chars, size_t* out_chars_len) {
+	parser->index += 1;
+	size_t start = parser->index;
+	// Decoding never makes a string longer, so the raw length is enough room
+	size_t end = start;
+	while(end < parser->len && parser->json[end] != '"') {
+		end += parser->json[end] == '\\' ? 2 : 1;
+	}
+	if(end >= parser->len) {
+		return fail(parser, "Unterminated string");
+	}
+	char* out = grug_arena_alloc_aligned(parser->arena, end - start + 1, 1);
+	if(!out) {
+		return fail(parser, "Out of memory");
+	}
+	size_t out_len = 0;
+	while(parser->index < end) {
+		char character = parser->json[parser->index];
+		if((unsigned char)character < 0x20) {
+			return fail(parser, "Control characters must be escaped in strings");
+		}
+		if(character != '\\') {
+			out[out_len++] = character;
+			parser->index += 1;
+			continue;
+		}
+		parser->index += 1;
+		char escape = parser->json[parser->index];
+		parser->index += 1;
+		switch(escape) {
+			case '"': out[out_len++] = '"'; break;
+			case '\\': out[out_len++] = '\\'; break;
+			case '/': out[out_len++] = '/'; break;
+			case 'b': out[out_len++] = '\b'; break;
+			case 'f': out[out_len++] = '\f'; break;
+			case 'n': out[out_len++] = '\n'; break;
+			case 'r': out[out_len++] = '\r'; break;
+			case 't': out[out_len++] = '\t'; break;
+			case 'u': {
+				uint32_t code_point = 0;
+				if(!parse_hex4(parser, &code_point)) {
+					return false;
+				}
+				// A surrogate pair is two escapes for one code point
+				if(code_point >= 0xD800 && code_point < 0xDC00 && end - parser->index >= 6 && parser->json[parser->index] == '\\' && parser->json[parser->index + 1] == 'u') {
+					parser->index += 2;
+					uint32_t low = 0;
+					if(!parse_hex4(parser, &low)) {
+						return false;
+					}
+					if(low < 0xDC00 || low >= 0xE000) {
+						return fail(parser, "Invalid surrogate pair");
+					}
+					code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+				}
+				// 6 escaped characters always have room for the at most 4 bytes they decode to
+				if(!append_utf8(out, &out_len, code_point)) {
+					return fail(parser, "Invalid code point");
+				}
+				break;
+			}
+			default:
+				return fail(parser, "Invalid escape sequence");
+		}
+	}
+	out[out_len] = '\0';
+	parser->index = end + 1;
+	*out_chars = out;
+	*out_chars_len = out_len;
+	return true;
+}
+
+static bool parse_number(struct json_parser* parser, double* out_number) {
+	size_t start = parser->index;
+	if(parser->json[parser->index] == '-') {
+		parser->index += 1;
+	}
+	size_t digits_start = parser->index;
+	while(parser->index < parser->len && parser->json[parser->index] >= '0' && parser->json[parser->index] <= '9') {
+		parser->index += 1;
+	}
+	if(parser->index == digits_start) {
+		return fail(parser, "Expected a digit");
+	}
+	if(parser->index < parser->len && parser->json[parser->index] == '.') {
+		parser->index += 1;
+		size_t fraction_start = parser->index;
+		while(parser->index < parser->len && parser->json[parser->index] >= '0' && parser->json[parser->index] <= '9') {
+			parser->index += 1;
+		}
+		if(parser->index == fraction_start) {
+			return fail(parser, "Expected a digit after the decimal point");
+		}
+	}
+	if(parser->index < parser->len && (parser->json[parser->index] == 'e' || parser->json[parser->index] == 'E')) {
+		parser->index += 1;
+		if(parser->index < parser->len && (parser->json[parser->index] == '+' || parser->json[parser->index] == '-')) {
+			parser->index += 1;
+		}
+		size_t exponent_start = parser->index;
+		while(parser->index < parser->len && parser->json[parser->index] >= '0' && parser->json[parser->index] <= '9') {
+			parser->index += 1;
+		}
+		if(parser->index == exponent_start) {
+			return fail(parser, "Expected a digit in the exponent");
+		}
+	}
+	// strtod needs a null terminated string, and numbers are short
+	char buffer[64];
+	size_t number_len = parser->index - start;
+	if(number_len >= sizeof(buffer)) {
+		return fail(parser, "Number is too long");
+	}
+	memcpy(buffer, parser->json + start, number_len);
+	buffer[number_len] = '\0';
+	*out_number = strtod(buffer, NULL);
+	return true;
+}
+
+static bool match_literal(struct json_parser* parser, char const* literal, size_t literal_len) {
+	if(parser->len - parser->index < literal_len || memcmp(parser->json + parser->index, literal, literal_len) != 0) {
+		return fail(parser, "Unexpected character");
+	}
+	parser->index += literal_len;
+	return true;
+}
+
+static bool parse_value(struct json_parser* parser, struct grug_json_value* out_value);
+
+static bool parse_array(struct json_parser* parser, struct grug_json_value* out_value) {
+	parser->index += 1;
+	size_t base = parser->values.len;
+	skip_whitespace(parser);
+	if(parser->index < parser->len && parser->json[parser->index] == ']') {
+		parser->index += 1;
+	} else {
+		while(true) {
+			struct grug_json_value item = {0};
+			if(!parse_value(parser, &item) || !json_stack_push(parser, &parser->values, &item, sizeof(item))) {
+				return false;
+			}
+			skip_whitespace(parser);
+			if(parser->index < parser->len && parser->json[parser->index] == ',') {
+				parser->index += 1;
+				continue;
+			}
+			if(parser->index < parser->len && parser->json[parser->index] == ']') {
+				parser->index += 1;
+				break;
+			}
+			return fail(parser, "Expected ',' or ']'");
+		}
+	}
+	out_value->type = GRUG_JSON_ARRAY;
+	out_value->data.array.len = (parser->values.len - base) / sizeof(struct grug_json_value);
+	void* items = NULL;
+	if(!json_stack_pop_into_arena(parser, &parser->values, base, &items)) {
+		return false;
+	}
+	out_value->data.array.items = items;
+	return true;
+}
+
+static bool parse_object(struct json_parser* parser, struct grug_json_value* out_value) {
+	parser->index += 1;
+	size_t base = parser->members.len;
+	skip_whitespace(parser);
+	if(parser->index < parser->len && parser->json[parser->index] == '}') {
+		parser->index += 1;
+	} else {
+		while(true) {
+			struct grug_json_member member = {0};
+			skip_whitespace(parser);
+			if(parser->index >= parser->len || parser->json[parser->index] != '"') {
+				return fail(parser, "Expected a key");
+			}
+			if(!parse_string(parser, &member.key, &member.key_len)) {
+				return false;
+			}
+			skip_whitespace(parser);
+			if(parser->index >= parser->len || parser->json[parser->index] != ':') {
+				return fail(parser, "Expected ':'");
+			}
+			parser->index += 1;
+			if(!parse_value(parser, &member.value) || !json_stack_push(parser, &parser->members, &member, sizeof(member))) {
+				return false;
+			}
+			skip_whitespace(parser);
+			if(parser->index < parser->len && parser->json[parser->index] == ',') {
+				parser->index += 1;
+				continue;
+			}
+			if(parser->index < parser->len && parser->json[parser->index] == '}') {
+				parser->index += 1;
+				break;
+			}
+			return fail(parser, "Expected ',' or '}'");
+		}
+	}
+	out_value->type = GRUG_JSON_OBJECT;
+	out_value->data.object.len = (parser->members.len - base) / sizeof(struct grug_json_member);
+	void* members = NULL;
+	if(!json_stack_pop_into_arena(parser, &parser->members, base, &members)) {
+		return false;
+	}
+	out_value->data.object.members = members;
+	return true;
+}
+
+static bool parse_value(struct json_parser* parser, struct grug_json_value* out_value) {
+	skip_whitespace(parser);
+	if(parser->index >= parser->len) {
+		return fail(parser, "Unexpected end of input");
+	}
+	*out_value = (struct grug_json_value) {0};
+	switch(parser->json[parser->index]) {
+		case '{':
+		case '[': {
+			if(parser->depth == GRUG_JSON_MAX_DEPTH) {
+				return fail(parser, "Nested too deeply");
+			}
+			parser->depth += 1;
+			bool success = parser->json[parser->index] == '{' ? parse_object(parser, out_value) : parse_array(parser, out_value);
+			parser->depth -= 1;
+			return success;
+		}
+		case '"':
+			out_value->type = GRUG_JSON_STRING;
+			return parse_string(parser, &out_value->data.string.chars, &out_value->data.string.len);
+		case 't':
+			out_value->type = GRUG_JSON_BOOL;
+			out_value->data.boolean = true;
+			return match_literal(parser, "true", 4);
+		case 'f':
+			out_value->type = GRUG_JSON_BOOL;
+			out_value->data.boolean = false;
+			return match_literal(parser, "false", 5);
+		case 'n':
+			out_value->type = GRUG_JSON_NULL;
+			return match_literal(parser, "null", 4);
+		default:
+			out_value->type = GRUG_JSON_NUMBER;
+			return parse_number(parser, &out_value->data.number);
+	}
+}
+
+static void json_stack_deinit(struct json_stack* stack) {
+	if(stack->data) {
+		GRUG_FREE(stack->data, stack->capacity);
+	}
+}
+
+bool grug_json_parse(char const* json, size_t json_len, struct grug_arena* arena, struct grug_json_value* out_value, char const** out_error_message, size_t* out_error_offset) {
+	struct json_parser parser = {.json = json, .len = json_len, .arena = arena};
+	*out_value = (struct grug_json_value) {0};
+	bool success = parse_value(&parser, out_value);
+	if(success) {
+		skip_whitespace(&parser);
+		if(parser.index != parser.len) {
+			success = fail(&parser, "Unexpected character after the end of the value");
+		}
+	}
+	json_stack_deinit(&parser.values);
+	json_stack_deinit(&parser.members);
+	if(!success) {
+		*out_error_message = parser.error_message;
+		*out_error_offset = parser.error_offset;
+	}
+	return success;
+}
+
+struct grug_json_value const* grug_json_get(struct grug_json_value const* object, char const* key) {
+	if(!object || object->type != GRUG_JSON_OBJECT) {
+		return NULL;
+	}
+	size_t key_len = strlen(key);
+	for(size_t member_index = 0; member_index < object->data.object.len; member_index += 1) {
+		struct grug_json_member const* member = &object->data.object.members[member_index];
+		if(member->key_len == key_len && memcmp(member->key, key, key_len) == 0) {
+			return &member->value;
+		}
+	}
+	return NULL;
+}
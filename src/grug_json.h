@@ -0,0 +1,56 @@
+#pragma once
+
+// Small JSON parser that builds a read-only tree in a grug_arena, used for the mod API and the JSON forms of grug files.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct grug_arena;
+
+enum grug_json_type_enum {
+	GRUG_JSON_NULL = 0,
+	GRUG_JSON_BOOL,
+	GRUG_JSON_NUMBER,
+	GRUG_JSON_STRING,
+	GRUG_JSON_ARRAY,
+	GRUG_JSON_OBJECT,
+};
+typedef uint32_t grug_json_type;
+
+struct grug_json_member;
+
+struct grug_json_value {
+	grug_json_type type;
+	union {
+		bool boolean;
+		double number;
+		/// Escapes are decoded, and the string is null terminated as well
+		struct {
+			char const* chars;
+			size_t len;
+		} string;
+		struct {
+			struct grug_json_value* items;
+			size_t len;
+		} array;
+		/// Members are kept in the order they were written in
+		struct {
+			struct grug_json_member* members;
+			size_t len;
+		} object;
+	} data;
+};
+
+struct grug_json_member {
+	char const* key;
+	size_t key_len;
+	struct grug_json_value value;
+};
+
+/// Parses `json` into a tree allocated from `arena`.
+/// Returns false upon a syntax error, with a description of it and the byte offset it was found at.
+bool grug_json_parse(char const* json, size_t json_len, struct grug_arena* arena, struct grug_json_value* out_value, char const** out_error_message, size_t* out_error_offset);
+
+/// Returns the value of the first member called `key`, or NULL if `object` isn't an object or has no such member
+struct grug_json_value const* grug_json_get(struct grug_json_value const* object, char const* key);
@@ -4,11 +4,20 @@
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "grug_main.h"
 #include "beard_arena.h"
+#include "grug_bytecode.h"
+#include "grug_cache.h"
+#include "grug_file.h"
+#include "grug_intern.h"
+#include "grug_json.h"
 #include "grug_options.h"
+#include "grug_scan.h"
+#include "grug_watch.h"
+#include "grug_workers.h"
 
 // MARK: utilities
 
@@ -30,75 +39,279 @@ void* grug_realloc(void* ptr, size_t old_len, size_t new_len) {
 	return new_ptr;
 }
 
-/// Returns a null terminated string of the entire contents of a file, or null if the file fails to open.
-static char* read_all_contents(char const* file_path, size_t* out_len) {
-	struct block {
-		char data[1024];
-		size_t data_len;
-		struct block* pnext;
-	};
-
-	struct block* first = 0;
-	struct block* last = 0;
-	size_t total_size = 0;
+static inline bool word_equals(char const* word, size_t word_len, char const* keyword, size_t keyword_len) {
+	return word_len == keyword_len && memcmp(word, keyword, keyword_len) == 0;
+}
 
-	FILE* file = fopen(file_path, "rb");
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
 
-	if(!file) {
-		if(out_len) {
-			*out_len = 0;
-		}
-		return NULL;
-	}
+static inline uint64_t rotate_left_64(uint64_t value, unsigned bits) {
+	return value << bits | value >> (64 - bits);
+}
 
-	first = GRUG_MALLOC(sizeof(struct block));
+static inline uint64_t read_u64(char const* bytes) {
+	uint64_t value;
+	memcpy(&value, bytes, sizeof(value));
+	return value;
+}
 
-	first->data_len = fread(first->data, 1, 1024, file);
-	total_size += first->data_len;
+static inline uint64_t xxh64_round(uint64_t accumulator, uint64_t input) {
+	return rotate_left_64(accumulator + input * XXH_PRIME64_2, 31) * XXH_PRIME64_1;
+}
 
-	last = first;
+static inline uint64_t xxh64_merge_round(uint64_t hash, uint64_t accumulator) {
+	return (hash ^ xxh64_round(0, accumulator)) * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
 
-	while(!feof(file)) {
-		struct block* new = GRUG_MALLOC(sizeof(struct block));
-		last->pnext = new;
-		last = new;
-		last->data_len = fread(last->data, 1, 1024, file);
-		total_size += last->data_len;
+/// XXH64 with a seed of 0, reading words in the machine's byte order, so hashes are only comparable on the same machine.
+/// Never returns 0, which compiled_file.content_hash uses for not knowing the contents.
+static uint64_t hash_contents(char const* bytes, size_t len) {
+	char const* end = bytes + len;
+	uint64_t hash;
+	if(len >= 32) {
+		uint64_t accumulators[4] = {XXH_PRIME64_1 + XXH_PRIME64_2, XXH_PRIME64_2, 0, 0 - XXH_PRIME64_1};
+		for(; end - bytes >= 32; bytes += 32) {
+			for(size_t lane = 0; lane < 4; lane += 1) {
+				accumulators[lane] = xxh64_round(accumulators[lane], read_u64(bytes + lane * 8));
+			}
+		}
+		hash = rotate_left_64(accumulators[0], 1) + rotate_left_64(accumulators[1], 7) + rotate_left_64(accumulators[2], 12) + rotate_left_64(accumulators[3], 18);
+		for(size_t lane = 0; lane < 4; lane += 1) {
+			hash = xxh64_merge_round(hash, accumulators[lane]);
+		}
+	} else {
+		hash = XXH_PRIME64_5;
 	}
-
-	if(!fclose(file)) {
-		// I'm not sure under what circumstances this can fail but may as well log it somewhere.
-		// TODO(bluesillybeard) we really should figure out a proper logging system, even it it's just user-defined print* functions
-		printf("GRUG: Failed to close file\n");
+	hash += len;
+	for(; end - bytes >= 8; bytes += 8) {
+		hash = rotate_left_64(hash ^ xxh64_round(0, read_u64(bytes)), 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
 	}
+	if(end - bytes >= 4) {
+		uint32_t word;
+		memcpy(&word, bytes, sizeof(word));
+		hash = rotate_left_64(hash ^ word * XXH_PRIME64_1, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		bytes += 4;
+	}
+	for(; bytes < end; bytes += 1) {
+		hash = rotate_left_64(hash ^ (uint8_t)*bytes * XXH_PRIME64_5, 11) * XXH_PRIME64_1;
+	}
+	hash ^= hash >> 33;
+	hash *= XXH_PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= XXH_PRIME64_3;
+	hash ^= hash >> 32;
+	return hash ? hash : 1;
+}
+
+/// The entire contents of a file, null terminated and writable, so the tokenizer can be handed them without a copy
+struct file_contents {
+	char* text;
+	size_t len;
+	/// What `text` was allocated with GRUG_MALLOC, or 0 if the game's file reader returned it
+	size_t capacity;
+};
 
-	char* data = GRUG_MALLOC(total_size + 1);
-	size_t data_written = 0;
-	while(first) {
-		memcpy(data + data_written, first->data, first->data_len);
-		data_written += first->data_len;
-		struct block* next = first->pnext;
-		GRUG_FREE(first, sizeof(struct block));
-		first = next;
+/// Reads the file at `path` with the game's file reader, or from the file system if it has no read_fn.
+/// Returns false if the file couldn't be read.
+static bool read_file(struct grug_file_reader const* reader, char const* path, struct file_contents* out_contents) {
+	*out_contents = (struct file_contents) {0};
+	if(reader->read_fn) {
+		out_contents->text = reader->read_fn(reader->user_data, path, &out_contents->len);
+	} else {
+		out_contents->text = grug_read_file(path, &out_contents->len, &out_contents->capacity);
 	}
-	if(out_len) {
-		*out_len = total_size;
+	return out_contents->text != NULL;
+}
+
+static void free_file_contents(struct grug_file_reader const* reader, struct file_contents* contents) {
+	if(contents->text && contents->capacity) {
+		GRUG_FREE(contents->text, contents->capacity);
+	} else if(contents->text) {
+		reader->free_fn(reader->user_data, contents->text, contents->len);
 	}
-	data[total_size] = 0;
-	return data;
+	*contents = (struct file_contents) {0};
 }
 
+// MARK: mod API types
+
+/// A type as mod_api.json spells it
+struct mod_api_type {
+	grug_type_type type;
+	/// The name of a custom id type, the extension of a resource or the type of an entity, or GRUG_SYMBOL_NONE
+	grug_symbol extra;
+};
+
+struct mod_api_param {
+	grug_symbol name;
+	struct mod_api_type type;
+};
+
+/// Game functions are numbered in the order mod_api.json declares them, and compiled calls refer to them by that index
+struct game_fn_entry {
+	grug_symbol name;
+	uint32_t first_param;
+	uint32_t params_len;
+	/// GRUG_TYPE_VOID if it doesn't return anything
+	struct mod_api_type return_type;
+	/// NULL until grug_register_game_fn is called for it
+	game_fn fn;
+	void* fn_data;
+	/// Set by grug_set_game_fn_thread_safe
+	bool thread_safe;
+};
+#define GAME_FN_INDEX_NONE UINT32_MAX
+
+struct mod_api_on_fn {
+	grug_symbol name;
+	uint32_t first_param;
+	uint32_t params_len;
+};
+
+struct mod_api_entity {
+	grug_symbol name;
+	/// An entity's on functions are contiguous, and their index in mod_api.on_fns is their grug_on_fn_id
+	uint32_t first_on_fn;
+	uint32_t on_fns_len;
+};
+
+/// Everything mod_api.json declares, allocated once when the state is created.
+/// The only part that changes afterwards is which game functions have been registered.
+struct mod_api {
+	struct mod_api_param* params;
+	uint32_t params_len;
+	struct game_fn_entry* game_fns;
+	uint32_t game_fns_len;
+	uint32_t registered_game_fns_len;
+	/// Open addressing hash table with linear probing from the symbol of a game function's name to its index.
+	/// The capacity is a power of two that keeps it at most half full, and empty slots are GAME_FN_INDEX_NONE.
+	uint32_t* game_fn_slots;
+	uint32_t game_fn_slots_capacity;
+	struct mod_api_entity* entities;
+	uint32_t entities_len;
+	struct mod_api_on_fn* on_fns;
+	uint32_t on_fns_len;
+	/// What grug_get_fn_ids returns, indexed by grug_on_fn_id
+	struct grug_on_fn_entry* on_fn_entries;
+};
+
 // MARK: private functions
 
+struct compiled_file {
+	grug_symbol path;
+	/// Index into mod_api.entities
+	uint32_t entity_type;
+	/// A bitset of the game functions the file calls, indexed like mod_api.game_fns, or NULL if it calls none
+	uint64_t* called_game_fns;
+	/// A bitset of the on functions the file defines, indexed by on_fn_index, or NULL if it defines none
+	uint64_t* defined_on_fns;
+	/// Indexed by slot
+	struct grug_member_layout* members;
+	uint32_t members_len;
+	/// The reload epoch of the state when the file was last compiled, which grug_on_fn_handle compares against
+	uint64_t epoch;
+	/// The hash_contents of the source the file was last compiled from, or 0 if grug_update has to recompile it whatever its contents
+	uint64_t content_hash;
+	/// Set once grug_update finds the file deleted from the mods directory or moved out of it.
+	/// It then defines no on functions, and no entities can be created from it, until it comes back.
+	bool removed;
+};
+
+#define ENTITY_PAGE_SIZE 1024
+
+struct entity_slot {
+	/// Its id is 0 while the slot is free
+	struct grug_entity entity;
+	/// Bumped every time the slot is freed, so the ids of deinitialized entities never become valid again
+	uint32_t generation;
+	/// The index + 1 of the next free slot while this one is free, or 0 if it's the last
+	uint32_t next_free;
+};
+
+/// What a thread that is running grug code has to itself.
+/// Worker threads pass a pointer to their own context around as their grug_state, which call_context_of and shared_state turn back into it,
+/// while the calling thread uses the `call` of the grug_state that grug_init returned.
+struct grug_call_context {
+	/// The state grug_init returned, which the threads only read from while they share it
+	struct grug_state* shared;
+	/// What is passed to the backend's vtable, which is the backend data of new_worker on worker threads
+	void* backend_obj;
+	struct grug_error last_error;
+	/// How many on function calls are running, counting the ones game functions make from inside others
+	uint32_t on_fn_call_depth;
+	bool runtime_error_raised;
+};
+
 struct grug_state {
+	/// Has to stay the first member, as worker threads pass their bare grug_call_context around as a grug_state
+	struct grug_call_context call;
+	/// Holds what the last grug_update returned
 	struct grug_arena* update_arena;
-	struct grug_error last_error;
+	/// The files grug_update reports, which live in update_arena
+	struct grug_file* updates;
+	size_t updates_len;
+	size_t updates_capacity;
+	/// Finds the files in the mods directory that grug_update has to compile. Created by the first grug_update or grug_get_mods.
+	struct grug_watch* watch;
+	/// What grug_get_mods returns. Every file grug_update or grug_get_mods compiles from the mods directory is in it,
+	/// and the names in it are interned in `symbols`.
+	struct grug_mod_dir mods;
+	uint32_t update_budget;
+	struct grug_update_stats update_stats;
+	/// NULL unless the settings have a cache_dir_path
+	struct grug_cache* cache;
+	/// Updated with atomics, as files get compiled on the worker threads too
+	struct grug_cache_stats cache_stats;
+	/// hash_contents of mod_api_json_source, which cache entries are only valid for
+	uint64_t mod_api_hash;
+	/// Holds the strings of `symbols` and the arrays of `mod_api`, which live as long as the state does
+	struct grug_arena* symbols_arena;
+	/// Every name the state deals with (entity types, on_fn names, game fn names and the identifiers in scripts) is interned here,
+	/// so they are compared as integers
+	struct grug_interner symbols;
+	struct mod_api mod_api;
+	/// Every file compiled so far, where a file's grug_file_id is its index plus one
+	struct compiled_file* files;
+	uint32_t files_len;
+	uint32_t files_capacity;
+	/// A slot map of the entities, where an entity's id is the generation of its slot << 32 | (the slot's index + 1).
+	/// Slots live in pages that never move, so a struct grug_entity stays where it is until the entity is deinitialized.
+	struct entity_slot** entity_pages;
+	uint32_t entity_pages_len;
+	uint32_t entity_pages_capacity;
+	/// The number of slots that have ever been used
+	uint32_t entity_slots_len;
+	/// The index + 1 of the most recently freed slot, or 0 if there is none
+	uint32_t free_entity_slot;
 	char const* mod_api_json_source;
 	struct grug_logger logger;
+	struct grug_file_reader file_reader;
+	struct grug_runtime_error_handler runtime_error_handler;
 	struct grug_backend backend;
+	/// The paths of grug_compile_file are relative to this
+	char const* mods_dir_path;
 	bool fast_mode;
+	/// Goes up every time a file is compiled
+	uint64_t reload_epoch;
+	/// NULL if the settings asked for no worker threads, or if threads or the backend don't support them
+	struct grug_workers* workers;
+	/// What the worker threads run grug code with, indexed by worker - 1, as the calling thread uses `call`
+	struct grug_call_context* worker_contexts;
 };
 
+/// Returns the context of the thread that passed `gst`, which may be a worker thread's
+static inline struct grug_call_context* call_context_of(struct grug_state const* gst) {
+	return (struct grug_call_context*)(void*)gst;
+}
+
+/// Returns the state grug_init returned, given the grug_state any thread passed
+static inline struct grug_state* shared_state(struct grug_state const* gst) {
+	return call_context_of(gst)->shared;
+}
+
 static void write_error_plain(struct grug_error_code error_code, char const* message, char const* custom_message, struct grug_file_location file, struct grug_callstack callstack, struct grug_arena* arena_or_none, struct grug_error* out_error) {
 	if(out_error) {
 		if(!message && custom_message) {
@@ -126,17 +339,425 @@ static void write_error_plain_basic(struct grug_error_code error_code, char cons
 static void write_error(struct grug_state* gst, struct grug_error_code error_code, char const* message, char const* custom_message, struct grug_file_location file, struct grug_callstack callstack, struct grug_error* out_error) {
 	write_error_plain(error_code, message, custom_message, file, callstack, NULL, out_error);
 	if(gst) {
-		write_error_plain(error_code, message, custom_message, file, callstack, gst->last_error.arena, &gst->last_error);
+		struct grug_error* last_error = &call_context_of(gst)->last_error;
+		write_error_plain(error_code, message, custom_message, file, callstack, last_error->arena, last_error);
 	}
 }
 
 static void write_error_basic(struct grug_state* gst, struct grug_error_code error_code, char const* message, char const* custom_message, struct grug_error* out_error) {
 	write_error_plain(error_code, message, custom_message, (struct grug_file_location){0}, (struct grug_callstack){0}, NULL, out_error);
 	if(gst) {
-		write_error_plain(error_code, message, custom_message, (struct grug_file_location){0}, (struct grug_callstack){0}, gst->last_error.arena, &gst->last_error);
+		struct grug_error* last_error = &call_context_of(gst)->last_error;
+		write_error_plain(error_code, message, custom_message, (struct grug_file_location){0}, (struct grug_callstack){0}, last_error->arena, last_error);
+	}
+}
+
+// MARK: mod API
+
+struct mod_api_loader {
+	struct grug_interner* symbols;
+	/// Where the arrays of `api` are allocated, which is the arena of `symbols`
+	struct grug_arena* arena;
+	struct mod_api* api;
+	bool failed;
+	struct grug_error* out_error;
+};
+
+static bool mod_api_error(struct mod_api_loader* loader, char const* format, char const* name) {
+	if(!loader->failed) {
+		loader->failed = true;
+		// write_error_basic copies the message, so a stack buffer is fine
+		char message_buffer[256];
+		(void)snprintf(message_buffer, sizeof(message_buffer), format, name);
+		write_error_basic(NULL, GRUG_ERROR_CODE_INIT_MOD_API_JSON, message_buffer, NULL, loader->out_error);
+	}
+	return false;
+}
+
+static grug_symbol mod_api_intern(struct mod_api_loader* loader, char const* string, size_t len) {
+	grug_symbol symbol = grug_intern(loader->symbols, string, len);
+	if(symbol == GRUG_SYMBOL_NONE) {
+		(void)mod_api_error(loader, "Failed to load mod_api.json: %s", "grug_intern() returned null");
+	}
+	return symbol;
+}
+
+/// Allocates `count` zeroed items, and a harmless non-null pointer when `count` is 0
+static void* mod_api_alloc(struct mod_api_loader* loader, size_t count, size_t item_size) {
+	size_t size = count ? count * item_size : 1;
+	void* items = grug_arena_alloc(loader->arena, size);
+	if(!items) {
+		(void)mod_api_error(loader, "Failed to load mod_api.json: %s", "grug_arena_alloc() returned null");
+		return NULL;
+	}
+	memset(items, 0, size);
+	return items;
+}
+
+/// Returns the member `key` of `object` if it is of `type`, and reports an error mentioning `owner` if it isn't.
+/// `owner` is the name of the function or entity the object belongs to, or NULL for the top level object.
+static struct grug_json_value const* mod_api_get(struct mod_api_loader* loader, struct grug_json_value const* object, char const* key, grug_json_type type, bool optional, char const* owner) {
+	struct grug_json_value const* value = grug_json_get(object, key);
+	if((value || optional) && (!value || value->type == type)) {
+		return value;
+	}
+	char message_buffer[256];
+	if(owner && value) {
+		(void)snprintf(message_buffer, sizeof(message_buffer), "\"%s\" of '%s' has the wrong JSON type", key, owner);
+	} else if(owner) {
+		(void)snprintf(message_buffer, sizeof(message_buffer), "'%s' is missing \"%s\"", owner, key);
+	} else {
+		(void)snprintf(message_buffer, sizeof(message_buffer), value ? "\"%s\" has the wrong JSON type" : "\"%s\" is missing", key);
+	}
+	(void)mod_api_error(loader, "mod_api.json: %s", message_buffer);
+	return NULL;
+}
+
+static bool mod_api_parse_type(struct mod_api_loader* loader, struct grug_json_value const* type_string, struct grug_json_value const* param, char const* owner, struct mod_api_type* out_type) {
+	char const* name = type_string->data.string.chars;
+	size_t name_len = type_string->data.string.len;
+	*out_type = (struct mod_api_type) {.type = GRUG_TYPE_ID, .extra = GRUG_SYMBOL_NONE};
+	if(word_equals(name, name_len, "bool", 4)) {
+		out_type->type = GRUG_TYPE_BOOL;
+	} else if(word_equals(name, name_len, "number", 6)) {
+		out_type->type = GRUG_TYPE_NUMBER;
+	} else if(word_equals(name, name_len, "string", 6)) {
+		out_type->type = GRUG_TYPE_STRING;
+	} else if(word_equals(name, name_len, "id", 2)) {
+		out_type->type = GRUG_TYPE_ID;
+	} else if(word_equals(name, name_len, "resource", 8)) {
+		out_type->type = GRUG_TYPE_RESOURCE;
+		struct grug_json_value const* extension = mod_api_get(loader, param, "resource_extension", GRUG_JSON_STRING, false, owner);
+		if(!extension) {
+			return false;
+		}
+		out_type->extra = mod_api_intern(loader, extension->data.string.chars, extension->data.string.len);
+	} else if(word_equals(name, name_len, "entity", 6)) {
+		out_type->type = GRUG_TYPE_ENTITY;
+		struct grug_json_value const* entity_type = mod_api_get(loader, param, "entity_type", GRUG_JSON_STRING, true, owner);
+		if(entity_type) {
+			out_type->extra = mod_api_intern(loader, entity_type->data.string.chars, entity_type->data.string.len);
+		}
+	} else {
+		// Any other name is a custom id type like `Gun`
+		out_type->extra = mod_api_intern(loader, name, name_len);
+	}
+	return !loader->failed;
+}
+
+/// Counts the entries of an optional "arguments" array
+static size_t mod_api_count_params(struct grug_json_value const* function) {
+	struct grug_json_value const* arguments = grug_json_get(function, "arguments");
+	return arguments && arguments->type == GRUG_JSON_ARRAY ? arguments->data.array.len : 0;
+}
+
+/// Appends the "arguments" of `function` to the params, which were allocated with room for all of them
+static bool mod_api_parse_params(struct mod_api_loader* loader, struct grug_json_value const* function, char const* owner, uint32_t* out_first_param, uint32_t* out_params_len) {
+	struct mod_api* api = loader->api;
+	*out_first_param = api->params_len;
+	*out_params_len = 0;
+	struct grug_json_value const* arguments = mod_api_get(loader, function, "arguments", GRUG_JSON_ARRAY, true, owner);
+	if(!arguments) {
+		return !loader->failed;
+	}
+	for(size_t argument_index = 0; argument_index < arguments->data.array.len; argument_index += 1) {
+		struct grug_json_value const* argument = &arguments->data.array.items[argument_index];
+		if(argument->type != GRUG_JSON_OBJECT) {
+			return mod_api_error(loader, "mod_api.json: the arguments of '%s' must be objects", owner);
+		}
+		struct grug_json_value const* name = mod_api_get(loader, argument, "name", GRUG_JSON_STRING, false, owner);
+		struct grug_json_value const* type = mod_api_get(loader, argument, "type", GRUG_JSON_STRING, false, owner);
+		if(!name || !type) {
+			return false;
+		}
+		struct mod_api_param* param = &api->params[api->params_len];
+		param->name = mod_api_intern(loader, name->data.string.chars, name->data.string.len);
+		if(!mod_api_parse_type(loader, type, argument, owner, &param->type)) {
+			return false;
+		}
+		api->params_len += 1;
+		*out_params_len += 1;
+	}
+	return true;
+}
+
+static uint32_t game_fn_slot_of(struct mod_api const* api, grug_symbol name) {
+	// Fibonacci hashing, which spreads the dense symbols over the table
+	return (uint32_t)(name * 2654435769U) & (api->game_fn_slots_capacity - 1);
+}
+
+/// Returns the index of the game function called `name`, or GAME_FN_INDEX_NONE if mod_api.json doesn't declare it
+static uint32_t find_game_fn(struct mod_api const* api, grug_symbol name) {
+	if(name == GRUG_SYMBOL_NONE || !api->game_fn_slots_capacity) {
+		return GAME_FN_INDEX_NONE;
+	}
+	for(uint32_t slot = game_fn_slot_of(api, name);; slot = (slot + 1) & (api->game_fn_slots_capacity - 1)) {
+		uint32_t index = api->game_fn_slots[slot];
+		if(index == GAME_FN_INDEX_NONE || api->game_fns[index].name == name) {
+			return index;
+		}
+	}
+}
+
+static bool mod_api_parse_game_fns(struct mod_api_loader* loader, struct grug_json_value const* game_functions) {
+	struct mod_api* api = loader->api;
+	uint32_t slots_capacity = 16;
+	while(slots_capacity < game_functions->data.object.len * 2) {
+		slots_capacity *= 2;
+	}
+	api->game_fn_slots = mod_api_alloc(loader, slots_capacity, sizeof(uint32_t));
+	api->game_fns = mod_api_alloc(loader, game_functions->data.object.len, sizeof(struct game_fn_entry));
+	if(loader->failed) {
+		return false;
+	}
+	memset(api->game_fn_slots, 0xFF, slots_capacity * sizeof(uint32_t));
+	api->game_fn_slots_capacity = slots_capacity;
+
+	for(size_t fn_index = 0; fn_index < game_functions->data.object.len; fn_index += 1) {
+		struct grug_json_member const* member = &game_functions->data.object.members[fn_index];
+		if(member->value.type != GRUG_JSON_OBJECT) {
+			return mod_api_error(loader, "mod_api.json: the game function '%s' must be an object", member->key);
+		}
+		struct game_fn_entry* entry = &api->game_fns[api->game_fns_len];
+		entry->name = mod_api_intern(loader, member->key, member->key_len);
+		if(loader->failed) {
+			return false;
+		}
+		if(find_game_fn(api, entry->name) != GAME_FN_INDEX_NONE) {
+			return mod_api_error(loader, "mod_api.json: the game function '%s' is declared twice", member->key);
+		}
+		struct grug_json_value const* return_type = mod_api_get(loader, &member->value, "return_type", GRUG_JSON_STRING, true, member->key);
+		if(loader->failed) {
+			return false;
+		}
+		entry->return_type = (struct mod_api_type) {.type = GRUG_TYPE_VOID, .extra = GRUG_SYMBOL_NONE};
+		if(return_type && !mod_api_parse_type(loader, return_type, &member->value, member->key, &entry->return_type)) {
+			return false;
+		}
+		if(!mod_api_parse_params(loader, &member->value, member->key, &entry->first_param, &entry->params_len)) {
+			return false;
+		}
+		uint32_t slot = game_fn_slot_of(api, entry->name);
+		while(api->game_fn_slots[slot] != GAME_FN_INDEX_NONE) {
+			slot = (slot + 1) & (slots_capacity - 1);
+		}
+		api->game_fn_slots[slot] = api->game_fns_len;
+		api->game_fns_len += 1;
+	}
+	return true;
+}
+
+static bool mod_api_parse_entities(struct mod_api_loader* loader, struct grug_json_value const* entities) {
+	struct mod_api* api = loader->api;
+	api->entities = mod_api_alloc(loader, entities->data.object.len, sizeof(struct mod_api_entity));
+	if(loader->failed) {
+		return false;
+	}
+	for(size_t entity_index = 0; entity_index < entities->data.object.len; entity_index += 1) {
+		struct grug_json_member const* member = &entities->data.object.members[entity_index];
+		if(member->value.type != GRUG_JSON_OBJECT) {
+			return mod_api_error(loader, "mod_api.json: the entity '%s' must be an object", member->key);
+		}
+		struct mod_api_entity* entity = &api->entities[api->entities_len];
+		entity->name = mod_api_intern(loader, member->key, member->key_len);
+		entity->first_on_fn = api->on_fns_len;
+		struct grug_json_value const* on_functions = mod_api_get(loader, &member->value, "on_functions", GRUG_JSON_OBJECT, true, member->key);
+		if(loader->failed) {
+			return false;
+		}
+		size_t on_fns_len = on_functions ? on_functions->data.object.len : 0;
+		for(size_t on_fn_index = 0; on_fn_index < on_fns_len; on_fn_index += 1) {
+			struct grug_json_member const* on_fn_member = &on_functions->data.object.members[on_fn_index];
+			if(on_fn_member->value.type != GRUG_JSON_OBJECT) {
+				return mod_api_error(loader, "mod_api.json: the on function '%s' must be an object", on_fn_member->key);
+			}
+			struct mod_api_on_fn* on_fn = &api->on_fns[api->on_fns_len];
+			on_fn->name = mod_api_intern(loader, on_fn_member->key, on_fn_member->key_len);
+			if(!mod_api_parse_params(loader, &on_fn_member->value, on_fn_member->key, &on_fn->first_param, &on_fn->params_len)) {
+				return false;
+			}
+			api->on_fn_entries[api->on_fns_len] = (struct grug_on_fn_entry) {
+				.entity_name = grug_symbol_string(loader->symbols, entity->name),
+				.on_fn_name = grug_symbol_string(loader->symbols, on_fn->name),
+				.id = api->on_fns_len,
+			};
+			api->on_fns_len += 1;
+		}
+		entity->on_fns_len = api->on_fns_len - entity->first_on_fn;
+		api->entities_len += 1;
+	}
+	return true;
+}
+
+/// Fills `out_api` from the text of mod_api.json, interning every name into `symbols` and allocating the arrays from its arena.
+/// A source of nothing but whitespace declares an empty mod API, which is what grug_default_settings() gives.
+/// Returns false and writes to out_error upon an error.
+static bool load_mod_api(char const* json, struct grug_interner* symbols, struct mod_api* out_api, struct grug_error* out_error) {
+	*out_api = (struct mod_api) {0};
+	size_t json_len = strlen(json);
+	if(json_len == strspn(json, " \t\r\n")) {
+		return true;
+	}
+
+	// The JSON tree is only needed until everything in it has been copied into the mod API
+	struct grug_arena* json_arena = grug_arena_new();
+	if(!json_arena) {
+		write_error_basic(NULL, GRUG_ERROR_CODE_INIT_MOD_API, "Failed to load mod_api.json: grug_arena_new() returned null", NULL, out_error);
+		return false;
+	}
+	struct grug_json_value root;
+	char const* json_error = NULL;
+	size_t json_error_offset = 0;
+	if(!grug_json_parse(json, json_len, json_arena, &root, &json_error, &json_error_offset)) {
+		char message_buffer[256];
+		(void)snprintf(message_buffer, sizeof(message_buffer), "mod_api.json is not valid JSON: %s at byte %zu", json_error, json_error_offset);
+		write_error_basic(NULL, GRUG_ERROR_CODE_INIT_MOD_API_JSON, message_buffer, NULL, out_error);
+		grug_arena_deinit(json_arena);
+		return false;
+	}
+
+	struct mod_api_loader loader = {
+		.symbols = symbols,
+		.arena = symbols->arena,
+		.api = out_api,
+		.out_error = out_error,
+	};
+	struct grug_json_value const* entities = NULL;
+	struct grug_json_value const* game_functions = NULL;
+	if(root.type != GRUG_JSON_OBJECT) {
+		(void)mod_api_error(&loader, "%s must be a JSON object", "mod_api.json");
+	} else {
+		entities = mod_api_get(&loader, &root, "entities", GRUG_JSON_OBJECT, false, NULL);
+		game_functions = mod_api_get(&loader, &root, "game_functions", GRUG_JSON_OBJECT, false, NULL);
+	}
+
+	if(!loader.failed) {
+		// Everything is counted up front, so each array is allocated once at its final size
+		size_t params_len = 0;
+		size_t on_fns_len = 0;
+		for(size_t entity_index = 0; entity_index < entities->data.object.len; entity_index += 1) {
+			struct grug_json_value const* on_functions = grug_json_get(&entities->data.object.members[entity_index].value, "on_functions");
+			if(on_functions && on_functions->type == GRUG_JSON_OBJECT) {
+				on_fns_len += on_functions->data.object.len;
+				for(size_t on_fn_index = 0; on_fn_index < on_functions->data.object.len; on_fn_index += 1) {
+					params_len += mod_api_count_params(&on_functions->data.object.members[on_fn_index].value);
+				}
+			}
+		}
+		for(size_t fn_index = 0; fn_index < game_functions->data.object.len; fn_index += 1) {
+			params_len += mod_api_count_params(&game_functions->data.object.members[fn_index].value);
+		}
+		if(params_len > UINT32_MAX / 2 || on_fns_len > UINT32_MAX / 2 || game_functions->data.object.len > UINT32_MAX / 4) {
+			(void)mod_api_error(&loader, "%s declares too many functions", "mod_api.json");
+		} else {
+			out_api->params = mod_api_alloc(&loader, params_len, sizeof(struct mod_api_param));
+			out_api->on_fns = mod_api_alloc(&loader, on_fns_len, sizeof(struct mod_api_on_fn));
+			out_api->on_fn_entries = mod_api_alloc(&loader, on_fns_len, sizeof(struct grug_on_fn_entry));
+		}
+	}
+	if(!loader.failed && mod_api_parse_entities(&loader, entities)) {
+		(void)mod_api_parse_game_fns(&loader, game_functions);
+	}
+
+	grug_arena_deinit(json_arena);
+	// The arrays are in the state's arena and go away with it, so there's nothing else to clean up
+	return !loader.failed;
+}
+
+// MARK: worker threads
+
+static void free_called_game_fns(struct grug_state const* gst, uint64_t* called_game_fns) {
+	if(called_game_fns) {
+		GRUG_FREE(called_game_fns, (gst->mod_api.game_fns_len + 63) / 64 * sizeof(uint64_t));
+	}
+}
+
+static void free_defined_on_fns(struct grug_state const* gst, uint32_t entity_type, uint64_t* defined_on_fns) {
+	if(defined_on_fns) {
+		GRUG_FREE(defined_on_fns, (gst->mod_api.entities[entity_type].on_fns_len + 63) / 64 * sizeof(uint64_t));
+	}
+}
+
+static inline bool file_defines_on_fn(struct compiled_file const* file, uint32_t on_fn_index) {
+	return file->defined_on_fns && (file->defined_on_fns[on_fn_index / 64] >> (on_fn_index % 64) & 1);
+}
+
+static void free_member_layout(struct grug_member_layout* members, uint32_t members_len) {
+	if(members) {
+		GRUG_FREE(members, members_len * sizeof(struct grug_member_layout));
+	}
+}
+
+/// Frees what the directories and files in `dir` own, but not `dir` itself
+static void free_mod_dir(struct grug_mod_dir* dir) { // NOLINT(misc-no-recursion): directories are only nested as deep as the mods directory is
+	for(size_t file_index = 0; file_index < dir->files_size; file_index += 1) {
+		struct grug_error* error = dir->files[file_index].error;
+		if(error) {
+			grug_free_error(error);
+			GRUG_FREE(error, sizeof(struct grug_error));
+		}
+	}
+	if(dir->files) {
+		GRUG_FREE(dir->files, dir->_files_capacity * sizeof(struct grug_file));
+	}
+	for(size_t mod_index = 0; mod_index < dir->mods_size; mod_index += 1) {
+		free_mod_dir(dir->mods[mod_index]);
+		GRUG_FREE(dir->mods[mod_index], sizeof(struct grug_mod_dir));
 	}
+	if(dir->mods) {
+		GRUG_FREE(dir->mods, dir->_mods_capacity * sizeof(struct grug_mod_dir*));
+	}
+	*dir = (struct grug_mod_dir) {0};
+}
+
+static void stop_workers(struct grug_state* gst) {
+	if(!gst->workers) {
+		return;
+	}
+	uint32_t worker_contexts_len = grug_workers_count(gst->workers) - 1;
+	grug_workers_free(gst->workers);
+	gst->workers = NULL;
+	if(!gst->worker_contexts) {
+		return;
+	}
+	for(uint32_t index = 0; index < worker_contexts_len; index += 1) {
+		struct grug_call_context* context = &gst->worker_contexts[index];
+		if(context->backend_obj) {
+			gst->backend.vtable->drop_worker(context->backend_obj);
+		}
+		grug_free_error(&context->last_error);
+	}
+	GRUG_FREE(gst->worker_contexts, worker_contexts_len * sizeof(struct grug_call_context));
+	gst->worker_contexts = NULL;
 }
 
+/// Leaves gst->workers NULL if the threads or their backend data couldn't be created, in which case batches run on the calling thread
+static void start_workers(struct grug_state* gst, uint32_t threads) {
+	if(!threads || !gst->backend.vtable->new_worker || !gst->backend.vtable->drop_worker) {
+		return;
+	}
+	gst->workers = grug_workers_new(threads);
+	if(!gst->workers) {
+		return;
+	}
+	// Fewer threads may have started than were asked for
+	uint32_t worker_contexts_len = grug_workers_count(gst->workers) - 1;
+	gst->worker_contexts = GRUG_MALLOC(worker_contexts_len * sizeof(struct grug_call_context));
+	if(!gst->worker_contexts) {
+		stop_workers(gst);
+		return;
+	}
+	for(uint32_t index = 0; index < worker_contexts_len; index += 1) {
+		gst->worker_contexts[index] = (struct grug_call_context) {.shared = gst};
+	}
+	for(uint32_t index = 0; index < worker_contexts_len; index += 1) {
+		gst->worker_contexts[index].backend_obj = gst->backend.vtable->new_worker(gst->backend.obj);
+		if(!gst->worker_contexts[index].backend_obj) {
+			stop_workers(gst);
+			return;
+		}
+	}
+}
 
 // MARK: public functions
 
@@ -146,13 +767,21 @@ struct grug_init_settings grug_default_settings(void) {
 		.mods_dir_path = "",
 		.runtime_error_handler = {0},
 		.logger = {0},
+		.file_reader = {0},
 		.backend = {0},
+		.worker_threads = 0,
+		.update_budget = 0,
+		.cache_dir_path = NULL,
 	};
 }
 
 /// Returns null upon an error and writes to out_error
 struct grug_state* grug_init(struct grug_init_settings settings, struct grug_error* out_error) {
-	(void)settings;
+	// grug has no way of freeing what the game's read_fn returned without it
+	if(settings.file_reader.read_fn && !settings.file_reader.free_fn) {
+		write_error_basic(NULL, GRUG_ERROR_CODE_INIT, "Failed to create state: the file reader has a read_fn but no free_fn", NULL, out_error);
+		return NULL;
+	}
 	struct grug_state* gst = GRUG_MALLOC(sizeof(struct grug_state));
 	if(!gst) {
 		write_error_basic(NULL, GRUG_ERROR_CODE_INIT, "Failed to create state: malloc() returned null", NULL, out_error);
@@ -164,46 +793,104 @@ struct grug_state* grug_init(struct grug_init_settings settings, struct grug_err
 		GRUG_FREE(gst, sizeof(struct grug_state));
 		return NULL;
 	}
-	char* mod_api_json_source = NULL;
+	struct grug_arena* symbols_arena = grug_arena_new();
+	if(!symbols_arena) {
+		write_error_basic(NULL, GRUG_ERROR_CODE_INIT, "Failed to create state: grug_arena_new() returned null", NULL, out_error);
+		grug_arena_deinit(update_arena);
+		GRUG_FREE(gst, sizeof(struct grug_state));
+		return NULL;
+	}
+	struct file_contents mod_api_file = {0};
 	if(!settings.mod_api_json_source) {
 		if(!settings.mod_api_json_path) {
 			write_error_basic(NULL, GRUG_ERROR_CODE_INIT, "failed to create state: a mod_api.json is required", NULL, out_error);
+			grug_arena_deinit(symbols_arena);
+			grug_arena_deinit(update_arena);
 			GRUG_FREE(gst, sizeof(struct grug_state));
 			return NULL;
 		}
-		size_t file_len = 0;
-		mod_api_json_source = read_all_contents(settings.mod_api_json_path, &file_len);
-		if(!mod_api_json_source) {
+		if(!read_file(&settings.file_reader, settings.mod_api_json_path, &mod_api_file)) {
 			write_error_basic(NULL, GRUG_ERROR_CODE_INIT, "failed to create state: could not find the mod_api.json file", NULL, out_error);
+			grug_arena_deinit(symbols_arena);
+			grug_arena_deinit(update_arena);
 			GRUG_FREE(gst, sizeof(struct grug_state));
 			return NULL;
 		}
-	} else {
-		size_t file_len = strlen(settings.mod_api_json_source);
-		mod_api_json_source = GRUG_MALLOC(file_len + 1);
-		if(!mod_api_json_source) {
-			write_error_basic(NULL, GRUG_ERROR_CODE_INIT, "failed to create state: malloc() returned null", NULL, out_error);
-			GRUG_FREE(gst, sizeof(struct grug_state));
-			return NULL;
-		}
-		memcpy(mod_api_json_source, settings.mod_api_json_source, file_len);
-		mod_api_json_source[file_len] = 0;
+	}
+	// The state keeps its own copy, which also means it only ever frees what it allocated itself
+	char const* mod_api_json = settings.mod_api_json_source ? settings.mod_api_json_source : mod_api_file.text;
+	size_t mod_api_json_len = settings.mod_api_json_source ? strlen(settings.mod_api_json_source) : strlen(mod_api_file.text);
+	char* mod_api_json_source = GRUG_MALLOC(mod_api_json_len + 1);
+	if(mod_api_json_source) {
+		memcpy(mod_api_json_source, mod_api_json, mod_api_json_len);
+		mod_api_json_source[mod_api_json_len] = 0;
+	}
+	free_file_contents(&settings.file_reader, &mod_api_file);
+	if(!mod_api_json_source) {
+		write_error_basic(NULL, GRUG_ERROR_CODE_INIT, "failed to create state: malloc() returned null", NULL, out_error);
+		grug_arena_deinit(symbols_arena);
+		grug_arena_deinit(update_arena);
+		GRUG_FREE(gst, sizeof(struct grug_state));
+		return NULL;
 	}
 	// Not sure why but GCC doesn't like allowing the initializer for the empty last error to be inside the initializer for the grug_state.
 	struct grug_error last_error = {0};
 	*gst = (struct grug_state) {
-		.last_error = last_error,
+		.call = {
+			.shared = gst,
+			.last_error = last_error,
+		},
 		.update_arena = update_arena,
+		.symbols_arena = symbols_arena,
 		.mod_api_json_source = mod_api_json_source,
 		.logger = settings.logger,
+		.file_reader = settings.file_reader,
+		.runtime_error_handler = settings.runtime_error_handler,
 		.backend = settings.backend,
 		.fast_mode = false,
+		.update_budget = settings.update_budget,
+		.mod_api_hash = hash_contents(mod_api_json_source, strlen(mod_api_json_source)),
 	};
+	grug_interner_init(&gst->symbols, symbols_arena);
+	bool success = load_mod_api(mod_api_json_source, &gst->symbols, &gst->mod_api, out_error);
+	if(success) {
+		// Kept in the symbols' arena, as it lives as long as the state does
+		gst->mods_dir_path = grug_arena_copy_string(symbols_arena, settings.mods_dir_path ? settings.mods_dir_path : "");
+		success = gst->mods_dir_path != NULL;
+		if(!success) {
+			write_error_basic(NULL, GRUG_ERROR_CODE_INIT, "Failed to create state: grug_arena_alloc() returned null", NULL, out_error);
+		}
+	}
+	if(success && settings.cache_dir_path) {
+		gst->cache = grug_cache_new(settings.cache_dir_path);
+		success = gst->cache != NULL;
+		if(!success) {
+			write_error_basic(NULL, GRUG_ERROR_CODE_INIT, "Failed to create state: the cache directory couldn't be created", NULL, out_error);
+		}
+	}
+	if(success && !gst->backend.vtable) {
+		gst->backend = grug_bytecode_backend_new();
+		success = gst->backend.vtable != NULL;
+		if(!success) {
+			write_error_basic(NULL, GRUG_ERROR_CODE_INIT, "Failed to create state: grug_bytecode_backend_new() failed", NULL, out_error);
+		}
+	}
+	if(!success) {
+		grug_cache_free(gst->cache);
+		grug_interner_deinit(&gst->symbols);
+		grug_arena_deinit(symbols_arena);
+		grug_arena_deinit(update_arena);
+		GRUG_FREE(mod_api_json_source, strlen(mod_api_json_source) + 1);
+		GRUG_FREE(gst, sizeof(struct grug_state));
+		return NULL;
+	}
+	gst->call.backend_obj = gst->backend.obj;
+	start_workers(gst, settings.worker_threads);
 	return gst;
 }
 
 struct grug_error const* grug_get_error(struct grug_state* gst) {
-	return &gst->last_error;
+	return &call_context_of(gst)->last_error;
 }
 
 struct grug_callstack grug_get_callstack(struct grug_state* gst) {
@@ -213,92 +900,297 @@ struct grug_callstack grug_get_callstack(struct grug_state* gst) {
 }
 
 bool grug_register_game_fn(struct grug_state* gst, char const* game_fn_name, void* fn_data, game_fn fn_ptr) {
-	// assert(false && "Not Implemented");
-	(void)gst;
-	(void)game_fn_name;
-	(void)fn_data;
-	(void)fn_ptr;
-	return false;
+	// A name that was never interned can't be in the mod API, so there's no need to intern it
+	grug_symbol name = grug_interner_find(&gst->symbols, game_fn_name, strlen(game_fn_name));
+	uint32_t index = find_game_fn(&gst->mod_api, name);
+	char message_buffer[256];
+	if(index == GAME_FN_INDEX_NONE) {
+		(void)snprintf(message_buffer, sizeof(message_buffer), "The game function '%s' is not declared in mod_api.json", game_fn_name);
+		write_error_basic(gst, GRUG_ERROR_CODE_INIT_FUNCTION_REGISTRATION, message_buffer, NULL, NULL);
+		return false;
+	}
+	struct game_fn_entry* entry = &gst->mod_api.game_fns[index];
+	if(entry->fn) {
+		(void)snprintf(message_buffer, sizeof(message_buffer), "The game function '%s' has already been registered", game_fn_name);
+		write_error_basic(gst, GRUG_ERROR_CODE_INIT_FUNCTION_REGISTRATION, message_buffer, NULL, NULL);
+		return false;
+	}
+	if(!fn_ptr) {
+		(void)snprintf(message_buffer, sizeof(message_buffer), "The game function '%s' can't be registered as null", game_fn_name);
+		write_error_basic(gst, GRUG_ERROR_CODE_INIT_FUNCTION_REGISTRATION, message_buffer, NULL, NULL);
+		return false;
+	}
+	entry->fn = fn_ptr;
+	entry->fn_data = fn_data;
+	gst->mod_api.registered_game_fns_len += 1;
+	return true;
+}
+
+bool grug_set_game_fn_thread_safe(struct grug_state* gst, char const* game_fn_name, bool thread_safe) {
+	grug_symbol name = grug_interner_find(&gst->symbols, game_fn_name, strlen(game_fn_name));
+	uint32_t index = find_game_fn(&gst->mod_api, name);
+	if(index == GAME_FN_INDEX_NONE) {
+		char message_buffer[256];
+		(void)snprintf(message_buffer, sizeof(message_buffer), "The game function '%s' is not declared in mod_api.json", game_fn_name);
+		write_error_basic(gst, GRUG_ERROR_CODE_INIT_FUNCTION_REGISTRATION, message_buffer, NULL, NULL);
+		return false;
+	}
+	gst->mod_api.game_fns[index].thread_safe = thread_safe;
+	return true;
 }
 
 bool grug_all_game_functions_registered(struct grug_state* gst) {
-	assert(false && "Not Implemented");
-	(void)gst;
-	return false;
+	gst = shared_state(gst);
+	return gst->mod_api.registered_game_fns_len == gst->mod_api.game_fns_len;
 }
 
 grug_on_fn_id grug_get_on_fn_id(struct grug_state* gst, const char* entity_type, const char* on_fn_name) {
-	assert(false && "Not Implemented");
-	(void)gst;
-	(void)entity_type;
-	(void)on_fn_name;
-	return 0;
+	gst = shared_state(gst);
+	struct mod_api const* api = &gst->mod_api;
+	grug_symbol entity_symbol = grug_interner_find(&gst->symbols, entity_type, strlen(entity_type));
+	grug_symbol on_fn_symbol = grug_interner_find(&gst->symbols, on_fn_name, strlen(on_fn_name));
+	if(entity_symbol == GRUG_SYMBOL_NONE || on_fn_symbol == GRUG_SYMBOL_NONE) {
+		return INVALID_GRUG_ON_FN_ID;
+	}
+	// Games look these up once and keep the ids, so a linear search over symbols is plenty
+	for(uint32_t entity_index = 0; entity_index < api->entities_len; entity_index += 1) {
+		struct mod_api_entity const* entity = &api->entities[entity_index];
+		if(entity->name != entity_symbol) {
+			continue;
+		}
+		for(uint32_t on_fn_index = entity->first_on_fn; on_fn_index < entity->first_on_fn + entity->on_fns_len; on_fn_index += 1) {
+			if(api->on_fns[on_fn_index].name == on_fn_symbol) {
+				return on_fn_index;
+			}
+		}
+		break;
+	}
+	return INVALID_GRUG_ON_FN_ID;
 }
 
 struct grug_on_fns grug_get_fn_ids(struct grug_state* gst) {
-	assert(false && "Not Implemented");
-	(void)gst;
-	return (struct grug_on_fns){0};
+	gst = shared_state(gst);
+	return (struct grug_on_fns) {
+		.entries = gst->mod_api.on_fn_entries,
+		.count = gst->mod_api.on_fns_len,
+	};
 }
 
-grug_file_id grug_compile_file(struct grug_state* gst, const char* path) {
-	assert(false && "Not Implemented");
-	(void)gst;
-	(void)path;
-	return 0;
+static inline struct entity_slot* entity_slot_at(struct grug_state const* gst, uint32_t slot_index) {
+	return &gst->entity_pages[slot_index / ENTITY_PAGE_SIZE][slot_index % ENTITY_PAGE_SIZE];
 }
 
-grug_file_id grug_compile_file_from_str(struct grug_state* gst, const char* path, char const* file_text) {
-	assert(false && "Not Implemented");
-	(void)gst;
-	(void)path;
-	(void)file_text;
-	return 0;
+/// Returns NULL if `entity` isn't an entity that is alive, which includes the ids of deinitialized entities whose slot got reused
+static struct grug_entity* entity_of(struct grug_state* gst, grug_entity_id entity) {
+	uint32_t slot_index = (uint32_t)entity - 1;
+	if(slot_index >= gst->entity_slots_len) {
+		return NULL;
+	}
+	struct entity_slot* slot = entity_slot_at(gst, slot_index);
+	return slot->entity.id == entity ? &slot->entity : NULL;
 }
 
-const struct grug_mod_dir* grug_get_mods(struct grug_state* gst) {
-	assert(false && "Not Implemented");
-	(void)gst;
-	return NULL;
+/// Every call into the backend that can run grug code is wrapped in begin_grug_call and end_grug_call, with the grug_state the thread passed
+static void begin_grug_call(struct grug_state* gst) {
+	struct grug_call_context* call = call_context_of(gst);
+	if(call->on_fn_call_depth == 0) {
+		call->runtime_error_raised = false;
+	}
+	call->on_fn_call_depth += 1;
 }
 
-grug_entity_id grug_create_entity(struct grug_state* gst, grug_file_id script, grug_object_id me_id) {
-	assert(false && "Not Implemented");
-	(void)gst;
-	(void)script;
-	(void)me_id;
-	return 0;
+/// Hands a runtime error to the runtime error handler once the outermost call returns, and returns whether the call succeeded
+static bool end_grug_call(struct grug_state* gst, bool success) {
+	struct grug_call_context* call = call_context_of(gst);
+	struct grug_state* shared = call->shared;
+	call->on_fn_call_depth -= 1;
+	bool raised = call->runtime_error_raised;
+	if(raised && call->on_fn_call_depth == 0) {
+		call->runtime_error_raised = false;
+		if(shared->runtime_error_handler.handler_fn) {
+			// Worker threads take turns, so the handler doesn't have to be thread-safe
+			if(shared->workers) {
+				grug_workers_lock(shared->workers);
+			}
+			shared->runtime_error_handler.handler_fn(gst, &call->last_error, shared->runtime_error_handler.user_data);
+			if(shared->workers) {
+				grug_workers_unlock(shared->workers);
+			}
+		}
+	}
+	return success && !raised;
 }
 
-grug_file_id grug_entity_get_file_id(struct grug_state* gst, grug_entity_id entity) {
-	assert(false && "Not Implemented");
-	(void)gst;
-	(void)entity;
-	return 0;
+void grug_raise_runtime_error(struct grug_state* gst, struct grug_error_code error_code, char const* message) {
+	struct grug_call_context* call = call_context_of(gst);
+	if(call->runtime_error_raised) {
+		return;
+	}
+	call->runtime_error_raised = true;
+	write_error_basic(gst, error_code, message, NULL, NULL);
 }
 
-struct grug_entity* grug_entity_get_data(struct grug_state* gst, grug_entity_id entity) {
-	assert(false && "Not Implemented");
-	(void)gst;
-	(void)entity;
-	return NULL;
+bool grug_runtime_error_raised(struct grug_state const* gst) {
+	return call_context_of(gst)->runtime_error_raised;
 }
 
-void grug_deinit_entity(struct grug_state* gst, grug_entity_id entity) {
-	assert(false && "Not Implemented");
-	(void)gst;
-	(void)entity;
+bool grug_fast_mode(struct grug_state const* gst) {
+	return shared_state(gst)->fast_mode;
 }
 
-struct grug_updates_list grug_update(struct grug_state* gst) {
-	assert(false && "Not Implemented");
-	(void)gst;
-	return (struct grug_updates_list){0};
+static bool add_entity_page(struct grug_state* gst) {
+	if(gst->entity_pages_len == gst->entity_pages_capacity) {
+		uint32_t new_capacity = gst->entity_pages_capacity ? gst->entity_pages_capacity * 2 : 16;
+		struct entity_slot** new_pages = grug_realloc(gst->entity_pages, gst->entity_pages_capacity * sizeof(struct entity_slot*), new_capacity * sizeof(struct entity_slot*));
+		if(!new_pages) {
+			return false;
+		}
+		gst->entity_pages = new_pages;
+		gst->entity_pages_capacity = new_capacity;
+	}
+	struct entity_slot* page = GRUG_MALLOC(ENTITY_PAGE_SIZE * sizeof(struct entity_slot));
+	if(!page) {
+		return false;
+	}
+	memset(page, 0, ENTITY_PAGE_SIZE * sizeof(struct entity_slot));
+	gst->entity_pages[gst->entity_pages_len++] = page;
+	return true;
 }
 
-void grug_deinit(struct grug_state* gst) {
-	assert(false && "Not Implemented");
-	(void)gst;
+static void free_entity_slot(struct grug_state* gst, uint32_t slot_index) {
+	struct entity_slot* slot = entity_slot_at(gst, slot_index);
+	slot->entity = (struct grug_entity) {0};
+	slot->generation += 1;
+	slot->next_free = gst->free_entity_slot;
+	gst->free_entity_slot = slot_index + 1;
+}
+
+grug_entity_id grug_create_entity(struct grug_state* gst, grug_file_id script, grug_object_id me_id) {
+	if(script == 0 || script > gst->files_len) {
+		write_error_basic(gst, GRUG_ERROR_CODE_RUNTIME, "Failed to create an entity: the file id doesn't belong to a compiled file", NULL, NULL);
+		return INVALID_GRUG_ENTITY_ID;
+	}
+	if(gst->files[script - 1].removed) {
+		write_error_basic(gst, GRUG_ERROR_CODE_RUNTIME, "Failed to create an entity: the file was removed from the mods directory", NULL, NULL);
+		return INVALID_GRUG_ENTITY_ID;
+	}
+	// The most recently freed slot is reused first, as it's the most likely to still be in the cache
+	uint32_t slot_index = gst->free_entity_slot - 1;
+	if(!gst->free_entity_slot) {
+		slot_index = gst->entity_slots_len;
+		if(slot_index == UINT32_MAX - 1) {
+			write_error_basic(gst, GRUG_ERROR_CODE_RUNTIME, "Failed to create an entity: there are too many entities", NULL, NULL);
+			return INVALID_GRUG_ENTITY_ID;
+		}
+		if(slot_index / ENTITY_PAGE_SIZE == gst->entity_pages_len && !add_entity_page(gst)) {
+			write_error_basic(gst, GRUG_ERROR_CODE_RUNTIME, "Failed to create an entity: malloc() returned null", NULL, NULL);
+			return INVALID_GRUG_ENTITY_ID;
+		}
+		gst->entity_slots_len += 1;
+	} else {
+		gst->free_entity_slot = entity_slot_at(gst, slot_index)->next_free;
+	}
+	struct entity_slot* slot = entity_slot_at(gst, slot_index);
+	slot->entity = (struct grug_entity) {
+		.id = (grug_entity_id)slot->generation << 32 | (slot_index + 1),
+		.file_id = script,
+		.me = me_id,
+		.data = NULL,
+	};
+	begin_grug_call(gst);
+	bool success = end_grug_call(gst, gst->backend.vtable->init_entity(gst->backend.obj, gst, &slot->entity));
+	if(!success) {
+		gst->backend.vtable->entity_data(gst->backend.obj, &slot->entity);
+		free_entity_slot(gst, slot_index);
+		return INVALID_GRUG_ENTITY_ID;
+	}
+	return slot->entity.id;
+}
+
+grug_file_id grug_entity_get_file_id(struct grug_state* gst, grug_entity_id entity) {
+	struct grug_entity* data = entity_of(shared_state(gst), entity);
+	return data ? data->file_id : 0;
+}
+
+struct grug_entity* grug_entity_get_data(struct grug_state* gst, grug_entity_id entity) {
+	return entity_of(shared_state(gst), entity);
+}
+
+size_t grug_get_member_layout(struct grug_state* gst, grug_file_id file_id, struct grug_member_layout const** out_members) {
+	gst = shared_state(gst);
+	if(file_id == 0 || file_id > gst->files_len) {
+		*out_members = NULL;
+		return 0;
+	}
+	struct compiled_file const* file = &gst->files[file_id - 1];
+	*out_members = file->members;
+	return file->members_len;
+}
+
+void* grug_entity_members(struct grug_state* gst, grug_entity_id entity) {
+	struct grug_state* shared = shared_state(gst);
+	struct grug_entity* data = entity_of(shared, entity);
+	if(!data || !shared->backend.vtable->entity_members) {
+		return NULL;
+	}
+	return shared->backend.vtable->entity_members(call_context_of(gst)->backend_obj, data);
+}
+
+void grug_deinit_entity(struct grug_state* gst, grug_entity_id entity) {
+	struct grug_entity* data = entity_of(gst, entity);
+	if(!data) {
+		return;
+	}
+	gst->backend.vtable->entity_data(gst->backend.obj, data);
+	free_entity_slot(gst, (uint32_t)entity - 1);
+}
+
+void grug_deinit(struct grug_state* gst) {
+	if(!gst) {
+		return;
+	}
+	for(uint32_t slot_index = 0; slot_index < gst->entity_slots_len; slot_index += 1) {
+		struct entity_slot* slot = entity_slot_at(gst, slot_index);
+		if(slot->entity.id) {
+			gst->backend.vtable->entity_data(gst->backend.obj, &slot->entity);
+		}
+	}
+	for(uint32_t page_index = 0; page_index < gst->entity_pages_len; page_index += 1) {
+		GRUG_FREE(gst->entity_pages[page_index], ENTITY_PAGE_SIZE * sizeof(struct entity_slot));
+	}
+	if(gst->entity_pages) {
+		GRUG_FREE(gst->entity_pages, gst->entity_pages_capacity * sizeof(struct entity_slot*));
+	}
+	for(uint32_t file_index = 0; file_index < gst->files_len; file_index += 1) {
+		free_called_game_fns(gst, gst->files[file_index].called_game_fns);
+		free_defined_on_fns(gst, gst->files[file_index].entity_type, gst->files[file_index].defined_on_fns);
+		free_member_layout(gst->files[file_index].members, gst->files[file_index].members_len);
+	}
+	if(gst->files) {
+		GRUG_FREE(gst->files, gst->files_capacity * sizeof(struct compiled_file));
+	}
+	stop_workers(gst);
+	grug_watch_free(gst->watch);
+	free_mod_dir(&gst->mods);
+	grug_cache_free(gst->cache);
+	if(gst->backend.vtable->drop) {
+		gst->backend.vtable->drop(gst->backend.obj);
+	}
+	if(gst->logger.drop_fn) {
+		gst->logger.drop_fn(gst->logger.user_data);
+	}
+	if(gst->file_reader.drop_fn) {
+		gst->file_reader.drop_fn(gst->file_reader.user_data);
+	}
+	if(gst->runtime_error_handler.drop_fn) {
+		gst->runtime_error_handler.drop_fn(gst->runtime_error_handler.user_data);
+	}
+	grug_interner_deinit(&gst->symbols);
+	grug_arena_deinit(gst->symbols_arena);
+	grug_arena_deinit(gst->update_arena);
+	grug_free_error(&gst->call.last_error);
+	GRUG_FREE((void*)gst->mod_api_json_source, strlen(gst->mod_api_json_source) + 1);
+	GRUG_FREE(gst, sizeof(struct grug_state));
 }
 
 void grug_swap_backend(struct grug_state* gst, struct grug_backend backend) {
@@ -311,29 +1203,388 @@ void grug_set_fast_mode(struct grug_state* gst, bool fast) {
 	gst->fast_mode = fast;
 }
 
+/// Returns the index of `on_fn_id` among the on functions of the entity's type, or GAME_FN_INDEX_NONE if the entity's type doesn't have it
+static uint32_t on_fn_index_of(struct grug_state const* gst, struct grug_entity const* entity, grug_on_fn_id on_fn_id) {
+	struct mod_api_entity const* entity_type = &gst->mod_api.entities[gst->files[entity->file_id - 1].entity_type];
+	if(on_fn_id < entity_type->first_on_fn || on_fn_id >= (grug_on_fn_id)entity_type->first_on_fn + entity_type->on_fns_len) {
+		return GAME_FN_INDEX_NONE;
+	}
+	return (uint32_t)(on_fn_id - entity_type->first_on_fn);
+}
+
 bool grug_call_on_function_raw(struct grug_state* gst, grug_entity_id entity, grug_on_fn_id on_fn_id, union grug_value* args) {
-	assert(false && "Not Implemented");
-	(void)gst;
-	(void)entity;
-	(void)on_fn_id;
-	(void)args;
-	return false;
+	struct grug_state* shared = shared_state(gst);
+	struct grug_entity* data = entity_of(shared, entity);
+	if(!data) {
+		return false;
+	}
+	uint32_t on_fn_index = on_fn_index_of(shared, data, on_fn_id);
+	if(on_fn_index == GAME_FN_INDEX_NONE) {
+		return false;
+	}
+	if(!file_defines_on_fn(&shared->files[data->file_id - 1], on_fn_index)) {
+		return true;
+	}
+	begin_grug_call(gst);
+	return end_grug_call(gst, shared->backend.vtable->call_on_function_raw(call_context_of(gst)->backend_obj, gst, data, on_fn_index, args));
 }
 
 bool grug_call_on_function(struct grug_state* gst, grug_entity_id entity, grug_on_fn_id on_fn_id, union grug_value* args, size_t args_len) {
-	assert(false && "Not Implemented");
+	struct grug_state* shared = shared_state(gst);
+	struct grug_entity* data = entity_of(shared, entity);
+	if(!data) {
+		return false;
+	}
+	uint32_t on_fn_index = on_fn_index_of(shared, data, on_fn_id);
+	if(on_fn_index == GAME_FN_INDEX_NONE || args_len != shared->mod_api.on_fns[on_fn_id].params_len) {
+		return false;
+	}
+	if(!file_defines_on_fn(&shared->files[data->file_id - 1], on_fn_index)) {
+		return true;
+	}
+	begin_grug_call(gst);
+	return end_grug_call(gst, shared->backend.vtable->call_on_function(call_context_of(gst)->backend_obj, gst, data, on_fn_index, args, args_len));
+}
+
+bool grug_file_defines_on_fn(struct grug_state* gst, grug_file_id file_id, grug_on_fn_id on_fn_id) {
+	gst = shared_state(gst);
+	if(file_id == 0 || file_id > gst->files_len) {
+		return false;
+	}
+	struct compiled_file const* file = &gst->files[file_id - 1];
+	struct mod_api_entity const* entity_type = &gst->mod_api.entities[file->entity_type];
+	if(on_fn_id < entity_type->first_on_fn || on_fn_id >= (grug_on_fn_id)entity_type->first_on_fn + entity_type->on_fns_len) {
+		return false;
+	}
+	return file_defines_on_fn(file, (uint32_t)(on_fn_id - entity_type->first_on_fn));
+}
+
+size_t grug_get_entities_defining_on_fn(struct grug_state* gst, grug_on_fn_id on_fn_id, grug_entity_id* out_entities, size_t capacity) {
+	gst = shared_state(gst);
+	size_t found = 0;
+	for(uint32_t slot_index = 0; slot_index < gst->entity_slots_len; slot_index += 1) {
+		struct grug_entity const* entity = &entity_slot_at(gst, slot_index)->entity;
+		if(!entity->id) {
+			continue;
+		}
+		uint32_t on_fn_index = on_fn_index_of(gst, entity, on_fn_id);
+		if(on_fn_index == GAME_FN_INDEX_NONE || !file_defines_on_fn(&gst->files[entity->file_id - 1], on_fn_index)) {
+			continue;
+		}
+		if(found < capacity) {
+			out_entities[found] = entity->id;
+		}
+		found += 1;
+	}
+	return found;
+}
+
+/// What handles of on functions that their file doesn't define call, so that calling them doesn't enter the backend
+static bool call_undefined_on_fn(void* backend_data, struct grug_state* gst, struct grug_entity* entity, uint64_t on_fn_index, union grug_value* args) {
+	(void)backend_data;
 	(void)gst;
 	(void)entity;
-	(void)on_fn_id;
+	(void)on_fn_index;
 	(void)args;
-	(void)args_len;
-	return false;
+	return true;
+}
+
+struct grug_on_fn_handle grug_get_on_fn_handle(struct grug_state* gst, grug_file_id file_id, grug_on_fn_id on_fn_id) {
+	gst = shared_state(gst);
+	struct grug_on_fn_handle handle = {0};
+	if(file_id == 0 || file_id > gst->files_len) {
+		return handle;
+	}
+	struct compiled_file const* file = &gst->files[file_id - 1];
+	struct mod_api_entity const* entity_type = &gst->mod_api.entities[file->entity_type];
+	if(on_fn_id < entity_type->first_on_fn || on_fn_id >= (grug_on_fn_id)entity_type->first_on_fn + entity_type->on_fns_len) {
+		return handle;
+	}
+	handle.file_id = file_id;
+	handle.on_fn_index = (uint32_t)(on_fn_id - entity_type->first_on_fn);
+	handle.call = file_defines_on_fn(file, handle.on_fn_index) ? gst->backend.vtable->call_on_function_raw : call_undefined_on_fn;
+	handle.args_len = gst->mod_api.on_fns[on_fn_id].params_len;
+	handle.epoch = file->epoch;
+	return handle;
+}
+
+bool grug_on_fn_handle_valid(struct grug_state const* gst, struct grug_on_fn_handle const* handle) {
+	gst = shared_state(gst);
+	return handle->call && handle->file_id <= gst->files_len && gst->files[handle->file_id - 1].epoch == handle->epoch;
+}
+
+uint64_t grug_reload_epoch(struct grug_state const* gst) {
+	return shared_state(gst)->reload_epoch;
+}
+
+bool grug_call_on_fn_handle(struct grug_state* gst, struct grug_on_fn_handle const* handle, grug_entity_id entity, union grug_value* args, size_t args_len) {
+	struct grug_state* shared = shared_state(gst);
+	struct grug_entity* data;
+	if(shared->fast_mode) {
+		// The game promised the entity is alive and of the handle's file
+		data = &entity_slot_at(shared, (uint32_t)entity - 1)->entity;
+	} else {
+		data = entity_of(shared, entity);
+		if(!data || !grug_on_fn_handle_valid(shared, handle) || data->file_id != handle->file_id || args_len != handle->args_len) {
+			return false;
+		}
+	}
+	begin_grug_call(gst);
+	// The backend data of the calling thread's context rather than something stored in the handle, so worker threads run it with their own
+	return end_grug_call(gst, handle->call(call_context_of(gst)->backend_obj, gst, data, handle->on_fn_index, args));
+}
+
+/// Runs a batch of entities of one file, reporting the runtime error of every call that fails as if it were called on its own
+static bool call_on_function_batch_of_file(struct grug_state* gst, struct grug_entity* const* entities, size_t const* indices, size_t count, uint32_t on_fn_index, union grug_value const* args, size_t stride, bool* results) {
+	struct grug_backend_vtable const* vtable = shared_state(gst)->backend.vtable;
+	void* backend_obj = call_context_of(gst)->backend_obj;
+	bool all_succeeded = true;
+	size_t done = 0;
+	while(done < count) {
+		union grug_value const* batch_args = args ? args + done * stride : NULL;
+		begin_grug_call(gst);
+		size_t succeeded;
+		bool failed;
+		if(vtable->call_on_function_batch) {
+			succeeded = vtable->call_on_function_batch(backend_obj, gst, entities + done, count - done, on_fn_index, batch_args, stride);
+			failed = done + succeeded < count;
+		} else {
+			// call_on_function_raw doesn't write to its arguments
+			failed = !vtable->call_on_function_raw(backend_obj, gst, entities[done], on_fn_index, (union grug_value*)batch_args);
+			succeeded = failed ? 0 : 1;
+		}
+		if(!end_grug_call(gst, !failed)) {
+			all_succeeded = false;
+		}
+		for(size_t index = done; results && index < done + succeeded; index += 1) {
+			results[indices[index]] = true;
+		}
+		done += succeeded;
+		if(failed) {
+			all_succeeded = false;
+			done += 1;
+		}
+	}
+	return all_succeeded;
+}
+
+/// The entities of one file in a batch, which are next to each other once they are sorted
+struct batch_group {
+	size_t start;
+	size_t end;
+	/// GAME_FN_INDEX_NONE if the file's entity type doesn't have the on function
+	uint32_t on_fn_index;
+	/// Set if the group has to run on the calling thread
+	bool main_thread;
+	/// Set if the file doesn't define the on function, so the calls would do nothing.
+	/// The group is still kept, as the workers need the groups to cover every sorted entity.
+	bool skipped;
+};
+
+/// What every worker of a parallel batch shares
+struct batch_job {
+	/// The state grug_init returned
+	struct grug_state* gst;
+	struct batch_group const* groups;
+	size_t groups_len;
+	struct grug_entity* const* entities;
+	size_t const* indices;
+	union grug_value const* args;
+	size_t stride;
+	bool* results;
+	/// Set by any worker whose call failed
+	bool failed;
+};
+
+/// The fewest entities a worker runs at a time, so stealing doesn't cost more than the calls it spreads out
+#define BATCH_GRAIN 64
+
+/// Returns whether every game function the file calls is thread-safe
+static bool file_is_thread_safe(struct grug_state const* gst, grug_file_id file_id) {
+	uint64_t const* called_game_fns = gst->files[file_id - 1].called_game_fns;
+	for(uint32_t game_fn_index = 0; called_game_fns && game_fn_index < gst->mod_api.game_fns_len; game_fn_index += 1) {
+		if((called_game_fns[game_fn_index / 64] >> (game_fn_index % 64) & 1) && !gst->mod_api.game_fns[game_fn_index].thread_safe) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/// Runs the sorted entities in [start, end) that may run on worker threads
+static void run_batch_range(void* data, uint32_t worker, size_t start, size_t end) {
+	struct batch_job* job = data;
+	// Worker threads run their calls with their own context, which they pass around as their grug_state
+	struct grug_state* gst = worker ? (struct grug_state*)(void*)&job->gst->worker_contexts[worker - 1] : job->gst;
+	// Finds the group that `start` is in
+	size_t low = 0;
+	size_t high = job->groups_len;
+	while(low < high) {
+		size_t middle = low + (high - low) / 2;
+		if(job->groups[middle].end <= start) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	for(size_t group_index = low; start < end; group_index += 1) {
+		struct batch_group const* group = &job->groups[group_index];
+		size_t stop = group->end < end ? group->end : end;
+		if(!group->main_thread && !group->skipped && group->on_fn_index != GAME_FN_INDEX_NONE) {
+			union grug_value const* args = job->args ? job->args + start * job->stride : NULL;
+			if(!call_on_function_batch_of_file(gst, job->entities + start, job->indices + start, stop - start, group->on_fn_index, args, job->stride, job->results)) {
+				__atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+			}
+		}
+		start = stop;
+	}
+}
+
+bool grug_call_on_function_batch(struct grug_state* gst, grug_on_fn_id on_fn_id, grug_entity_id const* entities, size_t count, union grug_value const* args, size_t stride, bool* results) {
+	if(results) {
+		memset(results, 0, count * sizeof(bool));
+	}
+	if(!count) {
+		return true;
+	}
+	struct grug_state* shared = shared_state(gst);
+	// No entity can be valid without a compiled file
+	uint32_t files_len = shared->files_len;
+	if(on_fn_id >= shared->mod_api.on_fns_len || !files_len) {
+		return false;
+	}
+	size_t params_len = shared->mod_api.on_fns[on_fn_id].params_len;
+	if(!params_len || !args) {
+		args = NULL;
+		stride = 0;
+	}
+	size_t groups_capacity = files_len < count ? files_len : count;
+	struct grug_entity** sorted = GRUG_MALLOC(count * sizeof(struct grug_entity*));
+	size_t* sorted_indices = GRUG_MALLOC(count * sizeof(size_t));
+	size_t* file_starts = GRUG_MALLOC((files_len + 2) * sizeof(size_t));
+	struct batch_group* groups = GRUG_MALLOC(groups_capacity * sizeof(struct batch_group));
+	union grug_value* gathered = stride ? GRUG_MALLOC(count * params_len * sizeof(union grug_value)) : NULL;
+	bool all_succeeded = true;
+	if(!sorted || !sorted_indices || !file_starts || !groups || (stride && !gathered)) {
+		// Calling the entities one by one doesn't need any memory
+		for(size_t index = 0; index < count; index += 1) {
+			bool succeeded = grug_call_on_function_raw(gst, entities[index], on_fn_id, args ? (union grug_value*)(args + index * stride) : NULL);
+			if(results) {
+				results[index] = succeeded;
+			}
+			all_succeeded &= succeeded;
+		}
+	} else {
+		// A counting sort groups the entities by file, keeping the order they were passed in within every file
+		memset(file_starts, 0, (files_len + 2) * sizeof(size_t));
+		for(size_t index = 0; index < count; index += 1) {
+			struct grug_entity const* data = entity_of(shared, entities[index]);
+			if(data) {
+				file_starts[data->file_id + 1] += 1;
+			} else {
+				all_succeeded = false;
+			}
+		}
+		for(uint32_t file_id = 1; file_id <= files_len + 1; file_id += 1) {
+			file_starts[file_id] += file_starts[file_id - 1];
+		}
+		for(size_t index = 0; index < count; index += 1) {
+			struct grug_entity* data = entity_of(shared, entities[index]);
+			if(data) {
+				size_t position = file_starts[data->file_id]++;
+				sorted[position] = data;
+				sorted_indices[position] = index;
+			}
+		}
+		size_t sorted_len = file_starts[files_len];
+
+		// file_starts[file_id] is now where the entities of the next file start
+		// A batch that a game function starts on a worker thread stays on that thread
+		bool parallel = shared->workers && gst == shared && sorted_len <= UINT32_MAX;
+		size_t parallel_len = 0;
+		size_t groups_len = 0;
+		size_t start = 0;
+		for(uint32_t file_id = 1; file_id <= files_len; file_id += 1) {
+			size_t end = file_starts[file_id];
+			if(start == end) {
+				continue;
+			}
+			uint32_t on_fn_index = on_fn_index_of(shared, sorted[start], on_fn_id);
+			struct batch_group* group = &groups[groups_len++];
+			*group = (struct batch_group) {
+				.start = start,
+				.end = end,
+				.on_fn_index = on_fn_index,
+				.main_thread = !parallel || !file_is_thread_safe(shared, file_id),
+				.skipped = on_fn_index != GAME_FN_INDEX_NONE && !file_defines_on_fn(&shared->files[file_id - 1], on_fn_index),
+			};
+			if(group->skipped) {
+				// The calls would do nothing, so they succeed without reaching the backend
+				for(size_t position = start; results && position < end; position += 1) {
+					results[sorted_indices[position]] = true;
+				}
+			} else if(group->on_fn_index == GAME_FN_INDEX_NONE) {
+				all_succeeded = false;
+			} else if(!group->main_thread) {
+				parallel_len += end - start;
+			}
+			start = end;
+		}
+		// The arguments are gathered in the order the entities were sorted in
+		if(stride) {
+			for(size_t position = 0; position < sorted_len; position += 1) {
+				memcpy(gathered + position * params_len, args + sorted_indices[position] * stride, params_len * sizeof(union grug_value));
+			}
+			args = gathered;
+			stride = params_len;
+		}
+
+		struct batch_job job = {
+			.gst = shared,
+			.groups = groups,
+			.groups_len = groups_len,
+			.entities = sorted,
+			.indices = sorted_indices,
+			.args = args,
+			.stride = stride,
+			.results = results,
+			.failed = false,
+		};
+		if(parallel_len >= 2 * BATCH_GRAIN) {
+			grug_workers_run(shared->workers, sorted_len, BATCH_GRAIN, run_batch_range, &job);
+			all_succeeded &= !job.failed;
+		} else {
+			// Too few entities to be worth waking the threads for
+			for(size_t group_index = 0; group_index < groups_len; group_index += 1) {
+				groups[group_index].main_thread = true;
+			}
+		}
+		for(size_t group_index = 0; group_index < groups_len; group_index += 1) {
+			struct batch_group const* group = &groups[group_index];
+			if(group->main_thread && !group->skipped && group->on_fn_index != GAME_FN_INDEX_NONE) {
+				all_succeeded &= call_on_function_batch_of_file(gst, sorted + group->start, sorted_indices + group->start, group->end - group->start, group->on_fn_index, args ? args + group->start * stride : NULL, stride, results);
+			}
+		}
+	}
+	if(sorted) {
+		GRUG_FREE(sorted, count * sizeof(struct grug_entity*));
+	}
+	if(sorted_indices) {
+		GRUG_FREE(sorted_indices, count * sizeof(size_t));
+	}
+	if(file_starts) {
+		GRUG_FREE(file_starts, (files_len + 2) * sizeof(size_t));
+	}
+	if(groups) {
+		GRUG_FREE(groups, groups_capacity * sizeof(struct batch_group));
+	}
+	if(gathered) {
+		GRUG_FREE(gathered, count * params_len * sizeof(union grug_value));
+	}
+	return all_succeeded;
 }
 
 void grug_game_fn_runtime_error(struct grug_state* gst, char const* message) {
-	assert(false && "Not Implemented");
-	(void)gst;
-	(void)message;
+	grug_raise_runtime_error(gst, GRUG_ERROR_CODE_RUNTIME_GAME_FN, message);
 }
 
 struct grug_error grug_copy_error(struct grug_error const* err, struct grug_arena* arena_or_none) {
@@ -473,8 +1724,7 @@ void grug_arena_deinit(struct grug_arena* arena) {
 }
 
 void grug_free_ast(struct grug_ast ast) {
-	assert(false && "Not Implemented");
-	(void)ast;
+	grug_arena_deinit(ast._arena);
 }
 
 static inline void write_char_to_buffer(char* out_buffer, size_t capacity, size_t* inout_index, char character) {
@@ -511,6 +1761,9 @@ size_t grug_tokens_to_grug(struct grug_token const* tokens, size_t num_tokens, c
 
 	for(size_t token_index = 0; token_index < num_tokens; token_index += 1) {
 		struct grug_token tok = tokens[token_index];
+		for(size_t space_index = 0; space_index < tok.spaces_before; space_index += 1) {
+			write_char_to_buffer(out_string_buffer, out_string_buffer_capacity, &write_index, ' ');
+		}
 		switch (tok.type) {
 			case GRUG_TOKEN_TYPE_OPEN_PARENTHESIS: {
 				write_char_to_buffer(out_string_buffer, out_string_buffer_capacity, &write_index, '(');
@@ -720,305 +1973,3491 @@ size_t grug_json_to_grug(char const* json, size_t json_len, char* out_string_buf
 	return return_value;
 }
 
-// TODO(bluesillybeard): this was supposed to be better but perhaps this is worse than the else-if chain or w/e else
-struct grug_token_info {
-	// May be NULL
-	char const* expected;
-	// If this is a string, this is the character that indicates the end of the string
-	char const* string_end;
-	grug_token_type type;
-	// If set, expected is instead treated as the start of a string (", r", e", etc)
-	bool is_string;
-	// whether this token requires proceeding non-ascii or whitespace character
-	bool proceed_with_special;
-	// whether this token expects to only show up at the start of a new line
-	bool expected_at_line_start;
-	
+// MARK: tokenizer
+
+/// What kind of token a byte can start. The tokenizer picks the token class from the first byte of a token with a single table lookup,
+/// and only words need further inspection (keywords are looked up once the whole word has been scanned).
+enum grug_char_class_enum {
+	GRUG_CHAR_CLASS_INVALID = 0,
+	/// A token that is always exactly this one character, see grug_single_char_tokens
+	GRUG_CHAR_CLASS_SINGLE,
+	/// `=` or `==`
+	GRUG_CHAR_CLASS_EQUALS,
+	/// `!=`
+	GRUG_CHAR_CLASS_BANG,
+	/// `>` or `>=`
+	GRUG_CHAR_CLASS_GREATER,
+	/// `<` or `<=`
+	GRUG_CHAR_CLASS_LESS,
+	GRUG_CHAR_CLASS_NEW_LINE,
+	GRUG_CHAR_CLASS_SPACE,
+	GRUG_CHAR_CLASS_QUOTE,
+	GRUG_CHAR_CLASS_HASH,
+	GRUG_CHAR_CLASS_WORD,
+	GRUG_CHAR_CLASS_DIGIT,
 };
+typedef uint8_t grug_char_class;
 
-/// These are in the order they are searched for
-/// If you can figure out some way to make this not suck but still pass GCCs -pedantic, be my guest.
-/// However it will likely be rewritten anyways.
-static struct grug_token_info token_infos[GRUG_TOKEN_TYPE_NUM] = {0}; //NOLINT: can't be const because C
-static bool token_infos_initialized = false;//NOLINT: can't be const because C
-
-static void init_token_infos(void) {
-	if(!token_infos_initialized) {
-		token_infos_initialized = true;
-		struct grug_token_info token_infos_local[GRUG_TOKEN_TYPE_NUM] = {
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_OPEN_PARENTHESIS, .expected = "(", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_CLOSE_PARENTHESIS, .expected = ")", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_OPEN_BRACE, .expected = "{", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_CLOSE_BRACE, .expected = "}", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_OPEN_BRACKET, .expected = "[", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_CLOSE_BRACKET, .expected = "]", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_PLUS, .expected = "+", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_MINUS, .expected = "-", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_STAR, .expected = "*", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_FORWARD_SLASH, .expected = "/", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_COMMA, .expected = ",", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_COLON, .expected = ":", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_DOT, .expected = ".", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_NEW_LINE, .expected = NULL, .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_DOUBLE_EQUALS, .expected = "==", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_NOT_EQUALS, .expected = "!=", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_EQUAL, .expected = "=", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_GREATER_EQUALS, .expected = ">=", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_GREATER, .expected = ">", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_LESS_EQUALS, .expected = "<=", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_LESS, .expected = "<", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_AND, .expected = "and", .string_end = NULL, .is_string = false, .proceed_with_special = true, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_OR, .expected = "or", .string_end = NULL, .is_string = false, .proceed_with_special = true, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_NOT, .expected = "not", .string_end = NULL, .is_string = false, .proceed_with_special = true, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_TRUE, .expected = "true", .string_end = NULL, .is_string = false, .proceed_with_special = true, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_FALSE, .expected = "false", .string_end = NULL, .is_string = false, .proceed_with_special = true, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_IF, .expected = "if", .string_end = NULL, .is_string = false, .proceed_with_special = true, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_ELSE, .expected = "else", .string_end = NULL, .is_string = false, .proceed_with_special = true, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_WHILE, .expected = "while", .string_end = NULL, .is_string = false, .proceed_with_special = true, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_BREAK, .expected = "break", .string_end = NULL, .is_string = false, .proceed_with_special = true, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_RETURN, .expected = "return", .string_end = NULL, .is_string = false, .proceed_with_special = true, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_CONTINUE, .expected = "continue", .string_end = NULL, .is_string = false, .proceed_with_special = true, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_EXPORT, .expected = "export", .string_end = NULL, .is_string = false, .proceed_with_special = true, .expected_at_line_start = true},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_LOCAL, .expected = "local", .string_end = NULL, .is_string = false, .proceed_with_special = true, .expected_at_line_start = true},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_INDENT, .expected = "    ", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = true},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_SPACE, .expected = " ", .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_STRING, .expected = "\"", .string_end = "\"", .is_string = true, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_ENTITY, .expected = "e\"", .string_end = "\"", .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_RESOURCE, .expected = "r\"", .string_end = "\"", .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_COMMENT, .expected = "#", .string_end = "\n", .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_WORD, .expected = NULL, .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_NUMBER, .expected = NULL, .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-			(struct grug_token_info) {.type = GRUG_TOKEN_TYPE_NONE, .expected = NULL, .string_end = NULL, .is_string = false, .proceed_with_special = false, .expected_at_line_start = false},
-		};
-		memcpy(token_infos, token_infos_local, sizeof(token_infos));
-	}
+#define GRUG_WORD_CHARS_A_TO_Z(_value) \
+	['a'] = _value, ['b'] = _value, ['c'] = _value, ['d'] = _value, ['e'] = _value, ['f'] = _value, ['g'] = _value, \
+	['h'] = _value, ['i'] = _value, ['j'] = _value, ['k'] = _value, ['l'] = _value, ['m'] = _value, ['n'] = _value, \
+	['o'] = _value, ['p'] = _value, ['q'] = _value, ['r'] = _value, ['s'] = _value, ['t'] = _value, ['u'] = _value, \
+	['v'] = _value, ['w'] = _value, ['x'] = _value, ['y'] = _value, ['z'] = _value, \
+	['A'] = _value, ['B'] = _value, ['C'] = _value, ['D'] = _value, ['E'] = _value, ['F'] = _value, ['G'] = _value, \
+	['H'] = _value, ['I'] = _value, ['J'] = _value, ['K'] = _value, ['L'] = _value, ['M'] = _value, ['N'] = _value, \
+	['O'] = _value, ['P'] = _value, ['Q'] = _value, ['R'] = _value, ['S'] = _value, ['T'] = _value, ['U'] = _value, \
+	['V'] = _value, ['W'] = _value, ['X'] = _value, ['Y'] = _value, ['Z'] = _value, ['_'] = _value
+
+#define GRUG_WORD_CHARS_0_TO_9(_value) \
+	['0'] = _value, ['1'] = _value, ['2'] = _value, ['3'] = _value, ['4'] = _value, \
+	['5'] = _value, ['6'] = _value, ['7'] = _value, ['8'] = _value, ['9'] = _value
+
+static const grug_char_class grug_char_classes[256] = {
+	['('] = GRUG_CHAR_CLASS_SINGLE,
+	[')'] = GRUG_CHAR_CLASS_SINGLE,
+	['{'] = GRUG_CHAR_CLASS_SINGLE,
+	['}'] = GRUG_CHAR_CLASS_SINGLE,
+	['['] = GRUG_CHAR_CLASS_SINGLE,
+	[']'] = GRUG_CHAR_CLASS_SINGLE,
+	['+'] = GRUG_CHAR_CLASS_SINGLE,
+	['-'] = GRUG_CHAR_CLASS_SINGLE,
+	['*'] = GRUG_CHAR_CLASS_SINGLE,
+	['/'] = GRUG_CHAR_CLASS_SINGLE,
+	[','] = GRUG_CHAR_CLASS_SINGLE,
+	[':'] = GRUG_CHAR_CLASS_SINGLE,
+	['.'] = GRUG_CHAR_CLASS_SINGLE,
+	['='] = GRUG_CHAR_CLASS_EQUALS,
+	['!'] = GRUG_CHAR_CLASS_BANG,
+	['>'] = GRUG_CHAR_CLASS_GREATER,
+	['<'] = GRUG_CHAR_CLASS_LESS,
+	['\n'] = GRUG_CHAR_CLASS_NEW_LINE,
+	[' '] = GRUG_CHAR_CLASS_SPACE,
+	['"'] = GRUG_CHAR_CLASS_QUOTE,
+	['#'] = GRUG_CHAR_CLASS_HASH,
+	GRUG_WORD_CHARS_A_TO_Z(GRUG_CHAR_CLASS_WORD),
+	GRUG_WORD_CHARS_0_TO_9(GRUG_CHAR_CLASS_DIGIT),
+};
+
+static const grug_token_type grug_single_char_tokens[256] = {
+	['('] = GRUG_TOKEN_TYPE_OPEN_PARENTHESIS,
+	[')'] = GRUG_TOKEN_TYPE_CLOSE_PARENTHESIS,
+	['{'] = GRUG_TOKEN_TYPE_OPEN_BRACE,
+	['}'] = GRUG_TOKEN_TYPE_CLOSE_BRACE,
+	['['] = GRUG_TOKEN_TYPE_OPEN_BRACKET,
+	[']'] = GRUG_TOKEN_TYPE_CLOSE_BRACKET,
+	['+'] = GRUG_TOKEN_TYPE_PLUS,
+	['-'] = GRUG_TOKEN_TYPE_MINUS,
+	['*'] = GRUG_TOKEN_TYPE_STAR,
+	['/'] = GRUG_TOKEN_TYPE_FORWARD_SLASH,
+	[','] = GRUG_TOKEN_TYPE_COMMA,
+	[':'] = GRUG_TOKEN_TYPE_COLON,
+	['.'] = GRUG_TOKEN_TYPE_DOT,
+};
+
+#undef GRUG_WORD_CHARS_A_TO_Z
+#undef GRUG_WORD_CHARS_0_TO_9
+
+static inline grug_char_class grug_char_class_of(char character) {
+	return grug_char_classes[(unsigned char)character];
 }
 
-static size_t check_token(char const* grug_src, size_t grug_len, uint32_t token_index, bool line_start, struct grug_error* o_error) {
-	struct grug_token_info info = token_infos[token_index];
-	if(info.expected) {
-		size_t expected_len = strlen(info.expected);
-		if(grug_len < expected_len) {
-			return 0;
+static inline bool is_word_char(char character) {
+	grug_char_class char_class = grug_char_class_of(character);
+	return char_class == GRUG_CHAR_CLASS_WORD || char_class == GRUG_CHAR_CLASS_DIGIT;
+}
+
+/// Most words, strings and indents are short, so the first few bytes are checked inline,
+/// and only longer runs pay for a call into the bulk scanners in grug_scan.c
+#define GRUG_INLINE_SCAN_LEN 16
+
+static inline size_t scan_word_end(char const* src, size_t len) {
+	size_t inline_len = len < GRUG_INLINE_SCAN_LEN ? len : GRUG_INLINE_SCAN_LEN;
+	for(size_t index = 0; index < inline_len; index += 1) {
+		if(!is_word_char(src[index])) {
+			return index;
 		}
-		if(info.is_string) {
-			size_t expected_end_len = strlen(info.string_end);
-			size_t char_index = expected_len;
-			size_t max_iterations = 100000000;
-			while(max_iterations--) {
-				if(strncmp(grug_src+char_index, info.string_end, expected_len) == 0) {
-					return char_index+1;
-				}
-				if(grug_src[char_index] == '\n') {
-					struct grug_error err = {
-						.error_type = GRUG_ERROR_CODE_COMPILE_TOKENIZER,
-						// Needs to be brought in line with what the test suite expects
-						.message = "Expected end quote but found end of line",
-					};
-					grug_assign_error(o_error, &err, NULL);
-					return 0;
-				}
-				char_index += 1;
-				if(char_index+expected_end_len >= grug_len) {
-					struct grug_error err = {
-						.error_type = GRUG_ERROR_CODE_COMPILE_TOKENIZER,
-						// Needs to be brought in line with what the test suite expects
-						.message = "Expected end quote but found end of file",
-					};
-					grug_assign_error(o_error, &err, NULL);
-					return 0;
-				}
-			}
-			assert(false);
+	}
+	return inline_len + grug_scan_word_end(src + inline_len, len - inline_len);
+}
+
+static inline size_t scan_quote_or_newline(char const* src, size_t len) {
+	size_t inline_len = len < GRUG_INLINE_SCAN_LEN ? len : GRUG_INLINE_SCAN_LEN;
+	for(size_t index = 0; index < inline_len; index += 1) {
+		if(src[index] == '"' || src[index] == '\n') {
+			return index;
 		}
-		if(strncmp(grug_src, info.expected, expected_len) == 0) {
-			if(info.expected_at_line_start && !line_start) {
-				struct grug_error err = {
-					.error_type = GRUG_ERROR_CODE_COMPILE_TOKENIZER,
-					// Needs to be brought in line with what the test suite expects
-					.message = "Expected token to only appear on a new line",
-				};
-				grug_assign_error(o_error, &err, NULL);
-				return 0;
-			}
-			if(info.proceed_with_special) {
-				if(grug_len == expected_len) {
-					struct grug_error err = {
-						.error_type = GRUG_ERROR_CODE_COMPILE_TOKENIZER,
-						// Needs to be brought in line with what the test suite expects
-						.message = "Expected token to not appear on the end of a file",
-					};
-					grug_assign_error(o_error, &err, NULL);
-					return 0;
-				}
-				assert(grug_len > expected_len);
-				if(isascii(grug_src[expected_len+1]) || isalnum(grug_src[expected_len+1])) {
-					// means this is probably one of the special cases
-					return 0;
-				}
-			}
-			return expected_len;
+	}
+	return inline_len + grug_scan_quote_or_newline(src + inline_len, len - inline_len);
+}
+
+static inline size_t scan_spaces(char const* src, size_t len) {
+	size_t inline_len = len < GRUG_INLINE_SCAN_LEN ? len : GRUG_INLINE_SCAN_LEN;
+	for(size_t index = 0; index < inline_len; index += 1) {
+		if(src[index] != ' ') {
+			return index;
 		}
-		return 0;
 	}
-	return 0;
+	return inline_len + grug_scan_spaces(src + inline_len, len - inline_len);
 }
 
-static struct grug_token pull_token(char const* grug_src, size_t grug_len, bool line_start, struct grug_error* o_error) {
-	for(uint32_t check_me = 0; check_me < GRUG_TOKEN_TYPE_NUM; check_me += 1) {
-		size_t token_size = check_token(grug_src, grug_len, check_me, line_start, o_error);
-		if(o_error->error_type.tag[0]) {
-			return (struct grug_token) {0};
+/// Returns GRUG_TOKEN_TYPE_WORD if the word is not a keyword.
+/// Dispatches on the first character so each word is compared against at most three keywords.
+static grug_token_type lookup_keyword(char const* word, size_t word_len) {
+	switch(word[0]) {
+		case 'a': {
+			if(word_equals(word, word_len, "and", 3)) { return GRUG_TOKEN_TYPE_AND; }
+			break;
 		}
-		if(token_size) {
-			return (struct grug_token) {
-				.contents = grug_src,
-				.contents_len = token_size,
-				.type = token_infos[check_me].type,
-			};
+		case 'b': {
+			if(word_equals(word, word_len, "break", 5)) { return GRUG_TOKEN_TYPE_BREAK; }
+			break;
 		}
-	}
-	// None of them matched, time to handle the special-cases:
-	// GRUG_TOKEN_TYPE_WORD
-	// GRUG_TOKEN_TYPE_NUMBER
-	if(isascii(grug_src[0])) {
-		size_t max_iterations = 100000000;
-		size_t read_index = 0;
-		while(max_iterations--) {
-			if(read_index > grug_len) {
-				struct grug_error err = {
-					.error_type = GRUG_ERROR_CODE_COMPILE_TOKENIZER,
-					// Needs to be brought in line with what the test suite expects
-					.message = "Im not really sure what to write here yet",
-				};
-				grug_assign_error(o_error, &err, NULL);
-				return (struct grug_token) {0};
-			}
-			if(!isalnum(grug_src[read_index])) {
-				return (struct grug_token) {
-					.contents = grug_src,
-					.contents_len = read_index,
-					.type = GRUG_TOKEN_TYPE_WORD,
-				};
-			}
-			read_index += 1;
+		case 'c': {
+			if(word_equals(word, word_len, "continue", 8)) { return GRUG_TOKEN_TYPE_CONTINUE; }
+			break;
 		}
-		assert(false);
-	} else if (isalnum(grug_src[0])) {
-		size_t max_iterations = 100000000;
-		size_t read_index = 0;
-		while(max_iterations--) {
-			if(read_index > grug_len) {
-				struct grug_error err = {
-					.error_type = GRUG_ERROR_CODE_COMPILE_TOKENIZER,
-					// Needs to be brought in line with what the test suite expects
-					.message = "Im not really sure what to write here yet",
-				};
-				grug_assign_error(o_error, &err, NULL);
-				return (struct grug_token) {0};
-			}
-			if(!isalnum(grug_src[read_index]) || isascii(grug_src[read_index])) {
-				return (struct grug_token) {
-					.contents = grug_src,
-					.contents_len = read_index,
-					.type = GRUG_TOKEN_TYPE_WORD,
-				};
-			}
-			read_index += 1;
+		case 'e': {
+			if(word_equals(word, word_len, "else", 4)) { return GRUG_TOKEN_TYPE_ELSE; }
+			if(word_equals(word, word_len, "export", 6)) { return GRUG_TOKEN_TYPE_EXPORT; }
+			break;
+		}
+		case 'f': {
+			if(word_equals(word, word_len, "false", 5)) { return GRUG_TOKEN_TYPE_FALSE; }
+			break;
+		}
+		case 'i': {
+			if(word_equals(word, word_len, "if", 2)) { return GRUG_TOKEN_TYPE_IF; }
+			break;
+		}
+		case 'l': {
+			if(word_equals(word, word_len, "local", 5)) { return GRUG_TOKEN_TYPE_LOCAL; }
+			break;
+		}
+		case 'n': {
+			if(word_equals(word, word_len, "not", 3)) { return GRUG_TOKEN_TYPE_NOT; }
+			break;
+		}
+		case 'o': {
+			if(word_equals(word, word_len, "or", 2)) { return GRUG_TOKEN_TYPE_OR; }
+			break;
+		}
+		case 'r': {
+			if(word_equals(word, word_len, "return", 6)) { return GRUG_TOKEN_TYPE_RETURN; }
+			break;
+		}
+		case 't': {
+			if(word_equals(word, word_len, "true", 4)) { return GRUG_TOKEN_TYPE_TRUE; }
+			break;
+		}
+		case 'w': {
+			if(word_equals(word, word_len, "while", 5)) { return GRUG_TOKEN_TYPE_WHILE; }
+			break;
+		}
+		default: {
+			break;
 		}
-		assert(false);
-	} else {
-		struct grug_error err = {
-			.error_type = GRUG_ERROR_CODE_COMPILE_TOKENIZER,
-			// Needs to be brought in line with what the test suite expects
-			.message = "Im not really sure what to write here yet",
-		};
-		grug_assign_error(o_error, &err, NULL);
-		return (struct grug_token) {0};
 	}
-
+	return GRUG_TOKEN_TYPE_WORD;
 }
 
-size_t grug_grug_to_tokens(char const* grug, size_t grug_len, struct grug_token* out_tokens, size_t out_tokens_capacity, struct grug_error* o_error) {
-	init_token_infos();
-	size_t read_index = 0;
-	size_t token_index = 0;
-	bool new_line = true;
-	while(true) {
-		assert(read_index <= grug_len);
-		struct grug_token tok = pull_token(grug+read_index, grug_len-read_index, new_line, o_error);
-		if(o_error->error_type.tag[0]) {
-			return 0;
-		}
-		if(tok.type == GRUG_TOKEN_TYPE_NONE) {
-			return token_index;
-		}
-		if(out_tokens && out_tokens_capacity >= token_index) {
-			out_tokens[token_index] = tok;
+/// The source text being tokenized. When a file arrives in chunks, `src` only holds part of it.
+struct tokenizer_input {
+	char const* src;
+	size_t len;
+	/// Offset of src[0] within the whole file
+	size_t file_offset;
+	/// Line number of src[0] within the whole file, starting at 1
+	size_t file_line;
+};
+
+static size_t line_number_at(struct tokenizer_input const* input, size_t offset) {
+	char const* grug_src = input->src;
+	size_t line = input->file_line;
+	for(size_t index = 0; index < offset; index += 1) {
+		if(grug_src[index] == '\n') {
+			line += 1;
 		}
-		token_index += 1;
-		new_line = tok.type == GRUG_TOKEN_TYPE_NEW_LINE;
-		
 	}
+	return line;
 }
 
-size_t grug_ast_to_tokens(struct grug_ast ast, struct grug_token* out_tokens, size_t out_tokens_capacity, struct grug_error* o_error) {
-	assert(false && "Not Implemented");
-	(void)ast;
-	(void)out_tokens;
-	(void)out_tokens_capacity;
-	(void)o_error;
-	return 0;
+static void write_tokenizer_error(struct tokenizer_input const* input, size_t offset, size_t num_characters, char const* message, struct grug_error* o_error) {
+	// grug_assign_error copies the message, so a stack buffer is fine
+	char message_buffer[256];
+	(void)snprintf(message_buffer, sizeof(message_buffer), "%s on line %zu", message, line_number_at(input, offset));
+	struct grug_error err = {
+		.error_type = GRUG_ERROR_CODE_COMPILE_TOKENIZER,
+		// Needs to be brought in line with what the test suite expects
+		.message = message_buffer,
+		.custom_message = message_buffer,
+		.file = {
+			.offset = input->file_offset + offset,
+			.num_characters = num_characters,
+		},
+	};
+	grug_assign_error(o_error, &err, NULL);
 }
 
-size_t grug_json_to_tokens(char const* json, size_t json_len, struct grug_token* out_tokens, size_t out_tokens_capacity, struct grug_error* o_error) {
-	struct grug_ast ast = grug_json_to_ast(json, json_len, NULL, o_error);
-	if(o_error->error_type.tag[0]) {
+/// Length of a string-like token starting at `start`, where the opening quote is at `quote_index`. Returns 0 and writes an error if the string is not closed.
+static size_t scan_string(struct tokenizer_input const* input, size_t start, size_t quote_index, struct grug_error* o_error) {
+	char const* grug_src = input->src;
+	size_t grug_len = input->len;
+	size_t read_index = quote_index + 1;
+	read_index += scan_quote_or_newline(grug_src + read_index, grug_len - read_index);
+	if(read_index < grug_len) {
+		if(grug_src[read_index] == '"') {
+			return read_index + 1 - start;
+		}
+		write_tokenizer_error(input, start, read_index - start, "Expected end quote but found end of line", o_error);
 		return 0;
 	}
-	size_t return_value = grug_ast_to_tokens(ast, out_tokens, out_tokens_capacity, o_error);
-	grug_free_ast(ast);
-	return return_value;
+	write_tokenizer_error(input, start, grug_len - start, "Expected end quote but found end of file", o_error);
+	return 0;
 }
 
-struct grug_ast grug_grug_to_ast(char const* grug, size_t grug_len, struct grug_arena* arena_or_none, struct grug_error* o_error) {
-	size_t num_tokens_required = grug_grug_to_tokens(grug, grug_len, NULL, 0, o_error);
-	if(o_error->error_type.tag[0]) {
-		return (struct grug_ast){0};
-	}
-	if(!num_tokens_required) {
-		return (struct grug_ast){0};
-	}
-	struct grug_token* tokens = GRUG_MALLOC(num_tokens_required * sizeof(struct grug_token));
-	if(!tokens) {
-		struct grug_error err = {
-			// TODO(bluesillybeard): add specific error codes for failed allocations
-			.error_type = GRUG_ERROR_CODE_COMPILE_TOKENIZER,
-			.message = "Failed to convert grug to tokens: malloc() returned null",
-		};
-		grug_assign_error(o_error, &err, NULL);
+/// Pulls the token that starts at `start`. `line_start` is true while only indentation has been seen on the current line.
+static struct grug_token pull_token(struct tokenizer_input const* input, size_t start, bool line_start, struct grug_error* o_error) {
+	char const* token_start = input->src + start;
+	size_t remaining = input->len - start;
+	grug_token_type type = GRUG_TOKEN_TYPE_NONE;
+	size_t token_len = 1;
+
+	switch(grug_char_class_of(token_start[0])) {
+		case GRUG_CHAR_CLASS_SINGLE: {
+			type = grug_single_char_tokens[(unsigned char)token_start[0]];
+			break;
+		}
+		case GRUG_CHAR_CLASS_EQUALS: {
+			type = GRUG_TOKEN_TYPE_EQUAL;
+			if(remaining > 1 && token_start[1] == '=') {
+				type = GRUG_TOKEN_TYPE_DOUBLE_EQUALS;
+				token_len = 2;
+			}
+			break;
+		}
+		case GRUG_CHAR_CLASS_BANG: {
+			if(remaining < 2 || token_start[1] != '=') {
+				write_tokenizer_error(input, start, 1, "Expected '=' after '!'", o_error);
+				return (struct grug_token) {0};
+			}
+			type = GRUG_TOKEN_TYPE_NOT_EQUALS;
+			token_len = 2;
+			break;
+		}
+		case GRUG_CHAR_CLASS_GREATER: {
+			type = GRUG_TOKEN_TYPE_GREATER;
+			if(remaining > 1 && token_start[1] == '=') {
+				type = GRUG_TOKEN_TYPE_GREATER_EQUALS;
+				token_len = 2;
+			}
+			break;
+		}
+		case GRUG_CHAR_CLASS_LESS: {
+			type = GRUG_TOKEN_TYPE_LESS;
+			if(remaining > 1 && token_start[1] == '=') {
+				type = GRUG_TOKEN_TYPE_LESS_EQUALS;
+				token_len = 2;
+			}
+			break;
+		}
+		case GRUG_CHAR_CLASS_NEW_LINE: {
+			type = GRUG_TOKEN_TYPE_NEW_LINE;
+			break;
+		}
+		case GRUG_CHAR_CLASS_SPACE: {
+			type = GRUG_TOKEN_TYPE_SPACE;
+			if(line_start) {
+				size_t spaces = scan_spaces(token_start, remaining);
+				if(spaces % GRUG_SPACES_PER_INDENT != 0) {
+					write_tokenizer_error(input, start, spaces, "Expected indentation to be a multiple of 4 spaces", o_error);
+					return (struct grug_token) {0};
+				}
+				type = GRUG_TOKEN_TYPE_INDENT;
+				token_len = GRUG_SPACES_PER_INDENT;
+			}
+			break;
+		}
+		case GRUG_CHAR_CLASS_QUOTE: {
+			type = GRUG_TOKEN_TYPE_STRING;
+			token_len = scan_string(input, start, start, o_error);
+			if(!token_len) {
+				return (struct grug_token) {0};
+			}
+			break;
+		}
+		case GRUG_CHAR_CLASS_HASH: {
+			type = GRUG_TOKEN_TYPE_COMMENT;
+			token_len += grug_scan_newline(token_start + 1, remaining - 1);
+			break;
+		}
+		case GRUG_CHAR_CLASS_WORD: {
+			// e"..." and r"..." are entity and resource strings
+			if(remaining > 1 && token_start[1] == '"' && (token_start[0] == 'e' || token_start[0] == 'r')) {
+				type = token_start[0] == 'e' ? GRUG_TOKEN_TYPE_ENTITY : GRUG_TOKEN_TYPE_RESOURCE;
+				token_len = scan_string(input, start, start + 1, o_error);
+				if(!token_len) {
+					return (struct grug_token) {0};
+				}
+				break;
+			}
+			token_len += scan_word_end(token_start + 1, remaining - 1);
+			type = lookup_keyword(token_start, token_len);
+			if((type == GRUG_TOKEN_TYPE_EXPORT || type == GRUG_TOKEN_TYPE_LOCAL) && !line_start) {
+				write_tokenizer_error(input, start, token_len, "Expected token to only appear on a new line", o_error);
+				return (struct grug_token) {0};
+			}
+			break;
+		}
+		case GRUG_CHAR_CLASS_DIGIT: {
+			type = GRUG_TOKEN_TYPE_NUMBER;
+			while(token_len < remaining && grug_char_class_of(token_start[token_len]) == GRUG_CHAR_CLASS_DIGIT) {
+				token_len += 1;
+			}
+			if(token_len < remaining && token_start[token_len] == '.') {
+				token_len += 1;
+				if(token_len >= remaining || grug_char_class_of(token_start[token_len]) != GRUG_CHAR_CLASS_DIGIT) {
+					write_tokenizer_error(input, start, token_len, "Missing digit after decimal point", o_error);
+					return (struct grug_token) {0};
+				}
+				while(token_len < remaining && grug_char_class_of(token_start[token_len]) == GRUG_CHAR_CLASS_DIGIT) {
+					token_len += 1;
+				}
+				if(token_len < remaining && token_start[token_len] == '.') {
+					write_tokenizer_error(input, start, token_len + 1, "Encountered two '.' periods in a number", o_error);
+					return (struct grug_token) {0};
+				}
+			}
+			break;
+		}
+		default: {
+			write_tokenizer_error(input, start, 1, "Unrecognized character", o_error);
+			return (struct grug_token) {0};
+		}
+	}
+
+	return (struct grug_token) {
+		.type = type,
+		.contents = token_start,
+		.contents_len = token_len,
+	};
+}
+
+/// Indents only count as indentation while nothing else has been seen on the line
+static inline bool is_line_start_after(bool line_start, grug_token_type type) {
+	return type == GRUG_TOKEN_TYPE_NEW_LINE || (line_start && type == GRUG_TOKEN_TYPE_INDENT);
+}
+
+/// Checks the `spaces` spaces at `start` for the mistakes the tokenizer can see without knowing the grammar,
+/// where `trailing` means that they are followed by a new line or the end of the file.
+/// Whether a particular pair of tokens needs a space between them is left to the parser.
+static bool check_spaces(struct tokenizer_input const* input, size_t start, size_t spaces, bool line_start, bool trailing, struct grug_error* o_error) {
+	if(!spaces) {
+		return true;
+	}
+	if(trailing) {
+		write_tokenizer_error(input, start, spaces, "Unexpected trailing whitespace", o_error);
+		return false;
+	}
+	if(line_start && spaces % GRUG_SPACES_PER_INDENT != 0) {
+		write_tokenizer_error(input, start, spaces, "Expected indentation to be a multiple of 4 spaces", o_error);
+		return false;
+	}
+	if(!line_start && spaces > 1) {
+		write_tokenizer_error(input, start, spaces, "Expected a single space between tokens", o_error);
+		return false;
+	}
+	if(spaces > UINT32_MAX) {
+		write_tokenizer_error(input, start, spaces, "Indentation is too deep", o_error);
+		return false;
+	}
+	return true;
+}
+
+/// Pulls the next token that isn't a SPACE or INDENT, and records the spaces it skipped in `spaces_before`
+static struct grug_token pull_token_without_whitespace(struct tokenizer_input const* input, size_t start, bool line_start, struct grug_error* o_error) {
+	size_t spaces = scan_spaces(input->src + start, input->len - start);
+	size_t token_start = start + spaces;
+	bool trailing = token_start == input->len || input->src[token_start] == '\n';
+	if(!check_spaces(input, start, spaces, line_start, trailing, o_error)) {
+		return (struct grug_token) {0};
+	}
+	struct grug_token tok = pull_token(input, token_start, line_start, o_error);
+	tok.spaces_before = (uint32_t)spaces;
+	return tok;
+}
+
+size_t grug_grug_to_tokens(char const* grug, size_t grug_len, struct grug_token* out_tokens, size_t out_tokens_capacity, struct grug_error* o_error) {
+	if(out_tokens_capacity) {
+		assert(out_tokens);
+	}
+	struct tokenizer_input input = {.src = grug, .len = grug_len, .file_offset = 0, .file_line = 1};
+	size_t read_index = 0;
+	size_t token_index = 0;
+	bool line_start = true;
+	while(read_index < grug_len) {
+		struct grug_token tok = pull_token(&input, read_index, line_start, o_error);
+		if(o_error->error_type.tag[0]) {
+			return 0;
+		}
+		if(token_index < out_tokens_capacity) {
+			out_tokens[token_index] = tok;
+		}
+		token_index += 1;
+		read_index += tok.contents_len;
+		line_start = is_line_start_after(line_start, tok.type);
+	}
+	return token_index;
+}
+
+struct grug_token* grug_grug_to_tokens_in_arena(char const* grug, size_t grug_len, struct grug_arena* arena, size_t* out_num_tokens, struct grug_error* o_error) {
+	assert(arena);
+	*out_num_tokens = 0;
+	struct tokenizer_input input = {.src = grug, .len = grug_len, .file_offset = 0, .file_line = 1};
+	// Hand written grug averages a bit over 3 bytes per token, so this rarely needs to grow more than once
+	size_t capacity = grug_len / 3 + 16;
+	struct grug_token* tokens = grug_arena_alloc(arena, capacity * sizeof(struct grug_token));
+	if(!tokens) {
+		write_tokenizer_error(&input, 0, 0, "Failed to allocate tokens", o_error);
+		return NULL;
+	}
+	size_t read_index = 0;
+	size_t num_tokens = 0;
+	bool line_start = true;
+	while(read_index < grug_len) {
+		struct grug_token tok = pull_token(&input, read_index, line_start, o_error);
+		if(o_error->error_type.tag[0]) {
+			return NULL;
+		}
+		if(num_tokens == capacity) {
+			// As long as nothing else was allocated from the arena in the meantime, this extends the array in place
+			tokens = grug_arena_realloc(arena, tokens, capacity * sizeof(struct grug_token), capacity * 2 * sizeof(struct grug_token));
+			if(!tokens) {
+				write_tokenizer_error(&input, read_index, 0, "Failed to allocate tokens", o_error);
+				return NULL;
+			}
+			capacity *= 2;
+		}
+		tokens[num_tokens] = tok;
+		num_tokens += 1;
+		read_index += tok.contents_len;
+		line_start = is_line_start_after(line_start, tok.type);
+	}
+	// Give the unused tail back to the arena
+	grug_arena_free(arena, tokens + num_tokens, (capacity - num_tokens) * sizeof(struct grug_token));
+	*out_num_tokens = num_tokens;
+	return tokens;
+}
+
+// MARK: compact tokens
+
+/// Tokens longer than this are a tokenizer error, since the length has to fit in 24 bits
+#define GRUG_COMPACT_TOKEN_MAX_LEN ((1U << 24) - 1)
+
+/// The token stream as the compiler uses it internally. struct grug_token is only materialized at the public API boundary.
+/// This is a structure of arrays with 8 bytes per token instead of the 24 of struct grug_token:
+/// a 32 bit offset into `src`, and a 32 bit kind holding the token type in the low 8 bits and the length in the high 24 bits.
+/// There are no SPACE or INDENT tokens, the gaps between the offsets already say where the spaces were.
+struct compact_tokens {
+	char const* src;
+	uint32_t* offsets;
+	uint32_t* kinds;
+	size_t count;
+};
+
+static inline grug_token_type compact_token_type(struct compact_tokens const* tokens, size_t index) {
+	return tokens->kinds[index] & 0xFFU;
+}
+
+static inline size_t compact_token_len(struct compact_tokens const* tokens, size_t index) {
+	return tokens->kinds[index] >> 8U;
+}
+
+static inline char const* compact_token_contents(struct compact_tokens const* tokens, size_t index) {
+	return tokens->src + tokens->offsets[index];
+}
+
+/// The number of spaces between the previous token and this one
+static inline size_t compact_token_spaces_before(struct compact_tokens const* tokens, size_t index) {
+	if(index == 0) {
+		return tokens->offsets[0];
+	}
+	return tokens->offsets[index] - tokens->offsets[index - 1] - compact_token_len(tokens, index - 1);
+}
+
+/// The indentation depth of the line that a token starts, which is only meaningful for the first token on a line
+static inline size_t compact_token_indent_depth(struct compact_tokens const* tokens, size_t index) {
+	return compact_token_spaces_before(tokens, index) / GRUG_SPACES_PER_INDENT;
+}
+
+static inline struct grug_token compact_token_at(struct compact_tokens const* tokens, size_t index) {
+	return (struct grug_token) {
+		.type = compact_token_type(tokens, index),
+		.spaces_before = (uint32_t)compact_token_spaces_before(tokens, index),
+		.contents = compact_token_contents(tokens, index),
+		.contents_len = compact_token_len(tokens, index),
+	};
+}
+
+/// Tokenizes `grug` into compact tokens allocated from `arena`.
+/// Both arrays live in one allocation (all the offsets, then all the kinds) so it can keep growing in place on top of the arena.
+/// Returns false and writes to o_error upon an error.
+static bool tokenize_compact(char const* grug, size_t grug_len, struct grug_arena* arena, struct compact_tokens* out_tokens, struct grug_error* o_error) {
+	assert(arena);
+	struct tokenizer_input input = {.src = grug, .len = grug_len, .file_offset = 0, .file_line = 1};
+	*out_tokens = (struct compact_tokens) {.src = grug, .offsets = NULL, .kinds = NULL, .count = 0};
+	if(grug_len > UINT32_MAX) {
+		write_tokenizer_error(&input, 0, 0, "Files larger than 4 GiB are not supported", o_error);
+		return false;
+	}
+	size_t capacity = grug_len / 3 + 16;
+	uint32_t* block = grug_arena_alloc(arena, capacity * 2 * sizeof(uint32_t));
+	if(!block) {
+		write_tokenizer_error(&input, 0, 0, "Failed to allocate tokens", o_error);
+		return false;
+	}
+	size_t read_index = 0;
+	size_t count = 0;
+	bool line_start = true;
+	while(read_index < grug_len) {
+		struct grug_token tok = pull_token_without_whitespace(&input, read_index, line_start, o_error);
+		if(o_error->error_type.tag[0]) {
+			return false;
+		}
+		read_index += tok.spaces_before;
+		if(tok.contents_len > GRUG_COMPACT_TOKEN_MAX_LEN) {
+			write_tokenizer_error(&input, read_index, tok.contents_len, "Tokens longer than 16 MiB are not supported", o_error);
+			return false;
+		}
+		if(count == capacity) {
+			size_t new_capacity = capacity * 2;
+			block = grug_arena_realloc(arena, block, capacity * 2 * sizeof(uint32_t), new_capacity * 2 * sizeof(uint32_t));
+			if(!block) {
+				write_tokenizer_error(&input, read_index, 0, "Failed to allocate tokens", o_error);
+				return false;
+			}
+			// the kinds start right after the offsets, so they move up along with the capacity
+			memmove(block + new_capacity, block + capacity, count * sizeof(uint32_t));
+			capacity = new_capacity;
+		}
+		block[count] = (uint32_t)read_index;
+		block[capacity + count] = tok.type | (uint32_t)(tok.contents_len << 8U);
+		count += 1;
+		read_index += tok.contents_len;
+		line_start = tok.type == GRUG_TOKEN_TYPE_NEW_LINE;
+	}
+	// Pack the kinds right after the offsets and give the rest back to the arena
+	memmove(block + count, block + capacity, count * sizeof(uint32_t));
+	grug_arena_free(arena, block + count * 2, (capacity - count) * 2 * sizeof(uint32_t));
+	*out_tokens = (struct compact_tokens) {.src = grug, .offsets = block, .kinds = block + count, .count = count};
+	return true;
+}
+
+/// The longest text that a token type fixes, which is that of `continue`
+#define GRUG_LONGEST_FIXED_TOKEN 8
+
+/// Whether the text of a token is its contents, rather than fixed by its type
+static bool token_has_contents(grug_token_type type) {
+	return type == GRUG_TOKEN_TYPE_STRING || type == GRUG_TOKEN_TYPE_ENTITY || type == GRUG_TOKEN_TYPE_RESOURCE
+		|| type == GRUG_TOKEN_TYPE_WORD || type == GRUG_TOKEN_TYPE_NUMBER || type == GRUG_TOKEN_TYPE_COMMENT;
+}
+
+/// Turns tokens that the caller made into compact tokens, so they can be parsed as they are.
+/// Their text is written to `out_src`, a buffer allocated from `src_arena` that the tokens point into, so the AST can point into it like into a file.
+/// The spaces get the checks that those of a file get. The tokenizer is run over the text of each token with contents, and only over that,
+/// which has to come out as one token of the same type, so the parser can rely on it like on a token the tokenizer made.
+/// Returns false and writes to o_error upon an error.
+static bool tokens_to_compact(struct grug_token const* tokens, size_t num_tokens, struct grug_arena* src_arena, struct grug_arena* token_arena, char** out_src, struct compact_tokens* out_tokens, struct grug_error* o_error) {
+	assert(src_arena && token_arena);
+	if(num_tokens) {
+		assert(tokens);
+	}
+	struct tokenizer_input input = {.src = "", .len = 0, .file_offset = 0, .file_line = 1};
+	*out_tokens = (struct compact_tokens) {.src = NULL, .offsets = NULL, .kinds = NULL, .count = 0};
+	// The text of a token without contents may not be set, so this is an upper bound
+	size_t src_capacity = 0;
+	for(size_t token_index = 0; token_index < num_tokens; token_index += 1) {
+		struct grug_token const* tok = &tokens[token_index];
+		if(tok->contents_len > GRUG_COMPACT_TOKEN_MAX_LEN) {
+			write_tokenizer_error(&input, 0, 0, "Tokens longer than 16 MiB are not supported", o_error);
+			return false;
+		}
+		src_capacity += tok->spaces_before + (tok->contents_len > GRUG_LONGEST_FIXED_TOKEN ? tok->contents_len : GRUG_LONGEST_FIXED_TOKEN);
+		if(src_capacity > UINT32_MAX) {
+			write_tokenizer_error(&input, 0, 0, "Files larger than 4 GiB are not supported", o_error);
+			return false;
+		}
+	}
+	char* src = grug_arena_alloc_aligned(src_arena, src_capacity + 1, 1);
+	// Both arrays in one allocation, like tokenize_compact does
+	uint32_t* block = grug_arena_alloc(token_arena, (num_tokens + 1) * 2 * sizeof(uint32_t));
+	if(!src || !block) {
+		write_tokenizer_error(&input, 0, 0, "Failed to allocate tokens", o_error);
+		return false;
+	}
+	input.src = src;
+	input.len = src_capacity;
+	size_t write_index = 0;
+	// Where the spaces before the next token start, which SPACE and INDENT tokens add to
+	size_t spaces_start = 0;
+	size_t count = 0;
+	size_t line = 1;
+	bool line_start = true;
+	for(size_t token_index = 0; token_index < num_tokens; token_index += 1) {
+		struct grug_token const* tok = &tokens[token_index];
+		if(tok->type == GRUG_TOKEN_TYPE_NONE || tok->type >= GRUG_TOKEN_TYPE_NUM || (token_has_contents(tok->type) && (!tok->contents || !tok->contents_len))) {
+			write_tokenizer_error(&input, write_index, 0, "Expected a token with a type, and with contents if its type has any", o_error);
+			return false;
+		}
+		size_t text_start = write_index + tok->spaces_before;
+		write_index += grug_tokens_to_grug(tok, 1, src + write_index, src_capacity - write_index, o_error);
+		if(tok->type == GRUG_TOKEN_TYPE_SPACE || tok->type == GRUG_TOKEN_TYPE_INDENT) {
+			continue;
+		}
+		if(!check_spaces(&input, spaces_start, text_start - spaces_start, line_start, tok->type == GRUG_TOKEN_TYPE_NEW_LINE, o_error)) {
+			return false;
+		}
+		size_t text_len = write_index - text_start;
+		if(token_has_contents(tok->type)) {
+			struct tokenizer_input token_input = {.src = src + text_start, .len = text_len, .file_offset = text_start, .file_line = line};
+			struct grug_token pulled = pull_token(&token_input, 0, line_start, o_error);
+			if(o_error->error_type.tag[0]) {
+				return false;
+			}
+			if(pulled.type != tok->type || pulled.contents_len != text_len) {
+				write_tokenizer_error(&token_input, 0, text_len, "Expected the contents of a token to be a single token of its type", o_error);
+				return false;
+			}
+		}
+		block[count] = (uint32_t)text_start;
+		block[num_tokens + count] = tok->type | (uint32_t)(text_len << 8U);
+		count += 1;
+		spaces_start = write_index;
+		line_start = tok->type == GRUG_TOKEN_TYPE_NEW_LINE;
+		if(line_start) {
+			line += 1;
+		}
+	}
+	if(!check_spaces(&input, spaces_start, write_index - spaces_start, line_start, true, o_error)) {
+		return false;
+	}
+	src[write_index] = '\0';
+	grug_arena_free(src_arena, src + write_index + 1, src_capacity - write_index);
+	// Pack the kinds right after the offsets and give the rest back to the arena
+	memmove(block + count, block + num_tokens, count * sizeof(uint32_t));
+	grug_arena_free(token_arena, block + count * 2, (num_tokens + 1 - count) * 2 * sizeof(uint32_t));
+	*out_src = src;
+	*out_tokens = (struct compact_tokens) {.src = src, .offsets = block, .kinds = block + count, .count = count};
+	return true;
+}
+
+// Goes through the compact tokens the compiler parses, so that they are what this returns
+size_t grug_grug_to_tokens_without_whitespace(char const* grug, size_t grug_len, struct grug_token* out_tokens, size_t out_tokens_capacity, struct grug_error* o_error) {
+	if(out_tokens_capacity) {
+		assert(out_tokens);
+	}
+	struct grug_arena* arena = grug_arena_new();
+	if(!arena) {
+		struct tokenizer_input input = {.src = grug, .len = grug_len, .file_offset = 0, .file_line = 1};
+		write_tokenizer_error(&input, 0, 0, "Failed to allocate tokens", o_error);
+		return 0;
+	}
+	struct compact_tokens tokens = {0};
+	size_t num_tokens = 0;
+	if(tokenize_compact(grug, grug_len, arena, &tokens, o_error)) {
+		num_tokens = tokens.count;
+		for(size_t index = 0; index < num_tokens && index < out_tokens_capacity; index += 1) {
+			out_tokens[index] = compact_token_at(&tokens, index);
+		}
+	}
+	grug_arena_deinit(arena);
+	return num_tokens;
+}
+
+// MARK: streaming tokenizer
+
+struct grug_tokenizer {
+	grug_token_sink on_token;
+	void* user_data;
+	/// The start of a line that was cut off by the end of the previous chunk.
+	/// The new line token is the only token that contains a '\n', so this never needs to hold more than one line.
+	char* carry;
+	size_t carry_len;
+	size_t carry_capacity;
+	/// Offset and line number of the first byte that has not been tokenized yet
+	size_t file_offset;
+	size_t file_line;
+	bool line_start;
+	bool failed;
+};
+
+struct grug_tokenizer* grug_tokenizer_begin(grug_token_sink on_token, void* user_data) {
+	assert(on_token);
+	struct grug_tokenizer* tokenizer = GRUG_MALLOC(sizeof(struct grug_tokenizer));
+	if(!tokenizer) {
+		return NULL;
+	}
+	*tokenizer = (struct grug_tokenizer) {
+		.on_token = on_token,
+		.user_data = user_data,
+		.carry = NULL,
+		.carry_len = 0,
+		.carry_capacity = 0,
+		.file_offset = 0,
+		.file_line = 1,
+		.line_start = true,
+		.failed = false,
+	};
+	return tokenizer;
+}
+
+static bool append_to_carry(struct grug_tokenizer* tokenizer, char const* data, size_t data_len) {
+	if(!data_len) {
+		return true;
+	}
+	if(tokenizer->carry_len + data_len > tokenizer->carry_capacity) {
+		size_t new_capacity = tokenizer->carry_capacity ? tokenizer->carry_capacity * 2 : 256;
+		while(new_capacity < tokenizer->carry_len + data_len) {
+			new_capacity *= 2;
+		}
+		char* new_carry = grug_realloc(tokenizer->carry, tokenizer->carry_capacity, new_capacity);
+		if(!new_carry) {
+			return false;
+		}
+		tokenizer->carry = new_carry;
+		tokenizer->carry_capacity = new_capacity;
+	}
+	memcpy(tokenizer->carry + tokenizer->carry_len, data, data_len);
+	tokenizer->carry_len += data_len;
+	return true;
+}
+
+/// Tokenizes `input` up to the last token that is known to be complete, and returns how many bytes that consumed.
+/// With `more_input` set, a token that runs into the end of `input` might continue in the next chunk so it is left for later.
+/// That includes errors more input could fix, like a string that is not closed yet.
+static size_t tokenize_available(struct grug_tokenizer* tokenizer, struct tokenizer_input const* input, bool more_input, struct grug_error* o_error) {
+	size_t read_index = 0;
+	while(read_index < input->len) {
+		struct grug_error token_error = {0};
+		struct grug_token tok = pull_token(input, read_index, tokenizer->line_start, &token_error);
+		if(token_error.error_type.tag[0]) {
+			bool runs_into_end = token_error.file.offset - input->file_offset + token_error.file.num_characters >= input->len;
+			if(more_input && runs_into_end) {
+				grug_free_error(&token_error);
+				break;
+			}
+			grug_assign_error(o_error, &token_error, NULL);
+			grug_free_error(&token_error);
+			tokenizer->failed = true;
+			break;
+		}
+		if(more_input && tok.type != GRUG_TOKEN_TYPE_NEW_LINE && read_index + tok.contents_len == input->len) {
+			break;
+		}
+		tokenizer->on_token(tokenizer->user_data, &tok);
+		read_index += tok.contents_len;
+		tokenizer->line_start = is_line_start_after(tokenizer->line_start, tok.type);
+		if(tok.type == GRUG_TOKEN_TYPE_NEW_LINE) {
+			tokenizer->file_line += 1;
+		}
+	}
+	tokenizer->file_offset += read_index;
+	return read_index;
+}
+
+static void write_carry_allocation_error(struct grug_tokenizer* tokenizer, struct grug_error* o_error) {
+	struct tokenizer_input input = {.src = NULL, .len = 0, .file_offset = tokenizer->file_offset, .file_line = tokenizer->file_line};
+	write_tokenizer_error(&input, 0, 0, "Failed to allocate the tokenizer carry buffer", o_error);
+	tokenizer->failed = true;
+}
+
+bool grug_tokenizer_feed(struct grug_tokenizer* tokenizer, char const* chunk, size_t chunk_len, struct grug_error* o_error) {
+	if(tokenizer->failed) {
+		return false;
+	}
+	size_t chunk_index = 0;
+	if(tokenizer->carry_len) {
+		// Only the rest of the carried line is needed to finish off the carried tokens
+		size_t line_len = grug_scan_newline(chunk, chunk_len);
+		size_t append_len = line_len < chunk_len ? line_len + 1 : chunk_len;
+		if(!append_to_carry(tokenizer, chunk, append_len)) {
+			write_carry_allocation_error(tokenizer, o_error);
+			return false;
+		}
+		chunk_index = append_len;
+		struct tokenizer_input carry_input = {.src = tokenizer->carry, .len = tokenizer->carry_len, .file_offset = tokenizer->file_offset, .file_line = tokenizer->file_line};
+		size_t consumed = tokenize_available(tokenizer, &carry_input, true, o_error);
+		if(tokenizer->failed) {
+			return false;
+		}
+		memmove(tokenizer->carry, tokenizer->carry + consumed, tokenizer->carry_len - consumed);
+		tokenizer->carry_len -= consumed;
+		if(tokenizer->carry_len) {
+			// The chunk ended before the carried line did
+			assert(chunk_index == chunk_len);
+			return true;
+		}
+	}
+	// Everything else is tokenized straight out of the chunk
+	struct tokenizer_input chunk_input = {.src = chunk + chunk_index, .len = chunk_len - chunk_index, .file_offset = tokenizer->file_offset, .file_line = tokenizer->file_line};
+	size_t consumed = tokenize_available(tokenizer, &chunk_input, true, o_error);
+	if(tokenizer->failed) {
+		return false;
+	}
+	if(!append_to_carry(tokenizer, chunk_input.src + consumed, chunk_input.len - consumed)) {
+		write_carry_allocation_error(tokenizer, o_error);
+		return false;
+	}
+	return true;
+}
+
+bool grug_tokenizer_finish(struct grug_tokenizer* tokenizer, struct grug_error* o_error) {
+	if(!tokenizer->failed && tokenizer->carry_len) {
+		struct tokenizer_input carry_input = {.src = tokenizer->carry, .len = tokenizer->carry_len, .file_offset = tokenizer->file_offset, .file_line = tokenizer->file_line};
+		(void)tokenize_available(tokenizer, &carry_input, false, o_error);
+	}
+	bool success = !tokenizer->failed;
+	if(tokenizer->carry) {
+		GRUG_FREE(tokenizer->carry, tokenizer->carry_capacity);
+	}
+	GRUG_FREE(tokenizer, sizeof(struct grug_tokenizer));
+	return success;
+}
+
+// MARK: flat AST
+
+/// Index into one of the pools of a flat_ast
+typedef uint32_t ast_index;
+#define AST_INDEX_NONE UINT32_MAX
+
+/// A growable array of same sized items
+struct ast_pool {
+	char* data;
+	uint32_t count;
+	uint32_t capacity;
+};
+
+struct flat_type {
+	grug_type_type type;
+	/// The name of a custom id type, or GRUG_SYMBOL_NONE
+	grug_symbol custom_name;
+};
+
+/// 16 bytes, where a struct grug_expr is 56. What the fields mean depends on `type`:
+/// - STRING, RESOURCE, ENTITY: `a` is a string index
+/// - IDENTIFIER: `a` is the symbol of the name
+/// - NUMBER: `a` is a string index of the number as written, and `b` a number index
+/// - UNARY: `a` is the operand
+/// - BINARY: `a` and `b` are the operands
+/// - CALL: `a` is the symbol of the function name, and the arguments are the `args_len` expr refs starting at `b`.
+///   Once bind_calls has run, `op` is a call_target and `c` the index of the helper function or game function.
+/// - PARENTHESIZED: `a` is the inner expression
+/// The type checker puts the result types in flat_ast.expr_types, which is indexed the same way.
+struct flat_expr {
+	uint8_t type;
+	/// grug_unary_operator, grug_binary_operator or call_target
+	uint8_t op;
+	/// The number of arguments of a CALL
+	uint16_t args_len;
+	ast_index a;
+	ast_index b;
+	ast_index c;
+};
+
+/// What the fields mean depends on `type`:
+/// - VARIABLE: `a` is the symbol of the name, `b` a type index or AST_INDEX_NONE for an assignment, and `c` the expression
+/// - CALL: `a` is the call expression
+/// - IF: the branches are the `b` branches starting at `a`, the first being the `if` itself, and `c` is the else block or AST_INDEX_NONE
+/// - WHILE: `a` is the condition, and `b` the block
+/// - RETURN: `a` is the expression, or AST_INDEX_NONE
+/// - COMMENT: `a` is a string index
+struct flat_statement {
+	uint8_t type;
+	uint8_t unused[3];
+	uint32_t line;
+	ast_index a;
+	ast_index b;
+	ast_index c;
+};
+
+struct flat_block {
+	ast_index first_statement;
+	uint32_t statements_len;
+};
+
+struct flat_branch {
+	ast_index cond;
+	ast_index block;
+};
+
+struct flat_member {
+	grug_symbol name;
+	ast_index type;
+	ast_index expr;
+};
+
+struct flat_argument {
+	grug_symbol name;
+	ast_index type;
+};
+
+/// Used for both on functions and helper functions
+struct flat_function {
+	grug_symbol name;
+	ast_index first_argument;
+	uint32_t arguments_len;
+	/// AST_INDEX_NONE for on functions and helper functions returning nothing
+	ast_index return_type;
+	ast_index block;
+	uint32_t line;
+	/// Set by the type checker for on functions: their index among the on functions of the file's entity type in mod_api.json
+	uint32_t on_fn_index;
+};
+
+/// The AST as the compiler uses it internally, with every kind of node in its own contiguous pool and children referenced by 32 bit index.
+/// A block's statements, a call's argument refs and an if's branches are each contiguous in their pool.
+/// Names are symbols of `interner`, and the other strings point into `arena`. Neither is owned by the flat AST; the pools are freed with flat_ast_deinit.
+/// struct grug_ast is only built from it on request, by flat_ast_export.
+struct flat_ast {
+	struct grug_arena* arena;
+	struct grug_interner* interner;
+	/// Set by bind_calls, so the game functions calls are bound to can be looked up when exporting
+	struct mod_api const* mod_api;
+	/// char const* of literals, comments and numbers as written
+	struct ast_pool strings;
+	/// double
+	struct ast_pool numbers;
+	struct ast_pool types;
+	struct ast_pool exprs;
+	/// uint32_t line number of each expression, for the errors found after parsing
+	struct ast_pool expr_lines;
+	/// struct flat_type of each expression, which is empty until the type checker has run
+	struct ast_pool expr_types;
+	/// ast_index of an expression, for call arguments
+	struct ast_pool expr_refs;
+	struct ast_pool statements;
+	struct ast_pool blocks;
+	struct ast_pool branches;
+	struct ast_pool members;
+	struct ast_pool arguments;
+	struct ast_pool on_functions;
+	struct ast_pool helper_functions;
+};
+
+static inline char const* flat_string_at(struct flat_ast const* ast, ast_index index) {
+	return ((char const* const*)(void const*)ast->strings.data)[index];
+}
+
+static inline double flat_number_at(struct flat_ast const* ast, ast_index index) {
+	return ((double const*)(void const*)ast->numbers.data)[index];
+}
+
+static inline struct flat_type const* flat_type_at(struct flat_ast const* ast, ast_index index) {
+	return (struct flat_type const*)(void const*)ast->types.data + index;
+}
+
+static inline struct flat_expr const* flat_expr_at(struct flat_ast const* ast, ast_index index) {
+	return (struct flat_expr const*)(void const*)ast->exprs.data + index;
+}
+
+static inline uint32_t flat_expr_line_at(struct flat_ast const* ast, ast_index index) {
+	return ((uint32_t const*)(void const*)ast->expr_lines.data)[index];
+}
+
+static inline struct flat_type const* flat_expr_type_at(struct flat_ast const* ast, ast_index index) {
+	return (struct flat_type const*)(void const*)ast->expr_types.data + index;
+}
+
+static inline ast_index flat_expr_ref_at(struct flat_ast const* ast, ast_index index) {
+	return ((ast_index const*)(void const*)ast->expr_refs.data)[index];
+}
+
+static inline struct flat_statement const* flat_statement_at(struct flat_ast const* ast, ast_index index) {
+	return (struct flat_statement const*)(void const*)ast->statements.data + index;
+}
+
+static inline struct flat_block const* flat_block_at(struct flat_ast const* ast, ast_index index) {
+	return (struct flat_block const*)(void const*)ast->blocks.data + index;
+}
+
+static inline struct flat_branch const* flat_branch_at(struct flat_ast const* ast, ast_index index) {
+	return (struct flat_branch const*)(void const*)ast->branches.data + index;
+}
+
+static inline struct flat_member const* flat_member_at(struct flat_ast const* ast, ast_index index) {
+	return (struct flat_member const*)(void const*)ast->members.data + index;
+}
+
+static inline struct flat_argument const* flat_argument_at(struct flat_ast const* ast, ast_index index) {
+	return (struct flat_argument const*)(void const*)ast->arguments.data + index;
+}
+
+static inline struct flat_function const* flat_on_function_at(struct flat_ast const* ast, ast_index index) {
+	return (struct flat_function const*)(void const*)ast->on_functions.data + index;
+}
+
+static inline struct flat_function const* flat_helper_function_at(struct flat_ast const* ast, ast_index index) {
+	return (struct flat_function const*)(void const*)ast->helper_functions.data + index;
+}
+
+/// Appends `count` items, and returns the index of the first one or AST_INDEX_NONE if the pool couldn't grow
+static ast_index ast_pool_push_many(struct ast_pool* pool, void const* items, size_t count, size_t item_size) {
+	if(count > (size_t)(AST_INDEX_NONE - 1 - pool->count)) {
+		return AST_INDEX_NONE;
+	}
+	if(pool->count + count > pool->capacity) {
+		size_t new_capacity = pool->capacity ? pool->capacity : 64;
+		while(new_capacity < pool->count + count) {
+			new_capacity *= 2;
+		}
+		if(new_capacity > AST_INDEX_NONE) {
+			new_capacity = AST_INDEX_NONE;
+		}
+		char* new_data = grug_realloc(pool->data, pool->capacity * item_size, new_capacity * item_size);
+		if(!new_data) {
+			return AST_INDEX_NONE;
+		}
+		pool->data = new_data;
+		pool->capacity = (uint32_t)new_capacity;
+	}
+	ast_index first = pool->count;
+	if(count) {
+		memcpy(pool->data + (size_t)first * item_size, items, count * item_size);
+	}
+	pool->count += (uint32_t)count;
+	return first;
+}
+
+static void ast_pool_deinit(struct ast_pool* pool, size_t item_size) {
+	if(pool->data) {
+		GRUG_FREE(pool->data, pool->capacity * item_size);
+	}
+	*pool = (struct ast_pool) {0};
+}
+
+static void flat_ast_deinit(struct flat_ast* ast) {
+	ast_pool_deinit(&ast->strings, sizeof(char const*));
+	ast_pool_deinit(&ast->numbers, sizeof(double));
+	ast_pool_deinit(&ast->types, sizeof(struct flat_type));
+	ast_pool_deinit(&ast->exprs, sizeof(struct flat_expr));
+	ast_pool_deinit(&ast->expr_lines, sizeof(uint32_t));
+	ast_pool_deinit(&ast->expr_types, sizeof(struct flat_type));
+	ast_pool_deinit(&ast->expr_refs, sizeof(ast_index));
+	ast_pool_deinit(&ast->statements, sizeof(struct flat_statement));
+	ast_pool_deinit(&ast->blocks, sizeof(struct flat_block));
+	ast_pool_deinit(&ast->branches, sizeof(struct flat_branch));
+	ast_pool_deinit(&ast->members, sizeof(struct flat_member));
+	ast_pool_deinit(&ast->arguments, sizeof(struct flat_argument));
+	ast_pool_deinit(&ast->on_functions, sizeof(struct flat_function));
+	ast_pool_deinit(&ast->helper_functions, sizeof(struct flat_function));
+}
+
+// MARK: parser
+
+/// Nesting expressions and blocks deeper than this is a parser error instead of a stack overflow
+#define GRUG_MAX_PARSE_DEPTH 256
+
+/// A growable array that the parser collects a list in before appending it to its pool in one go.
+/// A nested list is always finished before the list containing it gets its next element,
+/// so lists of the same kind can share one stack by each remembering where they started.
+struct parse_stack {
+	char* data;
+	size_t len;
+	size_t capacity;
+};
+
+struct parser {
+	struct compact_tokens const* tokens;
+	/// The same buffer as tokens->src, which lives in the AST's arena.
+	/// String literals and comments are null terminated in place, so the AST can point straight into it.
+	char* src;
+	struct flat_ast* ast;
+	size_t index;
+	size_t depth;
+	/// The line of the token at `lines_counted_until`, which parser_line moves up to `index`
+	uint32_t line;
+	size_t lines_counted_until;
+	/// struct flat_statement
+	struct parse_stack statements;
+	/// struct flat_branch
+	struct parse_stack branches;
+	/// ast_index of call arguments
+	struct parse_stack expr_refs;
+	bool failed;
+	struct grug_error* o_error;
+};
+
+static void write_parser_error(struct parser* parser, char const* message) {
+	if(parser->failed) {
+		return;
+	}
+	parser->failed = true;
+	struct compact_tokens const* tokens = parser->tokens;
+	// NEW_LINE tokens are the only ones containing a '\n', and comments may have had theirs overwritten
+	size_t line = 1;
+	for(size_t token_index = 0; token_index < parser->index && token_index < tokens->count; token_index += 1) {
+		if(compact_token_type(tokens, token_index) == GRUG_TOKEN_TYPE_NEW_LINE) {
+			line += 1;
+		}
+	}
+	size_t offset = 0;
+	size_t num_characters = 0;
+	if(parser->index < tokens->count) {
+		offset = tokens->offsets[parser->index];
+		num_characters = compact_token_len(tokens, parser->index);
+	} else if(tokens->count) {
+		offset = tokens->offsets[tokens->count - 1] + compact_token_len(tokens, tokens->count - 1);
+	}
+	// grug_assign_error copies the message, so a stack buffer is fine
+	char message_buffer[256];
+	(void)snprintf(message_buffer, sizeof(message_buffer), "%s on line %zu", message, line);
+	struct grug_error err = {
+		.error_type = GRUG_ERROR_CODE_COMPILE_PARSER,
+		// Needs to be brought in line with what the test suite expects
+		.message = message_buffer,
+		.custom_message = message_buffer,
+		.file = {
+			.offset = offset,
+			.num_characters = num_characters,
+		},
+	};
+	grug_assign_error(parser->o_error, &err, NULL);
+}
+
+static void write_parser_allocation_error(struct parser* parser) {
+	write_parser_error(parser, "Failed to allocate the AST");
+}
+
+static inline grug_token_type peek_type_at(struct parser const* parser, size_t index) {
+	if(index < parser->tokens->count) {
+		return compact_token_type(parser->tokens, index);
+	}
+	return GRUG_TOKEN_TYPE_NONE;
+}
+
+static inline grug_token_type peek_type(struct parser const* parser) {
+	return peek_type_at(parser, parser->index);
+}
+
+/// Writes "Expected <expected>, but got <the current token>"
+static void write_unexpected_token_error(struct parser* parser, char const* expected) {
+	char message_buffer[128];
+	grug_token_type type = peek_type(parser);
+	if(type == GRUG_TOKEN_TYPE_NONE) {
+		(void)snprintf(message_buffer, sizeof(message_buffer), "Expected %s, but got the end of the file", expected);
+	} else if(type == GRUG_TOKEN_TYPE_NEW_LINE) {
+		(void)snprintf(message_buffer, sizeof(message_buffer), "Expected %s, but got a new line", expected);
+	} else {
+		size_t len = compact_token_len(parser->tokens, parser->index);
+		int shown_len = len > 32 ? 32 : (int)len;
+		(void)snprintf(message_buffer, sizeof(message_buffer), "Expected %s, but got '%.*s'", expected, shown_len, compact_token_contents(parser->tokens, parser->index));
+	}
+	write_parser_error(parser, message_buffer);
+}
+
+/// Checks the spaces before the current token, which can only be 0 or 1 since the tokenizer rejects anything else in the middle of a line
+static bool expect_spaces_before(struct parser* parser, size_t spaces) {
+	if(parser->index >= parser->tokens->count || compact_token_spaces_before(parser->tokens, parser->index) == spaces) {
+		return true;
+	}
+	write_parser_error(parser, spaces ? "Expected a single space" : "Unexpected space");
+	return false;
+}
+
+static bool expect_indentation(struct parser* parser, size_t depth) {
+	if(compact_token_indent_depth(parser->tokens, parser->index) == depth) {
+		return true;
+	}
+	char message_buffer[64];
+	(void)snprintf(message_buffer, sizeof(message_buffer), "Expected an indentation of %zu spaces", depth * GRUG_SPACES_PER_INDENT);
+	write_parser_error(parser, message_buffer);
+	return false;
+}
+
+/// Consumes a token of `type` that has `spaces` spaces before it
+static bool expect_token(struct parser* parser, grug_token_type type, size_t spaces, char const* expected) {
+	if(parser->failed) {
+		return false;
+	}
+	if(peek_type(parser) != type) {
+		write_unexpected_token_error(parser, expected);
+		return false;
+	}
+	if(!expect_spaces_before(parser, spaces)) {
+		return false;
+	}
+	parser->index += 1;
+	return true;
+}
+
+static bool expect_end_of_line(struct parser* parser, bool allow_end_of_file) {
+	if(allow_end_of_file && peek_type(parser) == GRUG_TOKEN_TYPE_NONE) {
+		return !parser->failed;
+	}
+	return expect_token(parser, GRUG_TOKEN_TYPE_NEW_LINE, 0, "a new line");
+}
+
+static bool parse_stack_push(struct parser* parser, struct parse_stack* stack, void const* item, size_t item_size) {
+	if(stack->len + item_size > stack->capacity) {
+		size_t new_capacity = stack->capacity ? stack->capacity * 2 : item_size * 16;
+		char* new_data = grug_realloc(stack->data, stack->capacity, new_capacity);
+		if(!new_data) {
+			write_parser_allocation_error(parser);
+			return false;
+		}
+		stack->data = new_data;
+		stack->capacity = new_capacity;
+	}
+	memcpy(stack->data + stack->len, item, item_size);
+	stack->len += item_size;
+	return true;
+}
+
+/// Moves everything pushed since `base` to the end of `pool`, and returns the index of the first item
+static ast_index parse_stack_pop_into_pool(struct parser* parser, struct parse_stack* stack, size_t base, struct ast_pool* pool, size_t item_size, uint32_t* out_count) {
+	size_t count = (stack->len - base) / item_size;
+	stack->len = base;
+	*out_count = (uint32_t)count;
+	ast_index first = ast_pool_push_many(pool, stack->data + base, count, item_size);
+	if(first == AST_INDEX_NONE) {
+		write_parser_allocation_error(parser);
+	}
+	return first;
+}
+
+static void parse_stack_deinit(struct parse_stack* stack) {
+	if(stack->data) {
+		GRUG_FREE(stack->data, stack->capacity);
+	}
+	*stack = (struct parse_stack) {0};
+}
+
+static ast_index push_node(struct parser* parser, struct ast_pool* pool, void const* item, size_t item_size) {
+	if(parser->failed) {
+		return AST_INDEX_NONE;
+	}
+	ast_index index = ast_pool_push_many(pool, item, 1, item_size);
+	if(index == AST_INDEX_NONE) {
+		write_parser_allocation_error(parser);
+	}
+	return index;
+}
+
+static ast_index push_string(struct parser* parser, char const* string) {
+	return push_node(parser, &parser->ast->strings, (void const*)&string, sizeof(string));
+}
+
+/// Interns a name, which also gives it a null terminated copy, since the character after a name is usually part of the next token
+static grug_symbol intern_token(struct parser* parser, size_t index) {
+	if(parser->failed) {
+		return GRUG_SYMBOL_NONE;
+	}
+	grug_symbol symbol = grug_intern(parser->ast->interner, compact_token_contents(parser->tokens, index), compact_token_len(parser->tokens, index));
+	if(symbol == GRUG_SYMBOL_NONE) {
+		write_parser_allocation_error(parser);
+	}
+	return symbol;
+}
+
+/// Adds a null terminated copy of a token's contents to the AST's arena, for numbers
+static ast_index push_token_copy(struct parser* parser, size_t index) {
+	size_t len = compact_token_len(parser->tokens, index);
+	char* copy = grug_arena_alloc_aligned(parser->ast->arena, len + 1, 1);
+	if(!copy) {
+		write_parser_allocation_error(parser);
+		return AST_INDEX_NONE;
+	}
+	memcpy(copy, compact_token_contents(parser->tokens, index), len);
+	copy[len] = '\0';
+	return push_string(parser, copy);
+}
+
+/// Adds the contents of a string, entity or resource literal without its prefix and quotes.
+/// The closing quote is overwritten with the null terminator, which is safe because nothing reads a token's text again once it has been parsed.
+static ast_index push_literal_view(struct parser* parser, size_t index) {
+	char* contents = parser->src + parser->tokens->offsets[index];
+	size_t len = compact_token_len(parser->tokens, index);
+	size_t start = contents[0] == '"' ? 1 : 2;
+	contents[len - 1] = '\0';
+	return push_string(parser, contents + start);
+}
+
+/// Adds the text of a comment without the '#' and the space after it.
+/// The character after a comment is its '\n' (or the null terminator of the file), so that gets overwritten instead.
+static ast_index push_comment_view(struct parser* parser, size_t index) {
+	char* contents = parser->src + parser->tokens->offsets[index];
+	size_t len = compact_token_len(parser->tokens, index);
+	contents[len] = '\0';
+	size_t start = len > 1 && contents[1] == ' ' ? 2 : 1;
+	return push_string(parser, contents + start);
+}
+
+/// Returns the line of the current token.
+/// `index` only ever moves forward, so every NEW_LINE token gets counted once in total.
+static uint32_t parser_line(struct parser* parser) {
+	for(; parser->lines_counted_until < parser->index && parser->lines_counted_until < parser->tokens->count; parser->lines_counted_until += 1) {
+		if(compact_token_type(parser->tokens, parser->lines_counted_until) == GRUG_TOKEN_TYPE_NEW_LINE) {
+			parser->line += 1;
+		}
+	}
+	return parser->line;
+}
+
+static ast_index push_expr(struct parser* parser, struct flat_expr const* expr) {
+	// Expressions can't span lines, so the line of the token after one is its own
+	uint32_t line = parser_line(parser);
+	ast_index index = push_node(parser, &parser->ast->exprs, expr, sizeof(*expr));
+	(void)push_node(parser, &parser->ast->expr_lines, &line, sizeof(line));
+	return index;
+}
+
+static ast_index parse_type(struct parser* parser) {
+	if(peek_type(parser) != GRUG_TOKEN_TYPE_WORD) {
+		write_unexpected_token_error(parser, "a type");
+		return AST_INDEX_NONE;
+	}
+	char const* name = compact_token_contents(parser->tokens, parser->index);
+	size_t name_len = compact_token_len(parser->tokens, parser->index);
+	struct flat_type type = {.type = GRUG_TYPE_ID, .custom_name = GRUG_SYMBOL_NONE};
+	if(word_equals(name, name_len, "bool", 4)) {
+		type.type = GRUG_TYPE_BOOL;
+	} else if(word_equals(name, name_len, "number", 6)) {
+		type.type = GRUG_TYPE_NUMBER;
+	} else if(word_equals(name, name_len, "string", 6)) {
+		type.type = GRUG_TYPE_STRING;
+	} else if(word_equals(name, name_len, "id", 2)) {
+		type.type = GRUG_TYPE_ID;
+	} else if(word_equals(name, name_len, "resource", 8)) {
+		type.type = GRUG_TYPE_RESOURCE;
+	} else if(word_equals(name, name_len, "entity", 6)) {
+		type.type = GRUG_TYPE_ENTITY;
+	} else {
+		// Any other name is a custom id type like `Gun`, which the type checker looks up in the mod API
+		type.custom_name = intern_token(parser, parser->index);
+	}
+	parser->index += 1;
+	return push_node(parser, &parser->ast->types, &type, sizeof(type));
+}
+
+static ast_index parse_expression(struct parser* parser);
+
+/// Parses the arguments of a call, starting at the '('
+static ast_index parse_call(struct parser* parser, size_t name_index) {
+	struct flat_expr call = {.type = GRUG_EXPR_TYPE_CALL};
+	call.a = intern_token(parser, name_index);
+	if(!expect_token(parser, GRUG_TOKEN_TYPE_OPEN_PARENTHESIS, 0, "'('")) {
+		return AST_INDEX_NONE;
+	}
+	size_t base = parser->expr_refs.len;
+	if(peek_type(parser) != GRUG_TOKEN_TYPE_CLOSE_PARENTHESIS) {
+		while(!parser->failed) {
+			if(!expect_spaces_before(parser, parser->expr_refs.len == base ? 0 : 1)) {
+				break;
+			}
+			ast_index argument = parse_expression(parser);
+			if(parser->failed || !parse_stack_push(parser, &parser->expr_refs, &argument, sizeof(argument))) {
+				break;
+			}
+			if(peek_type(parser) != GRUG_TOKEN_TYPE_COMMA) {
+				break;
+			}
+			(void)expect_token(parser, GRUG_TOKEN_TYPE_COMMA, 0, "','");
+		}
+	}
+	if(parser->failed) {
+		parser->expr_refs.len = base;
+		return AST_INDEX_NONE;
+	}
+	if((parser->expr_refs.len - base) / sizeof(ast_index) > UINT16_MAX) {
+		parser->expr_refs.len = base;
+		write_parser_error(parser, "Too many arguments");
+		return AST_INDEX_NONE;
+	}
+	uint32_t args_len = 0;
+	call.b = parse_stack_pop_into_pool(parser, &parser->expr_refs, base, &parser->ast->expr_refs, sizeof(ast_index), &args_len);
+	call.args_len = (uint16_t)args_len;
+	call.c = AST_INDEX_NONE;
+	if(!expect_token(parser, GRUG_TOKEN_TYPE_CLOSE_PARENTHESIS, 0, "')'")) {
+		return AST_INDEX_NONE;
+	}
+	return push_expr(parser, &call);
+}
+
+static ast_index parse_primary_expression(struct parser* parser) {
+	struct flat_expr expr = {0};
+	size_t index = parser->index;
+	switch(peek_type(parser)) {
+		case GRUG_TOKEN_TYPE_TRUE:
+			expr.type = GRUG_EXPR_TYPE_TRUE;
+			break;
+		case GRUG_TOKEN_TYPE_FALSE:
+			expr.type = GRUG_EXPR_TYPE_FALSE;
+			break;
+		case GRUG_TOKEN_TYPE_STRING:
+			expr.type = GRUG_EXPR_TYPE_STRING;
+			expr.a = push_literal_view(parser, index);
+			break;
+		case GRUG_TOKEN_TYPE_RESOURCE:
+			expr.type = GRUG_EXPR_TYPE_RESOURCE;
+			expr.a = push_literal_view(parser, index);
+			break;
+		case GRUG_TOKEN_TYPE_ENTITY:
+			expr.type = GRUG_EXPR_TYPE_ENTITY;
+			expr.a = push_literal_view(parser, index);
+			break;
+		case GRUG_TOKEN_TYPE_NUMBER: {
+			expr.type = GRUG_EXPR_TYPE_NUMBER;
+			expr.a = push_token_copy(parser, index);
+			if(parser->failed) {
+				return AST_INDEX_NONE;
+			}
+			// The tokenizer already checked that this is a well formed number
+			double value = strtod(flat_string_at(parser->ast, expr.a), NULL);
+			expr.b = push_node(parser, &parser->ast->numbers, &value, sizeof(value));
+			break;
+		}
+		case GRUG_TOKEN_TYPE_WORD:
+			parser->index += 1;
+			if(peek_type(parser) == GRUG_TOKEN_TYPE_OPEN_PARENTHESIS) {
+				return parse_call(parser, index);
+			}
+			expr.type = GRUG_EXPR_TYPE_IDENTIFIER;
+			expr.a = intern_token(parser, index);
+			return push_expr(parser, &expr);
+		case GRUG_TOKEN_TYPE_OPEN_PARENTHESIS: {
+			parser->index += 1;
+			if(!expect_spaces_before(parser, 0)) {
+				return AST_INDEX_NONE;
+			}
+			expr.type = GRUG_EXPR_TYPE_PARENTHESIZED;
+			expr.a = parse_expression(parser);
+			if(!expect_token(parser, GRUG_TOKEN_TYPE_CLOSE_PARENTHESIS, 0, "')'")) {
+				return AST_INDEX_NONE;
+			}
+			return push_expr(parser, &expr);
+		}
+		default:
+			write_unexpected_token_error(parser, "an expression");
+			return AST_INDEX_NONE;
+	}
+	parser->index += 1;
+	return push_expr(parser, &expr);
+}
+
+static ast_index parse_unary_expression(struct parser* parser) {
+	// Every kind of nesting (parentheses, call arguments, operands) comes through here
+	if(parser->depth == GRUG_MAX_PARSE_DEPTH) {
+		write_parser_error(parser, "Expressions are nested too deeply");
+		return AST_INDEX_NONE;
+	}
+	parser->depth += 1;
+	ast_index result = AST_INDEX_NONE;
+	grug_token_type type = peek_type(parser);
+	if(type == GRUG_TOKEN_TYPE_NOT || type == GRUG_TOKEN_TYPE_MINUS) {
+		parser->index += 1;
+		// `not x` but `-x`
+		if(expect_spaces_before(parser, type == GRUG_TOKEN_TYPE_NOT ? 1 : 0)) {
+			struct flat_expr expr = {.type = GRUG_EXPR_TYPE_UNARY};
+			expr.op = type == GRUG_TOKEN_TYPE_NOT ? GRUG_UNARY_NOT : GRUG_UNARY_MINUS;
+			expr.a = parse_unary_expression(parser);
+			result = push_expr(parser, &expr);
+		}
+	} else {
+		result = parse_primary_expression(parser);
+	}
+	parser->depth -= 1;
+	return result;
+}
+
+/// Returns the precedence of a binary operator token, or 0 if it isn't one
+static unsigned binary_operator_of(grug_token_type type, grug_binary_operator* out_op) {
+	switch(type) {
+		case GRUG_TOKEN_TYPE_OR: *out_op = GRUG_BINARY_OR; return 1;
+		case GRUG_TOKEN_TYPE_AND: *out_op = GRUG_BINARY_AND; return 2;
+		case GRUG_TOKEN_TYPE_DOUBLE_EQUALS: *out_op = GRUG_BINARY_DOUBLEEQUALS; return 3;
+		case GRUG_TOKEN_TYPE_NOT_EQUALS: *out_op = GRUG_BINARY_NOTEQUALS; return 3;
+		case GRUG_TOKEN_TYPE_GREATER: *out_op = GRUG_BINARY_GREATER; return 4;
+		case GRUG_TOKEN_TYPE_GREATER_EQUALS: *out_op = GRUG_BINARY_GREATEREQUALS; return 4;
+		case GRUG_TOKEN_TYPE_LESS: *out_op = GRUG_BINARY_LESS; return 4;
+		case GRUG_TOKEN_TYPE_LESS_EQUALS: *out_op = GRUG_BINARY_LESSEQUALS; return 4;
+		case GRUG_TOKEN_TYPE_PLUS: *out_op = GRUG_BINARY_PLUS; return 5;
+		case GRUG_TOKEN_TYPE_MINUS: *out_op = GRUG_BINARY_MINUS; return 5;
+		case GRUG_TOKEN_TYPE_STAR: *out_op = GRUG_BINARY_MULTIPLY; return 6;
+		case GRUG_TOKEN_TYPE_FORWARD_SLASH: *out_op = GRUG_BINARY_DIVISION; return 6;
+		default: return 0;
+	}
+}
+
+/// Precedence climbing: parses operators binding at least as tightly as `min_precedence`, all of them left associative
+static ast_index parse_binary_expression(struct parser* parser, unsigned min_precedence) {
+	ast_index left = parse_unary_expression(parser);
+	while(!parser->failed) {
+		grug_binary_operator op = 0;
+		unsigned precedence = binary_operator_of(peek_type(parser), &op);
+		if(!precedence || precedence < min_precedence) {
+			break;
+		}
+		if(!expect_spaces_before(parser, 1)) {
+			break;
+		}
+		parser->index += 1;
+		if(!expect_spaces_before(parser, 1)) {
+			break;
+		}
+		struct flat_expr binary = {.type = GRUG_EXPR_TYPE_BINARY, .op = (uint8_t)op};
+		binary.a = left;
+		binary.b = parse_binary_expression(parser, precedence + 1);
+		left = push_expr(parser, &binary);
+	}
+	return left;
+}
+
+static ast_index parse_expression(struct parser* parser) {
+	return parse_binary_expression(parser, 1);
+}
+
+static ast_index parse_block(struct parser* parser, size_t depth);
+
+/// Parses `<cond> {` and the block after it, with the parser on the token after the `if` or `while`
+static struct flat_branch parse_condition_and_block(struct parser* parser, size_t depth) {
+	struct flat_branch branch = {.cond = AST_INDEX_NONE, .block = AST_INDEX_NONE};
+	if(!expect_spaces_before(parser, 1)) {
+		return branch;
+	}
+	branch.cond = parse_expression(parser);
+	if(!expect_token(parser, GRUG_TOKEN_TYPE_OPEN_BRACE, 1, "'{'")) {
+		return branch;
+	}
+	branch.block = parse_block(parser, depth);
+	return branch;
+}
+
+static void parse_if_statement(struct parser* parser, size_t depth, struct flat_statement* out_statement) {
+	out_statement->type = GRUG_STATEMENT_IF;
+	out_statement->c = AST_INDEX_NONE;
+	parser->index += 1;
+	size_t base = parser->branches.len;
+	struct flat_branch branch = parse_condition_and_block(parser, depth);
+	if(!parser->failed) {
+		(void)parse_stack_push(parser, &parser->branches, &branch, sizeof(branch));
+	}
+	while(!parser->failed && peek_type(parser) == GRUG_TOKEN_TYPE_ELSE) {
+		(void)expect_token(parser, GRUG_TOKEN_TYPE_ELSE, 1, "'else'");
+		if(peek_type(parser) == GRUG_TOKEN_TYPE_IF) {
+			(void)expect_token(parser, GRUG_TOKEN_TYPE_IF, 1, "'if'");
+			branch = parse_condition_and_block(parser, depth);
+			if(!parser->failed) {
+				(void)parse_stack_push(parser, &parser->branches, &branch, sizeof(branch));
+			}
+		} else {
+			if(expect_token(parser, GRUG_TOKEN_TYPE_OPEN_BRACE, 1, "'{'")) {
+				out_statement->c = parse_block(parser, depth);
+			}
+			break;
+		}
+	}
+	if(parser->failed) {
+		parser->branches.len = base;
+		return;
+	}
+	out_statement->a = parse_stack_pop_into_pool(parser, &parser->branches, base, &parser->ast->branches, sizeof(struct flat_branch), &out_statement->b);
+}
+
+/// Parses the statement starting at the current token, which is the first one on its line, up to and including its new line
+static void parse_statement(struct parser* parser, size_t depth, struct flat_statement* out_statement) {
+	size_t index = parser->index;
+	out_statement->line = parser_line(parser);
+	switch(peek_type(parser)) {
+		case GRUG_TOKEN_TYPE_COMMENT:
+			out_statement->type = GRUG_STATEMENT_COMMENT;
+			out_statement->a = push_comment_view(parser, index);
+			parser->index += 1;
+			break;
+		case GRUG_TOKEN_TYPE_IF:
+			parse_if_statement(parser, depth, out_statement);
+			break;
+		case GRUG_TOKEN_TYPE_WHILE: {
+			out_statement->type = GRUG_STATEMENT_WHILE;
+			parser->index += 1;
+			struct flat_branch loop = parse_condition_and_block(parser, depth);
+			out_statement->a = loop.cond;
+			out_statement->b = loop.block;
+			break;
+		}
+		case GRUG_TOKEN_TYPE_RETURN:
+			out_statement->type = GRUG_STATEMENT_RETURN;
+			out_statement->a = AST_INDEX_NONE;
+			parser->index += 1;
+			if(peek_type(parser) != GRUG_TOKEN_TYPE_NEW_LINE && expect_spaces_before(parser, 1)) {
+				out_statement->a = parse_expression(parser);
+			}
+			break;
+		case GRUG_TOKEN_TYPE_BREAK:
+			out_statement->type = GRUG_STATEMENT_BREAK;
+			parser->index += 1;
+			break;
+		case GRUG_TOKEN_TYPE_CONTINUE:
+			out_statement->type = GRUG_STATEMENT_CONTINUE;
+			parser->index += 1;
+			break;
+		case GRUG_TOKEN_TYPE_WORD: {
+			grug_token_type next_type = peek_type_at(parser, index + 1);
+			if(next_type == GRUG_TOKEN_TYPE_OPEN_PARENTHESIS) {
+				out_statement->type = GRUG_STATEMENT_CALL;
+				out_statement->a = parse_primary_expression(parser);
+				break;
+			}
+			if(next_type != GRUG_TOKEN_TYPE_COLON && next_type != GRUG_TOKEN_TYPE_EQUAL) {
+				parser->index += 1;
+				write_unexpected_token_error(parser, "':', '=' or '('");
+				return;
+			}
+			out_statement->type = GRUG_STATEMENT_VARIABLE;
+			out_statement->a = intern_token(parser, index);
+			parser->index += 1;
+			// Without a type this is an assignment to an existing variable
+			out_statement->b = AST_INDEX_NONE;
+			if(next_type == GRUG_TOKEN_TYPE_COLON) {
+				(void)expect_token(parser, GRUG_TOKEN_TYPE_COLON, 0, "':'");
+				if(!expect_spaces_before(parser, 1)) {
+					return;
+				}
+				out_statement->b = parse_type(parser);
+			}
+			if(!expect_token(parser, GRUG_TOKEN_TYPE_EQUAL, 1, "'='") || !expect_spaces_before(parser, 1)) {
+				return;
+			}
+			out_statement->c = parse_expression(parser);
+			break;
+		}
+		default:
+			write_unexpected_token_error(parser, "a statement");
+			return;
+	}
+	(void)expect_end_of_line(parser, false);
+}
+
+/// Parses the statements of a block up to and including its '}', with the parser on the token after the '{'.
+/// `depth` is the indentation depth of the line the block starts on.
+static ast_index parse_block(struct parser* parser, size_t depth) {
+	// Blocks share the limit with expressions, as both recurse on the C stack
+	if(parser->depth == GRUG_MAX_PARSE_DEPTH) {
+		write_parser_error(parser, "Blocks are nested too deeply");
+		return AST_INDEX_NONE;
+	}
+	if(!expect_end_of_line(parser, false)) {
+		return AST_INDEX_NONE;
+	}
+	parser->depth += 1;
+	size_t base = parser->statements.len;
+	while(!parser->failed) {
+		grug_token_type type = peek_type(parser);
+		if(type == GRUG_TOKEN_TYPE_NONE) {
+			write_unexpected_token_error(parser, "'}'");
+			break;
+		}
+		struct flat_statement statement = {0};
+		if(type == GRUG_TOKEN_TYPE_NEW_LINE) {
+			statement.type = GRUG_STATEMENT_EMPTY;
+			parser->index += 1;
+		} else if(type == GRUG_TOKEN_TYPE_CLOSE_BRACE) {
+			if(expect_indentation(parser, depth)) {
+				parser->index += 1;
+			}
+			break;
+		} else if(expect_indentation(parser, depth + 1)) {
+			parse_statement(parser, depth + 1, &statement);
+		}
+		if(!parser->failed) {
+			(void)parse_stack_push(parser, &parser->statements, &statement, sizeof(statement));
+		}
+	}
+	parser->depth -= 1;
+	if(parser->failed) {
+		parser->statements.len = base;
+		return AST_INDEX_NONE;
+	}
+	struct flat_block block = {0};
+	block.first_statement = parse_stack_pop_into_pool(parser, &parser->statements, base, &parser->ast->statements, sizeof(struct flat_statement), &block.statements_len);
+	return push_node(parser, &parser->ast->blocks, &block, sizeof(block));
+}
+
+/// Parses `name: type = expr`
+static void parse_member_variable(struct parser* parser) {
+	struct flat_member member = {0};
+	member.name = intern_token(parser, parser->index);
+	parser->index += 1;
+	if(!expect_token(parser, GRUG_TOKEN_TYPE_COLON, 0, "':'") || !expect_spaces_before(parser, 1)) {
+		return;
+	}
+	member.type = parse_type(parser);
+	if(!expect_token(parser, GRUG_TOKEN_TYPE_EQUAL, 1, "'='") || !expect_spaces_before(parser, 1)) {
+		return;
+	}
+	member.expr = parse_expression(parser);
+	if(expect_end_of_line(parser, true)) {
+		(void)push_node(parser, &parser->ast->members, &member, sizeof(member));
+	}
+}
+
+/// Parses an on function or a helper function, which one being decided by whether the name starts with "on_"
+static void parse_function(struct parser* parser) {
+	size_t name_index = parser->index;
+	struct flat_function function = {.return_type = AST_INDEX_NONE, .line = parser_line(parser)};
+	function.name = intern_token(parser, name_index);
+	parser->index += 1;
+	if(!expect_token(parser, GRUG_TOKEN_TYPE_OPEN_PARENTHESIS, 0, "'('")) {
+		return;
+	}
+	// Functions don't nest, so the arguments can go straight into their pool
+	function.first_argument = parser->ast->arguments.count;
+	if(peek_type(parser) != GRUG_TOKEN_TYPE_CLOSE_PARENTHESIS) {
+		while(!parser->failed) {
+			struct flat_argument argument = {0};
+			if(!expect_token(parser, GRUG_TOKEN_TYPE_WORD, function.arguments_len ? 1 : 0, "an argument name")) {
+				break;
+			}
+			argument.name = intern_token(parser, parser->index - 1);
+			if(!expect_token(parser, GRUG_TOKEN_TYPE_COLON, 0, "':'") || !expect_spaces_before(parser, 1)) {
+				break;
+			}
+			argument.type = parse_type(parser);
+			if(push_node(parser, &parser->ast->arguments, &argument, sizeof(argument)) == AST_INDEX_NONE) {
+				break;
+			}
+			function.arguments_len += 1;
+			if(peek_type(parser) != GRUG_TOKEN_TYPE_COMMA) {
+				break;
+			}
+			(void)expect_token(parser, GRUG_TOKEN_TYPE_COMMA, 0, "','");
+		}
+	}
+	if(!expect_token(parser, GRUG_TOKEN_TYPE_CLOSE_PARENTHESIS, 0, "')'")) {
+		return;
+	}
+
+	bool is_on_function = compact_token_len(parser->tokens, name_index) > 3 && strncmp(compact_token_contents(parser->tokens, name_index), "on_", 3) == 0;
+	if(peek_type(parser) == GRUG_TOKEN_TYPE_WORD) {
+		if(is_on_function) {
+			write_parser_error(parser, "On functions can't have a return type");
+			return;
+		}
+		if(!expect_spaces_before(parser, 1)) {
+			return;
+		}
+		function.return_type = parse_type(parser);
+	}
+	if(!expect_token(parser, GRUG_TOKEN_TYPE_OPEN_BRACE, 1, "'{'")) {
+		return;
+	}
+	function.block = parse_block(parser, 0);
+	if(!expect_end_of_line(parser, true)) {
+		return;
+	}
+	(void)push_node(parser, is_on_function ? &parser->ast->on_functions : &parser->ast->helper_functions, &function, sizeof(function));
+}
+
+/// Parses compact tokens into `out_ast`, whose names are interned with `interner` and whose other strings are allocated from `arena`.
+/// `src` is the writable buffer the tokens point into, which must live in `arena` too.
+/// Top level comments have nowhere to go in struct grug_ast, so they are skipped.
+/// Returns false and writes to o_error upon an error, in which case `out_ast` has already been deinitialized.
+static bool compact_tokens_to_flat_ast(struct compact_tokens const* tokens, char* src, struct grug_arena* arena, struct grug_interner* interner, struct flat_ast* out_ast, struct grug_error* o_error) {
+	assert(src == tokens->src);
+	*out_ast = (struct flat_ast) {.arena = arena, .interner = interner};
+	struct parser parser = {.tokens = tokens, .src = src, .ast = out_ast, .line = 1, .o_error = o_error};
+	while(!parser.failed && parser.index < tokens->count) {
+		switch(peek_type(&parser)) {
+			case GRUG_TOKEN_TYPE_NEW_LINE:
+				parser.index += 1;
+				break;
+			case GRUG_TOKEN_TYPE_COMMENT:
+				if(expect_indentation(&parser, 0)) {
+					parser.index += 1;
+					(void)expect_end_of_line(&parser, true);
+				}
+				break;
+			case GRUG_TOKEN_TYPE_WORD:
+				if(!expect_indentation(&parser, 0)) {
+					break;
+				}
+				if(peek_type_at(&parser, parser.index + 1) == GRUG_TOKEN_TYPE_COLON) {
+					parse_member_variable(&parser);
+				} else if(peek_type_at(&parser, parser.index + 1) == GRUG_TOKEN_TYPE_OPEN_PARENTHESIS) {
+					parse_function(&parser);
+				} else {
+					parser.index += 1;
+					write_unexpected_token_error(&parser, "':' or '('");
+				}
+				break;
+			default:
+				write_unexpected_token_error(&parser, "a member variable or function");
+				break;
+		}
+	}
+	parse_stack_deinit(&parser.statements);
+	parse_stack_deinit(&parser.branches);
+	parse_stack_deinit(&parser.expr_refs);
+	if(parser.failed) {
+		flat_ast_deinit(out_ast);
+		return false;
+	}
+	return true;
+}
+
+/// The tokens get their own arena so the token array is always on top of its stack and grows in place
+static struct grug_arena* new_token_arena(struct grug_error* o_error) {
+	struct grug_arena* token_arena = grug_arena_new();
+	if(!token_arena) {
+		struct grug_error err = {
+			// TODO(bluesillybeard): add specific error codes for failed allocations
+			.error_type = GRUG_ERROR_CODE_COMPILE_TOKENIZER,
+			.message = "Failed to convert grug to tokens: grug_arena_new() returned null",
+			.custom_message = "Failed to convert grug to tokens: grug_arena_new() returned null",
+		};
+		grug_assign_error(o_error, &err, NULL);
+	}
+	return token_arena;
+}
+
+/// Tokenizes and parses `src`, a null terminated buffer in `arena` that the AST will keep pointing into
+static bool parse_flat_ast(char* src, size_t src_len, struct grug_arena* arena, struct grug_interner* interner, struct flat_ast* out_ast, struct grug_error* o_error) {
+	struct grug_arena* token_arena = new_token_arena(o_error);
+	if(!token_arena) {
+		return false;
+	}
+	struct compact_tokens tokens = {0};
+	bool success = tokenize_compact(src, src_len, token_arena, &tokens, o_error) && compact_tokens_to_flat_ast(&tokens, src, arena, interner, out_ast, o_error);
+	// the ast only points into `arena`, so we can free the tokens immediately
+	grug_arena_deinit(token_arena);
+	return success;
+}
+
+// MARK: call binding
+
+enum call_target_enum {
+	CALL_TARGET_UNBOUND = 0,
+	CALL_TARGET_HELPER_FN,
+	CALL_TARGET_GAME_FN,
+};
+typedef uint8_t call_target;
+
+static void write_bind_error(struct flat_ast const* ast, ast_index expr_index, char const* format, char const* name, struct grug_error* o_error) {
+	// grug_assign_error copies the message, so a stack buffer is fine
+	char message_buffer[256];
+	char format_buffer[128];
+	(void)snprintf(format_buffer, sizeof(format_buffer), "%s on line %%u", format);
+	(void)snprintf(message_buffer, sizeof(message_buffer), format_buffer, name, flat_expr_line_at(ast, expr_index));
+	struct grug_error err = {
+		.error_type = GRUG_ERROR_CODE_COMPILE_TYPE_CHECKER,
+		.message = message_buffer,
+		.custom_message = message_buffer,
+	};
+	grug_assign_error(o_error, &err, NULL);
+}
+
+/// Binds every call in `ast` to the helper function of the same name in the file, or else to the game function of that name.
+/// From then on the `op` and `c` of a call say which function it ends up in, so nothing is looked up by name after compiling.
+/// Returns false and writes to o_error if a call's function doesn't exist.
+static bool bind_calls(struct flat_ast* ast, struct mod_api const* api, struct grug_error* o_error) {
+	ast->mod_api = api;
+	// A file's helper functions get their own little table for the duration of the pass, the same kind as the game functions'
+	uint32_t helpers_len = ast->helper_functions.count;
+	uint32_t slots_capacity = 16;
+	while(slots_capacity < helpers_len * 2) {
+		slots_capacity *= 2;
+	}
+	uint32_t* slots = GRUG_MALLOC(slots_capacity * sizeof(uint32_t));
+	if(!slots) {
+		struct grug_error err = {
+			.error_type = GRUG_ERROR_CODE_COMPILE_TYPE_CHECKER,
+			.message = "Failed to bind calls: malloc() returned null",
+			.custom_message = "Failed to bind calls: malloc() returned null",
+		};
+		grug_assign_error(o_error, &err, NULL);
+		return false;
+	}
+	memset(slots, 0xFF, slots_capacity * sizeof(uint32_t));
+	for(uint32_t helper_index = 0; helper_index < helpers_len; helper_index += 1) {
+		grug_symbol name = flat_helper_function_at(ast, helper_index)->name;
+		uint32_t slot = (uint32_t)(name * 2654435769U) & (slots_capacity - 1);
+		while(slots[slot] != AST_INDEX_NONE) {
+			if(flat_helper_function_at(ast, slots[slot])->name == name) {
+				char message_buffer[256];
+				(void)snprintf(message_buffer, sizeof(message_buffer), "The function '%s' was defined several times in the same file", grug_symbol_string(ast->interner, name));
+				struct grug_error err = {
+					.error_type = GRUG_ERROR_CODE_COMPILE_TYPE_CHECKER,
+					.message = message_buffer,
+					.custom_message = message_buffer,
+				};
+				grug_assign_error(o_error, &err, NULL);
+				GRUG_FREE(slots, slots_capacity * sizeof(uint32_t));
+				return false;
+			}
+			slot = (slot + 1) & (slots_capacity - 1);
+		}
+		slots[slot] = helper_index;
+	}
+
+	bool success = true;
+	struct flat_expr* exprs = (struct flat_expr*)(void*)ast->exprs.data;
+	for(ast_index expr_index = 0; expr_index < ast->exprs.count && success; expr_index += 1) {
+		struct flat_expr* call = &exprs[expr_index];
+		if(call->type != GRUG_EXPR_TYPE_CALL) {
+			continue;
+		}
+		grug_symbol name = call->a;
+		uint32_t slot = (uint32_t)(name * 2654435769U) & (slots_capacity - 1);
+		while(slots[slot] != AST_INDEX_NONE && flat_helper_function_at(ast, slots[slot])->name != name) {
+			slot = (slot + 1) & (slots_capacity - 1);
+		}
+		if(slots[slot] != AST_INDEX_NONE) {
+			call->op = CALL_TARGET_HELPER_FN;
+			call->c = slots[slot];
+			continue;
+		}
+		// The interner is shared with the state, so a game function's name is the same symbol here as in the mod API
+		uint32_t game_fn_index = find_game_fn(api, name);
+		if(game_fn_index == GAME_FN_INDEX_NONE) {
+			char const* function_name = grug_symbol_string(ast->interner, name);
+			write_bind_error(ast, expr_index, strncmp(function_name, "helper_", 7) == 0 ? "The function '%s' is not defined" : "The game function '%s' is not declared in mod_api.json", function_name, o_error);
+			success = false;
+			break;
+		}
+		call->op = CALL_TARGET_GAME_FN;
+		call->c = game_fn_index;
+	}
+	GRUG_FREE(slots, slots_capacity * sizeof(uint32_t));
+	return success;
+}
+
+/// Returns a cleared bitset of `bits` bits, or NULL after writing to o_error if it couldn't be allocated
+static uint64_t* new_bitset(size_t bits, struct grug_error* o_error) {
+	size_t words_len = (bits + 63) / 64;
+	uint64_t* bitset = GRUG_MALLOC(words_len * sizeof(uint64_t));
+	if(!bitset) {
+		struct grug_error err = {
+			.error_type = GRUG_ERROR_CODE_COMPILE,
+			.message = "Failed to compile: malloc() returned null",
+			.custom_message = "Failed to compile: malloc() returned null",
+		};
+		grug_assign_error(o_error, &err, NULL);
+		return NULL;
+	}
+	memset(bitset, 0, words_len * sizeof(uint64_t));
+	return bitset;
+}
+
+/// Sets *out_called_game_fns to the compiled_file.called_game_fns bitset of a file whose calls are bound.
+/// Returns false and writes to o_error if it couldn't be allocated.
+static bool find_called_game_fns(struct flat_ast const* ast, uint32_t game_fns_len, uint64_t** out_called_game_fns, struct grug_error* o_error) {
+	uint64_t* called_game_fns = NULL;
+	for(ast_index expr_index = 0; expr_index < ast->exprs.count; expr_index += 1) {
+		struct flat_expr const* call = flat_expr_at(ast, expr_index);
+		if(call->type != GRUG_EXPR_TYPE_CALL || call->op != CALL_TARGET_GAME_FN) {
+			continue;
+		}
+		if(!called_game_fns) {
+			called_game_fns = new_bitset(game_fns_len, o_error);
+			if(!called_game_fns) {
+				return false;
+			}
+		}
+		called_game_fns[call->c / 64] |= (uint64_t)1 << (call->c % 64);
+	}
+	*out_called_game_fns = called_game_fns;
+	return true;
+}
+
+/// Finds the on functions of a type checked file, so that calls of the others can return before entering the backend
+static bool find_defined_on_fns(struct flat_ast const* ast, uint32_t on_fns_len, uint64_t** out_defined_on_fns, struct grug_error* o_error) {
+	*out_defined_on_fns = NULL;
+	if(!ast->on_functions.count) {
+		return true;
+	}
+	uint64_t* defined_on_fns = new_bitset(on_fns_len, o_error);
+	if(!defined_on_fns) {
+		return false;
+	}
+	for(ast_index function_index = 0; function_index < ast->on_functions.count; function_index += 1) {
+		uint32_t on_fn_index = flat_on_function_at(ast, function_index)->on_fn_index;
+		defined_on_fns[on_fn_index / 64] |= (uint64_t)1 << (on_fn_index % 64);
+	}
+	*out_defined_on_fns = defined_on_fns;
+	return true;
+}
+
+// MARK: type checker
+
+struct checker_variable {
+	grug_symbol name;
+	struct flat_type type;
+};
+
+struct type_checker {
+	struct flat_ast* ast;
+	struct mod_api const* api;
+	struct mod_api_entity const* entity;
+	grug_symbol me_symbol;
+	/// The arguments and local variables in scope, innermost last
+	struct checker_variable* variables;
+	uint32_t variables_len;
+	uint32_t variables_capacity;
+	/// The members declared so far
+	uint32_t members_len;
+	/// The function being checked, or NULL while checking member variables
+	struct flat_function const* function;
+	uint32_t loop_depth;
+	bool failed;
+	struct grug_error* o_error;
+};
+
+/// `format` has at most a single %s for `name`, and gets " on line <line>" appended unless `line` is 0
+static bool write_type_error(struct type_checker* checker, uint32_t line, char const* format, char const* name) {
+	if(checker->failed) {
+		return false;
+	}
+	checker->failed = true;
+	char format_buffer[160];
+	(void)snprintf(format_buffer, sizeof(format_buffer), line ? "%s on line %%u" : "%s", format);
+	// grug_assign_error copies the message, so a stack buffer is fine
+	char message_buffer[256];
+	(void)snprintf(message_buffer, sizeof(message_buffer), format_buffer, name ? name : "", line);
+	struct grug_error err = {
+		.error_type = GRUG_ERROR_CODE_COMPILE_TYPE_CHECKER,
+		.message = message_buffer,
+		.custom_message = message_buffer,
+	};
+	grug_assign_error(checker->o_error, &err, NULL);
+	return false;
+}
+
+static char const* symbol_name(struct type_checker const* checker, grug_symbol symbol) {
+	return grug_symbol_string(checker->ast->interner, symbol);
+}
+
+static char const* type_name(struct type_checker const* checker, struct flat_type type) {
+	switch(type.type) {
+		case GRUG_TYPE_VOID: return "nothing";
+		case GRUG_TYPE_BOOL: return "bool";
+		case GRUG_TYPE_NUMBER: return "number";
+		case GRUG_TYPE_STRING: return "string";
+		case GRUG_TYPE_ID: return type.custom_name == GRUG_SYMBOL_NONE ? "id" : symbol_name(checker, type.custom_name);
+		case GRUG_TYPE_RESOURCE: return "resource";
+		case GRUG_TYPE_ENTITY: return "entity";
+		default: return "an unknown type";
+	}
+}
+
+static struct flat_type flat_type_of(struct mod_api_type type) {
+	return (struct flat_type) {.type = type.type, .custom_name = type.type == GRUG_TYPE_ID ? type.extra : GRUG_SYMBOL_NONE};
+}
+
+/// Whether a value of type `actual` can be used where `expected` is needed.
+/// A plain `id` accepts every id type, while a custom id type like `Gun` only accepts itself.
+static bool types_match(struct flat_type expected, struct flat_type actual) {
+	if(expected.type != actual.type) {
+		return false;
+	}
+	return expected.type != GRUG_TYPE_ID || expected.custom_name == GRUG_SYMBOL_NONE || expected.custom_name == actual.custom_name;
+}
+
+static bool push_checker_variable(struct type_checker* checker, grug_symbol name, struct flat_type type) {
+	if(checker->variables_len == checker->variables_capacity) {
+		uint32_t new_capacity = checker->variables_capacity ? checker->variables_capacity * 2 : 32;
+		struct checker_variable* new_variables = grug_realloc(checker->variables, checker->variables_capacity * sizeof(struct checker_variable), new_capacity * sizeof(struct checker_variable));
+		if(!new_variables) {
+			return write_type_error(checker, 0, "Failed to type check: malloc() returned null", NULL);
+		}
+		checker->variables = new_variables;
+		checker->variables_capacity = new_capacity;
+	}
+	checker->variables[checker->variables_len++] = (struct checker_variable) {.name = name, .type = type};
+	return true;
+}
+
+/// Looks up a local variable, an argument or a member variable, innermost first
+static bool find_variable(struct type_checker const* checker, grug_symbol name, struct flat_type* out_type) {
+	for(uint32_t variable_index = checker->variables_len; variable_index > 0; variable_index -= 1) {
+		if(checker->variables[variable_index - 1].name == name) {
+			*out_type = checker->variables[variable_index - 1].type;
+			return true;
+		}
+	}
+	for(uint32_t member_index = 0; member_index < checker->members_len; member_index += 1) {
+		struct flat_member const* member = flat_member_at(checker->ast, member_index);
+		if(member->name == name) {
+			*out_type = *flat_type_at(checker->ast, member->type);
+			return true;
+		}
+	}
+	return false;
+}
+
+static struct flat_type check_expr(struct type_checker* checker, ast_index index, bool needs_value);
+
+/// Checks a call's arguments against the parameter types of the function it is bound to
+static struct flat_type check_call(struct type_checker* checker, ast_index index) {
+	struct flat_ast* ast = checker->ast;
+	struct flat_expr const* call = flat_expr_at(ast, index);
+	uint32_t line = flat_expr_line_at(ast, index);
+	char const* name = symbol_name(checker, call->a);
+	uint32_t params_len = 0;
+	struct flat_type result = {.type = GRUG_TYPE_VOID, .custom_name = GRUG_SYMBOL_NONE};
+	struct flat_function const* helper = NULL;
+	struct game_fn_entry const* game_fn = NULL;
+	if(call->op == CALL_TARGET_HELPER_FN) {
+		helper = flat_helper_function_at(ast, call->c);
+		params_len = helper->arguments_len;
+		if(helper->return_type != AST_INDEX_NONE) {
+			result = *flat_type_at(ast, helper->return_type);
+		}
+	} else {
+		game_fn = &checker->api->game_fns[call->c];
+		params_len = game_fn->params_len;
+		result = flat_type_of(game_fn->return_type);
+		if(!game_fn->fn) {
+			write_type_error(checker, line, "The game function '%s' has not been registered", name);
+			return result;
+		}
+	}
+	if(call->args_len != params_len) {
+		write_type_error(checker, line, call->args_len < params_len ? "Function call '%s' expected more arguments" : "Function call '%s' got too many arguments", name);
+		return result;
+	}
+	for(uint32_t arg_index = 0; arg_index < call->args_len && !checker->failed; arg_index += 1) {
+		ast_index arg = flat_expr_ref_at(ast, call->b + arg_index);
+		struct flat_type arg_type = check_expr(checker, arg, true);
+		struct flat_type param_type;
+		grug_symbol resource_extension = GRUG_SYMBOL_NONE;
+		if(helper) {
+			param_type = *flat_type_at(ast, flat_argument_at(ast, helper->first_argument + arg_index)->type);
+		} else {
+			struct mod_api_type api_type = checker->api->params[game_fn->first_param + arg_index].type;
+			param_type = flat_type_of(api_type);
+			if(api_type.type == GRUG_TYPE_RESOURCE) {
+				resource_extension = api_type.extra;
+			}
+		}
+		if(checker->failed) {
+			break;
+		}
+		if(!types_match(param_type, arg_type)) {
+			char format[128];
+			(void)snprintf(format, sizeof(format), "Function call '%%s' expected the type %s for argument %u, but got %s", type_name(checker, param_type), arg_index + 1, type_name(checker, arg_type));
+			write_type_error(checker, line, format, name);
+			break;
+		}
+		struct flat_expr const* arg_expr = flat_expr_at(ast, arg);
+		if(resource_extension != GRUG_SYMBOL_NONE && arg_expr->type == GRUG_EXPR_TYPE_RESOURCE) {
+			char const* path = flat_string_at(ast, arg_expr->a);
+			size_t path_len = strlen(path);
+			size_t extension_len = grug_symbol_len(ast->interner, resource_extension);
+			char const* extension = symbol_name(checker, resource_extension);
+			if(path_len < extension_len || memcmp(path + path_len - extension_len, extension, extension_len) != 0) {
+				write_type_error(checker, line, "The resource extension of the argument should be '%s'", extension);
+			}
+		}
+	}
+	return result;
+}
+
+/// Returns the result type of the expression, and records it in ast->expr_types
+static struct flat_type check_expr(struct type_checker* checker, ast_index index, bool needs_value) {
+	struct flat_ast* ast = checker->ast;
+	struct flat_expr const* expr = flat_expr_at(ast, index);
+	uint32_t line = flat_expr_line_at(ast, index);
+	struct flat_type result = {.type = GRUG_TYPE_VOID, .custom_name = GRUG_SYMBOL_NONE};
+	switch(expr->type) {
+		case GRUG_EXPR_TYPE_TRUE:
+		case GRUG_EXPR_TYPE_FALSE:
+			result.type = GRUG_TYPE_BOOL;
+			break;
+		case GRUG_EXPR_TYPE_STRING:
+			result.type = GRUG_TYPE_STRING;
+			break;
+		case GRUG_EXPR_TYPE_RESOURCE:
+			result.type = GRUG_TYPE_RESOURCE;
+			break;
+		case GRUG_EXPR_TYPE_ENTITY:
+			result.type = GRUG_TYPE_ENTITY;
+			break;
+		case GRUG_EXPR_TYPE_NUMBER:
+			result.type = GRUG_TYPE_NUMBER;
+			break;
+		case GRUG_EXPR_TYPE_IDENTIFIER:
+			if(expr->a == checker->me_symbol) {
+				// `me` is the id of the object the entity belongs to, typed after the file's entity type
+				result = (struct flat_type) {.type = GRUG_TYPE_ID, .custom_name = checker->entity->name};
+			} else if(!find_variable(checker, expr->a, &result)) {
+				write_type_error(checker, line, "The variable '%s' does not exist", symbol_name(checker, expr->a));
+			}
+			break;
+		case GRUG_EXPR_TYPE_UNARY: {
+			struct flat_type operand = check_expr(checker, expr->a, true);
+			grug_type_type expected = expr->op == GRUG_UNARY_NOT ? GRUG_TYPE_BOOL : GRUG_TYPE_NUMBER;
+			if(!checker->failed && operand.type != expected) {
+				write_type_error(checker, line, expr->op == GRUG_UNARY_NOT ? "Found 'not' before %s, but it can only be put before a bool" : "Found '-' before %s, but it can only be put before a number", type_name(checker, operand));
+			}
+			result.type = expected;
+			break;
+		}
+		case GRUG_EXPR_TYPE_BINARY: {
+			struct flat_type left = check_expr(checker, expr->a, true);
+			struct flat_type right = check_expr(checker, expr->b, true);
+			if(checker->failed) {
+				break;
+			}
+			switch(expr->op) {
+				case GRUG_BINARY_OR:
+				case GRUG_BINARY_AND:
+					if(left.type != GRUG_TYPE_BOOL || right.type != GRUG_TYPE_BOOL) {
+						write_type_error(checker, line, "'%s' expects bool operands", expr->op == GRUG_BINARY_OR ? "or" : "and");
+					}
+					result.type = GRUG_TYPE_BOOL;
+					break;
+				case GRUG_BINARY_DOUBLEEQUALS:
+				case GRUG_BINARY_NOTEQUALS:
+					if(!types_match(left, right) && !types_match(right, left)) {
+						char format[128];
+						(void)snprintf(format, sizeof(format), "The left and right operand of a binary expression ('%%s') must have the same type, but got %s and %s", type_name(checker, left), type_name(checker, right));
+						write_type_error(checker, line, format, expr->op == GRUG_BINARY_DOUBLEEQUALS ? "==" : "!=");
+					}
+					result.type = GRUG_TYPE_BOOL;
+					break;
+				case GRUG_BINARY_GREATER:
+				case GRUG_BINARY_GREATEREQUALS:
+				case GRUG_BINARY_LESS:
+				case GRUG_BINARY_LESSEQUALS:
+					if(left.type != GRUG_TYPE_NUMBER || right.type != GRUG_TYPE_NUMBER) {
+						write_type_error(checker, line, "Comparisons expect number operands, but got %s", type_name(checker, left.type != GRUG_TYPE_NUMBER ? left : right));
+					}
+					result.type = GRUG_TYPE_BOOL;
+					break;
+				default:
+					if(left.type != GRUG_TYPE_NUMBER || right.type != GRUG_TYPE_NUMBER) {
+						write_type_error(checker, line, "Arithmetic expects number operands, but got %s", type_name(checker, left.type != GRUG_TYPE_NUMBER ? left : right));
+					}
+					result.type = GRUG_TYPE_NUMBER;
+					break;
+			}
+			break;
+		}
+		case GRUG_EXPR_TYPE_CALL:
+			result = check_call(checker, index);
+			if(!checker->failed && needs_value && result.type == GRUG_TYPE_VOID) {
+				write_type_error(checker, line, "Function call '%s' doesn't return a value", symbol_name(checker, expr->a));
+			}
+			break;
+		case GRUG_EXPR_TYPE_PARENTHESIZED:
+			result = check_expr(checker, expr->a, needs_value);
+			break;
+		default:
+			write_type_error(checker, line, "Unexpected expression", NULL);
+			break;
+	}
+	((struct flat_type*)(void*)ast->expr_types.data)[index] = result;
+	return result;
+}
+
+static void check_block(struct type_checker* checker, ast_index block_index);
+
+static void check_condition(struct type_checker* checker, ast_index cond, char const* statement_name) {
+	struct flat_type type = check_expr(checker, cond, true);
+	if(!checker->failed && type.type != GRUG_TYPE_BOOL) {
+		write_type_error(checker, flat_expr_line_at(checker->ast, cond), "The condition of %s statement must be a bool", statement_name);
+	}
+}
+
+static void check_statement(struct type_checker* checker, struct flat_statement const* statement) {
+	struct flat_ast* ast = checker->ast;
+	switch(statement->type) {
+		case GRUG_STATEMENT_VARIABLE: {
+			struct flat_type value = check_expr(checker, statement->c, true);
+			if(checker->failed) {
+				return;
+			}
+			char const* name = symbol_name(checker, statement->a);
+			struct flat_type existing;
+			bool exists = find_variable(checker, statement->a, &existing) || statement->a == checker->me_symbol;
+			if(statement->b != AST_INDEX_NONE) {
+				if(exists) {
+					write_type_error(checker, statement->line, "The variable '%s' shadows an earlier variable with the same name", name);
+					return;
+				}
+				struct flat_type declared = *flat_type_at(ast, statement->b);
+				if(!types_match(declared, value)) {
+					write_type_error(checker, statement->line, "Can't assign a value of the wrong type to '%s'", name);
+					return;
+				}
+				(void)push_checker_variable(checker, statement->a, declared);
+				return;
+			}
+			if(!exists) {
+				write_type_error(checker, statement->line, "Can't assign to the variable '%s', since it does not exist", name);
+			} else if(statement->a == checker->me_symbol) {
+				write_type_error(checker, statement->line, "Can't assign to '%s'", name);
+			} else if(!types_match(existing, value)) {
+				write_type_error(checker, statement->line, "Can't assign a value of the wrong type to '%s'", name);
+			}
+			return;
+		}
+		case GRUG_STATEMENT_CALL:
+			(void)check_expr(checker, statement->a, false);
+			return;
+		case GRUG_STATEMENT_IF:
+			for(uint32_t branch_index = 0; branch_index < statement->b && !checker->failed; branch_index += 1) {
+				struct flat_branch const* branch = flat_branch_at(ast, statement->a + branch_index);
+				check_condition(checker, branch->cond, "an if");
+				check_block(checker, branch->block);
+			}
+			if(statement->c != AST_INDEX_NONE) {
+				check_block(checker, statement->c);
+			}
+			return;
+		case GRUG_STATEMENT_WHILE:
+			check_condition(checker, statement->a, "a while");
+			checker->loop_depth += 1;
+			check_block(checker, statement->b);
+			checker->loop_depth -= 1;
+			return;
+		case GRUG_STATEMENT_RETURN: {
+			struct flat_function const* function = checker->function;
+			char const* name = symbol_name(checker, function->name);
+			if(function->return_type == AST_INDEX_NONE) {
+				if(statement->a != AST_INDEX_NONE) {
+					write_type_error(checker, statement->line, "Function '%s' wasn't supposed to return any value", name);
+				}
+				return;
+			}
+			if(statement->a == AST_INDEX_NONE) {
+				write_type_error(checker, statement->line, "Function '%s' is supposed to return a value", name);
+				return;
+			}
+			struct flat_type value = check_expr(checker, statement->a, true);
+			if(!checker->failed && !types_match(*flat_type_at(ast, function->return_type), value)) {
+				write_type_error(checker, statement->line, "Function '%s' is supposed to return a value of its return type", name);
+			}
+			return;
+		}
+		case GRUG_STATEMENT_BREAK:
+		case GRUG_STATEMENT_CONTINUE:
+			if(!checker->loop_depth) {
+				write_type_error(checker, statement->line, "There is a %s statement that isn't inside of a while loop", statement->type == GRUG_STATEMENT_BREAK ? "break" : "continue");
+			}
+			return;
+		default:
+			return;
+	}
+}
+
+static void check_block(struct type_checker* checker, ast_index block_index) {
+	if(block_index == AST_INDEX_NONE) {
+		return;
+	}
+	// Variables declared in a block go out of scope at its end
+	uint32_t variables_len = checker->variables_len;
+	struct flat_block const* block = flat_block_at(checker->ast, block_index);
+	for(uint32_t statement_index = 0; statement_index < block->statements_len && !checker->failed; statement_index += 1) {
+		check_statement(checker, flat_statement_at(checker->ast, block->first_statement + statement_index));
+	}
+	checker->variables_len = variables_len;
+}
+
+/// Returns whether the last statement of a block that isn't empty or a comment is a return
+static bool block_ends_with_return(struct flat_ast const* ast, ast_index block_index) {
+	struct flat_block const* block = flat_block_at(ast, block_index);
+	for(uint32_t statement_index = block->statements_len; statement_index > 0; statement_index -= 1) {
+		struct flat_statement const* statement = flat_statement_at(ast, block->first_statement + statement_index - 1);
+		if(statement->type != GRUG_STATEMENT_EMPTY && statement->type != GRUG_STATEMENT_COMMENT) {
+			return statement->type == GRUG_STATEMENT_RETURN;
+		}
+	}
+	return false;
+}
+
+static void check_function(struct type_checker* checker, struct flat_function const* function) {
+	struct flat_ast* ast = checker->ast;
+	checker->function = function;
+	checker->variables_len = 0;
+	for(uint32_t argument_index = 0; argument_index < function->arguments_len && !checker->failed; argument_index += 1) {
+		struct flat_argument const* argument = flat_argument_at(ast, function->first_argument + argument_index);
+		struct flat_type existing;
+		if(find_variable(checker, argument->name, &existing) || argument->name == checker->me_symbol) {
+			write_type_error(checker, function->line, "The argument '%s' shadows an earlier variable with the same name", symbol_name(checker, argument->name));
+			return;
+		}
+		(void)push_checker_variable(checker, argument->name, *flat_type_at(ast, argument->type));
+	}
+	check_block(checker, function->block);
+	if(!checker->failed && function->return_type != AST_INDEX_NONE && !block_ends_with_return(ast, function->block)) {
+		write_type_error(checker, function->line, "Function '%s' is supposed to return a value as its last statement", symbol_name(checker, function->name));
+	}
+}
+
+/// Matches an on function against the ones the entity type declares, and sets its on_fn_index
+static void check_on_function_signature(struct type_checker* checker, struct flat_function* on_fn, uint32_t previous_on_fn_index) {
+	struct mod_api const* api = checker->api;
+	struct mod_api_entity const* entity = checker->entity;
+	char const* name = symbol_name(checker, on_fn->name);
+	uint32_t found = GAME_FN_INDEX_NONE;
+	for(uint32_t index = 0; index < entity->on_fns_len; index += 1) {
+		if(api->on_fns[entity->first_on_fn + index].name == on_fn->name) {
+			found = index;
+			break;
+		}
+	}
+	if(found == GAME_FN_INDEX_NONE) {
+		char format[160];
+		(void)snprintf(format, sizeof(format), "The function '%%s' was not declared by entity '%s' in mod_api.json", symbol_name(checker, entity->name));
+		write_type_error(checker, on_fn->line, format, name);
+		return;
+	}
+	// Requiring the mod API's order also rules out defining the same on function twice
+	if(previous_on_fn_index != GAME_FN_INDEX_NONE && found <= previous_on_fn_index) {
+		write_type_error(checker, on_fn->line, "The function '%s' needs to be moved so the on functions are in the same order as in mod_api.json", name);
+		return;
+	}
+	struct mod_api_on_fn const* declared = &api->on_fns[entity->first_on_fn + found];
+	if(declared->params_len != on_fn->arguments_len) {
+		write_type_error(checker, on_fn->line, "Function '%s' has a different number of arguments than in mod_api.json", name);
+		return;
+	}
+	for(uint32_t argument_index = 0; argument_index < on_fn->arguments_len; argument_index += 1) {
+		struct mod_api_param const* param = &api->params[declared->first_param + argument_index];
+		struct flat_argument const* argument = flat_argument_at(checker->ast, on_fn->first_argument + argument_index);
+		struct flat_type const* argument_type = flat_type_at(checker->ast, argument->type);
+		struct flat_type param_type = flat_type_of(param->type);
+		if(argument_type->type != param_type.type || argument_type->custom_name != param_type.custom_name) {
+			write_type_error(checker, on_fn->line, "Function '%s' has an argument with a different type than in mod_api.json", name);
+			return;
+		}
+	}
+	on_fn->on_fn_index = found;
+}
+
+/// Type checks a flat AST whose calls have been bound by bind_calls, for a file implementing `entity`.
+/// Fills ast->expr_types and the on_fn_index of every on function.
+/// Returns false and writes to o_error upon an error.
+static bool type_check(struct flat_ast* ast, struct mod_api const* api, struct mod_api_entity const* entity, struct grug_error* o_error) {
+	struct type_checker checker = {
+		.ast = ast,
+		.api = api,
+		.entity = entity,
+		.me_symbol = grug_interner_find(ast->interner, "me", 2),
+		.o_error = o_error,
+	};
+	ast_pool_deinit(&ast->expr_types, sizeof(struct flat_type));
+	if(ast->exprs.count) {
+		ast->expr_types.data = GRUG_MALLOC(ast->exprs.count * sizeof(struct flat_type));
+		if(!ast->expr_types.data) {
+			return write_type_error(&checker, 0, "Failed to type check: malloc() returned null", NULL);
+		}
+		ast->expr_types.count = ast->exprs.count;
+		ast->expr_types.capacity = ast->exprs.count;
+	}
+
+	for(uint32_t member_index = 0; member_index < ast->members.count && !checker.failed; member_index += 1) {
+		struct flat_member const* member = flat_member_at(ast, member_index);
+		uint32_t line = flat_expr_line_at(ast, member->expr);
+		struct flat_type existing;
+		// A member's initializer can only use the members above it
+		if(find_variable(&checker, member->name, &existing) || member->name == checker.me_symbol) {
+			write_type_error(&checker, line, "The global variable '%s' shadows an earlier global variable", symbol_name(&checker, member->name));
+			break;
+		}
+		struct flat_type value = check_expr(&checker, member->expr, true);
+		if(!checker.failed && !types_match(*flat_type_at(ast, member->type), value)) {
+			write_type_error(&checker, line, "Can't assign a value of the wrong type to '%s'", symbol_name(&checker, member->name));
+		}
+		checker.members_len += 1;
+	}
+
+	uint32_t previous_on_fn_index = GAME_FN_INDEX_NONE;
+	for(uint32_t on_fn_index = 0; on_fn_index < ast->on_functions.count && !checker.failed; on_fn_index += 1) {
+		struct flat_function* on_fn = (struct flat_function*)(void*)ast->on_functions.data + on_fn_index;
+		check_on_function_signature(&checker, on_fn, previous_on_fn_index);
+		previous_on_fn_index = on_fn->on_fn_index;
+		if(!checker.failed) {
+			check_function(&checker, on_fn);
+		}
+	}
+	for(uint32_t helper_index = 0; helper_index < ast->helper_functions.count && !checker.failed; helper_index += 1) {
+		check_function(&checker, flat_helper_function_at(ast, helper_index));
+	}
+
+	if(checker.variables) {
+		GRUG_FREE(checker.variables, checker.variables_capacity * sizeof(struct checker_variable));
+	}
+	return !checker.failed;
+}
+
+// MARK: AST export
+
+static struct grug_type export_flat_type(struct flat_ast const* ast, struct flat_type const* flat) {
+	struct grug_type type = {.type = flat->type};
+	if(flat->custom_name != GRUG_SYMBOL_NONE) {
+		type.extra_data.custom_name = grug_symbol_string(ast->interner, flat->custom_name);
+	}
+	return type;
+}
+
+static struct grug_type export_type(struct flat_ast const* ast, ast_index index) {
+	if(index == AST_INDEX_NONE) {
+		return (struct grug_type) {0};
+	}
+	return export_flat_type(ast, flat_type_at(ast, index));
+}
+
+static bool export_expr(struct flat_ast const* ast, ast_index index, struct grug_arena* arena, struct grug_expr* out_expr);
+
+/// Exports an expression into a new arena allocation, for the children of unary, binary and parenthesized expressions
+static struct grug_expr* export_child_expr(struct flat_ast const* ast, ast_index index, struct grug_arena* arena) {
+	struct grug_expr* child = grug_arena_alloc(arena, sizeof(struct grug_expr));
+	if(!child || !export_expr(ast, index, arena, child)) {
+		return NULL;
+	}
+	return child;
+}
+
+/// Returns false if an allocation failed
+static bool export_expr(struct flat_ast const* ast, ast_index index, struct grug_arena* arena, struct grug_expr* out_expr) {
+	*out_expr = (struct grug_expr) {0};
+	if(index == AST_INDEX_NONE) {
+		out_expr->type = GRUG_EXPR_TYPE_NOTHING;
+		return true;
+	}
+	struct flat_expr const* flat = flat_expr_at(ast, index);
+	out_expr->type = flat->type;
+	// Only type checked ASTs have result types
+	if(ast->expr_types.count) {
+		out_expr->result_type = export_flat_type(ast, flat_expr_type_at(ast, index));
+	}
+	switch(flat->type) {
+		case GRUG_EXPR_TYPE_TRUE:
+		case GRUG_EXPR_TYPE_FALSE:
+		case GRUG_EXPR_TYPE_NOTHING:
+			return true;
+		case GRUG_EXPR_TYPE_STRING:
+			out_expr->expr_data.string = flat_string_at(ast, flat->a);
+			return true;
+		case GRUG_EXPR_TYPE_RESOURCE:
+			out_expr->expr_data.resource = flat_string_at(ast, flat->a);
+			return true;
+		case GRUG_EXPR_TYPE_ENTITY:
+			out_expr->expr_data.entity = flat_string_at(ast, flat->a);
+			return true;
+		case GRUG_EXPR_TYPE_IDENTIFIER:
+			out_expr->expr_data.identifier_name = grug_symbol_string(ast->interner, flat->a);
+			return true;
+		case GRUG_EXPR_TYPE_NUMBER:
+			out_expr->expr_data.number.string = flat_string_at(ast, flat->a);
+			out_expr->expr_data.number.value = flat_number_at(ast, flat->b);
+			return true;
+		case GRUG_EXPR_TYPE_UNARY:
+			out_expr->expr_data.unary.op = flat->op;
+			out_expr->expr_data.unary.inner = export_child_expr(ast, flat->a, arena);
+			return out_expr->expr_data.unary.inner != NULL;
+		case GRUG_EXPR_TYPE_BINARY:
+			out_expr->expr_data.binary.op = flat->op;
+			out_expr->expr_data.binary.left = export_child_expr(ast, flat->a, arena);
+			out_expr->expr_data.binary.right = export_child_expr(ast, flat->b, arena);
+			return out_expr->expr_data.binary.left && out_expr->expr_data.binary.right;
+		case GRUG_EXPR_TYPE_CALL: {
+			out_expr->expr_data.call.function_name = grug_symbol_string(ast->interner, flat->a);
+			out_expr->expr_data.call.args_count = flat->args_len;
+			if(flat->op == CALL_TARGET_GAME_FN) {
+				struct game_fn_entry const* game_fn = &ast->mod_api->game_fns[flat->c];
+				out_expr->expr_data.call.game_fn_ptr = game_fn->fn;
+				out_expr->expr_data.call.game_fn_data = game_fn->fn_data;
+			} else if(flat->op == CALL_TARGET_HELPER_FN) {
+				out_expr->expr_data.call.helper_fn_index = flat->c;
+			}
+			if(!flat->args_len) {
+				return true;
+			}
+			struct grug_expr* args = grug_arena_alloc(arena, flat->args_len * sizeof(struct grug_expr));
+			if(!args) {
+				return false;
+			}
+			for(uint32_t arg_index = 0; arg_index < flat->args_len; arg_index += 1) {
+				if(!export_expr(ast, flat_expr_ref_at(ast, flat->b + arg_index), arena, &args[arg_index])) {
+					return false;
+				}
+			}
+			out_expr->expr_data.call.args = args;
+			return true;
+		}
+		case GRUG_EXPR_TYPE_PARENTHESIZED:
+			out_expr->expr_data.parenthesized = export_child_expr(ast, flat->a, arena);
+			return out_expr->expr_data.parenthesized != NULL;
+		default:
+			assert(false && "Unknown expression type");
+			return false;
+	}
+}
+
+static bool export_block(struct flat_ast const* ast, ast_index index, struct grug_arena* arena, struct grug_block* out_block);
+
+static bool export_statement(struct flat_ast const* ast, struct flat_statement const* flat, struct grug_arena* arena, struct grug_statement* out_statement) {
+	*out_statement = (struct grug_statement) {0};
+	out_statement->type = flat->type;
+	switch(flat->type) {
+		case GRUG_STATEMENT_VARIABLE:
+			out_statement->statement_data.variable.name = grug_symbol_string(ast->interner, flat->a);
+			out_statement->statement_data.variable.type = export_type(ast, flat->b);
+			return export_expr(ast, flat->c, arena, &out_statement->statement_data.variable.assignment_expr);
+		case GRUG_STATEMENT_CALL:
+			return export_expr(ast, flat->a, arena, &out_statement->statement_data.call);
+		case GRUG_STATEMENT_IF: {
+			struct flat_branch const* branches = flat_branch_at(ast, flat->a);
+			struct grug_if_branch* branch = &out_statement->statement_data.if_stmt.branch;
+			if(!export_expr(ast, branches[0].cond, arena, &branch->cond) || !export_block(ast, branches[0].block, arena, &branch->block)) {
+				return false;
+			}
+			uint32_t additional_len = flat->b - 1;
+			if(additional_len) {
+				struct grug_if_branch* additional = grug_arena_alloc(arena, additional_len * sizeof(struct grug_if_branch));
+				if(!additional) {
+					return false;
+				}
+				for(uint32_t branch_index = 0; branch_index < additional_len; branch_index += 1) {
+					struct flat_branch const* flat_branch = &branches[branch_index + 1];
+					if(!export_expr(ast, flat_branch->cond, arena, &additional[branch_index].cond) || !export_block(ast, flat_branch->block, arena, &additional[branch_index].block)) {
+						return false;
+					}
+				}
+				out_statement->statement_data.if_stmt.additional_branches = additional;
+				out_statement->statement_data.if_stmt.additional_branches_len = additional_len;
+			}
+			return export_block(ast, flat->c, arena, &out_statement->statement_data.if_stmt.else_block);
+		}
+		case GRUG_STATEMENT_WHILE:
+			return export_expr(ast, flat->a, arena, &out_statement->statement_data.while_stmt.condition) && export_block(ast, flat->b, arena, &out_statement->statement_data.while_stmt.block);
+		case GRUG_STATEMENT_RETURN:
+			return export_expr(ast, flat->a, arena, &out_statement->statement_data.return_stmt.expr);
+		case GRUG_STATEMENT_COMMENT:
+			out_statement->statement_data.comment = flat_string_at(ast, flat->a);
+			return true;
+		case GRUG_STATEMENT_BREAK:
+		case GRUG_STATEMENT_CONTINUE:
+		case GRUG_STATEMENT_EMPTY:
+			return true;
+		default:
+			assert(false && "Unknown statement type");
+			return false;
+	}
+}
+
+/// A block of AST_INDEX_NONE, like a missing else block, is exported as an empty block
+static bool export_block(struct flat_ast const* ast, ast_index index, struct grug_arena* arena, struct grug_block* out_block) {
+	*out_block = (struct grug_block) {0};
+	if(index == AST_INDEX_NONE) {
+		return true;
+	}
+	struct flat_block const* flat = flat_block_at(ast, index);
+	if(!flat->statements_len) {
+		return true;
+	}
+	struct grug_statement* statements = grug_arena_alloc(arena, flat->statements_len * sizeof(struct grug_statement));
+	if(!statements) {
+		return false;
+	}
+	for(uint32_t statement_index = 0; statement_index < flat->statements_len; statement_index += 1) {
+		if(!export_statement(ast, flat_statement_at(ast, flat->first_statement + statement_index), arena, &statements[statement_index])) {
+			return false;
+		}
+	}
+	out_block->statements = statements;
+	out_block->statements_len = flat->statements_len;
+	return true;
+}
+
+static struct grug_argument* export_arguments(struct flat_ast const* ast, struct flat_function const* function, struct grug_arena* arena) {
+	if(!function->arguments_len) {
+		return NULL;
+	}
+	struct grug_argument* arguments = grug_arena_alloc(arena, function->arguments_len * sizeof(struct grug_argument));
+	if(!arguments) {
+		return NULL;
+	}
+	for(uint32_t argument_index = 0; argument_index < function->arguments_len; argument_index += 1) {
+		struct flat_argument const* flat = flat_argument_at(ast, function->first_argument + argument_index);
+		arguments[argument_index] = (struct grug_argument) {.name = grug_symbol_string(ast->interner, flat->name), .type = export_type(ast, flat->type)};
+	}
+	return arguments;
+}
+
+/// Builds the public, pointer linked AST out of a flat one. Everything is allocated from `arena`, and the strings are shared with the flat AST and its interner.
+static bool flat_ast_export(struct flat_ast const* ast, struct grug_arena* arena, struct grug_ast* out_ast, struct grug_error* o_error) {
+	struct grug_ast exported = {._arena = arena};
+	bool success = true;
+	if(ast->members.count) {
+		exported.members = grug_arena_alloc(arena, ast->members.count * sizeof(struct grug_member_variable));
+		success = exported.members != NULL;
+		for(uint32_t member_index = 0; success && member_index < ast->members.count; member_index += 1) {
+			struct flat_member const* flat = flat_member_at(ast, member_index);
+			struct grug_member_variable* member = &exported.members[member_index];
+			member->name = grug_symbol_string(ast->interner, flat->name);
+			member->type = export_type(ast, flat->type);
+			success = export_expr(ast, flat->expr, arena, &member->assignment_expr);
+		}
+		exported.members_count = ast->members.count;
+	}
+	if(success && ast->on_functions.count) {
+		exported.on_functions = grug_arena_alloc(arena, ast->on_functions.count * sizeof(struct grug_on_function));
+		success = exported.on_functions != NULL;
+		for(uint32_t function_index = 0; success && function_index < ast->on_functions.count; function_index += 1) {
+			struct flat_function const* flat = flat_on_function_at(ast, function_index);
+			struct grug_on_function* function = &exported.on_functions[function_index];
+			function->name = grug_symbol_string(ast->interner, flat->name);
+			function->arguments = export_arguments(ast, flat, arena);
+			function->arguments_len = flat->arguments_len;
+			function->on_fn_index = flat->on_fn_index;
+			success = (function->arguments || !flat->arguments_len) && export_block(ast, flat->block, arena, &function->block);
+		}
+		exported.on_functions_count = ast->on_functions.count;
+	}
+	if(success && ast->helper_functions.count) {
+		exported.helper_function = grug_arena_alloc(arena, ast->helper_functions.count * sizeof(struct grug_helper_function));
+		success = exported.helper_function != NULL;
+		for(uint32_t function_index = 0; success && function_index < ast->helper_functions.count; function_index += 1) {
+			struct flat_function const* flat = flat_helper_function_at(ast, function_index);
+			struct grug_helper_function* function = &exported.helper_function[function_index];
+			function->name = grug_symbol_string(ast->interner, flat->name);
+			function->return_type = export_type(ast, flat->return_type);
+			function->arguments = export_arguments(ast, flat, arena);
+			function->arguments_len = flat->arguments_len;
+			success = (function->arguments || !flat->arguments_len) && export_block(ast, flat->block, arena, &function->block);
+		}
+		exported.helper_functions_count = ast->helper_functions.count;
+	}
+	if(!success) {
+		struct grug_error err = {
+			// TODO(bluesillybeard): add specific error codes for failed allocations
+			.error_type = GRUG_ERROR_CODE_COMPILE_PARSER,
+			.message = "Failed to export the AST: grug_arena_alloc() returned null",
+			.custom_message = "Failed to export the AST: grug_arena_alloc() returned null",
+		};
+		grug_assign_error(o_error, &err, NULL);
+		return false;
+	}
+	*out_ast = exported;
+	return true;
+}
+
+// MARK: AST entry points
+
+static struct grug_arena* ast_arena_or_new(struct grug_arena* arena_or_none, struct grug_error* o_error) {
+	if(arena_or_none) {
+		return arena_or_none;
+	}
+	struct grug_arena* arena = grug_arena_new();
+	if(!arena) {
+		struct grug_error err = {
+			// TODO(bluesillybeard): add specific error codes for failed allocations
+			.error_type = GRUG_ERROR_CODE_COMPILE_PARSER,
+			.message = "Failed to create an AST: grug_arena_new() returned null",
+			.custom_message = "Failed to create an AST: grug_arena_new() returned null",
+		};
+		grug_assign_error(o_error, &err, NULL);
+	}
+	return arena;
+}
+
+/// Allocates a buffer for the source text that the AST can point into
+static char* alloc_ast_src(struct grug_arena* arena, size_t src_len, struct grug_error* o_error) {
+	char* src = grug_arena_alloc_aligned(arena, src_len + 1, 1);
+	if(!src) {
+		struct grug_error err = {
+			// TODO(bluesillybeard): add specific error codes for failed allocations
+			.error_type = GRUG_ERROR_CODE_COMPILE_PARSER,
+			.message = "Failed to create an AST: grug_arena_alloc() returned null",
+			.custom_message = "Failed to create an AST: grug_arena_alloc() returned null",
+		};
+		grug_assign_error(o_error, &err, NULL);
+		return NULL;
+	}
+	src[src_len] = '\0';
+	return src;
+}
+
+/// Parses `tokens`, which point into `src`, and exports the result, cleaning up `arena` on failure unless it belongs to the caller.
+/// `tokens` is NULL if making them failed already.
+static struct grug_ast parse_and_export(struct compact_tokens const* tokens, char* src, struct grug_arena* arena, bool owns_arena, struct grug_error* o_error) {
+	struct grug_ast ast = {0};
+	struct flat_ast flat = {0};
+	// Without a grug_state there is nothing to share the symbols with, so the names are interned into the AST's own arena
+	struct grug_interner interner;
+	grug_interner_init(&interner, arena);
+	if(tokens && compact_tokens_to_flat_ast(tokens, src, arena, &interner, &flat, o_error)) {
+		(void)flat_ast_export(&flat, arena, &ast, o_error);
+		flat_ast_deinit(&flat);
+	}
+	grug_interner_deinit(&interner);
+	if(!ast._arena && owns_arena) {
+		grug_arena_deinit(arena);
+	}
+	return ast;
+}
+
+struct grug_ast grug_grug_to_ast(char const* grug, size_t grug_len, struct grug_arena* arena_or_none, struct grug_error* o_error) {
+	struct grug_arena* arena = ast_arena_or_new(arena_or_none, o_error);
+	if(!arena) {
+		return (struct grug_ast){0};
+	}
+	// One copy of the whole file, so the AST can keep views into it after `grug` is gone
+	char* src = alloc_ast_src(arena, grug_len, o_error);
+	struct grug_arena* token_arena = src ? new_token_arena(o_error) : NULL;
+	struct compact_tokens tokens = {0};
+	bool tokenized = false;
+	if(token_arena) {
+		memcpy(src, grug, grug_len);
+		tokenized = tokenize_compact(src, grug_len, token_arena, &tokens, o_error);
+	}
+	struct grug_ast ast = parse_and_export(tokenized ? &tokens : NULL, src, arena, !arena_or_none, o_error);
+	// the ast only points into `arena`, so the tokens can go
+	grug_arena_deinit(token_arena);
+	return ast;
+}
+
+// Parses the tokens as they are, rather than printing them and tokenizing that, so they go through the same parser as a file's tokens
+struct grug_ast grug_tokens_to_ast(struct grug_token const* tokens, size_t num_tokens, struct grug_arena* arena_or_none, struct grug_error* o_error) {
+	struct grug_arena* arena = ast_arena_or_new(arena_or_none, o_error);
+	if(!arena) {
 		return (struct grug_ast){0};
 	}
-	size_t num_tokens = grug_grug_to_tokens(grug, grug_len, tokens, num_tokens_required, o_error);
-	if(o_error->error_type.tag[0]) {
-		GRUG_FREE(tokens, num_tokens_required * sizeof(struct grug_token));
-		return (struct grug_ast){0};
+	struct grug_arena* token_arena = new_token_arena(o_error);
+	char* src = NULL;
+	struct compact_tokens compact = {0};
+	bool converted = token_arena && tokens_to_compact(tokens, num_tokens, arena, token_arena, &src, &compact, o_error);
+	struct grug_ast ast = parse_and_export(converted ? &compact : NULL, src, arena, !arena_or_none, o_error);
+	grug_arena_deinit(token_arena);
+	return ast;
+}
+
+// MARK: compile cache
+
+// A file that compiled is cached as its type checked flat AST, which is what is left to do once the slow part is done,
+// and which doesn't depend on the backend. The pools are written as they are, apart from the symbols,
+// which get numbered in the order the file first uses them, and the strings, which are written out.
+
+/// Bump whenever the flat AST, or what the parser, call binding or type checker put in it, changes,
+/// so the entries an older grug wrote are invalidated
+#define COMPILE_CACHE_VERSION 1
+
+#define COMPILE_CACHE_BYTE_ORDER 0x01020304U
+
+/// The pools that are written as they are, in the order they are written in
+static struct {
+	size_t offset;
+	size_t item_size;
+} const cached_pools[] = {
+	{offsetof(struct flat_ast, numbers), sizeof(double)},
+	{offsetof(struct flat_ast, types), sizeof(struct flat_type)},
+	{offsetof(struct flat_ast, exprs), sizeof(struct flat_expr)},
+	{offsetof(struct flat_ast, expr_lines), sizeof(uint32_t)},
+	{offsetof(struct flat_ast, expr_types), sizeof(struct flat_type)},
+	{offsetof(struct flat_ast, expr_refs), sizeof(ast_index)},
+	{offsetof(struct flat_ast, statements), sizeof(struct flat_statement)},
+	{offsetof(struct flat_ast, blocks), sizeof(struct flat_block)},
+	{offsetof(struct flat_ast, branches), sizeof(struct flat_branch)},
+	{offsetof(struct flat_ast, members), sizeof(struct flat_member)},
+	{offsetof(struct flat_ast, arguments), sizeof(struct flat_argument)},
+	{offsetof(struct flat_ast, on_functions), sizeof(struct flat_function)},
+	{offsetof(struct flat_ast, helper_functions), sizeof(struct flat_function)},
+};
+#define CACHED_POOLS_LEN (sizeof(cached_pools) / sizeof(cached_pools[0]))
+
+/// Followed by the pools, then the symbols and then the strings, each of those being a uint32_t length and that many characters
+struct compile_cache_header {
+	/// "grugAST" and its null terminator
+	char magic[8];
+	uint32_t version;
+	/// COMPILE_CACHE_BYTE_ORDER as the writer saw it, which reads as something else on a machine with the other byte order
+	uint32_t byte_order;
+	uint64_t source_hash;
+	uint64_t mod_api_hash;
+	/// The name of the entity type is part of the key, as the same source can type check differently as another entity type
+	uint64_t entity_type_hash;
+	/// hash_contents of everything after the header, which catches entries that got cut short or damaged
+	uint64_t payload_hash;
+	uint32_t symbols_len;
+	uint32_t strings_len;
+	uint32_t pool_counts[CACHED_POOLS_LEN];
+};
+
+static inline struct ast_pool* cached_pool(struct flat_ast* ast, size_t pool_index) {
+	return (struct ast_pool*)(void*)((char*)ast + cached_pools[pool_index].offset);
+}
+
+/// Calls `fn` on every symbol of the AST, always in the same order. Returns false as soon as `fn` does.
+static bool map_flat_symbols(struct flat_ast* ast, bool (*fn)(void* data, grug_symbol* symbol), void* data) {
+	bool success = true;
+	for(ast_index index = 0; success && index < ast->types.count; index += 1) {
+		success = fn(data, &((struct flat_type*)(void*)ast->types.data)[index].custom_name);
+	}
+	for(ast_index index = 0; success && index < ast->expr_types.count; index += 1) {
+		success = fn(data, &((struct flat_type*)(void*)ast->expr_types.data)[index].custom_name);
+	}
+	for(ast_index index = 0; success && index < ast->exprs.count; index += 1) {
+		struct flat_expr* expr = (struct flat_expr*)(void*)ast->exprs.data + index;
+		if(expr->type == GRUG_EXPR_TYPE_IDENTIFIER || expr->type == GRUG_EXPR_TYPE_CALL) {
+			success = fn(data, &expr->a);
+		}
+	}
+	for(ast_index index = 0; success && index < ast->statements.count; index += 1) {
+		struct flat_statement* statement = (struct flat_statement*)(void*)ast->statements.data + index;
+		if(statement->type == GRUG_STATEMENT_VARIABLE) {
+			success = fn(data, &statement->a);
+		}
+	}
+	for(ast_index index = 0; success && index < ast->members.count; index += 1) {
+		success = fn(data, &((struct flat_member*)(void*)ast->members.data)[index].name);
+	}
+	for(ast_index index = 0; success && index < ast->arguments.count; index += 1) {
+		success = fn(data, &((struct flat_argument*)(void*)ast->arguments.data)[index].name);
+	}
+	for(ast_index index = 0; success && index < ast->on_functions.count; index += 1) {
+		success = fn(data, &((struct flat_function*)(void*)ast->on_functions.data)[index].name);
+	}
+	for(ast_index index = 0; success && index < ast->helper_functions.count; index += 1) {
+		success = fn(data, &((struct flat_function*)(void*)ast->helper_functions.data)[index].name);
+	}
+	return success;
+}
+
+/// Numbers the symbols of an AST that is about to be cached from 0
+struct cache_symbol_numbering {
+	/// Indexed by symbol, GRUG_SYMBOL_NONE for the symbols that haven't been numbered yet
+	uint32_t* number_of_symbol;
+	/// The symbols in the order they were numbered
+	grug_symbol* symbols;
+	uint32_t symbols_len;
+};
+
+static bool number_cached_symbol(void* data, grug_symbol* symbol) {
+	struct cache_symbol_numbering* numbering = data;
+	if(*symbol == GRUG_SYMBOL_NONE) {
+		return true;
+	}
+	if(numbering->number_of_symbol[*symbol] == GRUG_SYMBOL_NONE) {
+		numbering->number_of_symbol[*symbol] = numbering->symbols_len;
+		numbering->symbols[numbering->symbols_len] = *symbol;
+		numbering->symbols_len += 1;
+	}
+	*symbol = numbering->number_of_symbol[*symbol];
+	return true;
+}
+
+/// Gives cached symbols the symbols of the interner they were loaded into
+struct cache_symbol_lookup {
+	grug_symbol const* symbols;
+	uint32_t symbols_len;
+};
+
+static bool look_up_cached_symbol(void* data, grug_symbol* symbol) {
+	struct cache_symbol_lookup const* lookup = data;
+	if(*symbol == GRUG_SYMBOL_NONE) {
+		return true;
+	}
+	if(*symbol >= lookup->symbols_len) {
+		return false;
+	}
+	*symbol = lookup->symbols[*symbol];
+	return true;
+}
+
+static uint64_t compile_cache_key(uint64_t source_hash, uint64_t entity_type_hash) {
+	uint64_t key_parts[2] = {source_hash, entity_type_hash};
+	return hash_contents((char const*)key_parts, sizeof(key_parts));
+}
+
+static struct compile_cache_header compile_cache_header_of(struct grug_state const* gst, uint32_t entity_type, uint64_t source_hash) {
+	char const* entity_type_name = grug_symbol_string(&gst->symbols, gst->mod_api.entities[entity_type].name);
+	return (struct compile_cache_header) {
+		.magic = "grugAST",
+		.version = COMPILE_CACHE_VERSION,
+		.byte_order = COMPILE_CACHE_BYTE_ORDER,
+		.source_hash = source_hash,
+		.mod_api_hash = gst->mod_api_hash,
+		.entity_type_hash = hash_contents(entity_type_name, strlen(entity_type_name)),
+	};
+}
+
+static inline void write_cached_string(char** cursor, char const* string, size_t len) {
+	uint32_t len_u32 = (uint32_t)len;
+	memcpy(*cursor, &len_u32, sizeof(len_u32));
+	memcpy(*cursor + sizeof(len_u32), string, len);
+	*cursor += sizeof(len_u32) + len;
+}
+
+/// Reads a string written by write_cached_string, returning NULL if it runs past `end`
+static inline char const* read_cached_string(char const** cursor, char const* end, uint32_t* out_len) {
+	if((size_t)(end - *cursor) < sizeof(uint32_t)) {
+		return NULL;
+	}
+	memcpy(out_len, *cursor, sizeof(uint32_t));
+	char const* string = *cursor + sizeof(uint32_t);
+	if((size_t)(end - string) < *out_len) {
+		return NULL;
 	}
-	assert(num_tokens_required == num_tokens);
+	*cursor = string + *out_len;
+	return string;
+}
 
-	struct grug_ast ast = grug_tokens_to_ast(tokens, num_tokens, arena_or_none, o_error);
-	// ast keeps local copies of everything so we can free the tokens immediately
-	GRUG_FREE(tokens, num_tokens_required * sizeof(struct grug_token));
-	return ast;
+/// Writes a type checked file to the cache. The AST's symbols get renumbered on the way, so it can only be deinitialized afterwards.
+/// The cache is only there to speed things up, so failing to write to it isn't an error.
+static void store_cached_ast(struct grug_state* gst, uint32_t entity_type, uint64_t source_hash, struct flat_ast* ast) {
+	struct compile_cache_header header = compile_cache_header_of(gst, entity_type, source_hash);
+	size_t interner_symbols = (size_t)ast->interner->first_symbol + ast->interner->count;
+	struct cache_symbol_numbering numbering = {
+		.number_of_symbol = GRUG_MALLOC(interner_symbols * sizeof(uint32_t)),
+		.symbols = GRUG_MALLOC(interner_symbols * sizeof(grug_symbol)),
+	};
+	if(!numbering.number_of_symbol || !numbering.symbols) {
+		if(numbering.number_of_symbol) {
+			GRUG_FREE(numbering.number_of_symbol, interner_symbols * sizeof(uint32_t));
+		}
+		if(numbering.symbols) {
+			GRUG_FREE(numbering.symbols, interner_symbols * sizeof(grug_symbol));
+		}
+		return;
+	}
+	memset(numbering.number_of_symbol, 0xFF, interner_symbols * sizeof(uint32_t));
+	(void)map_flat_symbols(ast, number_cached_symbol, &numbering);
+
+	size_t payload_len = 0;
+	for(size_t pool_index = 0; pool_index < CACHED_POOLS_LEN; pool_index += 1) {
+		header.pool_counts[pool_index] = cached_pool(ast, pool_index)->count;
+		payload_len += header.pool_counts[pool_index] * cached_pools[pool_index].item_size;
+	}
+	header.symbols_len = numbering.symbols_len;
+	for(uint32_t symbol_index = 0; symbol_index < numbering.symbols_len; symbol_index += 1) {
+		payload_len += sizeof(uint32_t) + grug_symbol_len(ast->interner, numbering.symbols[symbol_index]);
+	}
+	header.strings_len = ast->strings.count;
+	for(ast_index string_index = 0; string_index < ast->strings.count; string_index += 1) {
+		payload_len += sizeof(uint32_t) + strlen(flat_string_at(ast, string_index));
+	}
+
+	char* entry = GRUG_MALLOC(sizeof(header) + payload_len);
+	if(entry) {
+		char* cursor = entry + sizeof(header);
+		for(size_t pool_index = 0; pool_index < CACHED_POOLS_LEN; pool_index += 1) {
+			size_t pool_len = header.pool_counts[pool_index] * cached_pools[pool_index].item_size;
+			if(pool_len) {
+				memcpy(cursor, cached_pool(ast, pool_index)->data, pool_len);
+			}
+			cursor += pool_len;
+		}
+		for(uint32_t symbol_index = 0; symbol_index < numbering.symbols_len; symbol_index += 1) {
+			grug_symbol symbol = numbering.symbols[symbol_index];
+			write_cached_string(&cursor, grug_symbol_string(ast->interner, symbol), grug_symbol_len(ast->interner, symbol));
+		}
+		for(ast_index string_index = 0; string_index < ast->strings.count; string_index += 1) {
+			char const* string = flat_string_at(ast, string_index);
+			write_cached_string(&cursor, string, strlen(string));
+		}
+		header.payload_hash = hash_contents(entry + sizeof(header), payload_len);
+		memcpy(entry, &header, sizeof(header));
+		if(grug_cache_store(gst->cache, compile_cache_key(source_hash, header.entity_type_hash), entry, sizeof(header) + payload_len)) {
+			(void)__atomic_fetch_add(&gst->cache_stats.stored, 1, __ATOMIC_RELAXED);
+		}
+		GRUG_FREE(entry, sizeof(header) + payload_len);
+	}
+	GRUG_FREE(numbering.number_of_symbol, interner_symbols * sizeof(uint32_t));
+	GRUG_FREE(numbering.symbols, interner_symbols * sizeof(grug_symbol));
 }
 
-struct grug_ast grug_tokens_to_ast(struct grug_token const* tokens, size_t num_tokens, struct grug_arena* arena_or_none, struct grug_error* o_error) {
+/// Reads the flat AST of an entry into `out_ast`, interning its symbols into `interner` and copying its strings into `arena`
+static bool read_cached_ast(char const* payload, char const* end, struct compile_cache_header const* header, struct grug_interner* interner, struct grug_arena* arena, struct flat_ast* out_ast) {
+	char const* cursor = payload;
+	for(size_t pool_index = 0; pool_index < CACHED_POOLS_LEN; pool_index += 1) {
+		size_t pool_len = header->pool_counts[pool_index] * cached_pools[pool_index].item_size;
+		if((size_t)(end - cursor) < pool_len) {
+			return false;
+		}
+		if(header->pool_counts[pool_index] && ast_pool_push_many(cached_pool(out_ast, pool_index), cursor, header->pool_counts[pool_index], cached_pools[pool_index].item_size) == AST_INDEX_NONE) {
+			return false;
+		}
+		cursor += pool_len;
+	}
+	grug_symbol* symbols = header->symbols_len ? GRUG_MALLOC(header->symbols_len * sizeof(grug_symbol)) : NULL;
+	bool success = symbols || !header->symbols_len;
+	for(uint32_t symbol_index = 0; success && symbol_index < header->symbols_len; symbol_index += 1) {
+		uint32_t len = 0;
+		char const* string = read_cached_string(&cursor, end, &len);
+		symbols[symbol_index] = string ? grug_intern(interner, string, len) : GRUG_SYMBOL_NONE;
+		success = symbols[symbol_index] != GRUG_SYMBOL_NONE;
+	}
+	if(success) {
+		struct cache_symbol_lookup lookup = {.symbols = symbols, .symbols_len = header->symbols_len};
+		success = map_flat_symbols(out_ast, look_up_cached_symbol, &lookup);
+	}
+	if(symbols) {
+		GRUG_FREE(symbols, header->symbols_len * sizeof(grug_symbol));
+	}
+	for(uint32_t string_index = 0; success && string_index < header->strings_len; string_index += 1) {
+		uint32_t len = 0;
+		char const* string = read_cached_string(&cursor, end, &len);
+		char* copy = string ? grug_arena_alloc_aligned(arena, (size_t)len + 1, 1) : NULL;
+		success = copy != NULL;
+		if(success) {
+			memcpy(copy, string, len);
+			copy[len] = '\0';
+			success = ast_pool_push_many(&out_ast->strings, (void const*)&copy, 1, sizeof(copy)) != AST_INDEX_NONE;
+		}
+	}
+	return success && cursor == end;
+}
+
+/// Loads the type checked flat AST of a file from the cache into `out_ast`, like call binding leaves it.
+/// Returns false on a miss, which is also what an entry that was written for other contents, entity type, mod_api.json or version of grug is.
+static bool load_cached_ast(struct grug_state* gst, uint32_t entity_type, uint64_t source_hash, struct grug_interner* interner, struct grug_arena* arena, struct flat_ast* out_ast) {
+	if(!gst->cache) {
+		return false;
+	}
+	struct compile_cache_header expected = compile_cache_header_of(gst, entity_type, source_hash);
+	struct grug_cache_entry entry;
+	if(!grug_cache_load(gst->cache, compile_cache_key(source_hash, expected.entity_type_hash), &entry)) {
+		(void)__atomic_fetch_add(&gst->cache_stats.misses, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+	struct compile_cache_header header = {0};
+	bool valid = entry.len >= sizeof(header);
+	if(valid) {
+		memcpy(&header, entry.data, sizeof(header));
+		char const* payload = (char const*)entry.data + sizeof(header);
+		size_t payload_len = entry.len - sizeof(header);
+		valid = memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0 && header.version == expected.version && header.byte_order == expected.byte_order;
+		valid = valid && header.source_hash == expected.source_hash && header.mod_api_hash == expected.mod_api_hash && header.entity_type_hash == expected.entity_type_hash;
+		valid = valid && header.payload_hash == hash_contents(payload, payload_len);
+	}
+	bool loaded = false;
+	if(valid) {
+		*out_ast = (struct flat_ast) {.arena = arena, .interner = interner, .mod_api = &gst->mod_api};
+		loaded = read_cached_ast((char const*)entry.data + sizeof(header), (char const*)entry.data + entry.len, &header, interner, arena, out_ast);
+		// The type checker errors on calls of game functions that haven't been registered, so those files have to go through it again
+		for(ast_index expr_index = 0; loaded && expr_index < out_ast->exprs.count; expr_index += 1) {
+			struct flat_expr const* call = flat_expr_at(out_ast, expr_index);
+			loaded = call->type != GRUG_EXPR_TYPE_CALL || call->op != CALL_TARGET_GAME_FN || gst->mod_api.game_fns[call->c].fn;
+		}
+		if(!loaded) {
+			flat_ast_deinit(out_ast);
+		}
+	}
+	grug_cache_release(&entry);
+	if(!valid) {
+		(void)__atomic_fetch_add(&gst->cache_stats.invalidated, 1, __ATOMIC_RELAXED);
+	}
+	(void)__atomic_fetch_add(loaded ? &gst->cache_stats.hits : &gst->cache_stats.misses, 1, __ATOMIC_RELAXED);
+	return loaded;
+}
+
+// MARK: compiling
+
+static void write_compile_error(struct grug_error* o_error, struct grug_error_code error_code, char const* format, char const* name) {
+	// write_error_plain_basic copies the message, so a stack buffer is fine
+	char message_buffer[256];
+	(void)snprintf(message_buffer, sizeof(message_buffer), format, name);
+	write_error_plain_basic(error_code, message_buffer, NULL, o_error->arena, o_error);
+}
+
+/// Finds the entity type a file implements from its name, which looks like `labrador-Dog.grug`.
+/// Returns false and writes to o_error if the name is malformed or the entity type isn't in mod_api.json.
+static bool entity_type_of_path(struct grug_state const* gst, char const* path, uint32_t* out_entity_type, struct grug_error* o_error) {
+	char const* file_name = strrchr(path, '/');
+	file_name = file_name ? file_name + 1 : path;
+	size_t file_name_len = strlen(file_name);
+	if(file_name_len < 5 || strcmp(file_name + file_name_len - 5, ".grug") != 0) {
+		write_compile_error(o_error, GRUG_ERROR_CODE_COMPILE_FILE_NAME, "The file name '%s' doesn't end with .grug", file_name);
+		return false;
+	}
+	char const* dash = NULL;
+	for(char const* character = file_name; character < file_name + file_name_len - 5; character += 1) {
+		if(*character == '-') {
+			dash = character;
+		}
+	}
+	if(!dash || dash + 1 == file_name + file_name_len - 5) {
+		write_compile_error(o_error, GRUG_ERROR_CODE_COMPILE_FILE_NAME, "The file name '%s' is missing its entity type, like in 'labrador-Dog.grug'", file_name);
+		return false;
+	}
+	grug_symbol entity_type = grug_interner_find(&gst->symbols, dash + 1, (size_t)(file_name + file_name_len - 5 - (dash + 1)));
+	for(uint32_t entity_index = 0; entity_index < gst->mod_api.entities_len; entity_index += 1) {
+		if(entity_type != GRUG_SYMBOL_NONE && gst->mod_api.entities[entity_index].name == entity_type) {
+			*out_entity_type = entity_index;
+			return true;
+		}
+	}
+	write_compile_error(o_error, GRUG_ERROR_CODE_COMPILE_FILE_NAME, "The entity type of the file '%s' is not declared in mod_api.json", file_name);
+	return false;
+}
+
+/// Returns the id of the file at `path`, adding it if it hasn't been compiled before, or INVALID_GRUG_FILE_ID if that fails
+static grug_file_id file_id_of_path(struct grug_state* gst, char const* path, uint32_t entity_type) {
+	grug_symbol path_symbol = grug_intern(&gst->symbols, path, strlen(path));
+	if(path_symbol == GRUG_SYMBOL_NONE) {
+		write_compile_error(&gst->call.last_error, GRUG_ERROR_CODE_COMPILE, "Failed to compile '%s': grug_intern() returned null", path);
+		return INVALID_GRUG_FILE_ID;
+	}
+	for(uint32_t file_index = 0; file_index < gst->files_len; file_index += 1) {
+		if(gst->files[file_index].path == path_symbol) {
+			return file_index + 1;
+		}
+	}
+	if(gst->files_len == gst->files_capacity) {
+		uint32_t new_capacity = gst->files_capacity ? gst->files_capacity * 2 : 64;
+		struct compiled_file* new_files = grug_realloc(gst->files, gst->files_capacity * sizeof(struct compiled_file), new_capacity * sizeof(struct compiled_file));
+		if(!new_files) {
+			write_compile_error(&gst->call.last_error, GRUG_ERROR_CODE_COMPILE, "Failed to compile '%s': malloc() returned null", path);
+			return INVALID_GRUG_FILE_ID;
+		}
+		gst->files = new_files;
+		gst->files_capacity = new_capacity;
+	}
+	gst->files[gst->files_len] = (struct compiled_file) {.path = path_symbol, .entity_type = entity_type};
+	gst->files_len += 1;
+	return gst->files_len;
+}
+
+/// Gives every entity of a recompiled file fresh member data from the new script
+static void reinit_entities_of_file(struct grug_state* gst, grug_file_id file_id) {
+	for(uint32_t slot_index = 0; slot_index < gst->entity_slots_len; slot_index += 1) {
+		struct grug_entity* entity = &entity_slot_at(gst, slot_index)->entity;
+		if(!entity->id || entity->file_id != file_id) {
+			continue;
+		}
+		gst->backend.vtable->entity_data(gst->backend.obj, entity);
+		entity->data = NULL;
+		begin_grug_call(gst);
+		(void)end_grug_call(gst, gst->backend.vtable->init_entity(gst->backend.obj, gst, entity));
+	}
+}
+
+/// Gives every member of a type checked file its slot, which is the index compiled code reads and writes it by, and the offset the game can find it at.
+/// Returns false and writes to o_error if the layout couldn't be allocated.
+static bool lay_out_members(struct grug_state* gst, struct flat_ast const* ast, struct grug_member_layout** out_members, uint32_t* out_members_len, struct grug_error* o_error) {
+	*out_members = NULL;
+	*out_members_len = ast->members.count;
+	if(!ast->members.count) {
+		return true;
+	}
+	struct grug_member_layout* members = GRUG_MALLOC(ast->members.count * sizeof(struct grug_member_layout));
+	if(!members) {
+		struct grug_error err = {
+			.error_type = GRUG_ERROR_CODE_COMPILE,
+			.message = "Failed to compile: malloc() returned null",
+			.custom_message = "Failed to compile: malloc() returned null",
+		};
+		grug_assign_error(o_error, &err, NULL);
+		return false;
+	}
+	size_t stride = gst->backend.vtable->member_stride ? gst->backend.vtable->member_stride(gst->backend.obj) : sizeof(union grug_value);
+	for(uint32_t member_index = 0; member_index < ast->members.count; member_index += 1) {
+		struct flat_member const* member = flat_member_at(ast, member_index);
+		members[member_index] = (struct grug_member_layout) {
+			.name = grug_symbol_string(ast->interner, member->name),
+			.type = export_type(ast, member->type),
+			.slot = member_index,
+			.offset = member_index * stride,
+		};
+	}
+	*out_members = members;
+	return true;
+}
+
+/// What compiling a file comes down to before the backend gets it, which is everything that only has to read the state
+struct prepared_file {
+	uint32_t entity_type;
+	uint64_t content_hash;
+	/// Holds the AST, and the strings of the file's own interner if it got one
+	struct grug_arena* arena;
+	/// The AST points into them, as they were parsed where they are
+	struct file_contents contents;
+	struct grug_ast ast;
+	uint64_t* called_game_fns;
+	uint64_t* defined_on_fns;
+	struct grug_member_layout* members;
+	uint32_t members_len;
+};
+
+/// Frees whatever of `prepared` commit_file didn't take over
+static void free_prepared_file(struct grug_state const* gst, struct prepared_file* prepared) {
+	free_called_game_fns(gst, prepared->called_game_fns);
+	free_defined_on_fns(gst, prepared->entity_type, prepared->defined_on_fns);
+	free_member_layout(prepared->members, prepared->members_len);
+	grug_arena_deinit(prepared->arena);
+	free_file_contents(&gst->file_reader, &prepared->contents);
+	*prepared = (struct prepared_file) {0};
+}
+
+/// Parses and type checks `contents`, whose hash_contents is `content_hash`, unless the cache has the result already.
+/// Takes over the contents, which get freed along with `out`.
+/// With `own_symbols` the names the state's symbols don't have yet go in an interner of the file's own,
+/// so the state is only read, and several threads can prepare files at once.
+/// Returns false and writes to o_error if the file doesn't compile, after which `out` must still be freed with free_prepared_file.
+static bool prepare_file(struct grug_state* gst, char const* path, struct file_contents* contents, uint64_t content_hash, bool own_symbols, struct prepared_file* out, struct grug_error* o_error) {
+	*out = (struct prepared_file) {.content_hash = content_hash, .contents = *contents};
+	*contents = (struct file_contents) {0};
+	if(!entity_type_of_path(gst, path, &out->entity_type, o_error)) {
+		return false;
+	}
+	// The tokenizer tells whether it failed by whether o_error holds an error, so an earlier error must not linger.
+	// Only the code is reset, which keeps the error's arena around for the next message.
+	o_error->error_type = GRUG_ERROR_CODE_NONE;
+	// Holds the AST until the backend has lowered it
+	out->arena = ast_arena_or_new(NULL, o_error);
+	if(!out->arena) {
+		return false;
+	}
+	struct grug_interner file_symbols;
+	struct grug_interner* symbols = &gst->symbols;
+	if(own_symbols) {
+		grug_interner_init_child(&file_symbols, &gst->symbols, out->arena);
+		symbols = &file_symbols;
+	}
+	struct flat_ast flat = {0};
+	bool cached = load_cached_ast(gst, out->entity_type, content_hash, symbols, out->arena, &flat);
+	bool parsed = cached;
+	if(!cached) {
+		// The names are looked up in the state's symbols first, so they are the same symbols as in the mod API
+		parsed = parse_flat_ast(out->contents.text, out->contents.len, out->arena, symbols, &flat, o_error);
+	}
+	bool success = parsed;
+	if(parsed) {
+		struct mod_api_entity const* entity = &gst->mod_api.entities[out->entity_type];
+		success = cached || (bind_calls(&flat, &gst->mod_api, o_error) && type_check(&flat, &gst->mod_api, entity, o_error));
+		success = success && flat_ast_export(&flat, out->arena, &out->ast, o_error);
+		success = success && find_called_game_fns(&flat, gst->mod_api.game_fns_len, &out->called_game_fns, o_error);
+		success = success && find_defined_on_fns(&flat, entity->on_fns_len, &out->defined_on_fns, o_error);
+		success = success && lay_out_members(gst, &flat, &out->members, &out->members_len, o_error);
+		if(success && !cached && gst->cache) {
+			store_cached_ast(gst, out->entity_type, content_hash, &flat);
+		}
+		flat_ast_deinit(&flat);
+	}
+	if(own_symbols) {
+		grug_interner_deinit(&file_symbols);
+	}
+	return success;
+}
+
+/// Hands a prepared file to the backend, and gives it an id if it hasn't been compiled before.
+/// Frees `prepared` either way. Returns INVALID_GRUG_FILE_ID and writes to the state's last error if that fails.
+static grug_file_id commit_file(struct grug_state* gst, char const* path, struct prepared_file* prepared) {
+	// Member names that were only in the file's own interner die with its arena
+	for(uint32_t member_index = 0; member_index < prepared->members_len; member_index += 1) {
+		char const* name = prepared->members[member_index].name;
+		grug_symbol symbol = grug_intern(&gst->symbols, name, strlen(name));
+		if(symbol == GRUG_SYMBOL_NONE) {
+			write_compile_error(&gst->call.last_error, GRUG_ERROR_CODE_COMPILE, "Failed to compile '%s': grug_intern() returned null", path);
+			free_prepared_file(gst, prepared);
+			return INVALID_GRUG_FILE_ID;
+		}
+		prepared->members[member_index].name = grug_symbol_string(&gst->symbols, symbol);
+	}
+	uint32_t files_len = gst->files_len;
+	grug_file_id file_id = file_id_of_path(gst, path, prepared->entity_type);
+	if(file_id != INVALID_GRUG_FILE_ID) {
+		struct compiled_file* file = &gst->files[file_id - 1];
+		uint64_t* called_game_fns = file->called_game_fns;
+		file->called_game_fns = prepared->called_game_fns;
+		prepared->called_game_fns = called_game_fns;
+		uint64_t* defined_on_fns = file->defined_on_fns;
+		file->defined_on_fns = prepared->defined_on_fns;
+		prepared->defined_on_fns = defined_on_fns;
+		struct grug_member_layout* members = file->members;
+		uint32_t members_len = file->members_len;
+		file->members = prepared->members;
+		file->members_len = prepared->members_len;
+		prepared->members = members;
+		prepared->members_len = members_len;
+		gst->reload_epoch += 1;
+		file->epoch = gst->reload_epoch;
+		file->content_hash = prepared->content_hash;
+		file->removed = false;
+		gst->backend.vtable->compile_script(gst->backend.obj, file_id, prepared->ast);
+		if(file_id <= files_len) {
+			reinit_entities_of_file(gst, file_id);
+		}
+	}
+	// Now holds what the file had before, if it was compiled before
+	free_prepared_file(gst, prepared);
+	return file_id;
+}
+
+/// Compiles `contents`, whose hash_contents is `content_hash`, and frees them
+static grug_file_id compile_file_text(struct grug_state* gst, const char* path, struct file_contents* contents, uint64_t content_hash) {
+	struct prepared_file prepared;
+	if(!prepare_file(gst, path, contents, content_hash, false, &prepared, &gst->call.last_error)) {
+		free_prepared_file(gst, &prepared);
+		return INVALID_GRUG_FILE_ID;
+	}
+	return commit_file(gst, path, &prepared);
+}
+
+grug_file_id grug_compile_file_from_str(struct grug_state* gst, const char* path, char const* file_text) {
+	// The parser writes to the text, so it gets a copy
+	size_t src_len = strlen(file_text);
+	struct file_contents contents = {.text = GRUG_MALLOC(src_len + 1), .len = src_len, .capacity = src_len + 1};
+	if(!contents.text) {
+		write_compile_error(&gst->call.last_error, GRUG_ERROR_CODE_COMPILE, "Failed to compile '%s': malloc() returned null", path);
+		return INVALID_GRUG_FILE_ID;
+	}
+	memcpy(contents.text, file_text, src_len + 1);
+	return compile_file_text(gst, path, &contents, hash_contents(file_text, src_len));
+}
+
+/// Reads the file at `path` in the mods directory, whose contents the caller frees with free_file_contents.
+/// Returns false and writes to o_error if it couldn't be read.
+static bool read_mod_file(struct grug_state const* gst, const char* path, struct file_contents* out_contents, struct grug_error* o_error) {
+	// The path stays relative to the mods directory, so it names the file the same way grug_compile_file_from_str would
+	size_t mods_dir_len = strlen(gst->mods_dir_path);
+	size_t path_len = strlen(path);
+	size_t full_path_len = mods_dir_len + 1 + path_len;
+	char* full_path = GRUG_MALLOC(full_path_len + 1);
+	if(!full_path) {
+		write_compile_error(o_error, GRUG_ERROR_CODE_COMPILE_IO, "Failed to read '%s': malloc() returned null", path);
+		return false;
+	}
+	if(mods_dir_len) {
+		(void)snprintf(full_path, full_path_len + 1, "%s/%s", gst->mods_dir_path, path);
+	} else {
+		memcpy(full_path, path, path_len + 1);
+	}
+	bool success = read_file(&gst->file_reader, full_path, out_contents);
+	GRUG_FREE(full_path, full_path_len + 1);
+	if(!success) {
+		write_compile_error(o_error, GRUG_ERROR_CODE_COMPILE_IO, "Failed to read '%s'", path);
+	}
+	return success;
+}
+
+grug_file_id grug_compile_file(struct grug_state* gst, const char* path) {
+	struct file_contents contents;
+	if(!read_mod_file(gst, path, &contents, &gst->call.last_error)) {
+		return INVALID_GRUG_FILE_ID;
+	}
+	return compile_file_text(gst, path, &contents, hash_contents(contents.text, contents.len));
+}
+
+size_t grug_ast_to_tokens(struct grug_ast ast, struct grug_token* out_tokens, size_t out_tokens_capacity, struct grug_error* o_error) {
 	assert(false && "Not Implemented");
-	(void)tokens;
-	(void)num_tokens;
-	(void)arena_or_none;
+	(void)ast;
+	(void)out_tokens;
+	(void)out_tokens_capacity;
 	(void)o_error;
-	return (struct grug_ast){0};
+	return 0;
+}
+
+size_t grug_json_to_tokens(char const* json, size_t json_len, struct grug_token* out_tokens, size_t out_tokens_capacity, struct grug_error* o_error) {
+	struct grug_ast ast = grug_json_to_ast(json, json_len, NULL, o_error);
+	if(o_error->error_type.tag[0]) {
+		return 0;
+	}
+	size_t return_value = grug_ast_to_tokens(ast, out_tokens, out_tokens_capacity, o_error);
+	grug_free_ast(ast);
+	return return_value;
 }
 
 struct grug_ast grug_json_to_ast(char const* json, size_t json_len, struct grug_arena* arena_or_none, struct grug_error* o_error) {
@@ -1059,3 +5498,444 @@ size_t grug_ast_to_json(struct grug_ast ast, char* out_string_buffer, size_t out
 	(void)o_error;
 	return 0;
 }
+
+// MARK: hot reloading
+
+/// Copies the `len` characters at `string` into the arena, followed by a null terminator. Returns NULL if that fails.
+static char* arena_copy_slice(struct grug_arena* arena, char const* string, size_t len) {
+	char* copy = grug_arena_alloc(arena, len + 1);
+	if(copy) {
+		memcpy(copy, string, len);
+		copy[len] = '\0';
+	}
+	return copy;
+}
+
+/// Returns the id of the file at `path` if it has been compiled, without adding it like file_id_of_path does
+static grug_file_id compiled_file_of_path(struct grug_state const* gst, char const* path) {
+	grug_symbol path_symbol = grug_interner_find(&gst->symbols, path, strlen(path));
+	for(uint32_t file_index = 0; path_symbol != GRUG_SYMBOL_NONE && file_index < gst->files_len; file_index += 1) {
+		if(gst->files[file_index].path == path_symbol) {
+			return file_index + 1;
+		}
+	}
+	return INVALID_GRUG_FILE_ID;
+}
+
+/// The parts of the name of a .grug file, like "labrador-Dog.grug", which point into its path
+struct mod_file_name {
+	char const* name;
+	size_t name_len;
+	/// Empty if the name has no '-'
+	char const* entity_name;
+	size_t entity_name_len;
+	/// Empty if the name has no '-'
+	char const* entity_type;
+	size_t entity_type_len;
+};
+
+static struct mod_file_name split_mod_file_name(char const* path) {
+	struct mod_file_name parts = {.entity_name = "", .entity_type = ""};
+	char const* name = strrchr(path, '/');
+	parts.name = name ? name + 1 : path;
+	parts.name_len = strlen(parts.name);
+	// The watch only reports paths that end with .grug
+	char const* extension = parts.name + parts.name_len - 5;
+	char const* dash = NULL;
+	for(char const* character = parts.name; character < extension; character += 1) {
+		if(*character == '-') {
+			dash = character;
+		}
+	}
+	if(dash) {
+		parts.entity_name = parts.name;
+		parts.entity_name_len = (size_t)(dash - parts.name);
+		parts.entity_type = dash + 1;
+		parts.entity_type_len = (size_t)(extension - (dash + 1));
+	}
+	return parts;
+}
+
+/// Returns `len` characters at `string` interned in the state's symbols, so equal names are the same pointer. Returns NULL if that fails.
+static char const* intern_name(struct grug_state* gst, char const* string, size_t len) {
+	grug_symbol symbol = grug_intern(&gst->symbols, string, len);
+	return symbol == GRUG_SYMBOL_NONE ? NULL : grug_symbol_string(&gst->symbols, symbol);
+}
+
+/// Returns the directory in the tree of grug_get_mods that the file at `path` is in, adding the directories that are missing.
+/// Returns NULL if an allocation fails.
+static struct grug_mod_dir* mod_dir_of_path(struct grug_state* gst, char const* path) {
+	struct grug_mod_dir* dir = &gst->mods;
+	for(char const* slash = strchr(path, '/'); dir && slash; path = slash + 1, slash = strchr(path, '/')) {
+		char const* name = intern_name(gst, path, (size_t)(slash - path));
+		if(!name) {
+			return NULL;
+		}
+		struct grug_mod_dir* child = NULL;
+		for(size_t mod_index = 0; mod_index < dir->mods_size && !child; mod_index += 1) {
+			if(dir->mods[mod_index]->name == name) {
+				child = dir->mods[mod_index];
+			}
+		}
+		if(!child) {
+			if(dir->mods_size == dir->_mods_capacity) {
+				size_t new_capacity = dir->_mods_capacity ? dir->_mods_capacity * 2 : 8;
+				struct grug_mod_dir** new_mods = grug_realloc(dir->mods, dir->_mods_capacity * sizeof(struct grug_mod_dir*), new_capacity * sizeof(struct grug_mod_dir*));
+				if(!new_mods) {
+					return NULL;
+				}
+				dir->mods = new_mods;
+				dir->_mods_capacity = new_capacity;
+			}
+			child = GRUG_MALLOC(sizeof(struct grug_mod_dir));
+			if(child) {
+				*child = (struct grug_mod_dir) {.name = name};
+				dir->mods[dir->mods_size++] = child;
+			}
+		}
+		dir = child;
+	}
+	return dir;
+}
+
+/// Puts the file at `path` in the tree of grug_get_mods, with `file_id`, or with a copy of `error` if it is INVALID_GRUG_FILE_ID.
+/// If it can't be allocated the file is left out, and grug_get_mods returns the tree without it.
+static void set_mod_file(struct grug_state* gst, char const* path, grug_file_id file_id, struct grug_error const* error) {
+	struct grug_mod_dir* dir = mod_dir_of_path(gst, path);
+	struct mod_file_name parts = split_mod_file_name(path);
+	char const* name = dir ? intern_name(gst, parts.name, parts.name_len) : NULL;
+	if(!name) {
+		return;
+	}
+	struct grug_file* file = NULL;
+	for(size_t file_index = 0; file_index < dir->files_size && !file; file_index += 1) {
+		if(dir->files[file_index].name == name) {
+			file = &dir->files[file_index];
+		}
+	}
+	if(!file) {
+		char const* entity_type = intern_name(gst, parts.entity_type, parts.entity_type_len);
+		char const* entity_name = intern_name(gst, parts.entity_name, parts.entity_name_len);
+		if(!entity_type || !entity_name) {
+			return;
+		}
+		if(dir->files_size == dir->_files_capacity) {
+			size_t new_capacity = dir->_files_capacity ? dir->_files_capacity * 2 : 16;
+			struct grug_file* new_files = grug_realloc(dir->files, dir->_files_capacity * sizeof(struct grug_file), new_capacity * sizeof(struct grug_file));
+			if(!new_files) {
+				return;
+			}
+			dir->files = new_files;
+			dir->_files_capacity = new_capacity;
+		}
+		file = &dir->files[dir->files_size++];
+		*file = (struct grug_file) {
+			.name = name,
+			.entity_type = entity_type,
+			.entity_name = entity_name,
+		};
+	}
+	if(file->error) {
+		grug_free_error(file->error);
+		GRUG_FREE(file->error, sizeof(struct grug_error));
+		file->error = NULL;
+	}
+	file->id = file_id;
+	if(file_id == INVALID_GRUG_FILE_ID) {
+		file->error = GRUG_MALLOC(sizeof(struct grug_error));
+		if(file->error) {
+			// The copy gets an arena of its own, which lives until the file compiles or the state is deinitialized
+			*file->error = grug_copy_error(error, NULL);
+		}
+	}
+}
+
+/// Returns `len` characters at `string` the way intern_name does, or NULL if they were never interned
+static char const* find_name(struct grug_state const* gst, char const* string, size_t len) {
+	grug_symbol symbol = grug_interner_find(&gst->symbols, string, len);
+	return symbol == GRUG_SYMBOL_NONE ? NULL : grug_symbol_string(&gst->symbols, symbol);
+}
+
+/// Takes the file at `path`, relative to `dir`, out of the tree of grug_get_mods, along with the directories that it leaves empty.
+/// Returns whether `dir` is empty afterwards.
+static bool remove_mod_file(struct grug_state const* gst, struct grug_mod_dir* dir, char const* path) { // NOLINT(misc-no-recursion): directories are only nested as deep as the mods directory is
+	char const* slash = strchr(path, '/');
+	char const* name = find_name(gst, path, slash ? (size_t)(slash - path) : strlen(path));
+	if(slash) {
+		for(size_t mod_index = 0; name && mod_index < dir->mods_size; mod_index += 1) {
+			struct grug_mod_dir* child = dir->mods[mod_index];
+			if(child->name == name && remove_mod_file(gst, child, slash + 1)) {
+				free_mod_dir(child);
+				GRUG_FREE(child, sizeof(struct grug_mod_dir));
+				memmove(dir->mods + mod_index, dir->mods + mod_index + 1, (dir->mods_size - mod_index - 1) * sizeof(struct grug_mod_dir*));
+				dir->mods_size -= 1;
+				break;
+			}
+		}
+	} else {
+		for(size_t file_index = 0; name && file_index < dir->files_size; file_index += 1) {
+			struct grug_file* file = &dir->files[file_index];
+			if(file->name == name) {
+				if(file->error) {
+					grug_free_error(file->error);
+					GRUG_FREE(file->error, sizeof(struct grug_error));
+				}
+				memmove(file, file + 1, (dir->files_size - file_index - 1) * sizeof(struct grug_file));
+				dir->files_size -= 1;
+				break;
+			}
+		}
+	}
+	return !dir->files_size && !dir->mods_size;
+}
+
+/// A file that grug_watch_changes reported. Any thread reads and prepares it, after which the calling thread commits it.
+struct changed_file {
+	char const* path;
+	/// It got deleted or moved out of the mods directory, so there is nothing to read
+	bool removed;
+	/// Its contents are what it was last compiled from, as editors often rewrite files without changing them,
+	/// and recompiling would reinitialize its entities for nothing
+	bool unchanged;
+	bool prepared_ok;
+	struct prepared_file prepared;
+	/// Why it couldn't be read or prepared
+	struct grug_error error;
+};
+
+/// The changed files of a grug_update, which live in the update arena
+struct changed_files {
+	struct grug_state* gst;
+	struct changed_file* files;
+	size_t len;
+	size_t capacity;
+};
+
+struct update_job {
+	struct grug_state* gst;
+	struct changed_file* files;
+	/// Set when the files are prepared on several threads, which mustn't intern into the state's symbols
+	bool own_symbols;
+};
+
+/// The most changed files that are prepared before being committed, which bounds how many ASTs are held at once
+#define UPDATE_BATCH 256
+
+/// The fewest changed files worth waking the worker threads for
+#define PARALLEL_UPDATE_MIN 4
+
+static void add_changed_file(void* user_data, char const* path, bool removed) {
+	struct changed_files* changed = user_data;
+	struct grug_arena* arena = changed->gst->update_arena;
+	if(changed->len == changed->capacity) {
+		size_t new_capacity = changed->capacity ? changed->capacity * 2 : 16;
+		struct changed_file* new_files = changed->files ? grug_arena_realloc(arena, changed->files, changed->capacity * sizeof(struct changed_file), new_capacity * sizeof(struct changed_file)) : grug_arena_alloc(arena, new_capacity * sizeof(struct changed_file));
+		if(!new_files) {
+			// The watch has already moved past the file, so it only gets picked up again once it changes again
+			return;
+		}
+		changed->files = new_files;
+		changed->capacity = new_capacity;
+	}
+	char const* path_copy = arena_copy_slice(arena, path, strlen(path));
+	if(path_copy) {
+		changed->files[changed->len] = (struct changed_file) {.path = path_copy, .removed = removed};
+		changed->len += 1;
+	}
+}
+
+/// Reads and prepares the changed files in [start, end), which only reads the state
+static void prepare_changed_files(void* data, uint32_t worker, size_t start, size_t end) {
+	(void)worker;
+	struct update_job* job = data;
+	struct grug_state* gst = job->gst;
+	for(size_t file_index = start; file_index < end; file_index += 1) {
+		struct changed_file* file = &job->files[file_index];
+		struct file_contents contents;
+		if(file->removed || !read_mod_file(gst, file->path, &contents, &file->error)) {
+			continue;
+		}
+		uint64_t content_hash = hash_contents(contents.text, contents.len);
+		grug_file_id compiled = compiled_file_of_path(gst, file->path);
+		file->unchanged = compiled != INVALID_GRUG_FILE_ID && gst->files[compiled - 1].content_hash == content_hash;
+		if(file->unchanged) {
+			free_file_contents(&gst->file_reader, &contents);
+		} else {
+			file->prepared_ok = prepare_file(gst, file->path, &contents, content_hash, job->own_symbols, &file->prepared, &file->error);
+		}
+	}
+}
+
+/// Adds the file at `path` to the updates, with the state's last error if it has no id and wasn't removed
+static void add_update(struct grug_state* gst, char const* path, grug_file_id file_id, bool removed) {
+	if(gst->updates_len == gst->updates_capacity) {
+		size_t new_capacity = gst->updates_capacity ? gst->updates_capacity * 2 : 16;
+		struct grug_file* new_updates = gst->updates ? grug_arena_realloc(gst->update_arena, gst->updates, gst->updates_capacity * sizeof(struct grug_file), new_capacity * sizeof(struct grug_file)) : grug_arena_alloc(gst->update_arena, new_capacity * sizeof(struct grug_file));
+		if(!new_updates) {
+			// The file is still recompiled, the game just doesn't hear about it
+			return;
+		}
+		gst->updates = new_updates;
+		gst->updates_capacity = new_capacity;
+	}
+	struct mod_file_name parts = split_mod_file_name(path);
+	struct grug_file* update = &gst->updates[gst->updates_len];
+	*update = (struct grug_file) {
+		.name = arena_copy_slice(gst->update_arena, parts.name, parts.name_len),
+		.entity_type = arena_copy_slice(gst->update_arena, parts.entity_type, parts.entity_type_len),
+		.entity_name = arena_copy_slice(gst->update_arena, parts.entity_name, parts.entity_name_len),
+		.id = file_id,
+		.removed = removed,
+	};
+	if(file_id == INVALID_GRUG_FILE_ID && !removed) {
+		update->error = grug_arena_alloc(gst->update_arena, sizeof(struct grug_error));
+		if(update->error) {
+			*update->error = grug_copy_error(&gst->call.last_error, gst->update_arena);
+			// The error lives in the update arena, which the game must not free
+			update->error->arena = NULL;
+		}
+	}
+	if(update->name && update->entity_type && update->entity_name && (file_id != INVALID_GRUG_FILE_ID || removed || update->error)) {
+		gst->updates_len += 1;
+	}
+}
+
+/// Stops the on functions of a file that got removed from the mods directory from running.
+/// Its entities stay alive, as the game may still be using them, and are reinitialized if the file comes back.
+static void remove_compiled_file(struct grug_state* gst, grug_file_id file_id) {
+	struct compiled_file* file = &gst->files[file_id - 1];
+	free_defined_on_fns(gst, file->entity_type, file->defined_on_fns);
+	file->defined_on_fns = NULL;
+	file->removed = true;
+	// Handles that were resolved before would still call into the old script
+	gst->reload_epoch += 1;
+	file->epoch = gst->reload_epoch;
+	// Whatever it comes back with gets compiled
+	file->content_hash = 0;
+}
+
+/// Hands a prepared file to the backend, and puts it in the tree of grug_get_mods, or takes it out if it was removed.
+/// With `report` it is also added to the updates.
+static void commit_changed_file(struct grug_state* gst, struct changed_file* changed, bool report) {
+	char const* path = changed->path;
+	grug_file_id compiled = compiled_file_of_path(gst, path);
+	if(changed->removed) {
+		gst->update_stats.files_removed += 1;
+		(void)remove_mod_file(gst, &gst->mods, path);
+		if(compiled != INVALID_GRUG_FILE_ID) {
+			remove_compiled_file(gst, compiled);
+		}
+		if(report) {
+			add_update(gst, path, compiled, true);
+		}
+		return;
+	}
+	gst->update_stats.files_changed += 1;
+	if(changed->unchanged) {
+		gst->update_stats.files_unchanged += 1;
+		// It may have only been compiled by grug_compile_file_from_str so far
+		set_mod_file(gst, path, compiled, NULL);
+		return;
+	}
+	grug_file_id file_id = INVALID_GRUG_FILE_ID;
+	if(changed->prepared_ok) {
+		file_id = commit_file(gst, path, &changed->prepared);
+	} else {
+		free_prepared_file(gst, &changed->prepared);
+		grug_assign_error(&gst->call.last_error, &changed->error, NULL);
+	}
+	grug_free_error(&changed->error);
+	if(file_id == INVALID_GRUG_FILE_ID && compiled != INVALID_GRUG_FILE_ID) {
+		// Writing back what it was last compiled from fixes the error, which the game has to hear about
+		gst->files[compiled - 1].content_hash = 0;
+	}
+	if(file_id == INVALID_GRUG_FILE_ID) {
+		gst->update_stats.files_failed += 1;
+	} else {
+		gst->update_stats.files_recompiled += 1;
+	}
+	set_mod_file(gst, path, file_id, &gst->call.last_error);
+	if(report) {
+		add_update(gst, path, file_id, false);
+	}
+}
+
+static int compare_changed_files(void const* a, void const* b) {
+	return strcmp(((struct changed_file const*)a)->path, ((struct changed_file const*)b)->path);
+}
+
+/// Compiles the files that the watch reports, creating the watch if there is none yet. With `report` they are added to the updates.
+static void compile_changed_files(struct grug_state* gst, uint32_t budget, bool report) {
+	if(!gst->watch) {
+		gst->watch = grug_watch_new(gst->mods_dir_path);
+		if(!gst->watch) {
+			return;
+		}
+	}
+	struct changed_files changed = {.gst = gst};
+	(void)grug_watch_changes(gst->watch, budget, add_changed_file, &changed);
+	// New files get their ids in the order of their paths, so they don't depend on the order the directories list them in, or on how the threads raced
+	if(changed.len > 1) {
+		qsort(changed.files, changed.len, sizeof(struct changed_file), compare_changed_files);
+	}
+	for(size_t batch_start = 0; batch_start < changed.len; batch_start += UPDATE_BATCH) {
+		size_t batch_len = changed.len - batch_start < UPDATE_BATCH ? changed.len - batch_start : UPDATE_BATCH;
+		struct update_job job = {
+			.gst = gst,
+			.files = changed.files + batch_start,
+			.own_symbols = gst->workers && batch_len >= PARALLEL_UPDATE_MIN,
+		};
+		if(job.own_symbols) {
+			grug_workers_run(gst->workers, batch_len, 1, prepare_changed_files, &job);
+		} else {
+			prepare_changed_files(&job, 0, 0, batch_len);
+		}
+		for(size_t file_index = 0; file_index < batch_len; file_index += 1) {
+			commit_changed_file(gst, &job.files[file_index], report);
+		}
+	}
+}
+
+struct grug_updates_list grug_update(struct grug_state* gst) {
+	grug_arena_clear(gst->update_arena, gst->updates_capacity * sizeof(struct grug_file));
+	gst->updates = NULL;
+	gst->updates_len = 0;
+	gst->updates_capacity = 0;
+	compile_changed_files(gst, gst->update_budget, true);
+	return (struct grug_updates_list) {
+		.count = gst->updates_len,
+		.updates = gst->updates,
+	};
+}
+
+const struct grug_mod_dir* grug_get_mods(struct grug_state* gst) {
+	if(!gst->mods.name) {
+		// The root is named after the last directory of the mods directory's path
+		char const* path = gst->mods_dir_path;
+		size_t end = strlen(path);
+		while(end > 1 && path[end - 1] == '/') {
+			end -= 1;
+		}
+		size_t start = end;
+		while(start > 0 && path[start - 1] != '/') {
+			start -= 1;
+		}
+		gst->mods.name = intern_name(gst, path + start, end - start);
+	}
+	// The budget is ignored, as the game asked for every file. The updates of the last grug_update are left alone, as the game may still be using them.
+	compile_changed_files(gst, 0, false);
+	return &gst->mods;
+}
+
+struct grug_update_stats grug_get_update_stats(struct grug_state const* gst) {
+	return gst->update_stats;
+}
+
+struct grug_cache_stats grug_get_cache_stats(struct grug_state const* gst) {
+	struct grug_cache_stats stats;
+	__atomic_load(&gst->cache_stats.hits, &stats.hits, __ATOMIC_RELAXED);
+	__atomic_load(&gst->cache_stats.misses, &stats.misses, __ATOMIC_RELAXED);
+	__atomic_load(&gst->cache_stats.invalidated, &stats.invalidated, __ATOMIC_RELAXED);
+	__atomic_load(&gst->cache_stats.stored, &stats.stored, __ATOMIC_RELAXED);
+	return stats;
+}
@@ -57,11 +57,11 @@ struct grug_error_code {
 #define GRUG_ERROR_CODE_COMPILE ((struct grug_error_code) {{2, 0, 0, 0}})
 #define GRUG_ERROR_CODE_RUNTIME ((struct grug_error_code) {{3, 0, 0, 0}})
 
-#define GRUG_ERROR_CODE_INIT_MOD_API ((struct grug_error_code){{1, 1, 0, 0}});
-#define GRUG_ERROR_CODE_INIT_FUNCTION_REGISTRATION ((struct grug_error_code){{1, 2, 0, 0}});
+#define GRUG_ERROR_CODE_INIT_MOD_API ((struct grug_error_code) {{1, 1, 0, 0}})
+#define GRUG_ERROR_CODE_INIT_FUNCTION_REGISTRATION ((struct grug_error_code) {{1, 2, 0, 0}})
 
-#define GRUG_ERROR_CODE_INIT_MOD_API_IO ((struct grug_error_code){{1, 1, 1, 0}});
-#define GRUG_ERROR_CODE_INIT_MOD_API_JSON ((struct grug_error_code){{1, 1, 2, 0}});
+#define GRUG_ERROR_CODE_INIT_MOD_API_IO ((struct grug_error_code) {{1, 1, 1, 0}})
+#define GRUG_ERROR_CODE_INIT_MOD_API_JSON ((struct grug_error_code) {{1, 1, 2, 0}})
 
 #define GRUG_ERROR_CODE_COMPILE_IO ((struct grug_error_code) {{2, 1, 0, 0}})
 #define GRUG_ERROR_CODE_COMPILE_FILE_NAME ((struct grug_error_code) {{2, 2, 0, 0}})
@@ -72,6 +72,9 @@ struct grug_error_code {
 
 #define GRUG_ERROR_CODE_COMPILE_FILE_NAME_EMPTY_FILE ((struct grug_error_code) {{2, 2, 1, 0}})
 
+#define GRUG_ERROR_CODE_RUNTIME_GAME_FN ((struct grug_error_code) {{3, 1, 0, 0}})
+#define GRUG_ERROR_CODE_RUNTIME_STACK_OVERFLOW ((struct grug_error_code) {{3, 2, 0, 0}})
+
 struct grug_file_location {
 	/// null terminated file name
 	char const* file_name;
@@ -118,6 +121,32 @@ struct grug_updates_list {
 	struct grug_file* updates;
 };
 
+/// Counts what grug_update and grug_get_mods have done since the state was created
+struct grug_update_stats {
+	/// Files the mods directory watch found to be created or changed
+	uint64_t files_changed;
+	/// Changed files that got recompiled
+	uint64_t files_recompiled;
+	/// Changed files that weren't recompiled, as their contents were the same as what they were last compiled from
+	uint64_t files_unchanged;
+	/// Changed files that failed to be read or compiled
+	uint64_t files_failed;
+	/// Files that were deleted from the mods directory or moved out of it, which aren't counted as changed
+	uint64_t files_removed;
+};
+
+/// Counts how the compile cache has done since the state was created
+struct grug_cache_stats {
+	/// Files that were loaded from the cache instead of being compiled
+	uint64_t hits;
+	/// Files that had to be compiled, as the cache had nothing for their contents
+	uint64_t misses;
+	/// Misses where the cache did have an entry, but it was written for another mod_api.json or version of grug, or it was damaged
+	uint64_t invalidated;
+	/// Files that were compiled and written to the cache
+	uint64_t stored;
+};
+
 struct grug_runtime_error_handler {
 	void* user_data;
 	void (*drop_fn)(void*);
@@ -139,6 +168,19 @@ struct grug_logger {
 	void (*log_trace)(struct grug_state* gst, void* user_data, char const* message);
 };
 
+/// Lets the game serve the files grug reads, which are mod_api.json and the mods, from its own virtual file system or archives.
+/// Leaving read_fn NULL reads from the file system. Setting read_fn requires free_fn, or grug_init fails. drop_fn is optional, and called by grug_deinit.
+struct grug_file_reader {
+	void* user_data;
+	void (*drop_fn)(void*);
+	/// Returns the contents of the file at `path`, which is the path grug would have opened, and writes their length to out_len.
+	/// The contents must be followed by a null terminator and be writable, as grug parses them where they are instead of copying them.
+	/// Returns NULL if the file can't be read. With worker_threads, several threads may call it at once.
+	char* (*read_fn)(void* user_data, char const* path, size_t* out_len);
+	/// Gets back what read_fn returned once grug is done with it, along with the length read_fn wrote
+	void (*free_fn)(void* user_data, char* contents, size_t len);
+};
+
 struct grug_on_fn_entry {
 	char const* entity_name;
 	char const* on_fn_name;
@@ -163,6 +205,10 @@ struct grug_file {
 
 	/// Null if there is no error in this file
 	struct grug_error* error;
+
+	/// Only set in the updates of grug_update, for a file that was deleted from the mods directory or moved out of it.
+	/// `id` is then the id it had, or INVALID_GRUG_FILE_ID if it never compiled.
+	bool removed;
 };
 
 struct grug_mod_dir {
@@ -237,6 +283,10 @@ struct grug_arena;
 
 struct grug_token {
 	grug_token_type type;
+	/// The number of spaces directly before this token.
+	/// Only set by grug_grug_to_tokens_without_whitespace, where it takes the place of the SPACE and INDENT tokens so grug_tokens_to_grug can still reproduce the formatting.
+	/// For the first token on a line it is the indentation, so GRUG_SPACES_PER_INDENT times the indentation depth.
+	uint32_t spaces_before;
 	/// When parsed from 'real' code this will always be set, however when generated from an AST or otherwise this may or may not be set.
 	/// Will not be null terminated, as it is simply a window view into the file contents string which is stored elsewhere
 	char const* contents;
@@ -339,7 +389,12 @@ struct grug_expr {
 			char const* function_name;
 			struct grug_expr* args;
 			size_t args_count;
-			void* game_fn_ptr;
+			/// Filled in by the type checker: the registered game_fn for a call to a game function, or null for a call to a helper function
+			game_fn game_fn_ptr;
+			/// Filled in by the type checker: the fn_data the game function was registered with
+			void* game_fn_data;
+			/// Filled in by the type checker for a call to a helper function: its index in grug_ast.helper_function
+			size_t helper_fn_index;
 		} call;
 		struct grug_expr* parenthesized;
 	} expr_data;
@@ -416,6 +471,9 @@ struct grug_on_function {
 	struct grug_argument* arguments;
 	size_t arguments_len;
 	struct grug_block block;
+	/// Filled in by the type checker: the index of this function among the on functions of its entity type in mod_api.json.
+	/// This is the `on_fn_index` that the backend's call_on_function gets.
+	size_t on_fn_index;
 };
 
 struct grug_helper_function {
@@ -480,7 +538,7 @@ typedef bool (*grug_backend_vtable_clear_entities)(void* backend_data);
 typedef void (*grug_backend_vtable_destroy_entity_data)(void* backend_data, struct grug_entity* entity);
 
 /// Run the on function at index `on_fn_index` of the script associated
-/// with `entity`.
+/// with `entity`, which is grug_on_function.on_fn_index and not the grug_on_fn_id.
 ///
 /// # SAFETY: `values` must point to an array of GrugValues of at least as
 /// many elements as the number of arguments to the on_ function
@@ -495,6 +553,35 @@ typedef bool (*grug_backend_vtable_call_on_function_raw)(void* backend_data, str
 /// expected arguments to the on_ function
 typedef bool (*grug_backend_vtable_call_on_function)(void* backend_data, struct grug_state* gst, struct grug_entity* entity, uint64_t on_fn_index, union grug_value* args, size_t args_len);
 
+/// Run the on function at index `on_fn_index` for each of the `count`
+/// entities in order, which all come from the same script. The arguments
+/// of entities[i] start at args[i * stride], so a stride of 0 passes the
+/// same arguments to every entity. `args` is null if there are none.
+///
+/// Stops after the first call that fails, so its runtime error can be
+/// reported before the rest of the batch runs.
+///
+/// Returns the number of calls that succeeded, which is `count` if all
+/// of them did. May be NULL, in which case call_on_function_raw is
+/// called for every entity instead.
+typedef size_t (*grug_backend_vtable_call_on_function_batch)(void* backend_data, struct grug_state* gst, struct grug_entity* const* entities, size_t count, uint64_t on_fn_index, union grug_value const* args, size_t stride);
+
+/// Returns backend data that shares the compiled scripts of `backend_data`, but has its own execution state (like its value stack and callstack),
+/// so a worker thread can pass it to the call_on_function hooks while other threads are running grug code.
+/// It must see scripts that get compiled later. Returns NULL if that fails.
+/// May be NULL, in which case grug_call_on_function_batch runs every call on the calling thread.
+typedef void* (*grug_backend_vtable_new_worker)(void* backend_data);
+/// Frees the execution state of a worker from new_worker
+typedef void (*grug_backend_vtable_drop_worker)(void* worker_data);
+
+/// Returns where the members of an entity start, which is what the offsets of grug_get_member_layout are relative to.
+/// May be NULL, in which case grug_entity_members always returns NULL.
+typedef union grug_value* (*grug_backend_vtable_entity_members)(void* backend_data, struct grug_entity* entity);
+
+/// Returns the distance in bytes from one member of an entity to the next, which is the same for every entity.
+/// May be NULL if members are next to each other.
+typedef size_t (*grug_backend_vtable_member_stride)(void* backend_data);
+
 struct grug_backend_vtable {
 	grug_backend_vtable_compile_script compile_script;
 	grug_backend_vtable_init_entity init_entity;
@@ -502,6 +589,11 @@ struct grug_backend_vtable {
 	grug_backend_vtable_destroy_entity_data entity_data;
 	grug_backend_vtable_call_on_function_raw call_on_function_raw;
 	grug_backend_vtable_call_on_function call_on_function;
+	grug_backend_vtable_call_on_function_batch call_on_function_batch;
+	grug_backend_vtable_new_worker new_worker;
+	grug_backend_vtable_drop_worker drop_worker;
+	grug_backend_vtable_entity_members entity_members;
+	grug_backend_vtable_member_stride member_stride;
     grug_backend_vtable_drop drop;
 };
 
@@ -510,9 +602,20 @@ struct grug_backend {
 	struct grug_backend_vtable* vtable;
 };
 
+/// The built-in backend, which lowers each file to register based bytecode and interprets it.
+/// grug_init uses it when grug_init_settings.backend has no vtable.
+/// Returns a backend without a vtable if it could not be allocated.
+struct grug_backend grug_bytecode_backend_new(void);
+
+/// Like the bytecode backend, but translates the bytecode of each file to machine code.
+/// The machine code only runs in fast mode, see grug_set_fast_mode; in safe mode the bytecode is interpreted.
+/// Falls back to the bytecode backend on platforms other than x86-64 Linux, or when the library is built with GRUG_NO_JIT.
+/// Returns a backend without a vtable if it could not be allocated.
+struct grug_backend grug_jit_backend_new(void);
+
 struct grug_init_settings {
 	/// The raw text of the mod API
-	/// May be NULL if the file path is defined instead.
+	/// May be NULL if the file path is defined instead. Text that is empty or only whitespace declares no entities and no game functions.
 	char const* mod_api_json_source;
 	/// The file path. Can be an absolute path or relative to CWD. If relative to CWD, grug will remember what it was at init so changing the CWD at runtime has no ill effect on grug.
 	/// May be NULL if the file source is defined instead.
@@ -521,7 +624,19 @@ struct grug_init_settings {
 	char const* mods_dir_path;
 	struct grug_runtime_error_handler runtime_error_handler;
 	struct grug_logger logger;
+	/// Reads from the file system if read_fn is NULL. grug_update watches the mods directory on the file system either way.
+	struct grug_file_reader file_reader;
 	struct grug_backend backend;
+	/// The number of threads grug_call_on_function_batch spreads its calls over next to the calling thread, which grug_update also parses and type checks files on.
+	/// 0 runs everything on the calling thread.
+	uint32_t worker_threads;
+	/// The most files a grug_update recompiles, and when the mods directory has to be polled, the most directory entries it looks at.
+	/// What is over budget is left for the next grug_update, so a big mods directory can't stall a frame. 0 means no limit.
+	uint32_t update_budget;
+	/// Where files that compiled are cached, keyed by their contents, entity type and mod_api.json, so the next process can skip compiling them.
+	/// It gets created if it doesn't exist, and nothing in it is ever deleted, so it can be emptied at any time. Can be an absolute path or relative to CWD.
+	/// NULL, the default, caches nothing.
+	char const* cache_dir_path;
 };
 
 // MARK: API
@@ -543,13 +658,22 @@ struct grug_callstack grug_get_callstack(struct grug_state* gst);
 // 	- function has already been registered
 bool grug_register_game_fn(struct grug_state* gst, char const* game_fn_name, void* fn_data, game_fn fn_ptr);
 
+// Game functions are main-thread-only until they are marked as thread-safe.
+// A batch of grug_call_on_function_batch only runs the entities of a file on worker threads if every game function the file calls is thread-safe.
+// Worker threads call a game function with their own grug_state, which it can pass to grug_game_fn_runtime_error, grug_get_error, grug_call_on_function
+// and the functions that look up ids, entities and handles.
+// Returns false if mod_api.json doesn't declare the game function.
+bool grug_set_game_fn_thread_safe(struct grug_state* gst, char const* game_fn_name, bool thread_safe);
+
 // Returns true if all game functions defined in mod_api.json are registered
 bool grug_all_game_functions_registered(struct grug_state* gst);
 
 // Get the on_fn_id for a particular on_ function for a particular entity
+// Returns INVALID_GRUG_ON_FN_ID if mod_api.json doesn't declare it
 grug_on_fn_id grug_get_on_fn_id(struct grug_state* gst, const char* entity_type, const char* on_fn_name);
 
 // Returns a list of all the fn ids for the mod_api.json
+// The entries are owned by the state and stay valid until grug_deinit
 struct grug_on_fns grug_get_fn_ids(struct grug_state* gst);
 
 // Compiles a single file from the mods directory
@@ -559,10 +683,15 @@ grug_file_id grug_compile_file(struct grug_state* gst, const char* path);
 // If it overlaps with a path on the actual filesystem, it is given the same id as that path
 grug_file_id grug_compile_file_from_str(struct grug_state* gst, const char* path, char const* file_text);
 
-// Compiles and inserts all grug files in the mods directory
+// Compiles and inserts all grug files in the mods directory, and returns the tree of them, where files that failed to compile have an error.
+// The first call does the cold start: the files are read, parsed and type checked on the worker_threads of the settings,
+// and then handed to the backend in the order of their paths, so they get ascending ids that don't depend on the threads.
+// Later calls compile what changed since, like grug_update does, but without reporting it in the updates of grug_update.
+// The tree is owned by the state, and grug_update keeps it up to date. It stays valid until grug_deinit.
 const struct grug_mod_dir* grug_get_mods(struct grug_state* gst);
 
 // Instantiate an entity from a script
+// Ids are generational handles: once an entity is deinitialized, its id stays invalid even after a new entity reuses its storage
 grug_entity_id grug_create_entity(struct grug_state* gst, grug_file_id script, grug_object_id me_id);
 
 // Gets the file id of an entity, or 0 (null id) if the ID given isn't an entity or doesn't exist.
@@ -571,12 +700,43 @@ grug_file_id grug_entity_get_file_id(struct grug_state* gst, grug_entity_id enti
 // Gets the entity data of an entity, or NULL if the ID given isn't an entity or doesn't exist.
 struct grug_entity* grug_entity_get_data(struct grug_state* gst, grug_entity_id entity);
 
+/// A member variable of a compiled file, as the compiler laid it out
+struct grug_member_layout {
+	/// Lives as long as the state does
+	char const* name;
+	struct grug_type type;
+	/// The member's index, in the order the file declares its members
+	uint32_t slot;
+	/// Where the member's union grug_value is, in bytes from what grug_entity_members returns
+	size_t offset;
+};
+
+// Gets the member layout of a compiled file, which stays valid until the file is recompiled.
+// Returns the number of members, or 0 with *out_members set to NULL if the file id doesn't belong to a compiled file.
+size_t grug_get_member_layout(struct grug_state* gst, grug_file_id file_id, struct grug_member_layout const** out_members);
+
+// Returns what the offsets of the entity's grug_get_member_layout are relative to, so the game can read and write members without calling into grug.
+// Returns NULL if the ID given isn't an entity, or if the backend doesn't expose members. Stays valid until the entity is deinitialized or its file is recompiled.
+void* grug_entity_members(struct grug_state* gst, grug_entity_id entity);
+
 // Destroy the data associated with an entity. Does nothing if called on a non-existent entity. TODO(bluesillybeard): should this have an error?
 void grug_deinit_entity(struct grug_state* gst, grug_entity_id entity);
 
+/// Recompiles the files in the mods directory that were created or changed since the last call, or since grug_get_mods.
+/// The first call compiles every file, unless grug_get_mods already did.
+/// Files that were deleted or moved out of the mods directory are reported as `removed`. Their entities stay alive, but none of their on functions run anymore,
+/// and no entities can be created from them, until a file with the same path is compiled again.
+/// Files whose contents are the same as what they were last compiled from aren't recompiled, so their entities aren't reinitialized.
+/// On Linux the directory is watched with inotify, so a call costs a single system call when nothing changed. Elsewhere it is polled.
+/// With worker_threads in the settings, many changed files, like all of them on the first call, are read, parsed and type checked in parallel.
+/// The backend still gets them one by one on the calling thread, in the order of their paths, so the ids they get don't depend on the threads.
 /// The values returned are entirely allocated temporarily and are 'freed' when grug_update is called again.
 struct grug_updates_list grug_update(struct grug_state* gst);
 
+struct grug_update_stats grug_get_update_stats(struct grug_state const* gst);
+
+struct grug_cache_stats grug_get_cache_stats(struct grug_state const* gst);
+
 // Destroy a grug state and free all its resources
 void grug_deinit(struct grug_state* gst);
 
@@ -590,13 +750,63 @@ void grug_set_fast_mode(struct grug_state* gst, bool fast);
 bool grug_call_on_function_raw(struct grug_state* gst, grug_entity_id entity, grug_on_fn_id on_fn_id, union grug_value* args);
 bool grug_call_on_function(struct grug_state* gst, grug_entity_id entity, grug_on_fn_id on_fn_id, union grug_value* args, size_t args_len);
 
+/// Calls `on_fn_id` on `count` entities, which is cheaper than calling grug_call_on_function_raw for each of them.
+/// The entities are grouped by file, so entities of different files may run in a different order than they were passed in.
+/// The arguments of entities[i] start at args[i * stride], so a stride of 0 passes the same arguments to every entity.
+/// `args` can be NULL if there are no arguments, and `results` can be NULL if only the return value is needed.
+/// results[i] is set to what grug_call_on_function_raw would have returned for entities[i].
+/// The calls must not deinitialize entities of the batch. Returns whether every call succeeded.
+///
+/// With worker_threads in the settings, the entities of files that only call thread-safe game functions are spread over the worker threads.
+/// The calls then must not create or deinitialize entities, or compile files. The runtime error handler is called on the thread that ran the call,
+/// one thread at a time, with the grug_state of that thread.
+bool grug_call_on_function_batch(struct grug_state* gst, grug_on_fn_id on_fn_id, grug_entity_id const* entities, size_t count, union grug_value const* args, size_t stride, bool* results);
+
+/// Returns whether the file defines `on_fn_id`. Calling an on function on an entity whose file doesn't define it does nothing and succeeds,
+/// without entering the backend.
+bool grug_file_defines_on_fn(struct grug_state* gst, grug_file_id file_id, grug_on_fn_id on_fn_id);
+
+/// Writes the ids of the entities whose file defines `on_fn_id` to out_entities, up to `capacity` of them, so the game can build its list of entities to call once.
+/// Returns how many there are, which can be more than `capacity`, so passing a capacity of 0 counts them.
+size_t grug_get_entities_defining_on_fn(struct grug_state* gst, grug_on_fn_id on_fn_id, grug_entity_id* out_entities, size_t capacity);
+
+/// An on function of a compiled file, resolved once by grug_get_on_fn_handle so that calls through it don't have to look it up again.
+/// It stays valid until its file is recompiled, which bumps the reload epoch.
+struct grug_on_fn_handle {
+	/// The backend's call_on_function_raw, one that does nothing if the file doesn't define the on function, or NULL if the handle didn't resolve
+	grug_backend_vtable_call_on_function_raw call;
+	grug_file_id file_id;
+	/// What `call` gets as its on_fn_index
+	uint32_t on_fn_index;
+	/// The number of arguments the on function expects
+	size_t args_len;
+	/// The reload epoch of the file when the handle was resolved
+	uint64_t epoch;
+};
+
+/// Resolves `on_fn_id` for the entities of `file_id`. The `call` of the handle is NULL if the file isn't compiled,
+/// or if `on_fn_id` isn't an on function of the file's entity type.
+struct grug_on_fn_handle grug_get_on_fn_handle(struct grug_state* gst, grug_file_id file_id, grug_on_fn_id on_fn_id);
+
+/// Returns whether the file of `handle` hasn't been recompiled since the handle was resolved
+bool grug_on_fn_handle_valid(struct grug_state const* gst, struct grug_on_fn_handle const* handle);
+
+/// Goes up every time a file is compiled, so the game can tell with one comparison whether any handle may have become invalid
+uint64_t grug_reload_epoch(struct grug_state const* gst);
+
+/// Calls the on function of `handle` on `entity`, which must be an entity of the handle's file.
+/// Returns the same as grug_call_on_function, including false if the handle is invalid, the entity isn't of its file,
+/// or `args_len` doesn't match. In fast mode none of this is checked, so the game has to make sure of it.
+/// Passing an unresolved or stale handle, or an entity that was destroyed, in fast mode is undefined behavior.
+bool grug_call_on_fn_handle(struct grug_state* gst, struct grug_on_fn_handle const* handle, grug_entity_id entity, union grug_value* args, size_t args_len);
+
 void grug_game_fn_runtime_error(struct grug_state* gst, char const* message);
 
 #define GRUG_CALL_ARGLESS(_state, _entity, _on_fn_id) \
-		grug_call_on_function(_state, _entity, _on_fn_id, NULL, 0); \
+		grug_call_on_function(_state, _entity, _on_fn_id, NULL, 0)
 
 #define GRUG_CALL(_state, _entity, _on_fn_id, _args_count, ...) \
-		grug_call_on_function(_state, _entity, _on_fn_id, (union grug_value[]) {__VA_ARGS__}, _args_count); \
+		grug_call_on_function(_state, _entity, _on_fn_id, (union grug_value[]) {__VA_ARGS__}, _args_count)
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-function"
@@ -644,6 +854,7 @@ static inline void grug_free_error(struct grug_error* err) {
 	*err = (struct grug_error) {0};
 }
 
+/// Frees everything the AST owns in one go, by deinitializing its arena
 void grug_free_ast(struct grug_ast ast);
 
 size_t grug_tokens_to_grug(struct grug_token const* tokens, size_t num_tokens, char* out_string_buffer, size_t out_string_buffer_capacity, struct grug_error* o_error);
@@ -654,12 +865,45 @@ size_t grug_json_to_grug(char const* json, size_t json_len, char* out_string_buf
 
 size_t grug_grug_to_tokens(char const* grug, size_t grug_len, struct grug_token* out_tokens, size_t out_tokens_capacity, struct grug_error* o_error);
 
+/// Like grug_grug_to_tokens, but leaves out SPACE and INDENT tokens and records the spaces before each token in its `spaces_before` instead.
+/// Whitespace that is wrong no matter where it is (trailing spaces, indentation that isn't a multiple of GRUG_SPACES_PER_INDENT, or more than one space between two tokens on a line) is a tokenizer error.
+size_t grug_grug_to_tokens_without_whitespace(char const* grug, size_t grug_len, struct grug_token* out_tokens, size_t out_tokens_capacity, struct grug_error* o_error);
+
+/// Tokenizes in a single pass into a token array allocated from `arena`, unlike grug_grug_to_tokens which has to be called twice to count and then fill.
+/// The array grows in place as long as nothing else is allocated from `arena` until this returns, so a dedicated arena works best.
+/// Returns NULL and writes to o_error upon an error.
+struct grug_token* grug_grug_to_tokens_in_arena(char const* grug, size_t grug_len, struct grug_arena* arena, size_t* out_num_tokens, struct grug_error* o_error);
+
+/// Called for each token produced by a grug_tokenizer.
+/// `token->contents` is only valid until the callback returns, as it points either into the chunk being fed or into the tokenizer's own buffer.
+typedef void (*grug_token_sink)(void* user_data, struct grug_token const* token);
+
+/// opaque state of a tokenizer that accepts a file in chunks
+struct grug_tokenizer;
+
+/// Returns NULL if the tokenizer could not be allocated
+struct grug_tokenizer* grug_tokenizer_begin(grug_token_sink on_token, void* user_data);
+
+/// Tokenizes the next chunk of the file. Chunks may be split anywhere, including inside a string or a multi-character operator like `>=`.
+/// Tokens are passed to `on_token` as soon as they are known to be complete, and `chunk` is not referenced after this returns.
+/// Returns false and writes to o_error upon an error, after which the tokenizer can only be finished.
+bool grug_tokenizer_feed(struct grug_tokenizer* tokenizer, char const* chunk, size_t chunk_len, struct grug_error* o_error);
+
+/// Tokenizes whatever is left at the end of the file, then frees the tokenizer. Must be called even if feeding failed.
+/// Returns false and writes to o_error upon an error.
+bool grug_tokenizer_finish(struct grug_tokenizer* tokenizer, struct grug_error* o_error);
+
 size_t grug_ast_to_tokens(struct grug_ast ast, struct grug_token* out_tokens, size_t out_tokens_capacity, struct grug_error* o_error);
 
 size_t grug_json_to_tokens(char const* json, size_t json_len, struct grug_token* out_tokens, size_t out_tokens_capacity, struct grug_error* o_error);
 
+/// Every node and string of the AST is allocated from `arena_or_none`, or from a new arena if it is null, which the AST then owns: grug_free_ast deinits it.
+/// The AST keeps its own copy of `grug`, and its string literals and comments point into that copy instead of being copied one by one.
 struct grug_ast grug_grug_to_ast(char const* grug, size_t grug_len, struct grug_arena* arena_or_none, struct grug_error* o_error);
 
+/// Parses the tokens as they are, which get the checks the tokenizer does on a file's: the contents of a token have to be a single token of its type,
+/// and the spaces have to be ones a file can have. The contents of a token whose type fixes its text may be unset.
+/// The AST keeps a copy of the tokens' text, like grug_grug_to_ast keeps one of the file.
 struct grug_ast grug_tokens_to_ast(struct grug_token const* tokens, size_t num_tokens, struct grug_arena* arena_or_none, struct grug_error* o_error);
 
 struct grug_ast grug_json_to_ast(char const* json, size_t json_len, struct grug_arena* arena_or_none, struct grug_error* o_error);
@@ -13,3 +13,8 @@
 #ifndef GRUG_FREE
 	#define GRUG_FREE(_ptr, _len) ((void)(_len), free(_ptr))
 #endif
+
+#include <stddef.h>
+
+/// Grows an allocation made with GRUG_MALLOC, allocating it if `ptr` is null. Defined in grug_main.c
+void* grug_realloc(void* ptr, size_t old_len, size_t new_len);
@@ -0,0 +1,242 @@
+#include "grug_scan.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if !defined(GRUG_NO_SIMD) && defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+	#define GRUG_SCAN_X86 1
+	#include <immintrin.h>
+#else
+	#define GRUG_SCAN_X86 0
+#endif
+
+// MARK: scalar
+
+static inline bool is_word_char(char character) {
+	char lower = (char)(character | 0x20);
+	return (lower >= 'a' && lower <= 'z') || (character >= '0' && character <= '9') || character == '_';
+}
+
+static size_t scan_quote_or_newline_scalar(char const* src, size_t len) {
+	size_t index = 0;
+	while(index < len && src[index] != '"' && src[index] != '\n') {
+		index += 1;
+	}
+	return index;
+}
+
+static size_t scan_newline_scalar(char const* src, size_t len) {
+	size_t index = 0;
+	while(index < len && src[index] != '\n') {
+		index += 1;
+	}
+	return index;
+}
+
+static size_t scan_word_end_scalar(char const* src, size_t len) {
+	size_t index = 0;
+	while(index < len && is_word_char(src[index])) {
+		index += 1;
+	}
+	return index;
+}
+
+static size_t scan_spaces_scalar(char const* src, size_t len) {
+	size_t index = 0;
+	while(index < len && src[index] == ' ') {
+		index += 1;
+	}
+	return index;
+}
+
+#if GRUG_SCAN_X86
+
+// MARK: SSE2
+
+// SSE2 is part of the x86-64 baseline so these need no target attribute.
+// Each loop handles whole 16 byte chunks and leaves the tail to the scalar version.
+// Note that the byte compares are signed, which conveniently puts every non-ascii byte out of the word character ranges.
+
+static inline __m128i sse2_word_char_mask(__m128i chunk) {
+	__m128i lower = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+	__m128i is_alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+	__m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(chunk, _mm_set1_epi8('9' + 1)));
+	__m128i is_underscore = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_'));
+	return _mm_or_si128(_mm_or_si128(is_alpha, is_digit), is_underscore);
+}
+
+static size_t scan_quote_or_newline_sse2(char const* src, size_t len) {
+	size_t index = 0;
+	while(index + 16 <= len) {
+		__m128i chunk = _mm_loadu_si128((__m128i const*)(src + index));
+		__m128i hits = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')));
+		unsigned mask = (unsigned)_mm_movemask_epi8(hits);
+		if(mask) {
+			return index + (size_t)__builtin_ctz(mask);
+		}
+		index += 16;
+	}
+	return index + scan_quote_or_newline_scalar(src + index, len - index);
+}
+
+static size_t scan_newline_sse2(char const* src, size_t len) {
+	size_t index = 0;
+	while(index + 16 <= len) {
+		__m128i chunk = _mm_loadu_si128((__m128i const*)(src + index));
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')));
+		if(mask) {
+			return index + (size_t)__builtin_ctz(mask);
+		}
+		index += 16;
+	}
+	return index + scan_newline_scalar(src + index, len - index);
+}
+
+static size_t scan_word_end_sse2(char const* src, size_t len) {
+	size_t index = 0;
+	while(index + 16 <= len) {
+		__m128i chunk = _mm_loadu_si128((__m128i const*)(src + index));
+		unsigned mask = ~(unsigned)_mm_movemask_epi8(sse2_word_char_mask(chunk)) & 0xFFFFU;
+		if(mask) {
+			return index + (size_t)__builtin_ctz(mask);
+		}
+		index += 16;
+	}
+	return index + scan_word_end_scalar(src + index, len - index);
+}
+
+static size_t scan_spaces_sse2(char const* src, size_t len) {
+	size_t index = 0;
+	while(index + 16 <= len) {
+		__m128i chunk = _mm_loadu_si128((__m128i const*)(src + index));
+		unsigned mask = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' '))) & 0xFFFFU;
+		if(mask) {
+			return index + (size_t)__builtin_ctz(mask);
+		}
+		index += 16;
+	}
+	return index + scan_spaces_scalar(src + index, len - index);
+}
+
+// MARK: AVX2
+
+#define GRUG_AVX2 __attribute__((target("avx2")))
+
+GRUG_AVX2 static inline __m256i avx2_word_char_mask(__m256i chunk) {
+	__m256i lower = _mm256_or_si256(chunk, _mm256_set1_epi8(0x20));
+	__m256i is_alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+	__m256i is_digit = _mm256_and_si256(_mm256_cmpgt_epi8(chunk, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), chunk));
+	__m256i is_underscore = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('_'));
+	return _mm256_or_si256(_mm256_or_si256(is_alpha, is_digit), is_underscore);
+}
+
+GRUG_AVX2 static size_t scan_quote_or_newline_avx2(char const* src, size_t len) {
+	size_t index = 0;
+	while(index + 32 <= len) {
+		__m256i chunk = _mm256_loadu_si256((__m256i const*)(src + index));
+		__m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\n')));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(hits);
+		if(mask) {
+			return index + (size_t)__builtin_ctz(mask);
+		}
+		index += 32;
+	}
+	return index + scan_quote_or_newline_sse2(src + index, len - index);
+}
+
+GRUG_AVX2 static size_t scan_newline_avx2(char const* src, size_t len) {
+	size_t index = 0;
+	while(index + 32 <= len) {
+		__m256i chunk = _mm256_loadu_si256((__m256i const*)(src + index));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\n')));
+		if(mask) {
+			return index + (size_t)__builtin_ctz(mask);
+		}
+		index += 32;
+	}
+	return index + scan_newline_sse2(src + index, len - index);
+}
+
+GRUG_AVX2 static size_t scan_word_end_avx2(char const* src, size_t len) {
+	size_t index = 0;
+	while(index + 32 <= len) {
+		__m256i chunk = _mm256_loadu_si256((__m256i const*)(src + index));
+		unsigned mask = ~(unsigned)_mm256_movemask_epi8(avx2_word_char_mask(chunk));
+		if(mask) {
+			return index + (size_t)__builtin_ctz(mask);
+		}
+		index += 32;
+	}
+	return index + scan_word_end_sse2(src + index, len - index);
+}
+
+GRUG_AVX2 static size_t scan_spaces_avx2(char const* src, size_t len) {
+	size_t index = 0;
+	while(index + 32 <= len) {
+		__m256i chunk = _mm256_loadu_si256((__m256i const*)(src + index));
+		unsigned mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(' ')));
+		if(mask) {
+			return index + (size_t)__builtin_ctz(mask);
+		}
+		index += 32;
+	}
+	return index + scan_spaces_sse2(src + index, len - index);
+}
+
+#undef GRUG_AVX2
+
+// MARK: dispatch
+
+// __builtin_cpu_supports is a load and a bit test, which is cheaper than the indirect call a cached function pointer would need,
+// and it keeps the scanners free of any global mutable state.
+static inline bool cpu_has_avx2(void) {
+	return __builtin_cpu_supports("avx2");
+}
+
+size_t grug_scan_quote_or_newline(char const* src, size_t len) {
+	if(cpu_has_avx2()) {
+		return scan_quote_or_newline_avx2(src, len);
+	}
+	return scan_quote_or_newline_sse2(src, len);
+}
+
+size_t grug_scan_newline(char const* src, size_t len) {
+	if(cpu_has_avx2()) {
+		return scan_newline_avx2(src, len);
+	}
+	return scan_newline_sse2(src, len);
+}
+
+size_t grug_scan_word_end(char const* src, size_t len) {
+	if(cpu_has_avx2()) {
+		return scan_word_end_avx2(src, len);
+	}
+	return scan_word_end_sse2(src, len);
+}
+
+size_t grug_scan_spaces(char const* src, size_t len) {
+	if(cpu_has_avx2()) {
+		return scan_spaces_avx2(src, len);
+	}
+	return scan_spaces_sse2(src, len);
+}
+
+#else
+
+size_t grug_scan_quote_or_newline(char const* src, size_t len) {
+	return scan_quote_or_newline_scalar(src, len);
+}
+
+size_t grug_scan_newline(char const* src, size_t len) {
+	return scan_newline_scalar(src, len);
+}
+
+size_t grug_scan_word_end(char const* src, size_t len) {
+	return scan_word_end_scalar(src, len);
+}
+
+size_t grug_scan_spaces(char const* src, size_t len) {
+	return scan_spaces_scalar(src, len);
+}
+
+#endif
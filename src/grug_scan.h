@@ -0,0 +1,19 @@
+#pragma once
+
+// Bulk byte scanners used by the tokenizer.
+// Each one has an SSE2 and an AVX2 implementation on x86, selected at runtime, and a portable scalar fallback.
+// Define GRUG_NO_SIMD to always use the scalar versions.
+
+#include <stddef.h>
+
+/// Returns the index of the first '"' or '\n' in `src`, or `len` if there is neither
+size_t grug_scan_quote_or_newline(char const* src, size_t len);
+
+/// Returns the index of the first '\n' in `src`, or `len` if there is none
+size_t grug_scan_newline(char const* src, size_t len);
+
+/// Returns the index of the first character in `src` that can not continue a word ([A-Za-z0-9_]), or `len` if they all can
+size_t grug_scan_word_end(char const* src, size_t len);
+
+/// Returns the number of ' ' characters at the start of `src`
+size_t grug_scan_spaces(char const* src, size_t len);
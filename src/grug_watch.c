@@ -0,0 +1,693 @@
+#include "grug_watch.h"
+
+#include "grug_options.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#if defined(__linux__) && !defined(GRUG_NO_INOTIFY)
+	#define WATCH_INOTIFY
+	#include <sys/inotify.h>
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define WATCH_NONE UINT32_MAX
+
+// MARK: entries
+
+/// A file or directory that the watch has seen
+struct watch_entry {
+	/// Relative to the root, without a leading slash. The root itself is "".
+	char* path;
+	size_t path_len;
+	uint32_t hash;
+	bool is_dir;
+	/// Set for directories that walks go over
+	bool listed;
+	/// Set for files in the pending queue
+	bool pending;
+	/// Set for files that got reported, whose modification time and size are then what they were back then
+	bool reported;
+	/// The value of grug_watch.walks when a walk last came across the file
+	uint32_t walk;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t size;
+	/// The inotify watch of a listed directory, or -1
+	int wd;
+};
+
+struct grug_watch {
+	char* root;
+	size_t root_len;
+	/// Entries are never removed, so that a path that comes back gets its old entry
+	struct watch_entry* entries;
+	uint32_t entries_len;
+	uint32_t entries_capacity;
+	/// Open addressing over the entries, holding an entry's index + 1, or 0 if the slot is empty.
+	/// A power of two that is kept at least twice as big as entries_len.
+	uint32_t* table;
+	uint32_t table_capacity;
+	/// The entries of the directories that walks go over, in the order they were found
+	uint32_t* dirs;
+	uint32_t dirs_len;
+	uint32_t dirs_capacity;
+	/// Index into dirs of the next directory to walk.
+	/// When polling it goes back to 0 once a walk is done, but inotify only walks after starting, to find what new directories hold, and after losing events.
+	uint32_t walk_cursor;
+	/// Counts the walks that started at the root. Once one is done, the files that got reported but that it didn't come across are gone.
+	uint32_t walks;
+	/// Whether the walk that is going on started at the root, so it goes over the whole tree
+	bool walking_from_root;
+	/// The entries of changed or removed files, oldest first from pending_start
+	uint32_t* pending;
+	uint32_t pending_start;
+	uint32_t pending_len;
+	uint32_t pending_capacity;
+	/// Scratch space for the path handed to the OS
+	char* path_buffer;
+	size_t path_buffer_capacity;
+	/// Scratch space for the path of an entry being looked at by a walk
+	char* name_buffer;
+	size_t name_buffer_capacity;
+	/// -1 when polling
+	int inotify_fd;
+	/// Index into dirs of the directory the last inotify event was for, as events tend to come in runs
+	uint32_t last_event_dir;
+};
+
+static uint32_t hash_path(char const* path, size_t path_len) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for(size_t index = 0; index < path_len; index += 1) {
+		hash = (hash ^ (uint8_t)path[index]) * 16777619u;
+	}
+	return hash;
+}
+
+/// Grows `*buffer` to hold at least `capacity` bytes, returning false if that fails
+static bool reserve_buffer(char** buffer, size_t* buffer_capacity, size_t capacity) {
+	if(capacity <= *buffer_capacity) {
+		return true;
+	}
+	size_t new_capacity = *buffer_capacity ? *buffer_capacity : 256;
+	while(new_capacity < capacity) {
+		new_capacity *= 2;
+	}
+	char* new_buffer = grug_realloc(*buffer, *buffer_capacity, new_capacity);
+	if(!new_buffer) {
+		return false;
+	}
+	*buffer = new_buffer;
+	*buffer_capacity = new_capacity;
+	return true;
+}
+
+/// Grows an array of entry indices to hold one more, returning false if that fails
+static bool reserve_index(uint32_t** indices, uint32_t* indices_capacity, uint32_t indices_len) {
+	if(indices_len < *indices_capacity) {
+		return true;
+	}
+	uint32_t new_capacity = *indices_capacity ? *indices_capacity * 2 : 64;
+	uint32_t* new_indices = grug_realloc(*indices, *indices_capacity * sizeof(uint32_t), new_capacity * sizeof(uint32_t));
+	if(!new_indices) {
+		return false;
+	}
+	*indices = new_indices;
+	*indices_capacity = new_capacity;
+	return true;
+}
+
+static bool grow_table(struct grug_watch* watch) {
+	uint32_t new_capacity = watch->table_capacity ? watch->table_capacity * 2 : 128;
+	uint32_t* new_table = GRUG_MALLOC(new_capacity * sizeof(uint32_t));
+	if(!new_table) {
+		return false;
+	}
+	memset(new_table, 0, new_capacity * sizeof(uint32_t));
+	for(uint32_t entry_index = 0; entry_index < watch->entries_len; entry_index += 1) {
+		uint32_t slot = watch->entries[entry_index].hash & (new_capacity - 1);
+		while(new_table[slot]) {
+			slot = (slot + 1) & (new_capacity - 1);
+		}
+		new_table[slot] = entry_index + 1;
+	}
+	if(watch->table) {
+		GRUG_FREE(watch->table, watch->table_capacity * sizeof(uint32_t));
+	}
+	watch->table = new_table;
+	watch->table_capacity = new_capacity;
+	return true;
+}
+
+/// Returns the index of the entry of `path`, adding it if there is none, or WATCH_NONE if that fails
+static uint32_t entry_of(struct grug_watch* watch, char const* path, size_t path_len, bool is_dir) {
+	uint32_t hash = hash_path(path, path_len);
+	uint32_t slot = hash & (watch->table_capacity - 1);
+	for(; watch->table[slot]; slot = (slot + 1) & (watch->table_capacity - 1)) {
+		struct watch_entry const* entry = &watch->entries[watch->table[slot] - 1];
+		if(entry->hash == hash && entry->path_len == path_len && memcmp(entry->path, path, path_len) == 0) {
+			return watch->table[slot] - 1;
+		}
+	}
+	if(watch->entries_len == WATCH_NONE - 1) {
+		return WATCH_NONE;
+	}
+	if(watch->entries_len == watch->entries_capacity) {
+		uint32_t new_capacity = watch->entries_capacity ? watch->entries_capacity * 2 : 64;
+		struct watch_entry* new_entries = grug_realloc(watch->entries, watch->entries_capacity * sizeof(struct watch_entry), new_capacity * sizeof(struct watch_entry));
+		if(!new_entries) {
+			return WATCH_NONE;
+		}
+		watch->entries = new_entries;
+		watch->entries_capacity = new_capacity;
+	}
+	char* path_copy = GRUG_MALLOC(path_len + 1);
+	if(!path_copy) {
+		return WATCH_NONE;
+	}
+	memcpy(path_copy, path, path_len);
+	path_copy[path_len] = '\0';
+	uint32_t entry_index = watch->entries_len;
+	watch->entries[entry_index] = (struct watch_entry) {
+		.path = path_copy,
+		.path_len = path_len,
+		.hash = hash,
+		.is_dir = is_dir,
+		.wd = -1,
+	};
+	watch->entries_len += 1;
+	watch->table[slot] = entry_index + 1;
+	if(watch->entries_len * 2 > watch->table_capacity && !grow_table(watch)) {
+		// The table still has room for this entry, it just can't take more
+		watch->entries_len -= 1;
+		watch->table[slot] = 0;
+		GRUG_FREE(path_copy, path_len + 1);
+		return WATCH_NONE;
+	}
+	return entry_index;
+}
+
+/// Returns the path of an entry the way the OS can find it, which stays valid until the next call
+static char const* os_path(struct grug_watch* watch, char const* path, size_t path_len) {
+	if(!watch->root_len) {
+		return path_len ? path : ".";
+	}
+	if(!reserve_buffer(&watch->path_buffer, &watch->path_buffer_capacity, watch->root_len + 1 + path_len + 1)) {
+		return NULL;
+	}
+	memcpy(watch->path_buffer, watch->root, watch->root_len);
+	size_t len = watch->root_len;
+	if(path_len) {
+		watch->path_buffer[len++] = '/';
+		memcpy(watch->path_buffer + len, path, path_len);
+		len += path_len;
+	}
+	watch->path_buffer[len] = '\0';
+	return watch->path_buffer;
+}
+
+static bool is_grug_file_name(char const* name, size_t name_len) {
+	return name_len > 5 && memcmp(name + name_len - 5, ".grug", 5) == 0;
+}
+
+static void mark_pending(struct grug_watch* watch, uint32_t entry_index) {
+	if(watch->entries[entry_index].pending) {
+		return;
+	}
+	if(watch->pending_start && watch->pending_len == watch->pending_capacity) {
+		// Reuses the room of the files that got reported, which is all of it when the queue is empty
+		memmove(watch->pending, watch->pending + watch->pending_start, (watch->pending_len - watch->pending_start) * sizeof(uint32_t));
+		watch->pending_len -= watch->pending_start;
+		watch->pending_start = 0;
+	}
+	if(!reserve_index(&watch->pending, &watch->pending_capacity, watch->pending_len)) {
+		// Forgetting that it was reported makes the next walk treat it as new
+		watch->entries[entry_index].reported = false;
+		return;
+	}
+	watch->pending[watch->pending_len++] = entry_index;
+	watch->entries[entry_index].pending = true;
+}
+
+/// Marks the files that got reported and are in the directory at `path`, or in the directories in it, as pending
+static void mark_pending_under(struct grug_watch* watch, char const* path, size_t path_len) {
+	for(uint32_t entry_index = 0; entry_index < watch->entries_len; entry_index += 1) {
+		struct watch_entry const* entry = &watch->entries[entry_index];
+		if(!entry->is_dir && entry->reported && entry->path_len > path_len && entry->path[path_len] == '/' && memcmp(entry->path, path, path_len) == 0) {
+			mark_pending(watch, entry_index);
+		}
+	}
+}
+
+/// Marks the files that got reported but that the walk that just went over the whole tree didn't come across as pending,
+/// which reports them as removed
+static void mark_unwalked_files(struct grug_watch* watch) {
+	for(uint32_t entry_index = 0; entry_index < watch->entries_len; entry_index += 1) {
+		struct watch_entry const* entry = &watch->entries[entry_index];
+		if(!entry->is_dir && entry->reported && entry->walk != watch->walks) {
+			mark_pending(watch, entry_index);
+		}
+	}
+}
+
+// MARK: inotify
+
+#ifdef WATCH_INOTIFY
+
+#define WATCH_INOTIFY_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVE_SELF | IN_ONLYDIR)
+
+/// Falls back to polling, which has to walk the whole tree to notice what changed from now on
+static void stop_inotify(struct grug_watch* watch) {
+	close(watch->inotify_fd);
+	watch->inotify_fd = -1;
+	for(uint32_t dir_index = 0; dir_index < watch->dirs_len; dir_index += 1) {
+		watch->entries[watch->dirs[dir_index]].wd = -1;
+	}
+	watch->walk_cursor = 0;
+}
+
+static void add_inotify_watch(struct grug_watch* watch, uint32_t entry_index) {
+	if(watch->inotify_fd < 0) {
+		return;
+	}
+	struct watch_entry* entry = &watch->entries[entry_index];
+	char const* path = os_path(watch, entry->path, entry->path_len);
+	int wd = path ? inotify_add_watch(watch->inotify_fd, path, WATCH_INOTIFY_MASK) : -1;
+	if(wd >= 0) {
+		entry->wd = wd;
+	} else if(!path || (errno != ENOENT && errno != ENOTDIR)) {
+		// Most likely max_user_watches was reached, and a tree that is only partly watched would miss changes
+		stop_inotify(watch);
+	}
+}
+
+static void remove_inotify_watch(struct grug_watch* watch, uint32_t entry_index) {
+	struct watch_entry* entry = &watch->entries[entry_index];
+	if(watch->inotify_fd >= 0 && entry->wd >= 0) {
+		(void)inotify_rm_watch(watch->inotify_fd, entry->wd);
+	}
+	entry->wd = -1;
+}
+
+#else
+
+static void add_inotify_watch(struct grug_watch* watch, uint32_t entry_index) {
+	(void)watch;
+	(void)entry_index;
+}
+
+static void remove_inotify_watch(struct grug_watch* watch, uint32_t entry_index) {
+	(void)watch;
+	(void)entry_index;
+}
+
+#endif
+
+// MARK: walking
+
+static void list_dir(struct grug_watch* watch, uint32_t entry_index) {
+	if(watch->entries[entry_index].listed || !reserve_index(&watch->dirs, &watch->dirs_capacity, watch->dirs_len)) {
+		return;
+	}
+	watch->dirs[watch->dirs_len++] = entry_index;
+	watch->entries[entry_index].listed = true;
+	add_inotify_watch(watch, entry_index);
+}
+
+static void unlist_dir(struct grug_watch* watch, uint32_t dir_index) {
+	uint32_t entry_index = watch->dirs[dir_index];
+	remove_inotify_watch(watch, entry_index);
+	watch->entries[entry_index].listed = false;
+	memmove(watch->dirs + dir_index, watch->dirs + dir_index + 1, (watch->dirs_len - dir_index - 1) * sizeof(uint32_t));
+	watch->dirs_len -= 1;
+	if(dir_index < watch->walk_cursor) {
+		watch->walk_cursor -= 1;
+	}
+	watch->last_event_dir = 0;
+}
+
+/// Returns whether the file of an entry that was reported before got changed, updating what it remembers of it
+static bool file_changed(struct grug_watch* watch, uint32_t entry_index, bool* out_exists) {
+	struct watch_entry* entry = &watch->entries[entry_index];
+	char const* path = os_path(watch, entry->path, entry->path_len);
+	struct stat file_stat;
+	*out_exists = path && stat(path, &file_stat) == 0 && S_ISREG(file_stat.st_mode);
+	if(!*out_exists) {
+		return false;
+	}
+#ifdef __APPLE__
+	int64_t mtime_sec = (int64_t)file_stat.st_mtimespec.tv_sec;
+	int64_t mtime_nsec = (int64_t)file_stat.st_mtimespec.tv_nsec;
+#else
+	int64_t mtime_sec = (int64_t)file_stat.st_mtim.tv_sec;
+	int64_t mtime_nsec = (int64_t)file_stat.st_mtim.tv_nsec;
+#endif
+	bool changed = !entry->reported || entry->mtime_sec != mtime_sec || entry->mtime_nsec != mtime_nsec || entry->size != (int64_t)file_stat.st_size;
+	entry->mtime_sec = mtime_sec;
+	entry->mtime_nsec = mtime_nsec;
+	entry->size = (int64_t)file_stat.st_size;
+	return changed;
+}
+
+/// Looks at every entry of the directory at dirs[dir_index], listing new directories and marking new and changed files as pending.
+/// Returns the number of entries looked at.
+static size_t walk_dir(struct grug_watch* watch, uint32_t dir_index) {
+	uint32_t dir_entry = watch->dirs[dir_index];
+	char const* dir_path = os_path(watch, watch->entries[dir_entry].path, watch->entries[dir_entry].path_len);
+	DIR* dir = dir_path ? opendir(dir_path) : NULL;
+	if(!dir) {
+		// The root is kept, so that polling finds it once it gets created
+		if(dir_path && dir_entry != 0) {
+			unlist_dir(watch, dir_index);
+		}
+		return 1;
+	}
+	size_t looked_at = 0;
+	struct dirent* dirent;
+	while((dirent = readdir(dir))) {
+		// Hidden entries are skipped, which also skips "." and ".." and the swap files of editors
+		if(dirent->d_name[0] == '.') {
+			continue;
+		}
+		looked_at += 1;
+		struct watch_entry const* parent = &watch->entries[dir_entry];
+		size_t name_len = strlen(dirent->d_name);
+		size_t path_len = parent->path_len ? parent->path_len + 1 + name_len : name_len;
+		if(!reserve_buffer(&watch->name_buffer, &watch->name_buffer_capacity, path_len + 1)) {
+			continue;
+		}
+		if(parent->path_len) {
+			memcpy(watch->name_buffer, parent->path, parent->path_len);
+			watch->name_buffer[parent->path_len] = '/';
+		}
+		memcpy(watch->name_buffer + path_len - name_len, dirent->d_name, name_len + 1);
+		bool is_dir = false;
+		bool is_file = false;
+#ifdef _DIRENT_HAVE_D_TYPE
+		is_dir = dirent->d_type == DT_DIR;
+		is_file = dirent->d_type == DT_REG;
+		if(dirent->d_type == DT_UNKNOWN || dirent->d_type == DT_LNK)
+#endif
+		{
+			// Symbolic links to directories aren't followed, so a link can't make the tree endless
+			struct stat entry_stat;
+			char const* path = os_path(watch, watch->name_buffer, path_len);
+			if(path && lstat(path, &entry_stat) == 0) {
+				is_dir = S_ISDIR(entry_stat.st_mode);
+				is_file = S_ISREG(entry_stat.st_mode) || (S_ISLNK(entry_stat.st_mode) && stat(path, &entry_stat) == 0 && S_ISREG(entry_stat.st_mode));
+			}
+		}
+		if(is_dir) {
+			uint32_t entry_index = entry_of(watch, watch->name_buffer, path_len, true);
+			if(entry_index != WATCH_NONE) {
+				list_dir(watch, entry_index);
+			}
+		} else if(is_file && is_grug_file_name(dirent->d_name, name_len)) {
+			uint32_t entry_index = entry_of(watch, watch->name_buffer, path_len, false);
+			if(entry_index == WATCH_NONE) {
+				continue;
+			}
+			watch->entries[entry_index].walk = watch->walks;
+			if(watch->entries[entry_index].pending) {
+				continue;
+			}
+			// Files that were never reported don't need to be stat'ed yet, as reporting them does that
+			bool exists = true;
+			if(!watch->entries[entry_index].reported || file_changed(watch, entry_index, &exists)) {
+				mark_pending(watch, entry_index);
+			}
+		}
+	}
+	closedir(dir);
+	return looked_at;
+}
+
+#ifdef WATCH_INOTIFY
+
+/// Returns the index into dirs of the directory with the inotify watch `wd`, or WATCH_NONE
+static uint32_t dir_of_wd(struct grug_watch* watch, int wd) {
+	if(watch->last_event_dir < watch->dirs_len && watch->entries[watch->dirs[watch->last_event_dir]].wd == wd) {
+		return watch->last_event_dir;
+	}
+	for(uint32_t dir_index = 0; dir_index < watch->dirs_len; dir_index += 1) {
+		if(watch->entries[watch->dirs[dir_index]].wd == wd) {
+			watch->last_event_dir = dir_index;
+			return dir_index;
+		}
+	}
+	return WATCH_NONE;
+}
+
+static void handle_event(struct grug_watch* watch, struct inotify_event const* event) {
+	if(event->mask & IN_Q_OVERFLOW) {
+		// Events got lost, so only a walk can tell what changed
+		watch->walk_cursor = 0;
+		return;
+	}
+	uint32_t dir_index = dir_of_wd(watch, event->wd);
+	if(dir_index == WATCH_NONE) {
+		return;
+	}
+	uint32_t dir_entry = watch->dirs[dir_index];
+	if(event->mask & IN_IGNORED) {
+		// The directory was deleted, or its watch was removed below
+		watch->entries[dir_entry].wd = -1;
+		unlist_dir(watch, dir_index);
+		return;
+	}
+	if(event->mask & IN_MOVE_SELF) {
+		// Its path and those of the directories in it are stale, so they are found again under their new paths
+		// by the event of the directory it was moved into
+		struct watch_entry* moved = &watch->entries[dir_entry];
+		size_t moved_len = moved->path_len;
+		for(uint32_t index = 0; index < watch->dirs_len; index += 1) {
+			if(index != dir_index && watch->entries[watch->dirs[index]].wd == moved->wd) {
+				// It was moved inside the tree, and its new path got listed already, which inotify gave the same watch
+				moved->wd = -1;
+				break;
+			}
+		}
+		for(uint32_t index = watch->dirs_len; index > 0; index -= 1) {
+			struct watch_entry const* dir = &watch->entries[watch->dirs[index - 1]];
+			if(index - 1 == dir_index || (dir->path_len > moved_len && dir->path[moved_len] == '/' && memcmp(dir->path, moved->path, moved_len) == 0)) {
+				unlist_dir(watch, index - 1);
+			}
+		}
+		return;
+	}
+	if(!event->len) {
+		return;
+	}
+	struct watch_entry const* parent = &watch->entries[dir_entry];
+	size_t name_len = strlen(event->name);
+	size_t path_len = parent->path_len ? parent->path_len + 1 + name_len : name_len;
+	if(event->name[0] == '.' || !reserve_buffer(&watch->name_buffer, &watch->name_buffer_capacity, path_len + 1)) {
+		return;
+	}
+	if(parent->path_len) {
+		memcpy(watch->name_buffer, parent->path, parent->path_len);
+		watch->name_buffer[parent->path_len] = '/';
+	}
+	memcpy(watch->name_buffer + path_len - name_len, event->name, name_len + 1);
+	if(event->mask & IN_ISDIR) {
+		if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+			uint32_t entry_index = entry_of(watch, watch->name_buffer, path_len, true);
+			if(entry_index != WATCH_NONE && !watch->entries[entry_index].listed) {
+				// Listing it appends it to dirs, so the next walk picks it up to find what it already holds
+				list_dir(watch, entry_index);
+			}
+		} else if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			// The files in a directory that is moved away get no events of their own
+			mark_pending_under(watch, watch->name_buffer, path_len);
+		}
+	} else if(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM) && is_grug_file_name(event->name, name_len)) {
+		uint32_t entry_index = entry_of(watch, watch->name_buffer, path_len, false);
+		if(entry_index != WATCH_NONE) {
+			mark_pending(watch, entry_index);
+		}
+	}
+}
+
+static void read_events(struct grug_watch* watch) {
+	union {
+		struct inotify_event event;
+		char bytes[4096];
+	} buffer;
+	while(watch->inotify_fd >= 0) {
+		ssize_t read_len = read(watch->inotify_fd, buffer.bytes, sizeof(buffer.bytes));
+		if(read_len <= 0) {
+			// EAGAIN once every event has been read
+			return;
+		}
+		for(size_t offset = 0; offset < (size_t)read_len;) {
+			struct inotify_event const* event = (struct inotify_event const*)(void*)(buffer.bytes + offset);
+			handle_event(watch, event);
+			offset += sizeof(struct inotify_event) + event->len;
+		}
+	}
+}
+
+#endif
+
+// MARK: API
+
+struct grug_watch* grug_watch_new(char const* root) {
+	struct grug_watch* watch = GRUG_MALLOC(sizeof(struct grug_watch));
+	if(!watch) {
+		return NULL;
+	}
+	*watch = (struct grug_watch) {
+		.root_len = strlen(root),
+		.inotify_fd = -1,
+	};
+	// A trailing slash would double up when paths get joined
+	while(watch->root_len > 1 && root[watch->root_len - 1] == '/') {
+		watch->root_len -= 1;
+	}
+	watch->root = GRUG_MALLOC(watch->root_len + 1);
+	if(!watch->root || !grow_table(watch)) {
+		grug_watch_free(watch);
+		return NULL;
+	}
+	memcpy(watch->root, root, watch->root_len);
+	watch->root[watch->root_len] = '\0';
+#ifdef WATCH_INOTIFY
+	watch->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+	// The root is always entries[0] and dirs[0]
+	uint32_t root_entry = entry_of(watch, "", 0, true);
+	if(root_entry == WATCH_NONE) {
+		grug_watch_free(watch);
+		return NULL;
+	}
+	list_dir(watch, root_entry);
+	if(!watch->dirs_len) {
+		grug_watch_free(watch);
+		return NULL;
+	}
+	return watch;
+}
+
+void grug_watch_free(struct grug_watch* watch) {
+	if(!watch) {
+		return;
+	}
+#ifdef WATCH_INOTIFY
+	if(watch->inotify_fd >= 0) {
+		close(watch->inotify_fd);
+	}
+#endif
+	for(uint32_t entry_index = 0; entry_index < watch->entries_len; entry_index += 1) {
+		GRUG_FREE(watch->entries[entry_index].path, watch->entries[entry_index].path_len + 1);
+	}
+	if(watch->entries) {
+		GRUG_FREE(watch->entries, watch->entries_capacity * sizeof(struct watch_entry));
+	}
+	if(watch->table) {
+		GRUG_FREE(watch->table, watch->table_capacity * sizeof(uint32_t));
+	}
+	if(watch->dirs) {
+		GRUG_FREE(watch->dirs, watch->dirs_capacity * sizeof(uint32_t));
+	}
+	if(watch->pending) {
+		GRUG_FREE(watch->pending, watch->pending_capacity * sizeof(uint32_t));
+	}
+	if(watch->path_buffer) {
+		GRUG_FREE(watch->path_buffer, watch->path_buffer_capacity);
+	}
+	if(watch->name_buffer) {
+		GRUG_FREE(watch->name_buffer, watch->name_buffer_capacity);
+	}
+	if(watch->root) {
+		GRUG_FREE(watch->root, watch->root_len + 1);
+	}
+	GRUG_FREE(watch, sizeof(struct grug_watch));
+}
+
+size_t grug_watch_changes(struct grug_watch* watch, size_t budget, grug_watch_fn fn, void* user_data) {
+#ifdef WATCH_INOTIFY
+	if(watch->inotify_fd >= 0 && watch->entries[0].wd < 0) {
+		// The root didn't exist yet
+		add_inotify_watch(watch, 0);
+		watch->walk_cursor = watch->entries[0].wd < 0 ? watch->dirs_len : 0;
+	}
+	read_events(watch);
+#endif
+	if(watch->inotify_fd < 0 && watch->walk_cursor == watch->dirs_len) {
+		// Polling starts the next walk over the tree
+		watch->walk_cursor = 0;
+	}
+	// At least one directory gets walked, so a directory with more entries than the budget still gets done
+	size_t looked_at = 0;
+	while(watch->walk_cursor < watch->dirs_len && (!budget || looked_at < budget)) {
+		uint32_t dir_index = watch->walk_cursor;
+		if(dir_index == 0) {
+			watch->walks += 1;
+			watch->walking_from_root = true;
+		}
+		watch->walk_cursor += 1;
+		looked_at += walk_dir(watch, dir_index);
+	}
+	if(watch->walking_from_root && watch->walk_cursor == watch->dirs_len) {
+		watch->walking_from_root = false;
+		mark_unwalked_files(watch);
+	}
+	size_t reported = 0;
+	while(watch->pending_start < watch->pending_len && (!budget || reported < budget)) {
+		uint32_t entry_index = watch->pending[watch->pending_start++];
+		watch->entries[entry_index].pending = false;
+		// Notified files are reported even if their modification time didn't change, as it only has the resolution of the file system
+		bool exists;
+		(void)file_changed(watch, entry_index, &exists);
+		if(!exists) {
+			// It is new if it comes back
+			bool was_reported = watch->entries[entry_index].reported;
+			watch->entries[entry_index].reported = false;
+			if(was_reported) {
+				fn(user_data, watch->entries[entry_index].path, true);
+				reported += 1;
+			}
+			continue;
+		}
+		watch->entries[entry_index].reported = true;
+		fn(user_data, watch->entries[entry_index].path, false);
+		reported += 1;
+	}
+	return reported;
+}
+
+bool grug_watch_notified(struct grug_watch const* watch) {
+	return watch->inotify_fd >= 0;
+}
+
+#else
+
+struct grug_watch* grug_watch_new(char const* root) {
+	(void)root;
+	return NULL;
+}
+
+void grug_watch_free(struct grug_watch* watch) {
+	(void)watch;
+}
+
+size_t grug_watch_changes(struct grug_watch* watch, size_t budget, grug_watch_fn fn, void* user_data) {
+	(void)watch;
+	(void)budget;
+	(void)fn;
+	(void)user_data;
+	return 0;
+}
+
+bool grug_watch_notified(struct grug_watch const* watch) {
+	(void)watch;
+	return false;
+}
+
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+// Finds the .grug files under a directory that were created, changed or removed since it was last asked.
+// On Linux every directory of the tree gets an inotify watch, so asking costs a single read() when nothing changed,
+// and only the files that events name get stat'ed. Elsewhere, or if inotify runs out of watches, the tree is polled:
+// every call continues a walk that stats the files and compares their modification times.
+// Define GRUG_NO_INOTIFY to always poll.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct grug_watch;
+
+/// Gets the path of a created or changed file, relative to the root of the watch.
+/// `removed` is set instead if the file got reported before, and has since been deleted or moved away.
+typedef void (*grug_watch_fn)(void* user_data, char const* path, bool removed);
+
+/// Watches the directory tree at `root`, where "" is the working directory. The directory doesn't have to exist yet.
+/// Returns NULL if it couldn't be allocated, or if the platform can't list directories.
+struct grug_watch* grug_watch_new(char const* root);
+
+/// `watch` may be NULL
+void grug_watch_free(struct grug_watch* watch);
+
+/// Calls `fn` for every file that was created or changed since the last call, which is every file on the first call,
+/// and for every file it reported before that was deleted or moved away since.
+/// A budget other than 0 bounds how many files get reported, and how many directory entries get looked at while walking the tree.
+/// What is over budget is left for the next call. Returns the number of files reported.
+size_t grug_watch_changes(struct grug_watch* watch, size_t budget, grug_watch_fn fn, void* user_data);
+
+/// Whether the watch gets told about changes by the OS, rather than polling
+bool grug_watch_notified(struct grug_watch const* watch);
@@ -0,0 +1,330 @@
+#include "grug_workers.h"
+
+#include "grug_options.h"
+
+#if !defined(GRUG_NO_THREADS) && (defined(__unix__) || defined(__APPLE__))
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+/// A power of two. Splitting halves a range every push, so 64 is enough for any range that fits in 32 bits.
+#define WORKERS_DEQUE_CAPACITY 64
+#define WORKERS_CACHE_LINE 64
+
+// MARK: deque
+
+/// A Chase-Lev deque of ranges, packed as start << 32 | end.
+/// Its owner pushes and takes at the bottom, and other workers steal from the top.
+struct workers_deque {
+	int64_t top;
+	char top_padding[WORKERS_CACHE_LINE - sizeof(int64_t)];
+	int64_t bottom;
+	char bottom_padding[WORKERS_CACHE_LINE - sizeof(int64_t)];
+	uint64_t tasks[WORKERS_DEQUE_CAPACITY];
+};
+
+static inline uint64_t pack_range(size_t start, size_t end) {
+	return (uint64_t)start << 32 | (uint64_t)end;
+}
+
+/// Only the owner may push, and returns false if the deque is full
+static bool deque_push(struct workers_deque* deque, uint64_t task) {
+	int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+	int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	if(bottom - top >= WORKERS_DEQUE_CAPACITY) {
+		return false;
+	}
+	__atomic_store_n(&deque->tasks[bottom & (WORKERS_DEQUE_CAPACITY - 1)], task, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+/// Only the owner may take, which races thieves for the last task
+static bool deque_take(struct workers_deque* deque, uint64_t* out_task) {
+	int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+	if(top > bottom) {
+		__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+		return false;
+	}
+	*out_task = __atomic_load_n(&deque->tasks[bottom & (WORKERS_DEQUE_CAPACITY - 1)], __ATOMIC_RELAXED);
+	if(top < bottom) {
+		return true;
+	}
+	bool won = __atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+	__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+	return won;
+}
+
+static bool deque_steal(struct workers_deque* deque, uint64_t* out_task) {
+	int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+	if(top >= bottom) {
+		return false;
+	}
+	uint64_t task = __atomic_load_n(&deque->tasks[top & (WORKERS_DEQUE_CAPACITY - 1)], __ATOMIC_RELAXED);
+	if(!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		return false;
+	}
+	*out_task = task;
+	return true;
+}
+
+// MARK: pool
+
+struct grug_workers {
+	pthread_t* threads;
+	uint32_t threads_len;
+	uint32_t threads_capacity;
+	/// One per worker, where the calling thread's is the first
+	struct workers_deque* deques;
+	pthread_mutex_t lock;
+	pthread_cond_t job_started;
+	pthread_cond_t job_done;
+	/// Serializes the game callbacks of grug_workers_lock
+	pthread_mutex_t callback_lock;
+	/// Whether the locks and conditions above have been initialized
+	bool initialized;
+	/// Bumped for every job, so a thread can tell a new job from a spurious wakeup
+	uint64_t job_generation;
+	/// The threads that are still working on the current job
+	uint32_t threads_running;
+	bool stopping;
+
+	grug_workers_fn fn;
+	void* job;
+	size_t grain;
+	/// The items of the current job that haven't run yet
+	size_t items_left;
+};
+
+/// The part of a worker thread that grug_workers_new hands it
+struct workers_thread_start {
+	struct grug_workers* workers;
+	uint32_t worker;
+};
+
+static bool take_or_steal(struct grug_workers* workers, uint32_t worker, uint64_t* out_task) {
+	if(deque_take(&workers->deques[worker], out_task)) {
+		return true;
+	}
+	uint32_t workers_len = workers->threads_len + 1;
+	for(uint32_t offset = 1; offset < workers_len; offset += 1) {
+		if(deque_steal(&workers->deques[(worker + offset) % workers_len], out_task)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/// Works on the current job until every item of it has run, including the ones other workers are still running
+static void work(struct grug_workers* workers, uint32_t worker) {
+	struct workers_deque* deque = &workers->deques[worker];
+	for(;;) {
+		uint64_t task;
+		if(!take_or_steal(workers, worker, &task)) {
+			if(__atomic_load_n(&workers->items_left, __ATOMIC_ACQUIRE) == 0) {
+				return;
+			}
+			sched_yield();
+			continue;
+		}
+		size_t start = (size_t)(task >> 32);
+		size_t end = (size_t)(task & UINT32_MAX);
+		// The upper halves are left for thieves, and come back to this worker in reverse order if nobody steals them
+		while(end - start > workers->grain) {
+			size_t middle = start + (end - start) / 2;
+			if(!deque_push(deque, pack_range(middle, end))) {
+				break;
+			}
+			end = middle;
+		}
+		workers->fn(workers->job, worker, start, end);
+		__atomic_sub_fetch(&workers->items_left, end - start, __ATOMIC_RELEASE);
+	}
+}
+
+static void* worker_thread(void* data) {
+	struct workers_thread_start start = *(struct workers_thread_start*)data;
+	GRUG_FREE(data, sizeof(struct workers_thread_start));
+	struct grug_workers* workers = start.workers;
+	uint64_t seen_generation = 0;
+	pthread_mutex_lock(&workers->lock);
+	for(;;) {
+		while(workers->job_generation == seen_generation && !workers->stopping) {
+			pthread_cond_wait(&workers->job_started, &workers->lock);
+		}
+		if(workers->stopping) {
+			break;
+		}
+		seen_generation = workers->job_generation;
+		pthread_mutex_unlock(&workers->lock);
+
+		work(workers, start.worker);
+
+		pthread_mutex_lock(&workers->lock);
+		workers->threads_running -= 1;
+		if(workers->threads_running == 0) {
+			pthread_cond_signal(&workers->job_done);
+		}
+	}
+	pthread_mutex_unlock(&workers->lock);
+	return NULL;
+}
+
+struct grug_workers* grug_workers_new(uint32_t threads) {
+	if(threads == 0) {
+		return NULL;
+	}
+	struct grug_workers* workers = GRUG_MALLOC(sizeof(struct grug_workers));
+	if(!workers) {
+		return NULL;
+	}
+	*workers = (struct grug_workers) {.threads_capacity = threads};
+	workers->threads = GRUG_MALLOC(threads * sizeof(pthread_t));
+	workers->deques = GRUG_MALLOC((threads + 1) * sizeof(struct workers_deque));
+	if(!workers->threads || !workers->deques) {
+		grug_workers_free(workers);
+		return NULL;
+	}
+	memset(workers->deques, 0, (threads + 1) * sizeof(struct workers_deque));
+	pthread_mutex_init(&workers->lock, NULL);
+	// A runtime error handler may call back into grug, which can end up calling the handler again
+	pthread_mutexattr_t callback_lock_attributes;
+	pthread_mutexattr_init(&callback_lock_attributes);
+	pthread_mutexattr_settype(&callback_lock_attributes, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&workers->callback_lock, &callback_lock_attributes);
+	pthread_mutexattr_destroy(&callback_lock_attributes);
+	pthread_cond_init(&workers->job_started, NULL);
+	pthread_cond_init(&workers->job_done, NULL);
+	workers->initialized = true;
+	for(uint32_t thread_index = 0; thread_index < threads; thread_index += 1) {
+		struct workers_thread_start* start = GRUG_MALLOC(sizeof(struct workers_thread_start));
+		if(!start) {
+			grug_workers_free(workers);
+			return NULL;
+		}
+		*start = (struct workers_thread_start) {.workers = workers, .worker = thread_index + 1};
+		if(pthread_create(&workers->threads[thread_index], NULL, worker_thread, start) != 0) {
+			GRUG_FREE(start, sizeof(struct workers_thread_start));
+			grug_workers_free(workers);
+			return NULL;
+		}
+		workers->threads_len += 1;
+	}
+	return workers;
+}
+
+void grug_workers_free(struct grug_workers* workers) {
+	if(!workers) {
+		return;
+	}
+	if(workers->initialized) {
+		pthread_mutex_lock(&workers->lock);
+		workers->stopping = true;
+		pthread_cond_broadcast(&workers->job_started);
+		pthread_mutex_unlock(&workers->lock);
+		for(uint32_t thread_index = 0; thread_index < workers->threads_len; thread_index += 1) {
+			pthread_join(workers->threads[thread_index], NULL);
+		}
+		pthread_cond_destroy(&workers->job_done);
+		pthread_cond_destroy(&workers->job_started);
+		pthread_mutex_destroy(&workers->callback_lock);
+		pthread_mutex_destroy(&workers->lock);
+	}
+	if(workers->threads) {
+		GRUG_FREE(workers->threads, workers->threads_capacity * sizeof(pthread_t));
+	}
+	if(workers->deques) {
+		GRUG_FREE(workers->deques, (workers->threads_capacity + 1) * sizeof(struct workers_deque));
+	}
+	GRUG_FREE(workers, sizeof(struct grug_workers));
+}
+
+uint32_t grug_workers_count(struct grug_workers const* workers) {
+	return workers->threads_len + 1;
+}
+
+void grug_workers_run(struct grug_workers* workers, size_t count, size_t grain, grug_workers_fn fn, void* job) {
+	// Ranges are packed in 32 bits a side
+	assert(count <= UINT32_MAX);
+	uint32_t workers_len = workers->threads_len + 1;
+	pthread_mutex_lock(&workers->lock);
+	workers->fn = fn;
+	workers->job = job;
+	workers->grain = grain ? grain : 1;
+	workers->items_left = count;
+	// Every worker starts with an equal share, and the threads only look at the deques once the lock is released
+	for(uint32_t worker = 0; worker < workers_len; worker += 1) {
+		struct workers_deque* deque = &workers->deques[worker];
+		deque->top = 0;
+		deque->bottom = 0;
+		size_t start = count * worker / workers_len;
+		size_t end = count * (worker + 1) / workers_len;
+		if(start < end) {
+			deque->tasks[0] = pack_range(start, end);
+			deque->bottom = 1;
+		}
+	}
+	workers->threads_running = workers->threads_len;
+	workers->job_generation += 1;
+	pthread_cond_broadcast(&workers->job_started);
+	pthread_mutex_unlock(&workers->lock);
+
+	work(workers, 0);
+
+	// The threads may still be looking at the deques, which the next job resets
+	pthread_mutex_lock(&workers->lock);
+	while(workers->threads_running) {
+		pthread_cond_wait(&workers->job_done, &workers->lock);
+	}
+	pthread_mutex_unlock(&workers->lock);
+}
+
+void grug_workers_lock(struct grug_workers* workers) {
+	pthread_mutex_lock(&workers->callback_lock);
+}
+
+void grug_workers_unlock(struct grug_workers* workers) {
+	pthread_mutex_unlock(&workers->callback_lock);
+}
+
+#else
+
+struct grug_workers* grug_workers_new(uint32_t threads) {
+	(void)threads;
+	return NULL;
+}
+
+void grug_workers_free(struct grug_workers* workers) {
+	(void)workers;
+}
+
+uint32_t grug_workers_count(struct grug_workers const* workers) {
+	(void)workers;
+	return 1;
+}
+
+void grug_workers_run(struct grug_workers* workers, size_t count, size_t grain, grug_workers_fn fn, void* job) {
+	(void)workers;
+	(void)grain;
+	if(count) {
+		fn(job, 0, 0, count);
+	}
+}
+
+void grug_workers_lock(struct grug_workers* workers) {
+	(void)workers;
+}
+
+void grug_workers_unlock(struct grug_workers* workers) {
+	(void)workers;
+}
+
+#endif
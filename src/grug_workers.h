@@ -0,0 +1,33 @@
+#pragma once
+
+// A pool of threads that spreads a range of items over itself with work stealing.
+// Every worker owns a deque of ranges. It splits the range it is working on in halves, pushing the upper half for others to steal,
+// and steals the oldest (so largest) range of another worker once its own deque runs dry.
+// Define GRUG_NO_THREADS to leave threads out, in which case grug_workers_new always returns NULL.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct grug_workers;
+
+/// Runs the items in [start, end) of a job. `worker` is 0 on the thread that called grug_workers_run, and 1 up to the worker count on the others.
+typedef void (*grug_workers_fn)(void* job, uint32_t worker, size_t start, size_t end);
+
+/// Starts `threads` threads, which wait until grug_workers_run hands them a job.
+/// Returns NULL if threads aren't supported or couldn't be started.
+struct grug_workers* grug_workers_new(uint32_t threads);
+
+/// Stops and joins the threads. `workers` may be NULL.
+void grug_workers_free(struct grug_workers* workers);
+
+/// The number of workers, counting the thread that calls grug_workers_run
+uint32_t grug_workers_count(struct grug_workers const* workers);
+
+/// Runs `fn` over the items in [0, count), in ranges of at most `grain` items, on every worker including the calling thread.
+/// Returns once every item has run. Only one thread may run a job at a time.
+void grug_workers_run(struct grug_workers* workers, size_t count, size_t grain, grug_workers_fn fn, void* job);
+
+/// Serializes callbacks that workers make into the game, like the runtime error handler. The lock is recursive.
+void grug_workers_lock(struct grug_workers* workers);
+void grug_workers_unlock(struct grug_workers* workers);
@@ -0,0 +1,165 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <grug_main.h>
+
+// Tokenizer throughput benchmark.
+// Generates a large corpus of grug source in memory and reports how many MB/s grug_grug_to_tokens gets through it.
+// Usage: bench_tokenizer [corpus size in MB] [iterations]
+
+// Typical hand written scripts, which are mostly short words and punctuation
+static char const code_corpus_chunk[] =
+	"# A long-ish header comment, like the ones most of our generated data files start with\n"
+	"health: number = 100\n"
+	"name: string = \"Labrador Retriever of the northern hills\"\n"
+	"bark_sound: resource = r\"sounds/bark.wav\"\n"
+	"friend: entity = e\"labrador\"\n"
+	"\n"
+	"on_spawn() {\n"
+	"    print_string(me, \"I have spawned\")\n"
+	"    health = health + 10.5\n"
+	"}\n"
+	"\n"
+	"on_bark(sound: string) {\n"
+	"    i: number = 0\n"
+	"    while i < 10 {\n"
+	"        if i >= 5 and not (health <= 0) or i == 3 {\n"
+	"            print_string(me, sound)\n"
+	"        } else {\n"
+	"            helper_whimper(i * 2 / 3 - 1)\n"
+	"        }\n"
+	"        i = i + 1\n"
+	"    }\n"
+	"}\n"
+	"\n"
+	"helper_whimper(times: number) bool {\n"
+	"    return times != 0\n"
+	"}\n"
+	"\n";
+
+// Generated data files, which are mostly long string tables and long comment headers
+static char const data_corpus_chunk[] =
+	"# ==========================================================================================================\n"
+	"# This file was generated from the item spreadsheet, do not edit it by hand. Any changes will be overwritten\n"
+	"# ==========================================================================================================\n"
+	"description_1: string = \"A finely crafted blade, forged in the fires of the northern mountains by the dwarven smiths of old\"\n"
+	"description_2: string = \"A sturdy shield, reinforced with iron bands and painted with the crest of a long forgotten kingdom\"\n"
+	"description_3: string = \"A bundle of arrows fletched with the feathers of the great eagles that nest on the highest cliffs\"\n"
+	"icon_1: resource = r\"textures/items/weapons/swords/northern_mountain_dwarven_longsword_icon.png\"\n"
+	"\n";
+
+static double seconds_now(void) {
+	return (double)clock() / (double)CLOCKS_PER_SEC;
+}
+
+/// Returns false if tokenizing failed
+static bool bench_corpus(char const* name, char const* chunk, size_t chunk_len, size_t corpus_megabytes, size_t iterations) {
+	size_t num_chunks = (corpus_megabytes * 1024 * 1024) / chunk_len + 1;
+	size_t corpus_len = num_chunks * chunk_len;
+	char* corpus = malloc(corpus_len);
+	if(!corpus) {
+		(void)fprintf(stderr, "Failed to allocate the corpus\n");
+		return false;
+	}
+	for(size_t chunk_index = 0; chunk_index < num_chunks; chunk_index += 1) {
+		memcpy(corpus + chunk_index * chunk_len, chunk, chunk_len);
+	}
+
+	struct grug_error error = {0};
+	size_t num_tokens = grug_grug_to_tokens(corpus, corpus_len, NULL, 0, &error);
+	if(error.error_type.tag[0]) {
+		(void)fprintf(stderr, "Failed to tokenize the corpus: %s\n", error.message);
+		grug_free_error(&error);
+		free(corpus);
+		return false;
+	}
+	struct grug_token* tokens = malloc(num_tokens * sizeof(struct grug_token));
+	if(!tokens) {
+		(void)fprintf(stderr, "Failed to allocate the tokens\n");
+		free(corpus);
+		return false;
+	}
+
+	// Count then fill, like callers of grug_grug_to_tokens have to.
+	// The token buffer is reused so page faults don't drown out the tokenizer itself.
+	double best_two_pass_seconds = 0;
+	for(size_t iteration = 0; iteration < iterations; iteration += 1) {
+		double start = seconds_now();
+		size_t counted = grug_grug_to_tokens(corpus, corpus_len, NULL, 0, &error);
+		size_t filled = grug_grug_to_tokens(corpus, corpus_len, tokens, counted, &error);
+		double elapsed = seconds_now() - start;
+		if(counted != num_tokens || filled != num_tokens || error.error_type.tag[0]) {
+			(void)fprintf(stderr, "Tokenizing the corpus gave inconsistent results\n");
+			free(tokens);
+			free(corpus);
+			return false;
+		}
+		if(iteration == 0 || elapsed < best_two_pass_seconds) {
+			best_two_pass_seconds = elapsed;
+		}
+	}
+
+	// A single pass into a growable token array, with the arena kept around between passes for the same reason as above
+	double best_single_pass_seconds = 0;
+	struct grug_arena* arena = grug_arena_new();
+	for(size_t iteration = 0; iteration < iterations; iteration += 1) {
+		grug_arena_clear(arena, SIZE_MAX);
+		size_t filled = 0;
+		double start = seconds_now();
+		struct grug_token const* arena_tokens = grug_grug_to_tokens_in_arena(corpus, corpus_len, arena, &filled, &error);
+		double elapsed = seconds_now() - start;
+		if(!arena_tokens || filled != num_tokens || error.error_type.tag[0]) {
+			(void)fprintf(stderr, "Tokenizing the corpus gave inconsistent results\n");
+			grug_arena_deinit(arena);
+			free(tokens);
+			free(corpus);
+			return false;
+		}
+		if(iteration == 0 || elapsed < best_single_pass_seconds) {
+			best_single_pass_seconds = elapsed;
+		}
+	}
+
+	grug_arena_deinit(arena);
+
+	size_t num_tokens_without_whitespace = grug_grug_to_tokens_without_whitespace(corpus, corpus_len, NULL, 0, &error);
+	if(error.error_type.tag[0]) {
+		(void)fprintf(stderr, "Failed to tokenize the corpus without whitespace: %s\n", error.message);
+		grug_free_error(&error);
+		free(tokens);
+		free(corpus);
+		return false;
+	}
+
+	double megabytes = (double)corpus_len / (1024.0 * 1024.0);
+	printf("%s corpus: %.1f MB, %zu tokens, %zu without whitespace\n", name, megabytes, num_tokens, num_tokens_without_whitespace);
+	printf("    count + fill, best of %zu: %.3f s, %.1f MB/s\n", iterations, best_two_pass_seconds, megabytes / best_two_pass_seconds);
+	printf("    single pass,  best of %zu: %.3f s, %.1f MB/s\n", iterations, best_single_pass_seconds, megabytes / best_single_pass_seconds);
+
+	free(tokens);
+	free(corpus);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	size_t corpus_megabytes = 64;
+	size_t iterations = 5;
+	if(argc > 1) {
+		corpus_megabytes = (size_t)strtoull(argv[1], NULL, 10);
+	}
+	if(argc > 2) {
+		iterations = (size_t)strtoull(argv[2], NULL, 10);
+	}
+
+	if(!bench_corpus("code", code_corpus_chunk, sizeof(code_corpus_chunk) - 1, corpus_megabytes, iterations)) {
+		return 1;
+	}
+	if(!bench_corpus("data", data_corpus_chunk, sizeof(data_corpus_chunk) - 1, corpus_megabytes, iterations)) {
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,1974 @@
+#include <grug_main.h>
+// For running the same file lowered in different ways, and for the member stride of the built-in backends, which the public API doesn't offer
+#include <grug_bytecode.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Checks what the runtime does, beyond what the grug-tests harness covers for a single file and a single call at a time.
+// Everything it needs is made up here, so it runs from any directory.
+
+static int failures;
+
+#define CHECK(_condition) do { \
+		if(!(_condition)) { \
+			(void)fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_condition); \
+			failures += 1; \
+		} \
+	} while(0)
+
+static char const* mod_api_json =
+	"{"
+		"\"entities\": {"
+			"\"Dog\": {"
+				"\"description\": \"A dog\","
+				"\"on_functions\": {"
+					"\"on_spawn\": {\"description\": \"Called once\"},"
+					"\"on_tick\": {\"description\": \"Called every tick\", \"arguments\": [{\"name\": \"n\", \"type\": \"number\"}]}"
+				"}"
+			"}"
+		"},"
+		"\"game_functions\": {"
+			"\"add\": {\"description\": \"Adds to the total\", \"arguments\": [{\"name\": \"n\", \"type\": \"number\"}]}"
+		"}"
+	"}";
+
+static char const* adder_text =
+	"on_tick(n: number) {\n"
+	"    add(n)\n"
+	"}\n";
+
+// Doesn't define on_tick, so batches have to skip its entities without skipping those of the other files
+static char const* sleeper_text =
+	"on_spawn() {\n"
+	"    add(1000000)\n"
+	"}\n";
+
+static char const* doubler_text =
+	"on_tick(n: number) {\n"
+	"    add(n * 2)\n"
+	"}\n";
+
+static char const* tenfold_text =
+	"on_tick(n: number) {\n"
+	"    add(n * 10)\n"
+	"}\n";
+
+// Has members, a helper function and control flow, so that what the cache stores isn't trivial
+static char const* counter_text =
+	"count: number = 3\n"
+	"label: string = \"counter\"\n"
+	"\n"
+	"on_tick(n: number) {\n"
+	"    i: number = 0\n"
+	"    while i < n {\n"
+	"        count = helper_step(count, i)\n"
+	"        i = i + 1\n"
+	"    }\n"
+	"    if label == \"counter\" {\n"
+	"        add(count)\n"
+	"    }\n"
+	"}\n"
+	"\n"
+	"helper_step(value: number, i: number) number {\n"
+	"    if i < 2 {\n"
+	"        return value + i\n"
+	"    }\n"
+	"    return value * 2\n"
+	"}\n";
+
+static int64_t total;
+
+static union grug_value game_fn_add(struct grug_state* gst, void* data, const union grug_value args[]) {
+	(void)gst;
+	(void)data;
+	__atomic_fetch_add(&total, (int64_t)args[0]._number, __ATOMIC_RELAXED);
+	return (union grug_value) {0};
+}
+
+/// Creates a state for mod_api_json whose game functions are yet to be registered. A null `backend.vtable` gets the default backend.
+static struct grug_state* init_state(uint32_t worker_threads, char const* cache_dir_path, char const* mods_dir_path, struct grug_backend backend) {
+	struct grug_init_settings settings = grug_default_settings();
+	settings.mod_api_json_source = mod_api_json;
+	settings.mod_api_json_path = NULL;
+	settings.worker_threads = worker_threads;
+	settings.cache_dir_path = cache_dir_path;
+	settings.mods_dir_path = mods_dir_path;
+	settings.backend = backend;
+	struct grug_error error = {0};
+	struct grug_state* gst = grug_init(settings, &error);
+	if(!gst) {
+		(void)fprintf(stderr, "Failed to create state: %s\n", error.message);
+		grug_free_error(&error);
+	}
+	return gst;
+}
+
+static struct grug_state* new_state(uint32_t worker_threads, char const* cache_dir_path, char const* mods_dir_path) {
+	struct grug_state* gst = init_state(worker_threads, cache_dir_path, mods_dir_path, (struct grug_backend) {0});
+	if(!gst) {
+		return NULL;
+	}
+	CHECK(grug_register_game_fn(gst, "add", NULL, game_fn_add));
+	CHECK(grug_set_game_fn_thread_safe(gst, "add", true));
+	return gst;
+}
+
+// MARK: directories
+
+#if defined(__unix__) || defined(__APPLE__)
+
+/// Removes the directory at `dir_path` along with everything in it
+static void remove_dir(char const* dir_path) { // NOLINT(misc-no-recursion): only as deep as the test makes it
+	DIR* dir = opendir(dir_path);
+	if(!dir) {
+		return;
+	}
+	char path[4096];
+	for(struct dirent* entry = readdir(dir); entry; entry = readdir(dir)) {
+		if(strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+			(void)snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+			struct stat entry_stat;
+			if(lstat(path, &entry_stat) == 0 && S_ISDIR(entry_stat.st_mode)) {
+				remove_dir(path);
+			} else {
+				(void)unlink(path);
+			}
+		}
+	}
+	(void)closedir(dir);
+	(void)rmdir(dir_path);
+}
+
+/// Writes `text` to `path` in the directory at `dir_path`, creating the directories in `path` that are missing
+static bool write_file(char const* dir_path, char const* path, char const* text) {
+	char full_path[4096];
+	(void)snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, path);
+	for(char* slash = strchr(full_path + strlen(dir_path) + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		(void)mkdir(full_path, 0755);
+		*slash = '/';
+	}
+	FILE* file = fopen(full_path, "wb");
+	if(!file) {
+		return false;
+	}
+	bool written = fputs(text, file) >= 0;
+	return fclose(file) == 0 && written;
+}
+
+#endif
+
+// MARK: tokenizer
+
+/// Writes lines whose words, strings, comments and indentation grow a byte at a time, and returns the length written.
+/// That way every scanner both stops and runs out of input at every position within a 16 and 32 byte vector.
+static size_t write_scanner_corpus(char* out) {
+	static char const letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_abcdefghijklmnopqrstuvwxyz";
+	size_t len = 0;
+	for(int width = 0; width < 80; width += 1) {
+		int indent = (width % 5) * GRUG_SPACES_PER_INDENT;
+		len += (size_t)sprintf(out + len, "%*sw%.*s = \"%.*s\" # %.*s\n", indent, "", width, letters, width, letters, width, letters);
+		len += (size_t)sprintf(out + len, "%*sx >= 12.5 != e\"%.*s\" == r\"%.*s\"\n", indent, "", width, letters, width, letters);
+	}
+	return len;
+}
+
+/// Writes the type, offset and length of each token of the scanner corpus to `path`, with and without whitespace tokens.
+/// test_runtime and test_runtime_portable each write one, and ctest compares them.
+static void write_token_dump(char const* path) {
+	static char corpus[32768];
+	static struct grug_token tokens[16384];
+	size_t corpus_len = write_scanner_corpus(corpus);
+
+	FILE* f = fopen(path, "w");
+	CHECK(f);
+	if(!f) {
+		return;
+	}
+	for(int keep_whitespace = 1; keep_whitespace >= 0; keep_whitespace -= 1) {
+		struct grug_error error = {0};
+		size_t num_tokens = keep_whitespace ? grug_grug_to_tokens(corpus, corpus_len, tokens, 16384, &error) : grug_grug_to_tokens_without_whitespace(corpus, corpus_len, tokens, 16384, &error);
+		CHECK(!error.error_type.tag[0]);
+		CHECK(num_tokens > 0 && num_tokens <= 16384);
+		grug_free_error(&error);
+		for(size_t index = 0; index < num_tokens && index < 16384; index += 1) {
+			(void)fprintf(f, "%d %zu %zu %" PRIu32 "\n", (int)tokens[index].type, (size_t)(tokens[index].contents - corpus), tokens[index].contents_len, tokens[index].spaces_before);
+		}
+	}
+	CHECK(fclose(f) == 0);
+}
+
+static char const* every_token_text =
+	"export\n"
+	"local ( ) { } [ ] + - * / , : . == != = >= > <= <\n"
+	"and or not true false if else while break return continue\n"
+	"\"s\" e\"e\" r\"r\" e r andy 12 1.5 # c\n";
+
+static grug_token_type const every_token_types[] = {
+	GRUG_TOKEN_TYPE_EXPORT, GRUG_TOKEN_TYPE_NEW_LINE,
+	GRUG_TOKEN_TYPE_LOCAL, GRUG_TOKEN_TYPE_OPEN_PARENTHESIS, GRUG_TOKEN_TYPE_CLOSE_PARENTHESIS, GRUG_TOKEN_TYPE_OPEN_BRACE, GRUG_TOKEN_TYPE_CLOSE_BRACE,
+	GRUG_TOKEN_TYPE_OPEN_BRACKET, GRUG_TOKEN_TYPE_CLOSE_BRACKET, GRUG_TOKEN_TYPE_PLUS, GRUG_TOKEN_TYPE_MINUS, GRUG_TOKEN_TYPE_STAR, GRUG_TOKEN_TYPE_FORWARD_SLASH,
+	GRUG_TOKEN_TYPE_COMMA, GRUG_TOKEN_TYPE_COLON, GRUG_TOKEN_TYPE_DOT, GRUG_TOKEN_TYPE_DOUBLE_EQUALS, GRUG_TOKEN_TYPE_NOT_EQUALS, GRUG_TOKEN_TYPE_EQUAL,
+	GRUG_TOKEN_TYPE_GREATER_EQUALS, GRUG_TOKEN_TYPE_GREATER, GRUG_TOKEN_TYPE_LESS_EQUALS, GRUG_TOKEN_TYPE_LESS, GRUG_TOKEN_TYPE_NEW_LINE,
+	GRUG_TOKEN_TYPE_AND, GRUG_TOKEN_TYPE_OR, GRUG_TOKEN_TYPE_NOT, GRUG_TOKEN_TYPE_TRUE, GRUG_TOKEN_TYPE_FALSE, GRUG_TOKEN_TYPE_IF, GRUG_TOKEN_TYPE_ELSE,
+	GRUG_TOKEN_TYPE_WHILE, GRUG_TOKEN_TYPE_BREAK, GRUG_TOKEN_TYPE_RETURN, GRUG_TOKEN_TYPE_CONTINUE, GRUG_TOKEN_TYPE_NEW_LINE,
+	GRUG_TOKEN_TYPE_STRING, GRUG_TOKEN_TYPE_ENTITY, GRUG_TOKEN_TYPE_RESOURCE, GRUG_TOKEN_TYPE_WORD, GRUG_TOKEN_TYPE_WORD, GRUG_TOKEN_TYPE_WORD,
+	GRUG_TOKEN_TYPE_NUMBER, GRUG_TOKEN_TYPE_NUMBER, GRUG_TOKEN_TYPE_COMMENT, GRUG_TOKEN_TYPE_NEW_LINE,
+};
+
+static void test_every_token_type(void) {
+	size_t expected_count = sizeof(every_token_types) / sizeof(every_token_types[0]);
+	struct grug_token tokens[64];
+	struct grug_error error = {0};
+	size_t num_tokens = grug_grug_to_tokens_without_whitespace(every_token_text, strlen(every_token_text), tokens, 64, &error);
+	CHECK(!error.error_type.tag[0]);
+	CHECK(num_tokens == expected_count);
+	for(size_t index = 0; index < num_tokens && index < expected_count; index += 1) {
+		CHECK(tokens[index].type == every_token_types[index]);
+	}
+
+	// Each of these is cut short at the offset next to it
+	static char const* const bad_texts[] = {"a = !b\n", "a = 1.\n", "a = 1.2.3\n", "a = @\n", "a local\n", "a = \"b\n"};
+	static size_t const bad_offsets[] = {4, 4, 4, 4, 2, 4};
+	for(size_t index = 0; index < 6; index += 1) {
+		CHECK(grug_grug_to_tokens(bad_texts[index], strlen(bad_texts[index]), tokens, 64, &error) == 0);
+		CHECK(grug_error_code_matches(error.error_type, GRUG_ERROR_CODE_COMPILE_TOKENIZER));
+		CHECK(error.file.offset == bad_offsets[index]);
+		grug_free_error(&error);
+	}
+}
+
+/// grug_grug_to_tokens_in_arena has to grow its array when a file has more tokens than its guess, which this one does
+static void test_arena_tokens_match_buffer_tokens(void) {
+	static char text[4096];
+	static struct grug_token tokens[4096];
+	size_t len = 0;
+	while(len + 4 < sizeof(text)) {
+		len += (size_t)sprintf(text + len, "a=b\n");
+	}
+	struct grug_error error = {0};
+	size_t num_tokens = grug_grug_to_tokens(text, len, tokens, 4096, &error);
+	CHECK(!error.error_type.tag[0]);
+	CHECK(num_tokens == len);
+
+	struct grug_arena* arena = grug_arena_new();
+	CHECK(arena);
+	if(!arena) {
+		return;
+	}
+	size_t arena_num_tokens = 0;
+	struct grug_token* arena_tokens = grug_grug_to_tokens_in_arena(text, len, arena, &arena_num_tokens, &error);
+	CHECK(arena_tokens);
+	CHECK(arena_num_tokens == num_tokens);
+	for(size_t index = 0; arena_tokens && index < arena_num_tokens && index < num_tokens; index += 1) {
+		CHECK(arena_tokens[index].type == tokens[index].type);
+		CHECK(arena_tokens[index].contents == tokens[index].contents);
+		CHECK(arena_tokens[index].contents_len == tokens[index].contents_len);
+	}
+	grug_arena_deinit(arena);
+	grug_free_error(&error);
+}
+
+#define STREAMED_TOKENS 64
+
+/// What a grug_tokenizer passed to its sink, with the contents copied out since they only live until the sink returns
+struct streamed_tokens {
+	size_t count;
+	grug_token_type types[STREAMED_TOKENS];
+	size_t lens[STREAMED_TOKENS];
+	char text[1024];
+	size_t text_len;
+};
+
+static void collect_streamed_token(void* user_data, struct grug_token const* token) {
+	struct streamed_tokens* streamed = user_data;
+	CHECK(streamed->count < STREAMED_TOKENS && streamed->text_len + token->contents_len <= sizeof(streamed->text));
+	if(streamed->count < STREAMED_TOKENS && streamed->text_len + token->contents_len <= sizeof(streamed->text)) {
+		streamed->types[streamed->count] = token->type;
+		streamed->lens[streamed->count] = token->contents_len;
+		memcpy(streamed->text + streamed->text_len, token->contents, token->contents_len);
+		streamed->count += 1;
+		streamed->text_len += token->contents_len;
+	}
+}
+
+/// Feeds `text` to a grug_tokenizer in three chunks, cut at `split_a` and `split_b`. Returns whether it succeeded.
+static bool stream_tokens(char const* text, size_t split_a, size_t split_b, struct streamed_tokens* out, struct grug_error* o_error) {
+	*out = (struct streamed_tokens) {0};
+	struct grug_tokenizer* tokenizer = grug_tokenizer_begin(collect_streamed_token, out);
+	CHECK(tokenizer);
+	if(!tokenizer) {
+		return false;
+	}
+	size_t len = strlen(text);
+	bool fed = grug_tokenizer_feed(tokenizer, text, split_a, o_error);
+	fed = fed && grug_tokenizer_feed(tokenizer, text + split_a, split_b - split_a, o_error);
+	fed = fed && grug_tokenizer_feed(tokenizer, text + split_b, len - split_b, o_error);
+	bool finished = grug_tokenizer_finish(tokenizer, o_error);
+	return fed && finished;
+}
+
+// Every pair of split points gets tried, which cuts inside the string, the comment, ">=", "!=" and the number
+static char const* streamed_text =
+	"on_spawn() {\n"
+	"    s: string = \"split me\"\n"
+	"    # split this comment too\n"
+	"    if 1 >= 2 {\n"
+	"        add(12.5)\n"
+	"    }\n"
+	"    b: bool = s != \"\"\n"
+	"}\n";
+
+// Three spaces of indentation is an error, which may only be reported once the chunk holding the 'a' arrives
+static char const* bad_indentation_text =
+	"on_spawn() {\n"
+	"   add(1)\n"
+	"}\n";
+
+static void test_streamed_tokens_match_one_shot(void) {
+	struct grug_token tokens[STREAMED_TOKENS];
+	struct grug_error error = {0};
+	size_t len = strlen(streamed_text);
+	size_t num_tokens = grug_grug_to_tokens(streamed_text, len, tokens, STREAMED_TOKENS, &error);
+	CHECK(!error.error_type.tag[0]);
+	CHECK(num_tokens <= STREAMED_TOKENS);
+
+	struct streamed_tokens streamed;
+	for(size_t split_a = 0; split_a <= len; split_a += 1) {
+		for(size_t split_b = split_a; split_b <= len; split_b += 1) {
+			CHECK(stream_tokens(streamed_text, split_a, split_b, &streamed, &error));
+			CHECK(streamed.count == num_tokens);
+			CHECK(streamed.text_len == len && memcmp(streamed.text, streamed_text, len) == 0);
+			for(size_t index = 0; index < streamed.count && index < num_tokens; index += 1) {
+				CHECK(streamed.types[index] == tokens[index].type);
+				CHECK(streamed.lens[index] == tokens[index].contents_len);
+			}
+		}
+	}
+	grug_free_error(&error);
+
+	struct grug_error one_shot_error = {0};
+	len = strlen(bad_indentation_text);
+	CHECK(grug_grug_to_tokens(bad_indentation_text, len, tokens, STREAMED_TOKENS, &one_shot_error) == 0);
+	CHECK(one_shot_error.error_type.tag[0]);
+	for(size_t split_a = 0; split_a <= len; split_a += 1) {
+		for(size_t split_b = split_a; split_b <= len; split_b += 1) {
+			struct grug_error streamed_error = {0};
+			CHECK(!stream_tokens(bad_indentation_text, split_a, split_b, &streamed, &streamed_error));
+			CHECK(grug_error_code_matches(streamed_error.error_type, one_shot_error.error_type));
+			CHECK(streamed_error.message && one_shot_error.message && strcmp(streamed_error.message, one_shot_error.message) == 0);
+			CHECK(streamed_error.file.offset == one_shot_error.file.offset);
+			CHECK(streamed_error.file.num_characters == one_shot_error.file.num_characters);
+			// Only "on_spawn() {\n" comes before the error
+			CHECK(streamed.count == 6);
+			grug_free_error(&streamed_error);
+		}
+	}
+	grug_free_error(&one_shot_error);
+}
+
+/// grug_grug_to_tokens_without_whitespace materializes the compact tokens, whose offsets and kinds have to give back the source.
+/// The parser reads them as well, so where it reports an error depends on them too.
+static void test_compact_tokens_round_trip(void) {
+	static char corpus[32768];
+	static char printed[32768];
+	static struct grug_token tokens[16384];
+	size_t len = write_scanner_corpus(corpus);
+	struct grug_error error = {0};
+	size_t num_tokens = grug_grug_to_tokens_without_whitespace(corpus, len, tokens, 16384, &error);
+	CHECK(!error.error_type.tag[0]);
+	CHECK(num_tokens > 0 && num_tokens <= 16384);
+	size_t offset = 0;
+	for(size_t index = 0; index < num_tokens && index < 16384; index += 1) {
+		offset += tokens[index].spaces_before;
+		CHECK(tokens[index].contents == corpus + offset);
+		offset += tokens[index].contents_len;
+	}
+	CHECK(offset == len);
+	size_t printed_len = grug_tokens_to_grug(tokens, num_tokens, printed, sizeof(printed), &error);
+	CHECK(printed_len == len && memcmp(printed, corpus, len) == 0);
+	CHECK(!error.error_type.tag[0]);
+
+	// The stray "2" sits at a different offset for every string length
+	char text[128];
+	for(int width = 0; width < 40; width += 1) {
+		len = (size_t)sprintf(text, "a: string = \"%.*s\"\nb: number = 1 2\n", width, "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyz");
+		struct grug_ast ast = grug_grug_to_ast(text, len, NULL, &error);
+		CHECK(!ast._arena);
+		CHECK(grug_error_code_matches(error.error_type, GRUG_ERROR_CODE_COMPILE_PARSER));
+		CHECK(error.file.offset == (size_t)(strstr(text, " 2") + 1 - text));
+		CHECK(error.file.num_characters == 1);
+		grug_free_error(&error);
+	}
+}
+
+static void test_spaces_before_round_trip(void) {
+	static char printed[4096];
+	struct grug_token tokens[256];
+	struct grug_error error = {0};
+	size_t len = strlen(counter_text);
+	size_t num_tokens = grug_grug_to_tokens_without_whitespace(counter_text, len, tokens, 256, &error);
+	CHECK(!error.error_type.tag[0]);
+	CHECK(num_tokens <= 256);
+	size_t printed_len = grug_tokens_to_grug(tokens, num_tokens, printed, sizeof(printed), &error);
+	CHECK(printed_len == len && memcmp(printed, counter_text, len) == 0);
+
+	// The first token of a line holds its indentation, and a token after a space holds that one space
+	for(size_t index = 1; index < num_tokens && index < 256; index += 1) {
+		if(tokens[index].contents_len == 5 && memcmp(tokens[index].contents, "count", 5) == 0 && tokens[index - 1].type == GRUG_TOKEN_TYPE_NEW_LINE) {
+			CHECK(tokens[index].spaces_before == 2 * GRUG_SPACES_PER_INDENT);
+		}
+		if(tokens[index].type == GRUG_TOKEN_TYPE_OPEN_BRACE) {
+			CHECK(tokens[index].spaces_before == 1);
+		}
+		if(tokens[index].type == GRUG_TOKEN_TYPE_OPEN_PARENTHESIS || tokens[index].type == GRUG_TOKEN_TYPE_NEW_LINE) {
+			CHECK(tokens[index].spaces_before == 0);
+		}
+	}
+
+	// Whitespace that is wrong wherever it is gets reported where it starts
+	static char const* const bad_texts[] = {
+		"a: number = 1 \n",
+		"on_spawn() {\n   add(1)\n}\n",
+		"a: number =  1\n",
+	};
+	static size_t const bad_offsets[] = {13, 13, 11};
+	for(size_t index = 0; index < 3; index += 1) {
+		CHECK(grug_grug_to_tokens_without_whitespace(bad_texts[index], strlen(bad_texts[index]), tokens, 256, &error) == 0);
+		CHECK(grug_error_code_matches(error.error_type, GRUG_ERROR_CODE_COMPILE_TOKENIZER));
+		CHECK(error.file.offset == bad_offsets[index]);
+		grug_free_error(&error);
+	}
+}
+
+// MARK: parser
+
+/// Writes an on function whose body nests `depth` if statements, and returns its length
+static size_t write_nested_ifs(char* out, size_t depth) {
+	size_t len = (size_t)sprintf(out, "on_spawn() {\n");
+	for(size_t level = 1; level <= depth; level += 1) {
+		len += (size_t)sprintf(out + len, "%*sif true {\n", (int)(level * GRUG_SPACES_PER_INDENT), "");
+	}
+	for(size_t level = depth; level >= 1; level -= 1) {
+		len += (size_t)sprintf(out + len, "%*s}\n", (int)(level * GRUG_SPACES_PER_INDENT), "");
+	}
+	len += (size_t)sprintf(out + len, "}\n");
+	return len;
+}
+
+/// Checks that `ast` is counter_text's
+static void check_counter_ast(struct grug_ast const* ast) {
+	CHECK(ast->members_count == 2 && ast->on_functions_count == 1 && ast->helper_functions_count == 1);
+	if(ast->members_count != 2 || ast->on_functions_count != 1 || ast->helper_functions_count != 1) {
+		return;
+	}
+	CHECK(strcmp(ast->members[0].name, "count") == 0 && ast->members[0].type.type == GRUG_TYPE_NUMBER);
+	CHECK(strcmp(ast->members[1].name, "label") == 0 && ast->members[1].type.type == GRUG_TYPE_STRING);
+	CHECK(ast->members[1].assignment_expr.type == GRUG_EXPR_TYPE_STRING && strcmp(ast->members[1].assignment_expr.expr_data.string, "counter") == 0);
+
+	struct grug_on_function const* on_tick = &ast->on_functions[0];
+	CHECK(strcmp(on_tick->name, "on_tick") == 0);
+	CHECK(on_tick->arguments_len == 1 && strcmp(on_tick->arguments[0].name, "n") == 0 && on_tick->arguments[0].type.type == GRUG_TYPE_NUMBER);
+	CHECK(on_tick->block.statements_len == 3);
+	if(on_tick->block.statements_len == 3) {
+		CHECK(on_tick->block.statements[0].type == GRUG_STATEMENT_VARIABLE);
+		CHECK(on_tick->block.statements[1].type == GRUG_STATEMENT_WHILE);
+		CHECK(on_tick->block.statements[1].statement_data.while_stmt.block.statements_len == 2);
+		CHECK(on_tick->block.statements[2].type == GRUG_STATEMENT_IF);
+	}
+
+	struct grug_helper_function const* helper = &ast->helper_function[0];
+	CHECK(strcmp(helper->name, "helper_step") == 0 && helper->return_type.type == GRUG_TYPE_NUMBER && helper->arguments_len == 2);
+	CHECK(helper->block.statements_len == 2);
+	if(helper->block.statements_len == 2) {
+		CHECK(helper->block.statements[0].type == GRUG_STATEMENT_IF);
+		CHECK(helper->block.statements[1].type == GRUG_STATEMENT_RETURN);
+	}
+}
+
+static void test_parse_into_caller_arena(void) {
+	struct grug_arena* arena = grug_arena_new();
+	CHECK(arena);
+	if(!arena) {
+		return;
+	}
+	struct grug_error error = {0};
+	size_t len = strlen(counter_text);
+	struct grug_ast ast = grug_grug_to_ast(counter_text, len, arena, &error);
+	CHECK(!error.error_type.tag[0]);
+	CHECK(ast._arena == arena);
+	check_counter_ast(&ast);
+
+	// Parsing from tokens gives the same AST
+	struct grug_token tokens[256];
+	size_t num_tokens = grug_grug_to_tokens(counter_text, len, tokens, 256, &error);
+	CHECK(num_tokens <= 256);
+	struct grug_ast from_tokens = grug_tokens_to_ast(tokens, num_tokens, arena, &error);
+	CHECK(!error.error_type.tag[0]);
+	CHECK(from_tokens._arena == arena);
+	check_counter_ast(&from_tokens);
+
+	// Both ASTs live in the caller's arena, so freeing it frees them, which the leak checker would notice otherwise
+	grug_arena_deinit(arena);
+	grug_free_error(&error);
+}
+
+/// Whether parsing `tokens` fails with a tokenizer error
+static bool tokens_fail_to_parse(struct grug_token const* tokens, size_t num_tokens) {
+	struct grug_error error = {0};
+	struct grug_ast ast = grug_tokens_to_ast(tokens, num_tokens, NULL, &error);
+	bool failed = !ast._arena && grug_error_code_matches(error.error_type, GRUG_ERROR_CODE_COMPILE_TOKENIZER);
+	if(ast._arena) {
+		grug_free_ast(ast);
+	}
+	grug_free_error(&error);
+	return failed;
+}
+
+static void test_tokens_parse_as_given(void) {
+	struct grug_error error = {0};
+	size_t len = strlen(counter_text);
+	struct grug_token tokens[256];
+	size_t num_tokens = grug_grug_to_tokens_without_whitespace(counter_text, len, tokens, 256, &error);
+	CHECK(num_tokens <= 256);
+
+	// Tokens made from an AST may leave the text of the token types that fix it unset
+	for(size_t index = 0; index < num_tokens; index += 1) {
+		if(tokens[index].type != GRUG_TOKEN_TYPE_WORD && tokens[index].type != GRUG_TOKEN_TYPE_NUMBER && tokens[index].type != GRUG_TOKEN_TYPE_STRING) {
+			tokens[index].contents = NULL;
+			tokens[index].contents_len = 0;
+		}
+	}
+	struct grug_ast ast = grug_tokens_to_ast(tokens, num_tokens, NULL, &error);
+	CHECK(!error.error_type.tag[0]);
+	check_counter_ast(&ast);
+	if(ast._arena) {
+		grug_free_ast(ast);
+	}
+
+	// count: number = 3
+	struct grug_token member[] = {
+		{.type = GRUG_TOKEN_TYPE_WORD, .contents = "count", .contents_len = 5},
+		{.type = GRUG_TOKEN_TYPE_COLON},
+		{.type = GRUG_TOKEN_TYPE_WORD, .spaces_before = 1, .contents = "number", .contents_len = 6},
+		{.type = GRUG_TOKEN_TYPE_EQUAL, .spaces_before = 1},
+		{.type = GRUG_TOKEN_TYPE_NUMBER, .spaces_before = 1, .contents = "3", .contents_len = 1},
+		{.type = GRUG_TOKEN_TYPE_NEW_LINE},
+	};
+	size_t member_len = sizeof(member) / sizeof(member[0]);
+	ast = grug_tokens_to_ast(member, member_len, NULL, &error);
+	CHECK(!error.error_type.tag[0] && ast.members_count == 1);
+	if(ast._arena) {
+		grug_free_ast(ast);
+	}
+
+	// The contents of a token have to be a single token of its type, and the spaces have to be what a file can have
+	member[0].contents = "if";
+	member[0].contents_len = 2;
+	CHECK(tokens_fail_to_parse(member, member_len));
+	member[0].contents = "co unt";
+	member[0].contents_len = 6;
+	CHECK(tokens_fail_to_parse(member, member_len));
+	member[0].contents = "count";
+	member[0].contents_len = 5;
+	member[4].contents = "3.";
+	member[4].contents_len = 2;
+	CHECK(tokens_fail_to_parse(member, member_len));
+	member[4].contents = "3";
+	member[4].contents_len = 1;
+	member[3].spaces_before = 2;
+	CHECK(tokens_fail_to_parse(member, member_len));
+	member[3].spaces_before = 1;
+	member[0].spaces_before = 3;
+	CHECK(tokens_fail_to_parse(member, member_len));
+	member[0].spaces_before = 0;
+	member[5].spaces_before = 1;
+	CHECK(tokens_fail_to_parse(member, member_len));
+	member[5].spaces_before = 0;
+	member[2].type = GRUG_TOKEN_TYPE_NUM;
+	CHECK(tokens_fail_to_parse(member, member_len));
+	grug_free_error(&error);
+}
+
+static char const* branchy_text =
+	"a: number = 1 + 2 * -(3 - 4)\n"
+	"\n"
+	"on_spawn() {\n"
+	"    if a > 1 {\n"
+	"        add(a, 2)\n"
+	"    } else if a < 0 {\n"
+	"        add(0)\n"
+	"    } else {\n"
+	"        add(1)\n"
+	"    }\n"
+	"}\n";
+
+/// The parser links expressions and statements by index in the flat AST, and these have to come out as the right pointers
+static void test_exported_ast_links(void) {
+	struct grug_error error = {0};
+	struct grug_ast ast = grug_grug_to_ast(branchy_text, strlen(branchy_text), NULL, &error);
+	CHECK(ast._arena);
+	if(!ast._arena) {
+		grug_free_error(&error);
+		return;
+	}
+	CHECK(ast.members_count == 1 && ast.on_functions_count == 1);
+
+	// 1 + (2 * -((3 - 4)))
+	struct grug_expr const* sum = &ast.members[0].assignment_expr;
+	CHECK(sum->type == GRUG_EXPR_TYPE_BINARY && sum->expr_data.binary.op == GRUG_BINARY_PLUS);
+	CHECK(sum->expr_data.binary.left->type == GRUG_EXPR_TYPE_NUMBER && sum->expr_data.binary.left->expr_data.number.value == 1);
+	struct grug_expr const* product = sum->expr_data.binary.right;
+	CHECK(product->type == GRUG_EXPR_TYPE_BINARY && product->expr_data.binary.op == GRUG_BINARY_MULTIPLY);
+	CHECK(product->expr_data.binary.left->type == GRUG_EXPR_TYPE_NUMBER && product->expr_data.binary.left->expr_data.number.value == 2);
+	struct grug_expr const* negated = product->expr_data.binary.right;
+	CHECK(negated->type == GRUG_EXPR_TYPE_UNARY && negated->expr_data.unary.op == GRUG_UNARY_MINUS);
+	CHECK(negated->expr_data.unary.inner->type == GRUG_EXPR_TYPE_PARENTHESIZED);
+	CHECK(negated->expr_data.unary.inner->expr_data.parenthesized->expr_data.binary.op == GRUG_BINARY_MINUS);
+
+	struct grug_block const* body = &ast.on_functions[0].block;
+	CHECK(body->statements_len == 1 && body->statements[0].type == GRUG_STATEMENT_IF);
+	if(body->statements_len == 1) {
+		struct grug_statement const* if_stmt = &body->statements[0];
+		CHECK(if_stmt->statement_data.if_stmt.branch.cond.expr_data.binary.op == GRUG_BINARY_GREATER);
+		struct grug_expr const* call = &if_stmt->statement_data.if_stmt.branch.block.statements[0].statement_data.call;
+		CHECK(strcmp(call->expr_data.call.function_name, "add") == 0 && call->expr_data.call.args_count == 2);
+		CHECK(strcmp(call->expr_data.call.args[0].expr_data.identifier_name, "a") == 0);
+		CHECK(call->expr_data.call.args[1].expr_data.number.value == 2);
+		CHECK(if_stmt->statement_data.if_stmt.additional_branches_len == 1);
+		CHECK(if_stmt->statement_data.if_stmt.additional_branches[0].cond.expr_data.binary.op == GRUG_BINARY_LESS);
+		CHECK(if_stmt->statement_data.if_stmt.else_block.statements_len == 1);
+		CHECK(if_stmt->statement_data.if_stmt.else_block.statements[0].statement_data.call.expr_data.call.args[0].expr_data.number.value == 1);
+	}
+	grug_free_ast(ast);
+	grug_free_error(&error);
+}
+
+static void test_deeply_nested_blocks_fail_to_parse(void) {
+	// Room for 400 levels, each indented by at most 400 levels on both its opening and closing line
+	static char text[400 * (2 * GRUG_SPACES_PER_INDENT * 400 + 13)];
+
+	struct grug_error error = {0};
+	size_t len = write_nested_ifs(text, 100);
+	struct grug_ast ast = grug_grug_to_ast(text, len, NULL, &error);
+	CHECK(ast._arena);
+	CHECK(ast.on_functions_count == 1);
+	grug_free_ast(ast);
+	grug_free_error(&error);
+
+	// Would recurse once per block without the limit, however deep the file nests them
+	len = write_nested_ifs(text, 400);
+	ast = grug_grug_to_ast(text, len, NULL, &error);
+	CHECK(!ast._arena);
+	CHECK(grug_error_code_matches(error.error_type, GRUG_ERROR_CODE_COMPILE_PARSER));
+	grug_free_error(&error);
+}
+
+// MARK: names
+
+static void test_names_are_interned(void) {
+	// Within an AST, every use of a name is the same string
+	struct grug_error error = {0};
+	struct grug_ast ast = grug_grug_to_ast(counter_text, strlen(counter_text), NULL, &error);
+	CHECK(ast._arena);
+	if(ast._arena && ast.members_count == 2 && ast.on_functions_count == 1 && ast.helper_functions_count == 1) {
+		struct grug_block const* body = &ast.on_functions[0].block;
+		struct grug_block const* loop = &body->statements[1].statement_data.while_stmt.block;
+		// `count = helper_step(count, i)`
+		struct grug_statement const* assignment = &loop->statements[0];
+		CHECK(assignment->statement_data.variable.name == ast.members[0].name);
+		CHECK(assignment->statement_data.variable.assignment_expr.expr_data.call.function_name == ast.helper_function[0].name);
+		CHECK(assignment->statement_data.variable.assignment_expr.expr_data.call.args[0].expr_data.identifier_name == ast.members[0].name);
+		// The local `i` of on_tick and the argument `i` of helper_step
+		CHECK(body->statements[0].statement_data.variable.name == ast.helper_function[0].arguments[1].name);
+	}
+	grug_free_ast(ast);
+	grug_free_error(&error);
+
+	struct grug_state* gst = new_state(0, NULL, NULL);
+	CHECK(gst);
+	if(!gst) {
+		return;
+	}
+	// Names the game builds at runtime find the same ids as literals do
+	char entity_type[8];
+	char on_fn_name[16];
+	(void)snprintf(entity_type, sizeof(entity_type), "%s", "Dog");
+	(void)snprintf(on_fn_name, sizeof(on_fn_name), "on_%s", "tick");
+	grug_on_fn_id on_tick = grug_get_on_fn_id(gst, "Dog", "on_tick");
+	CHECK(on_tick != INVALID_GRUG_ON_FN_ID);
+	CHECK(grug_get_on_fn_id(gst, entity_type, on_fn_name) == on_tick);
+	CHECK(grug_get_on_fn_id(gst, "Dog", "on_spawn") != on_tick);
+	CHECK(grug_get_on_fn_id(gst, "Dog", "on_tic") == INVALID_GRUG_ON_FN_ID);
+	CHECK(grug_get_on_fn_id(gst, "Cat", "on_tick") == INVALID_GRUG_ON_FN_ID);
+
+	// The state interns the names of all files into one table, so the same member name is the same string in each
+	grug_file_id counter = grug_compile_file_from_str(gst, "counter-Dog.grug", counter_text);
+	grug_file_id other_counter = grug_compile_file_from_str(gst, "other_counter-Dog.grug", counter_text);
+	struct grug_member_layout const* counter_members;
+	struct grug_member_layout const* other_counter_members;
+	CHECK(grug_get_member_layout(gst, counter, &counter_members) == 2);
+	CHECK(grug_get_member_layout(gst, other_counter, &other_counter_members) == 2);
+	if(counter_members && other_counter_members) {
+		CHECK(counter_members[0].name == other_counter_members[0].name && strcmp(counter_members[0].name, "count") == 0);
+		CHECK(counter_members[1].name == other_counter_members[1].name && strcmp(counter_members[1].name, "label") == 0);
+	}
+	grug_deinit(gst);
+}
+
+static int registry_data;
+static void* registry_data_seen;
+
+static union grug_value game_fn_add_recording_data(struct grug_state* gst, void* data, const union grug_value args[]) {
+	registry_data_seen = data;
+	return game_fn_add(gst, data, args);
+}
+
+/// Compiles `text` as a Dog file, and returns whether the type checker rejected it
+static bool fails_type_check(struct grug_state* gst, char const* text) {
+	if(grug_compile_file_from_str(gst, "wrong-Dog.grug", text) != INVALID_GRUG_FILE_ID) {
+		return false;
+	}
+	struct grug_error const* error = grug_get_error(gst);
+	return error && grug_error_code_matches(error->error_type, GRUG_ERROR_CODE_COMPILE_TYPE_CHECKER);
+}
+
+static void test_game_fn_registry(void) {
+	struct grug_state* gst = init_state(0, NULL, NULL, (struct grug_backend) {0});
+	CHECK(gst);
+	if(!gst) {
+		return;
+	}
+	CHECK(!grug_all_game_functions_registered(gst));
+	CHECK(!grug_register_game_fn(gst, "subtract", NULL, game_fn_add));
+	CHECK(!grug_register_game_fn(gst, "ad", NULL, game_fn_add));
+	CHECK(!grug_register_game_fn(gst, "add", NULL, NULL));
+	CHECK(grug_register_game_fn(gst, "add", &registry_data, game_fn_add_recording_data));
+	CHECK(!grug_register_game_fn(gst, "add", NULL, game_fn_add));
+	CHECK(grug_all_game_functions_registered(gst));
+
+	// Call sites are checked against the registry's parameter types
+	CHECK(fails_type_check(gst, "on_spawn() {\n    add(\"1\")\n}\n"));
+	CHECK(fails_type_check(gst, "on_spawn() {\n    add(1, 2)\n}\n"));
+	CHECK(fails_type_check(gst, "on_spawn() {\n    subtract(1)\n}\n"));
+
+	// A bound call passes the fn_data the game function was registered with
+	grug_file_id adder = grug_compile_file_from_str(gst, "adder-Dog.grug", adder_text);
+	CHECK(adder != INVALID_GRUG_FILE_ID);
+	grug_entity_id entity = grug_create_entity(gst, adder, 0);
+	union grug_value arg = {._number = 5};
+	total = 0;
+	registry_data_seen = NULL;
+	CHECK(grug_call_on_function(gst, entity, grug_get_on_fn_id(gst, "Dog", "on_tick"), &arg, 1));
+	CHECK(total == 5);
+	CHECK(registry_data_seen == &registry_data);
+	grug_deinit_entity(gst, entity);
+	grug_deinit(gst);
+}
+
+// MARK: optimizations
+
+// Has constants to fold, a dead branch, an invariant to hoist, and a continue and break
+static char const* looper_text =
+	"on_tick(n: number) {\n"
+	"    i: number = 0\n"
+	"    sum: number = 0\n"
+	"    while i < n {\n"
+	"        k: number = 2 * 3 + 1\n"
+	"        if true {\n"
+	"            sum = sum + k * n\n"
+	"        } else {\n"
+	"            sum = sum - 1000\n"
+	"        }\n"
+	"        if i == 3 {\n"
+	"            i = i + 1\n"
+	"            continue\n"
+	"        }\n"
+	"        if i > 8 {\n"
+	"            break\n"
+	"        }\n"
+	"        sum = sum + (n + 1) * (n + 1)\n"
+	"        i = i + 1\n"
+	"    }\n"
+	"    add(sum)\n"
+	"}\n";
+
+static int64_t looper_expected(int64_t n) {
+	int64_t sum = 0;
+	for(int64_t i = 0; i < n;) {
+		sum += 7 * n;
+		if(i == 3) {
+			i += 1;
+			continue;
+		}
+		if(i > 8) {
+			break;
+		}
+		sum += (n + 1) * (n + 1);
+		i += 1;
+	}
+	return sum;
+}
+
+/// counter_text's on_tick, where `count` carries over from one tick to the next
+static int64_t counter_expected(int64_t* count, int64_t n) {
+	for(int64_t i = 0; i < n; i += 1) {
+		*count = i < 2 ? *count + i : *count * 2;
+	}
+	return *count;
+}
+
+#define LOWERINGS 3
+
+/// The IR passes that each lowering runs
+static uint32_t const lowering_passes[LOWERINGS] = {0, GRUG_IR_PASSES_ALL, GRUG_IR_PASSES_ALL};
+/// Whether each lowering gets superinstructions
+static bool const lowering_fused[LOWERINGS] = {false, false, true};
+
+/// Bytecode of the files compiled while lowering_backend is in use, indexed by file id
+struct lowered_file {
+	struct bytecode_file* lowerings[LOWERINGS];
+	size_t on_tick_index;
+};
+static struct lowered_file lowered_files[3];
+
+static grug_backend_vtable_compile_script bytecode_compile_script;
+
+/// Compiles the file with the bytecode backend as usual, and lowers its type checked AST once per lowering on the side
+static void lowering_compile_script(void* backend_data, grug_file_id file_id, struct grug_ast ast) {
+	bytecode_compile_script(backend_data, file_id, ast);
+	CHECK(file_id < 3);
+	if(file_id >= 3) {
+		return;
+	}
+	struct lowered_file* lowered = &lowered_files[file_id];
+	for(size_t index = 0; index < ast.on_functions_count; index += 1) {
+		if(strcmp(ast.on_functions[index].name, "on_tick") == 0) {
+			lowered->on_tick_index = ast.on_functions[index].on_fn_index;
+		}
+	}
+	for(size_t lowering = 0; lowering < LOWERINGS; lowering += 1) {
+		struct grug_ir ir;
+		grug_ir_from_ast(&ir, &ast);
+		grug_ir_optimize(&ir, lowering_passes[lowering]);
+		lowered->lowerings[lowering] = grug_bytecode_compile_file(&ir);
+		grug_ir_free(&ir);
+		if(lowering_fused[lowering]) {
+			grug_bytecode_fuse(lowered->lowerings[lowering]);
+		}
+		CHECK(lowered->lowerings[lowering] && !lowered->lowerings[lowering]->failed);
+	}
+}
+
+/// Runs on_tick(n) of a new entity of `file` for each n in `ticks`, and returns what it added up
+static int64_t run_lowered(struct grug_state* gst, struct bytecode_file const* file, size_t on_tick_index, int64_t const* ticks, size_t ticks_len) {
+	struct bytecode_vm vm;
+	CHECK(grug_bytecode_vm_init(&vm));
+	struct grug_entity entity = {0};
+	CHECK(grug_bytecode_alloc_entity_data(gst, file, &entity));
+	total = 0;
+	CHECK(grug_bytecode_run(&vm, gst, file, &entity, &file->init, NULL));
+	for(size_t index = 0; index < ticks_len; index += 1) {
+		union grug_value arg = {._number = (double)ticks[index]};
+		CHECK(grug_bytecode_run(&vm, gst, file, &entity, &file->on_fns[on_tick_index], &arg));
+	}
+	grug_bytecode_free_entity_data(&entity);
+	grug_bytecode_vm_deinit(&vm);
+	return total;
+}
+
+static void test_lowerings_match(void) {
+	static int64_t const ticks[] = {0, 1, 2, 3, 4, 5, 9, 10, 11, 25};
+	size_t ticks_len = sizeof(ticks) / sizeof(ticks[0]);
+
+	struct grug_backend backend = grug_bytecode_backend_new();
+	CHECK(backend.vtable);
+	if(!backend.vtable) {
+		return;
+	}
+	static struct grug_backend_vtable lowering_vtable;
+	lowering_vtable = *backend.vtable;
+	bytecode_compile_script = lowering_vtable.compile_script;
+	lowering_vtable.compile_script = lowering_compile_script;
+	backend.vtable = &lowering_vtable;
+	memset(lowered_files, 0, sizeof(lowered_files));
+
+	struct grug_state* gst = init_state(0, NULL, NULL, backend);
+	CHECK(gst);
+	if(!gst) {
+		return;
+	}
+	CHECK(grug_register_game_fn(gst, "add", NULL, game_fn_add));
+
+	grug_file_id looper = grug_compile_file_from_str(gst, "looper-Dog.grug", looper_text);
+	grug_file_id counter = grug_compile_file_from_str(gst, "counter-Dog.grug", counter_text);
+	CHECK(looper == 1 && counter == 2);
+
+	int64_t looper_total = 0;
+	int64_t counter_total = 0;
+	int64_t count = 3;
+	for(size_t index = 0; index < ticks_len; index += 1) {
+		looper_total += looper_expected(ticks[index]);
+		counter_total += counter_expected(&count, ticks[index]);
+	}
+	for(size_t lowering = 0; lowering < LOWERINGS && looper == 1 && counter == 2; lowering += 1) {
+		struct bytecode_file const* looper_file = lowered_files[looper].lowerings[lowering];
+		struct bytecode_file const* counter_file = lowered_files[counter].lowerings[lowering];
+		CHECK(run_lowered(gst, looper_file, lowered_files[looper].on_tick_index, ticks, ticks_len) == looper_total);
+		CHECK(run_lowered(gst, counter_file, lowered_files[counter].on_tick_index, ticks, ticks_len) == counter_total);
+	}
+	// Folding `2 * 3 + 1` and dropping the else branch leave less code
+	CHECK(lowered_files[looper].lowerings[1]->code_len < lowered_files[looper].lowerings[0]->code_len);
+	// The loop has pairs to fuse
+	size_t fused_instructions = 0;
+	for(uint32_t index = 0; index < lowered_files[looper].lowerings[2]->code_len; index += 1) {
+		fused_instructions += lowered_files[looper].lowerings[2]->code[index].op != lowered_files[looper].lowerings[1]->code[index].op;
+	}
+	CHECK(fused_instructions > 0);
+
+	for(size_t file_id = 1; file_id < 3; file_id += 1) {
+		for(size_t lowering = 0; lowering < LOWERINGS; lowering += 1) {
+			grug_bytecode_free_file(lowered_files[file_id].lowerings[lowering]);
+		}
+	}
+	grug_deinit(gst);
+}
+
+// MARK: jit
+
+// Has NaN comparisons, `not`, unary minus and a recursive helper, which on_spawn recurses into until the stack overflows
+static char const* jit_ops_text =
+	"on_spawn() {\n"
+	"    add(helper_sum(0 - 1))\n"
+	"}\n"
+	"\n"
+	"on_tick(n: number) {\n"
+	"    nan: number = (n - n) / (n - n)\n"
+	"    same: bool = nan == nan\n"
+	"    if same {\n"
+	"        add(1)\n"
+	"    }\n"
+	"    if nan != nan {\n"
+	"        add(2)\n"
+	"    }\n"
+	"    if nan < n or nan >= n {\n"
+	"        add(4)\n"
+	"    }\n"
+	"    if not (nan > n) and not (nan <= n) {\n"
+	"        add(8)\n"
+	"    }\n"
+	"    if not same {\n"
+	"        add(16)\n"
+	"    }\n"
+	"    add(-n)\n"
+	"    add(-(0 - helper_sum(n)))\n"
+	"}\n"
+	"\n"
+	"helper_sum(n: number) number {\n"
+	"    if n == 0 {\n"
+	"        return 0\n"
+	"    }\n"
+	"    return n + helper_sum(n - 1)\n"
+	"}\n";
+
+static int64_t jit_ops_expected(int64_t n) {
+	return 2 + 8 + 16 - n + n * (n + 1) / 2;
+}
+
+/// What running the same calls on a backend adds up to
+struct backend_run {
+	int64_t looper;
+	int64_t counter;
+	int64_t ops;
+	/// Whether on_spawn's endless recursion failed with a stack overflow, after which on_tick still ran
+	bool overflowed;
+	/// What the looper entity adds up to once its file is recompiled from tenfold_text
+	int64_t reloaded;
+};
+
+/// Runs looper_text, counter_text and jit_ops_text in fast mode with `backend`
+static bool run_backend(struct grug_backend backend, int64_t const* ticks, size_t ticks_len, struct backend_run* out) {
+	CHECK(backend.vtable);
+	if(!backend.vtable) {
+		return false;
+	}
+	struct grug_state* gst = init_state(0, NULL, NULL, backend);
+	if(!gst) {
+		failures += 1;
+		return false;
+	}
+	CHECK(grug_register_game_fn(gst, "add", NULL, game_fn_add));
+	grug_set_fast_mode(gst, true);
+	grug_on_fn_id on_spawn = grug_get_on_fn_id(gst, "Dog", "on_spawn");
+	grug_on_fn_id on_tick = grug_get_on_fn_id(gst, "Dog", "on_tick");
+	grug_file_id looper = grug_compile_file_from_str(gst, "looper-Dog.grug", looper_text);
+	grug_file_id counter = grug_compile_file_from_str(gst, "counter-Dog.grug", counter_text);
+	grug_file_id ops = grug_compile_file_from_str(gst, "ops-Dog.grug", jit_ops_text);
+	CHECK(looper != INVALID_GRUG_FILE_ID && counter != INVALID_GRUG_FILE_ID && ops != INVALID_GRUG_FILE_ID);
+	grug_entity_id looper_entity = grug_create_entity(gst, looper, 1);
+	grug_entity_id counter_entity = grug_create_entity(gst, counter, 2);
+	grug_entity_id ops_entity = grug_create_entity(gst, ops, 3);
+
+	grug_entity_id const entities[] = {looper_entity, counter_entity, ops_entity};
+	int64_t* const totals[] = {&out->looper, &out->counter, &out->ops};
+	for(size_t file = 0; file < 3; file += 1) {
+		total = 0;
+		for(size_t index = 0; index < ticks_len; index += 1) {
+			CHECK(GRUG_CALL(gst, entities[file], on_tick, 1, GRUG_ARG_NUMBER((double)ticks[index])));
+		}
+		*totals[file] = total;
+	}
+
+	total = 0;
+	out->overflowed = !GRUG_CALL_ARGLESS(gst, ops_entity, on_spawn) && total == 0
+		&& grug_error_code_matches(grug_get_error(gst)->error_type, GRUG_ERROR_CODE_RUNTIME_STACK_OVERFLOW)
+		&& GRUG_CALL(gst, ops_entity, on_tick, 1, GRUG_ARG_NUMBER(3)) && total == jit_ops_expected(3);
+
+	// Recompiling replaces the code that the looper entity runs
+	CHECK(grug_compile_file_from_str(gst, "looper-Dog.grug", tenfold_text) == looper);
+	total = 0;
+	CHECK(GRUG_CALL(gst, looper_entity, on_tick, 1, GRUG_ARG_NUMBER(7)));
+	out->reloaded = total;
+	grug_deinit(gst);
+	return true;
+}
+
+static void test_jit_matches_bytecode(void) {
+	static int64_t const ticks[] = {0, 1, 2, 3, 4, 5, 9, 10, 11, 25};
+	size_t ticks_len = sizeof(ticks) / sizeof(ticks[0]);
+	struct backend_run interpreted = {0};
+	struct backend_run jitted = {0};
+	if(!run_backend(grug_bytecode_backend_new(), ticks, ticks_len, &interpreted) || !run_backend(grug_jit_backend_new(), ticks, ticks_len, &jitted)) {
+		return;
+	}
+	int64_t looper_total = 0;
+	int64_t counter_total = 0;
+	int64_t ops_total = 0;
+	int64_t count = 3;
+	for(size_t index = 0; index < ticks_len; index += 1) {
+		looper_total += looper_expected(ticks[index]);
+		counter_total += counter_expected(&count, ticks[index]);
+		ops_total += jit_ops_expected(ticks[index]);
+	}
+	CHECK(interpreted.looper == looper_total && jitted.looper == looper_total);
+	CHECK(interpreted.counter == counter_total && jitted.counter == counter_total);
+	CHECK(interpreted.ops == ops_total && jitted.ops == ops_total);
+	CHECK(interpreted.overflowed && jitted.overflowed);
+	CHECK(interpreted.reloaded == 70 && jitted.reloaded == 70);
+}
+
+// MARK: batches
+
+#define BATCH_ENTITIES 3000
+
+struct batch_outcome {
+	bool succeeded;
+	int64_t total;
+	bool results[BATCH_ENTITIES];
+};
+
+/// Ticks entities of the three files, interleaved so that every worker's range crosses the entities of the file without on_tick
+static bool run_batch(uint32_t worker_threads, struct batch_outcome* out) {
+	struct grug_state* gst = new_state(worker_threads, NULL, NULL);
+	if(!gst) {
+		return false;
+	}
+	grug_file_id files[] = {
+		grug_compile_file_from_str(gst, "adder-Dog.grug", adder_text),
+		grug_compile_file_from_str(gst, "sleeper-Dog.grug", sleeper_text),
+		grug_compile_file_from_str(gst, "doubler-Dog.grug", doubler_text),
+	};
+	static grug_entity_id entities[BATCH_ENTITIES];
+	static union grug_value args[BATCH_ENTITIES];
+	for(size_t index = 0; index < BATCH_ENTITIES; index += 1) {
+		CHECK(files[index % 3] != INVALID_GRUG_FILE_ID);
+		entities[index] = grug_create_entity(gst, files[index % 3], (grug_object_id)index);
+		args[index] = GRUG_ARG_NUMBER((double)(index % 7 + 1));
+	}
+	grug_on_fn_id on_tick = grug_get_on_fn_id(gst, "Dog", "on_tick");
+	total = 0;
+	out->succeeded = grug_call_on_function_batch(gst, on_tick, entities, BATCH_ENTITIES, args, 1, out->results);
+	out->total = total;
+	grug_deinit(gst);
+	return true;
+}
+
+static void test_batch_threads_match_serial(void) {
+	static struct batch_outcome serial;
+	static struct batch_outcome threaded;
+	if(!run_batch(0, &serial)) {
+		failures += 1;
+		return;
+	}
+	int64_t expected = 0;
+	for(size_t index = 0; index < BATCH_ENTITIES; index += 1) {
+		int64_t n = (int64_t)(index % 7 + 1);
+		expected += index % 3 == 0 ? n : index % 3 == 2 ? n * 2 : 0;
+	}
+	CHECK(serial.succeeded);
+	CHECK(serial.total == expected);
+	uint32_t const thread_counts[] = {1, 3, 4};
+	for(size_t count_index = 0; count_index < sizeof(thread_counts) / sizeof(thread_counts[0]); count_index += 1) {
+		if(!run_batch(thread_counts[count_index], &threaded)) {
+			failures += 1;
+			continue;
+		}
+		CHECK(threaded.succeeded == serial.succeeded);
+		CHECK(threaded.total == serial.total);
+		CHECK(memcmp(threaded.results, serial.results, sizeof(serial.results)) == 0);
+	}
+}
+
+/// What game_fn_probing_add expects the grug_state it gets to show, which it counts the differences from
+struct state_probe {
+	struct grug_state* main;
+	uint64_t epoch;
+	grug_on_fn_id on_tick;
+	uint64_t mismatches;
+	bool worker_seen;
+};
+
+/// Adds like game_fn_add, but raises a runtime error for negative numbers, and checks what the calling thread's grug_state shows
+static union grug_value game_fn_probing_add(struct grug_state* gst, void* data, const union grug_value args[]) {
+	struct state_probe* probe = data;
+	if(gst != probe->main) {
+		__atomic_store_n(&probe->worker_seen, true, __ATOMIC_RELAXED);
+	}
+	bool matches = grug_reload_epoch(gst) == probe->epoch && grug_get_on_fn_id(gst, "Dog", "on_tick") == probe->on_tick;
+	if(args[0]._number < 0) {
+		grug_game_fn_runtime_error(gst, "negative");
+		matches &= grug_runtime_error_raised(gst) && strcmp(grug_get_error(gst)->message, "negative") == 0;
+	} else {
+		__atomic_fetch_add(&total, (int64_t)args[0]._number, __ATOMIC_RELAXED);
+	}
+	if(!matches) {
+		__atomic_fetch_add(&probe->mismatches, 1, __ATOMIC_RELAXED);
+	}
+	return (union grug_value) {0};
+}
+
+/// Game functions on worker threads look up the state through the grug_state they get, which has to show files compiled since the last batch
+static void test_batch_workers_see_the_state(void) {
+	struct grug_state* gst = init_state(3, NULL, NULL, (struct grug_backend) {0});
+	if(!gst) {
+		failures += 1;
+		return;
+	}
+	static struct state_probe probe;
+	probe = (struct state_probe) {.main = gst, .on_tick = grug_get_on_fn_id(gst, "Dog", "on_tick")};
+	CHECK(grug_register_game_fn(gst, "add", &probe, game_fn_probing_add));
+	CHECK(grug_set_game_fn_thread_safe(gst, "add", true));
+
+	static grug_entity_id entities[BATCH_ENTITIES];
+	static union grug_value args[BATCH_ENTITIES];
+	static bool results[BATCH_ENTITIES];
+	size_t half = BATCH_ENTITIES / 2;
+	grug_file_id adder = grug_compile_file_from_str(gst, "adder-Dog.grug", adder_text);
+	CHECK(adder != INVALID_GRUG_FILE_ID);
+	int64_t expected = 0;
+	size_t expected_failures = 0;
+	for(size_t index = 0; index < half; index += 1) {
+		entities[index] = grug_create_entity(gst, adder, (grug_object_id)index);
+		int64_t n = index % 100 == 0 ? -1 : (int64_t)(index % 7 + 1);
+		args[index] = GRUG_ARG_NUMBER((double)n);
+		if(n < 0) {
+			expected_failures += 1;
+		} else {
+			expected += n;
+		}
+	}
+	probe.epoch = grug_reload_epoch(gst);
+	total = 0;
+	CHECK(!grug_call_on_function_batch(gst, probe.on_tick, entities, half, args, 1, results));
+	CHECK(total == expected);
+	size_t failed = 0;
+	for(size_t index = 0; index < half; index += 1) {
+		CHECK(results[index] == (args[index]._number >= 0));
+		if(!results[index]) {
+			failed += 1;
+		}
+	}
+	CHECK(failed == expected_failures);
+
+	// The second batch has to run the new file and see the new epoch without anything being copied to the workers
+	grug_file_id doubler = grug_compile_file_from_str(gst, "doubler-Dog.grug", doubler_text);
+	CHECK(doubler != INVALID_GRUG_FILE_ID);
+	for(size_t index = half; index < BATCH_ENTITIES; index += 1) {
+		entities[index] = grug_create_entity(gst, doubler, (grug_object_id)index);
+		args[index] = GRUG_ARG_NUMBER(1);
+		expected += 2;
+	}
+	probe.epoch = grug_reload_epoch(gst);
+	total = 0;
+	CHECK(!grug_call_on_function_batch(gst, probe.on_tick, entities, BATCH_ENTITIES, args, 1, results));
+	CHECK(total == expected);
+	CHECK(probe.mismatches == 0);
+	CHECK(probe.worker_seen);
+	grug_deinit(gst);
+}
+
+// MARK: handles
+
+static void test_handles_after_reload(void) {
+	struct grug_state* gst = new_state(0, NULL, NULL);
+	if(!gst) {
+		failures += 1;
+		return;
+	}
+	grug_on_fn_id on_tick = grug_get_on_fn_id(gst, "Dog", "on_tick");
+	grug_file_id file = grug_compile_file_from_str(gst, "reloaded-Dog.grug", adder_text);
+	grug_entity_id entity = grug_create_entity(gst, file, 1);
+	CHECK(entity);
+	union grug_value arg = GRUG_ARG_NUMBER(2);
+
+	struct grug_on_fn_handle handle = grug_get_on_fn_handle(gst, file, on_tick);
+	CHECK(grug_on_fn_handle_valid(gst, &handle));
+	total = 0;
+	CHECK(grug_call_on_fn_handle(gst, &handle, entity, &arg, 1));
+	CHECK(total == 2);
+	// A wrong number of arguments is caught outside of fast mode
+	CHECK(!grug_call_on_fn_handle(gst, &handle, entity, &arg, 0));
+	CHECK(total == 2);
+
+	// Recompiling the file keeps its id and its entities, but not the handles resolved before it
+	uint64_t epoch = grug_reload_epoch(gst);
+	CHECK(grug_compile_file_from_str(gst, "reloaded-Dog.grug", tenfold_text) == file);
+	CHECK(grug_reload_epoch(gst) > epoch);
+	CHECK(!grug_on_fn_handle_valid(gst, &handle));
+	CHECK(!grug_call_on_fn_handle(gst, &handle, entity, &arg, 1));
+	CHECK(total == 2);
+	CHECK(grug_entity_get_file_id(gst, entity) == file);
+
+	handle = grug_get_on_fn_handle(gst, file, on_tick);
+	CHECK(grug_on_fn_handle_valid(gst, &handle));
+	CHECK(grug_call_on_fn_handle(gst, &handle, entity, &arg, 1));
+	CHECK(total == 22);
+
+	// The id of a destroyed entity doesn't reach whatever entity reuses its slot
+	grug_deinit_entity(gst, entity);
+	grug_entity_id reused = grug_create_entity(gst, file, 2);
+	CHECK(reused && reused != entity);
+	CHECK(!grug_call_on_fn_handle(gst, &handle, entity, &arg, 1));
+	CHECK(total == 22);
+
+	struct grug_on_fn_handle unresolved = grug_get_on_fn_handle(gst, file + 1, on_tick);
+	CHECK(!unresolved.call);
+	CHECK(!grug_on_fn_handle_valid(gst, &unresolved));
+	grug_deinit(gst);
+}
+
+// MARK: entities
+
+static void test_entity_ids_are_generational(void) {
+	struct grug_state* gst = new_state(0, NULL, NULL);
+	if(!gst) {
+		failures += 1;
+		return;
+	}
+	grug_on_fn_id on_tick = grug_get_on_fn_id(gst, "Dog", "on_tick");
+	grug_file_id file = grug_compile_file_from_str(gst, "generational-Dog.grug", adder_text);
+	grug_entity_id stale = grug_create_entity(gst, file, 1);
+	CHECK(stale != INVALID_GRUG_ENTITY_ID);
+	grug_deinit_entity(gst, stale);
+
+	// The next entity reuses the freed slot, which the low 32 bits name, under a new generation
+	grug_entity_id reused = grug_create_entity(gst, file, 2);
+	CHECK(reused != INVALID_GRUG_ENTITY_ID);
+	CHECK((uint32_t)reused == (uint32_t)stale);
+	CHECK(reused != stale);
+
+	CHECK(grug_entity_get_file_id(gst, stale) == 0);
+	CHECK(!grug_entity_get_data(gst, stale));
+	CHECK(!grug_entity_members(gst, stale));
+	total = 0;
+	CHECK(!GRUG_CALL(gst, stale, on_tick, 1, GRUG_ARG_NUMBER(5)));
+	CHECK(total == 0);
+	// Deinitializing the stale id again leaves the entity in its slot alone
+	grug_deinit_entity(gst, stale);
+
+	CHECK(grug_entity_get_file_id(gst, reused) == file);
+	struct grug_entity* data = grug_entity_get_data(gst, reused);
+	CHECK(data && data->id == reused && data->me == 2);
+	CHECK(GRUG_CALL(gst, reused, on_tick, 1, GRUG_ARG_NUMBER(5)));
+	CHECK(total == 5);
+
+	// Churning through the same slot never hands out an id twice
+	grug_entity_id previous = reused;
+	for(size_t index = 0; index < 100; index += 1) {
+		grug_deinit_entity(gst, previous);
+		grug_entity_id next = grug_create_entity(gst, file, 3);
+		CHECK((uint32_t)next == (uint32_t)stale);
+		CHECK(next != previous && next != stale && next != reused);
+		CHECK(grug_entity_get_file_id(gst, previous) == 0);
+		previous = next;
+	}
+	CHECK(grug_entity_get_file_id(gst, previous) == file);
+	grug_deinit(gst);
+}
+
+static void test_member_layout(void) {
+	struct grug_state* gst = new_state(0, NULL, NULL);
+	if(!gst) {
+		failures += 1;
+		return;
+	}
+	grug_on_fn_id on_tick = grug_get_on_fn_id(gst, "Dog", "on_tick");
+	grug_file_id file = grug_compile_file_from_str(gst, "layout-Dog.grug", counter_text);
+	struct grug_member_layout const* members;
+	CHECK(grug_get_member_layout(gst, file, &members) == 2);
+	// The built-in backends keep the members of neighbouring entities between those of one entity
+	size_t stride = BYTECODE_MEMBERS_CHUNK * sizeof(union grug_value);
+	CHECK(strcmp(members[0].name, "count") == 0);
+	CHECK(members[0].type.type == GRUG_TYPE_NUMBER);
+	CHECK(members[0].slot == 0 && members[0].offset == 0);
+	CHECK(strcmp(members[1].name, "label") == 0);
+	CHECK(members[1].type.type == GRUG_TYPE_STRING);
+	CHECK(members[1].slot == 1 && members[1].offset == stride);
+	// Reading through a wrong layout would be reading garbage
+	bool laid_out = members[0].offset == 0 && members[1].offset == stride;
+
+	grug_entity_id entity = grug_create_entity(gst, file, 1);
+	char* base = grug_entity_members(gst, entity);
+	CHECK(base);
+	if(base && laid_out) {
+		union grug_value* count = (union grug_value*)(base + members[0].offset);
+		union grug_value* label = (union grug_value*)(base + members[1].offset);
+		CHECK(count->_number == 3);
+		CHECK(strcmp(label->_string, "counter") == 0);
+
+		// The layout sees what on functions write, and on functions see what the game writes
+		total = 0;
+		CHECK(GRUG_CALL(gst, entity, on_tick, 1, GRUG_ARG_NUMBER(5)));
+		CHECK(count->_number == 32 && total == 32);
+		count->_number = 100;
+		CHECK(GRUG_CALL(gst, entity, on_tick, 1, GRUG_ARG_NUMBER(0)));
+		CHECK(total == 132);
+	}
+
+	// A second entity of the file has its own members at the same offsets
+	grug_entity_id other = grug_create_entity(gst, file, 2);
+	char* other_base = grug_entity_members(gst, other);
+	CHECK(other_base && other_base != base);
+	if(other_base && laid_out) {
+		CHECK(((union grug_value*)(other_base + members[0].offset))->_number == 3);
+	}
+
+	CHECK(grug_get_member_layout(gst, file + 1, &members) == 0 && !members);
+	grug_deinit(gst);
+}
+
+static grug_backend_vtable_call_on_function counted_call_on_function;
+static size_t backend_calls;
+
+static bool counting_call_on_function(void* backend_data, struct grug_state* gst, struct grug_entity* entity, uint64_t on_fn_index, union grug_value* args, size_t args_len) {
+	backend_calls += 1;
+	return counted_call_on_function(backend_data, gst, entity, on_fn_index, args, args_len);
+}
+
+static void test_entities_defining_on_fn(void) {
+	struct grug_backend backend = grug_bytecode_backend_new();
+	CHECK(backend.vtable);
+	if(!backend.vtable) {
+		return;
+	}
+	static struct grug_backend_vtable counting_vtable;
+	counting_vtable = *backend.vtable;
+	counted_call_on_function = counting_vtable.call_on_function;
+	counting_vtable.call_on_function = counting_call_on_function;
+	backend.vtable = &counting_vtable;
+	struct grug_state* gst = init_state(0, NULL, NULL, backend);
+	if(!gst) {
+		failures += 1;
+		return;
+	}
+	CHECK(grug_register_game_fn(gst, "add", NULL, game_fn_add));
+	grug_on_fn_id on_spawn = grug_get_on_fn_id(gst, "Dog", "on_spawn");
+	grug_on_fn_id on_tick = grug_get_on_fn_id(gst, "Dog", "on_tick");
+	grug_file_id adder = grug_compile_file_from_str(gst, "adder-Dog.grug", adder_text);
+	grug_file_id sleeper = grug_compile_file_from_str(gst, "sleeper-Dog.grug", sleeper_text);
+	grug_file_id doubler = grug_compile_file_from_str(gst, "doubler-Dog.grug", doubler_text);
+	CHECK(grug_file_defines_on_fn(gst, adder, on_tick) && !grug_file_defines_on_fn(gst, adder, on_spawn));
+	CHECK(!grug_file_defines_on_fn(gst, sleeper, on_tick) && grug_file_defines_on_fn(gst, sleeper, on_spawn));
+	CHECK(grug_file_defines_on_fn(gst, doubler, on_tick));
+	CHECK(!grug_file_defines_on_fn(gst, doubler + 1, on_tick));
+
+	grug_entity_id first_adder = grug_create_entity(gst, adder, 1);
+	grug_entity_id first_sleeper = grug_create_entity(gst, sleeper, 2);
+	grug_entity_id second_adder = grug_create_entity(gst, adder, 3);
+	grug_entity_id second_sleeper = grug_create_entity(gst, sleeper, 4);
+	grug_entity_id doubler_entity = grug_create_entity(gst, doubler, 5);
+
+	// A capacity of 0 only counts them, and a capacity that is too small still gets the full count
+	CHECK(grug_get_entities_defining_on_fn(gst, on_tick, NULL, 0) == 3);
+	grug_entity_id defining[4] = {0, 0, 0, 0};
+	CHECK(grug_get_entities_defining_on_fn(gst, on_tick, defining, 2) == 3);
+	CHECK(defining[0] == first_adder && defining[1] == second_adder && defining[2] == 0);
+	CHECK(grug_get_entities_defining_on_fn(gst, on_tick, defining, 4) == 3);
+	CHECK(defining[0] == first_adder && defining[1] == second_adder && defining[2] == doubler_entity && defining[3] == 0);
+	CHECK(grug_get_entities_defining_on_fn(gst, on_spawn, defining, 4) == 2);
+	CHECK(defining[0] == first_sleeper && defining[1] == second_sleeper);
+
+	// Calling on_tick on entities that don't define it succeeds, but never reaches the backend
+	backend_calls = 0;
+	total = 0;
+	CHECK(GRUG_CALL(gst, first_sleeper, on_tick, 1, GRUG_ARG_NUMBER(5)));
+	CHECK(GRUG_CALL(gst, second_sleeper, on_tick, 1, GRUG_ARG_NUMBER(5)));
+	CHECK(backend_calls == 0 && total == 0);
+	CHECK(GRUG_CALL(gst, first_adder, on_tick, 1, GRUG_ARG_NUMBER(5)));
+	CHECK(GRUG_CALL(gst, doubler_entity, on_tick, 1, GRUG_ARG_NUMBER(5)));
+	CHECK(backend_calls == 2 && total == 15);
+
+	// Deinitialized entities aren't listed
+	grug_deinit_entity(gst, second_adder);
+	CHECK(grug_get_entities_defining_on_fn(gst, on_tick, defining, 4) == 2);
+	CHECK(defining[0] == first_adder && defining[1] == doubler_entity);
+	grug_deinit(gst);
+}
+
+// MARK: cache
+
+#if defined(__unix__) || defined(__APPLE__)
+
+/// Compiles counter_text in a new state that caches in `cache_dir_path`, and returns what ticking an entity of it adds up to
+static int64_t tick_counter(char const* cache_dir_path, struct grug_cache_stats* out_stats) {
+	struct grug_state* gst = new_state(0, cache_dir_path, NULL);
+	if(!gst) {
+		failures += 1;
+		return -1;
+	}
+	grug_file_id file = grug_compile_file_from_str(gst, "counter-Dog.grug", counter_text);
+	CHECK(file != INVALID_GRUG_FILE_ID);
+	grug_entity_id entity = grug_create_entity(gst, file, 1);
+	total = 0;
+	CHECK(GRUG_CALL(gst, entity, grug_get_on_fn_id(gst, "Dog", "on_tick"), 1, GRUG_ARG_NUMBER(5)));
+	CHECK(GRUG_CALL(gst, entity, grug_get_on_fn_id(gst, "Dog", "on_tick"), 1, GRUG_ARG_NUMBER(3)));
+	*out_stats = grug_get_cache_stats(gst);
+	grug_deinit(gst);
+	return total;
+}
+
+static void test_cache_hit_matches_cold_compile(void) {
+	char dir_path[] = "/tmp/grug_test_cache_XXXXXX";
+	if(!mkdtemp(dir_path)) {
+		(void)fprintf(stderr, "Failed to create a cache directory\n");
+		failures += 1;
+		return;
+	}
+	struct grug_cache_stats uncached_stats;
+	int64_t uncached = tick_counter(NULL, &uncached_stats);
+	// Ticking by 5 adds 32, after which ticking by 3 adds 66
+	CHECK(uncached == 98);
+	CHECK(uncached_stats.hits == 0 && uncached_stats.stored == 0);
+
+	struct grug_cache_stats cold_stats;
+	int64_t cold = tick_counter(dir_path, &cold_stats);
+	CHECK(cold_stats.misses == 1);
+	CHECK(cold_stats.stored == 1);
+	CHECK(cold_stats.hits == 0);
+
+	struct grug_cache_stats warm_stats;
+	int64_t warm = tick_counter(dir_path, &warm_stats);
+	CHECK(warm_stats.hits == 1);
+	CHECK(warm_stats.misses == 0);
+
+	CHECK(cold == uncached);
+	CHECK(warm == cold);
+	remove_dir(dir_path);
+}
+
+#endif
+
+// MARK: mods directory
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#define MODS_FILES 9
+
+/// Enough files that grug_get_mods prepares them on the worker threads, in nested directories and with one that doesn't compile
+static char const* const mods_files[MODS_FILES][2] = {
+	{"b-Dog.grug", "on_tick(n: number) {\n    add(n * 2)\n}\n"},
+	{"a-Dog.grug", "on_tick(n: number) {\n    add(n)\n}\n"},
+	{"pack/d-Dog.grug", "on_tick(n: number) {\n    add(n * 10)\n}\n"},
+	{"pack/c-Dog.grug", "on_tick(n: number) {\n    add(n + 100)\n}\n"},
+	{"pack/inner/e-Dog.grug", "on_tick(n: number) {\n    add(n * n)\n}\n"},
+	{"pack/inner/f-Dog.grug", "on_spawn() {\n    add(1000000)\n}\n"},
+	{"pack/inner/g-Dog.grug", "on_tick(n: number) {\n    add(n - 1)\n}\n"},
+	{"broken-Dog.grug", "on_tick(n: number) {\n    add(m)\n}\n"},
+	{"z-Dog.grug", "on_tick(n: number) {\n    add(n * 3)\n}\n"},
+};
+
+struct mods_outcome {
+	size_t files_len;
+	/// Copied, as the names die with the state
+	char names[MODS_FILES][64];
+	grug_file_id ids[MODS_FILES];
+	bool errors[MODS_FILES];
+	/// What ticking an entity of each file by 3 adds up to
+	int64_t totals[MODS_FILES];
+	size_t updates_after;
+};
+
+/// Adds the files of `dir` and of the directories in it to `out`, ticking an entity of every file that compiled
+static void collect_mods(struct grug_state* gst, struct grug_mod_dir const* dir, struct mods_outcome* out) { // NOLINT(misc-no-recursion): only as deep as the test makes it
+	for(size_t file_index = 0; file_index < dir->files_size && out->files_len < MODS_FILES; file_index += 1) {
+		struct grug_file const* file = &dir->files[file_index];
+		size_t index = out->files_len++;
+		(void)snprintf(out->names[index], sizeof(out->names[index]), "%s", file->name);
+		out->ids[index] = file->id;
+		out->errors[index] = file->error != NULL;
+		CHECK(strcmp(file->entity_type, "Dog") == 0);
+		if(!file->error) {
+			grug_entity_id entity = grug_create_entity(gst, file->id, 1);
+			total = 0;
+			CHECK(GRUG_CALL(gst, entity, grug_get_on_fn_id(gst, "Dog", "on_tick"), 1, GRUG_ARG_NUMBER(3)));
+			out->totals[index] = total;
+		}
+	}
+	for(size_t mod_index = 0; mod_index < dir->mods_size; mod_index += 1) {
+		collect_mods(gst, dir->mods[mod_index], out);
+	}
+}
+
+static bool load_mods(char const* dir_path, uint32_t worker_threads, struct mods_outcome* out) {
+	struct grug_state* gst = new_state(worker_threads, NULL, dir_path);
+	if(!gst) {
+		return false;
+	}
+	struct grug_mod_dir const* mods = grug_get_mods(gst);
+	CHECK(mods);
+	if(mods) {
+		CHECK(strncmp(mods->name, "grug_test_mods_", 15) == 0);
+		collect_mods(gst, mods, out);
+	}
+	// grug_get_mods compiled everything already, so there is nothing left to update
+	out->updates_after = grug_update(gst).count;
+	grug_deinit(gst);
+	return true;
+}
+
+static void test_get_mods_threads_match_serial(void) {
+	char dir_path[] = "/tmp/grug_test_mods_XXXXXX";
+	if(!mkdtemp(dir_path)) {
+		(void)fprintf(stderr, "Failed to create a mods directory\n");
+		failures += 1;
+		return;
+	}
+	for(size_t file_index = 0; file_index < MODS_FILES; file_index += 1) {
+		CHECK(write_file(dir_path, mods_files[file_index][0], mods_files[file_index][1]));
+	}
+	static struct mods_outcome serial;
+	static struct mods_outcome threaded;
+	if(!load_mods(dir_path, 0, &serial) || !load_mods(dir_path, 4, &threaded)) {
+		failures += 1;
+		remove_dir(dir_path);
+		return;
+	}
+	CHECK(serial.files_len == MODS_FILES);
+	CHECK(serial.updates_after == 0);
+
+	// Files that compiled get the ids from 1 up, in the order of their paths
+	bool id_taken[MODS_FILES + 1] = {0};
+	size_t errors = 0;
+	for(size_t index = 0; index < serial.files_len; index += 1) {
+		if(serial.errors[index]) {
+			errors += 1;
+			CHECK(strcmp(serial.names[index], "broken-Dog.grug") == 0);
+			CHECK(serial.ids[index] == INVALID_GRUG_FILE_ID);
+		} else if(serial.ids[index] >= 1 && serial.ids[index] < MODS_FILES) {
+			CHECK(!id_taken[serial.ids[index]]);
+			id_taken[serial.ids[index]] = true;
+		} else {
+			CHECK(serial.ids[index] >= 1 && serial.ids[index] < MODS_FILES);
+		}
+	}
+	CHECK(errors == 1);
+	// The tree lists the files of a directory before its directories, in the order of their paths
+	CHECK(strcmp(serial.names[0], "a-Dog.grug") == 0 && serial.ids[0] == 1 && serial.totals[0] == 3);
+	CHECK(strcmp(serial.names[1], "b-Dog.grug") == 0 && serial.ids[1] == 2 && serial.totals[1] == 6);
+	CHECK(strcmp(serial.names[3], "z-Dog.grug") == 0 && serial.ids[3] == 8 && serial.totals[3] == 9);
+	CHECK(strcmp(serial.names[4], "c-Dog.grug") == 0 && serial.ids[4] == 3 && serial.totals[4] == 103);
+	CHECK(strcmp(serial.names[8], "g-Dog.grug") == 0 && serial.ids[8] == 7 && serial.totals[8] == 2);
+
+	CHECK(threaded.files_len == serial.files_len);
+	CHECK(threaded.updates_after == 0);
+	for(size_t index = 0; index < serial.files_len && index < threaded.files_len; index += 1) {
+		CHECK(strcmp(threaded.names[index], serial.names[index]) == 0);
+		CHECK(threaded.ids[index] == serial.ids[index]);
+		CHECK(threaded.errors[index] == serial.errors[index]);
+		CHECK(threaded.totals[index] == serial.totals[index]);
+	}
+	remove_dir(dir_path);
+}
+
+#endif
+
+// MARK: hot reloading
+
+#if defined(__unix__) || defined(__APPLE__)
+
+/// Returns the update for the file called `name` in `updates`, picking the one that is or isn't `removed`, or NULL if there is none
+static struct grug_file const* find_update(struct grug_updates_list updates, char const* name, bool removed) {
+	for(size_t index = 0; index < updates.count; index += 1) {
+		if(strcmp(updates.updates[index].name, name) == 0 && updates.updates[index].removed == removed) {
+			return &updates.updates[index];
+		}
+	}
+	return NULL;
+}
+
+static void test_update_reports_written_files(void) {
+	char dir_path[] = "/tmp/grug_test_written_XXXXXX";
+	if(!mkdtemp(dir_path)) {
+		(void)fprintf(stderr, "Failed to create a mods directory\n");
+		failures += 1;
+		return;
+	}
+	struct grug_state* gst = new_state(0, NULL, dir_path);
+	if(!gst) {
+		failures += 1;
+		remove_dir(dir_path);
+		return;
+	}
+	grug_on_fn_id on_tick = grug_get_on_fn_id(gst, "Dog", "on_tick");
+	CHECK(grug_update(gst).count == 0);
+
+	// A file written after an update is reported by the next one, and then never again while it stays the same
+	CHECK(write_file(dir_path, "pack/a-Dog.grug", adder_text));
+	struct grug_updates_list updates = grug_update(gst);
+	CHECK(updates.count == 1);
+	struct grug_file const* added = find_update(updates, "a-Dog.grug", false);
+	CHECK(added && added->id != INVALID_GRUG_FILE_ID && !added->error);
+	grug_file_id adder = added ? added->id : INVALID_GRUG_FILE_ID;
+	for(size_t index = 0; index < 3; index += 1) {
+		CHECK(grug_update(gst).count == 0);
+	}
+	struct grug_update_stats stats = grug_get_update_stats(gst);
+	CHECK(stats.files_changed == 1 && stats.files_recompiled == 1);
+
+	grug_entity_id entity = grug_create_entity(gst, adder, 1);
+	total = 0;
+	CHECK(GRUG_CALL(gst, entity, on_tick, 1, GRUG_ARG_NUMBER(5)));
+	CHECK(total == 5);
+
+	// Writing something else to it is reported once more, under the same id
+	CHECK(write_file(dir_path, "pack/a-Dog.grug", doubler_text));
+	updates = grug_update(gst);
+	CHECK(updates.count == 1);
+	added = find_update(updates, "a-Dog.grug", false);
+	CHECK(added && added->id == adder);
+	CHECK(grug_update(gst).count == 0);
+	total = 0;
+	CHECK(GRUG_CALL(gst, entity, on_tick, 1, GRUG_ARG_NUMBER(5)));
+	CHECK(total == 10);
+
+	grug_deinit(gst);
+	remove_dir(dir_path);
+}
+
+static void test_unchanged_rewrite_is_not_recompiled(void) {
+	char dir_path[] = "/tmp/grug_test_unchanged_XXXXXX";
+	if(!mkdtemp(dir_path)) {
+		(void)fprintf(stderr, "Failed to create a mods directory\n");
+		failures += 1;
+		return;
+	}
+	CHECK(write_file(dir_path, "counter-Dog.grug", counter_text));
+	struct grug_state* gst = new_state(0, NULL, dir_path);
+	if(!gst) {
+		failures += 1;
+		remove_dir(dir_path);
+		return;
+	}
+	grug_on_fn_id on_tick = grug_get_on_fn_id(gst, "Dog", "on_tick");
+	struct grug_updates_list updates = grug_update(gst);
+	CHECK(updates.count == 1);
+	grug_file_id counter = updates.count == 1 ? updates.updates[0].id : INVALID_GRUG_FILE_ID;
+	grug_entity_id entity = grug_create_entity(gst, counter, 1);
+	total = 0;
+	CHECK(GRUG_CALL(gst, entity, on_tick, 1, GRUG_ARG_NUMBER(5)));
+	CHECK(total == 32);
+	struct grug_on_fn_handle handle = grug_get_on_fn_handle(gst, counter, on_tick);
+	uint64_t epoch = grug_reload_epoch(gst);
+	struct grug_update_stats before = grug_get_update_stats(gst);
+
+	// Writing the same contents back is seen, but skipped, so the entity keeps the count it ticked up to
+	CHECK(write_file(dir_path, "counter-Dog.grug", counter_text));
+	CHECK(grug_update(gst).count == 0);
+	struct grug_update_stats after = grug_get_update_stats(gst);
+	CHECK(after.files_changed == before.files_changed + 1);
+	CHECK(after.files_unchanged == before.files_unchanged + 1);
+	CHECK(after.files_recompiled == before.files_recompiled);
+	CHECK(grug_reload_epoch(gst) == epoch);
+	CHECK(grug_on_fn_handle_valid(gst, &handle));
+	union grug_value arg = GRUG_ARG_NUMBER(3);
+	total = 0;
+	CHECK(grug_call_on_fn_handle(gst, &handle, entity, &arg, 1));
+	// Ticking by 3 after ticking by 5 adds 66, where a reinitialized count would add 8
+	CHECK(total == 66);
+
+	// Writing something else is recompiled, like before
+	CHECK(write_file(dir_path, "counter-Dog.grug", adder_text));
+	updates = grug_update(gst);
+	CHECK(updates.count == 1 && updates.updates[0].id == counter);
+	after = grug_get_update_stats(gst);
+	CHECK(after.files_unchanged == before.files_unchanged + 1);
+	CHECK(after.files_recompiled == before.files_recompiled + 1);
+	CHECK(!grug_on_fn_handle_valid(gst, &handle));
+
+	grug_deinit(gst);
+	remove_dir(dir_path);
+}
+
+static void test_update_reports_removed_files(void) {
+	char dir_path[] = "/tmp/grug_test_removed_XXXXXX";
+	if(!mkdtemp(dir_path)) {
+		(void)fprintf(stderr, "Failed to create a mods directory\n");
+		failures += 1;
+		return;
+	}
+	char path[4096];
+	char moved_path[4096];
+	CHECK(write_file(dir_path, "a-Dog.grug", adder_text));
+	CHECK(write_file(dir_path, "pack/b-Dog.grug", doubler_text));
+	struct grug_state* gst = new_state(0, NULL, dir_path);
+	if(!gst) {
+		failures += 1;
+		remove_dir(dir_path);
+		return;
+	}
+	grug_on_fn_id on_tick = grug_get_on_fn_id(gst, "Dog", "on_tick");
+	CHECK(grug_update(gst).count == 2);
+	struct grug_mod_dir const* mods = grug_get_mods(gst);
+	CHECK(mods->files_size == 1 && mods->mods_size == 1);
+	grug_file_id adder = mods->files[0].id;
+	grug_file_id doubler = mods->mods[0]->files[0].id;
+	grug_entity_id entity = grug_create_entity(gst, adder, 1);
+
+	// A deleted file is reported once, and its entities stop running its code
+	(void)snprintf(path, sizeof(path), "%s/a-Dog.grug", dir_path);
+	CHECK(unlink(path) == 0);
+	struct grug_updates_list updates = grug_update(gst);
+	CHECK(updates.count == 1);
+	struct grug_file const* removed = find_update(updates, "a-Dog.grug", true);
+	CHECK(removed && removed->id == adder && !removed->error);
+	CHECK(grug_update(gst).count == 0);
+	CHECK(grug_get_update_stats(gst).files_removed == 1);
+	total = 0;
+	CHECK(GRUG_CALL(gst, entity, on_tick, 1, GRUG_ARG_NUMBER(5)));
+	CHECK(total == 0);
+	CHECK(!grug_file_defines_on_fn(gst, adder, on_tick));
+	CHECK(grug_create_entity(gst, adder, 2) == INVALID_GRUG_ENTITY_ID);
+	CHECK(mods->files_size == 0 && mods->mods_size == 1);
+
+	// A directory that is moved takes its files with it, which are removed at their old paths
+	(void)snprintf(path, sizeof(path), "%s/pack", dir_path);
+	(void)snprintf(moved_path, sizeof(moved_path), "%s/moved", dir_path);
+	CHECK(rename(path, moved_path) == 0);
+	updates = grug_update(gst);
+	CHECK(updates.count == 2);
+	removed = find_update(updates, "b-Dog.grug", true);
+	CHECK(removed && removed->id == doubler);
+	struct grug_file const* added = find_update(updates, "b-Dog.grug", false);
+	CHECK(added && added->id != doubler && added->id != INVALID_GRUG_FILE_ID);
+	CHECK(mods->mods_size == 1 && strcmp(mods->mods[0]->name, "moved") == 0);
+
+	// A file that comes back keeps its id, and its entities run it again
+	CHECK(write_file(dir_path, "a-Dog.grug", adder_text));
+	updates = grug_update(gst);
+	CHECK(updates.count == 1);
+	added = find_update(updates, "a-Dog.grug", false);
+	CHECK(added && added->id == adder);
+	total = 0;
+	CHECK(GRUG_CALL(gst, entity, on_tick, 1, GRUG_ARG_NUMBER(5)));
+	CHECK(total == 5);
+	CHECK(mods->files_size == 1);
+
+	grug_deinit(gst);
+	remove_dir(dir_path);
+}
+
+#endif
+
+// MARK: file reader
+
+static char read_buffer[1024];
+
+/// Serves mod_api_json for any path, with no free_fn to give it back to
+static char* read_mod_api(void* user_data, char const* path, size_t* out_len) {
+	(void)user_data;
+	(void)path;
+	*out_len = strlen(mod_api_json);
+	memcpy(read_buffer, mod_api_json, *out_len + 1);
+	return read_buffer;
+}
+
+static void test_file_reader_needs_free_fn(void) {
+	struct grug_init_settings settings = grug_default_settings();
+	settings.file_reader.read_fn = read_mod_api;
+	struct grug_error error = {0};
+	struct grug_state* gst = grug_init(settings, &error);
+	CHECK(!gst);
+	CHECK(grug_error_code_matches(error.error_type, GRUG_ERROR_CODE_INIT));
+	grug_free_error(&error);
+	if(gst) {
+		grug_deinit(gst);
+	}
+}
+
+#define SERVED_FILES 2
+
+/// Serves files from memory, counting what it hands out and gets back
+struct served_files {
+	char const* paths[SERVED_FILES];
+	char const* texts[SERVED_FILES];
+	/// The buffers handed out and not freed yet
+	char* buffers[8];
+	size_t lens[8];
+	size_t reads;
+	size_t frees;
+	/// Frees of a buffer that wasn't handed out, or with another length than it was handed out with
+	size_t bad_frees;
+	size_t drops;
+};
+
+/// Hands out a writable, null terminated copy of the file, which free_served_file checks it gets back unchanged in length
+static char* read_served_file(void* user_data, char const* path, size_t* out_len) {
+	struct served_files* served = user_data;
+	for(size_t file_index = 0; file_index < SERVED_FILES; file_index += 1) {
+		if(strcmp(path, served->paths[file_index]) != 0) {
+			continue;
+		}
+		size_t len = strlen(served->texts[file_index]);
+		for(size_t slot = 0; slot < 8; slot += 1) {
+			if(!served->buffers[slot]) {
+				served->buffers[slot] = malloc(len + 1);
+				if(!served->buffers[slot]) {
+					return NULL;
+				}
+				memcpy(served->buffers[slot], served->texts[file_index], len + 1);
+				served->lens[slot] = len;
+				served->reads += 1;
+				*out_len = len;
+				return served->buffers[slot];
+			}
+		}
+	}
+	return NULL;
+}
+
+static void free_served_file(void* user_data, char* contents, size_t len) {
+	struct served_files* served = user_data;
+	served->frees += 1;
+	for(size_t slot = 0; slot < 8; slot += 1) {
+		if(served->buffers[slot] == contents && served->lens[slot] == len) {
+			free(contents);
+			served->buffers[slot] = NULL;
+			return;
+		}
+	}
+	served->bad_frees += 1;
+}
+
+static void drop_served_files(void* user_data) {
+	struct served_files* served = user_data;
+	served->drops += 1;
+}
+
+static void test_file_reader_serves_files(void) {
+	struct served_files served = {
+		.paths = {"virtual/mod_api.json", "virtual/mods/served-Dog.grug"},
+		.texts = {mod_api_json, tenfold_text},
+	};
+	struct grug_init_settings settings = grug_default_settings();
+	settings.mod_api_json_source = NULL;
+	settings.mod_api_json_path = "virtual/mod_api.json";
+	settings.mods_dir_path = "virtual/mods";
+	settings.file_reader = (struct grug_file_reader) {
+		.user_data = &served,
+		.drop_fn = drop_served_files,
+		.read_fn = read_served_file,
+		.free_fn = free_served_file,
+	};
+	struct grug_error error = {0};
+	struct grug_state* gst = grug_init(settings, &error);
+	CHECK(gst);
+	if(!gst) {
+		(void)fprintf(stderr, "Failed to create state: %s\n", error.message);
+		grug_free_error(&error);
+		return;
+	}
+	// mod_api.json is read once, and given back before grug_init returns
+	CHECK(served.reads == 1 && served.frees == 1);
+	CHECK(grug_register_game_fn(gst, "add", NULL, game_fn_add));
+
+	grug_file_id file = grug_compile_file(gst, "served-Dog.grug");
+	CHECK(file != INVALID_GRUG_FILE_ID);
+	grug_entity_id entity = grug_create_entity(gst, file, 1);
+	total = 0;
+	CHECK(GRUG_CALL(gst, entity, grug_get_on_fn_id(gst, "Dog", "on_tick"), 1, GRUG_ARG_NUMBER(4)));
+	CHECK(total == 40);
+	// Compiling it again reads it again
+	CHECK(grug_compile_file(gst, "served-Dog.grug") == file);
+
+	// A file the reader doesn't have fails to compile without anything to give back
+	CHECK(grug_compile_file(gst, "missing-Dog.grug") == INVALID_GRUG_FILE_ID);
+	CHECK(grug_error_code_matches(grug_get_error(gst)->error_type, GRUG_ERROR_CODE_COMPILE_IO));
+	grug_deinit(gst);
+
+	CHECK(served.reads == 3);
+	CHECK(served.frees == served.reads && served.bad_frees == 0);
+	CHECK(served.drops == 1);
+	for(size_t slot = 0; slot < 8; slot += 1) {
+		CHECK(!served.buffers[slot]);
+	}
+}
+
+/// `argv[1]` is where to write the token dump, if given
+int main(int argc, char* argv[]) {
+	if(argc > 1) {
+		write_token_dump(argv[1]);
+	}
+	test_every_token_type();
+	test_arena_tokens_match_buffer_tokens();
+	test_streamed_tokens_match_one_shot();
+	test_compact_tokens_round_trip();
+	test_spaces_before_round_trip();
+	test_parse_into_caller_arena();
+	test_tokens_parse_as_given();
+	test_exported_ast_links();
+	test_deeply_nested_blocks_fail_to_parse();
+	test_names_are_interned();
+	test_game_fn_registry();
+	test_lowerings_match();
+	test_jit_matches_bytecode();
+	test_batch_threads_match_serial();
+	test_batch_workers_see_the_state();
+	test_handles_after_reload();
+	test_entity_ids_are_generational();
+	test_member_layout();
+	test_entities_defining_on_fn();
+	test_file_reader_needs_free_fn();
+	test_file_reader_serves_files();
+#if defined(__unix__) || defined(__APPLE__)
+	test_cache_hit_matches_cold_compile();
+	test_get_mods_threads_match_serial();
+	test_update_reports_written_files();
+	test_unchanged_rewrite_is_not_recompiled();
+	test_update_reports_removed_files();
+#endif
+	if(failures) {
+		(void)fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}